@@ -30,6 +30,7 @@
 #include "spec1d/empiricalmodel.hpp"
 #include "spec1d/model.hpp"
 #include "spec1d/modelloader.hpp"
+#include "spec1d/modelsnapshot.hpp"
 #include "spec1d/lovematrices.hpp"
 #include "spec1d/rayleighmatrices.hpp"
 #include "spec1d/lobattoprojection.hpp"
@@ -43,6 +44,7 @@ typedef AnisotropicRhoVsXiVpVs<double> cell_parameter_t;
 typedef AnisotropicRhoVsXiVpVsHalfspace<double, MAXORDER> boundary_t;
 typedef Cell<double, cell_parameter_t, MAXORDER> cell_t;
 typedef Model<double, cell_parameter_t, boundary_t, MAXORDER> model_t;
+typedef ModelSnapshot<double, cell_parameter_t, boundary_t, MAXORDER> snapshot_t;
 typedef Mesh<double, MAXORDER> mesh_t;
 typedef LoveMatrices<double, MAXORDER> lovesolver_t;
 typedef RayleighMatrices<double, MAXORDER> rayleighsolver_t;
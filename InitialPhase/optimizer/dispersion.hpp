@@ -28,6 +28,8 @@
 
 #include <fftw3.h>
 
+#include "spec1d/textreader.hpp"
+
 class DispersionData {
 public:
 
@@ -42,26 +44,33 @@ public:
     fmax(_fmax),
     fullspec(NULL),
     fullenv(NULL),
-    sigma_phase(0.1e03)
+    sigma_phase(0.1e03),
+    picks_only(false)
   {
   }
 
-  bool load(const char *filename)
+  //
+  // With band_only set only the frequency column is parsed for rows outside
+  // [fmin, fmax] and their spectrum values are left as zero.
+  //
+  bool load(const char *filename, bool band_only = false)
   {
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
+    TextReader in;
+    if (!in.open(filename)) {
       fprintf(stderr, "error: failed to open %s for reading\n", filename);
       return false;
     }
 
-    if (fscanf(fp, "%lf %lf %lf %lf %lf\n",
-               &lon1, &lat1, &lon2, &lat2, &distkm) != 5) {
+    if (!in.read_double(lon1) || !in.read_double(lat1) ||
+	!in.read_double(lon2) || !in.read_double(lat2) ||
+	!in.read_double(distkm)) {
       fprintf(stderr, "error: failed to parse line 1\n");
       return false;
     }
 
-    if (fscanf(fp, "%lf %d %lf %lf %d\n",
-	       &samplerate, &daycount, &asnr, &csnr, &samples) != 5) {
+    if (!in.read_double(samplerate) || !in.read_int(daycount) ||
+	!in.read_double(asnr) || !in.read_double(csnr) ||
+	!in.read_int(samples)) {
       fprintf(stderr, "error: failed to parse line 2\n");
       return false;
     }
@@ -77,10 +86,19 @@ public:
     for (int i = 0; i < samples; i ++) {
 
       
-      if (fscanf(fp, "%lf %lf %lf %lf %lf\n",
-		 &freq[i],
-		 &sreal[i], &simag[i],
-		 &nreal[i], &nimag[i]) != 5) {
+      if (!in.read_double(freq[i])) {
+	fprintf(stderr, "error: failed to read spectrum\n");
+	return false;
+      }
+
+      if (band_only && (freq[i] < fmin || freq[i] > fmax)) {
+	sreal[i] = 0.0;
+	simag[i] = 0.0;
+	nreal[i] = 0.0;
+	nimag[i] = 0.0;
+	in.skip_line();
+      } else if (!in.read_double(sreal[i]) || !in.read_double(simag[i]) ||
+		 !in.read_double(nreal[i]) || !in.read_double(nimag[i])) {
 	fprintf(stderr, "error: failed to read spectrum\n");
 	return false;
       }
@@ -95,7 +113,7 @@ public:
 
     }
 
-    fclose(fp);
+    in.close();
 
 
     target_phase.resize(freq.size());
@@ -110,29 +128,24 @@ public:
 
   bool load_phase(const char *filename)
   {
-    FILE *fp;
+    TextReader in;
 
-    fp = fopen(filename, "r");
-    if (fp == NULL) {
+    if (!in.open(filename)) {
       fprintf(stderr, "error: failed to open phase file: %s\n", filename);
       return false;
     }
 
-    while (!feof(fp)) {
+    while (!in.eof()) {
 
       double lf, lc;
       int sign, offset;
       double le;
       
-      if (fscanf(fp, "%lf %lf %d %d %lf\n", &lf, &lc, &sign, &offset, &le) != 5) {
-	if (feof(fp)) {
-	  break;
-	} else {
-
-	  fprintf(stderr, "error: failed to parse line\n");
-	  return false;
-
-	}
+      if (!in.read_double(lf) || !in.read_double(lc) ||
+	  !in.read_int(sign) || !in.read_int(offset) ||
+	  !in.read_double(le)) {
+	fprintf(stderr, "error: failed to parse line\n");
+	return false;
       }
 
       fpoints.push_back(lf);
@@ -141,7 +154,7 @@ public:
 
     }
 
-    fclose(fp);
+    in.close();
     return true;
   }
 
@@ -236,7 +249,36 @@ public:
 	throw std::exception();
       }
     }
-      
+
+    initialise_picks();
+  }
+
+  //
+  // Nearest sample in [ffirst, flast] of each pick in the band, in
+  // ascending frequency.
+  //
+  void initialise_picks()
+  {
+    pick_index.clear();
+    pick_phase.clear();
+    pick_error.clear();
+
+    if (flast < ffirst || freq.size() < 2) {
+      return;
+    }
+
+    double df = freq[1] - freq[0];
+    
+    for (size_t p = 0; p < fpoints.size(); p ++) {
+      int i = (int)floor((fpoints[p] - freq[0])/df + 0.5);
+      if (i < ffirst || i > flast) {
+	continue;
+      }
+
+      pick_index.push_back(i);
+      pick_phase.push_back(cpoints[p]);
+      pick_error.push_back(epoints[p]);
+    }
   }
 
   
@@ -268,6 +310,14 @@ public:
   std::vector<double> target_error;
 
   std::vector<double> fpoints, cpoints, epoints;
+
+  //
+  // With picks_only set the likelihoods solve only at the pick samples
+  //
+  bool picks_only;
+  std::vector<int> pick_index;
+  std::vector<double> pick_phase;
+  std::vector<double> pick_error;
 };
 
 #endif // dispersion_hpp
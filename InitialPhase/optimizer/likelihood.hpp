@@ -147,6 +147,47 @@ double love_phase_compute(DispersionData &data,
   return k;
 }
 
+//
+// Cubic Hermite interpolation of k (and so phase) and group velocity at i
+// from the solved samples i0 and i1.
+//
+void hermite_predict(int i, int i0, int i1, DispersionData &data)
+{
+  double omega0 = data.freq[i0] * 2.0 * M_PI;
+  double omega1 = data.freq[i1] * 2.0 * M_PI;
+  double omega = data.freq[i] * 2.0 * M_PI;
+  double affine = (omega1 - omega0);
+  double t = (omega - omega0)/affine;
+  double t2 = t*t;
+  double t3 = t2*t;
+
+  /*
+   * Interpolate k/c
+   */
+  double A = 2.0*t3 - 3.0*t2 + 1.0;
+  double B = t3 - 2.0*t2 + t;
+  double C = -2.0*t3 + 3.0*t2;
+  double D = t3 - t2;
+
+  data.predicted_k[i] = A*data.predicted_k[i0] + affine*B/data.predicted_group[i0] +
+    C*data.predicted_k[i1] + affine*D/data.predicted_group[i1];
+
+  data.predicted_phase[i] = omega/data.predicted_k[i];
+
+  /*
+   * Interpolate Group
+   */
+  double dA = 6.0*t2 - 6.0*t;
+  double dB = 3.0*t2 - 4.0*t + 1.0;
+  double dC = -6.0*t2 + 6.0*t;
+  double dD = 3.0*t2 - 2.0*t;
+    
+  data.predicted_group[i] = 1.0/(dA * data.predicted_k[i0]/affine +
+				 dB/data.predicted_group[i0] +
+				 dC * data.predicted_k[i1]/affine +
+				 dD/data.predicted_group[i1]);
+}
+
 void spline_fill(int offset, int i0, int i1,
 		 DispersionData &data,
 		 Spec1DMatrix<double> &G,
@@ -158,38 +199,19 @@ void spline_fill(int offset, int i0, int i1,
   
   for (int i = i0 + 1; i < i1; i ++) {
 
+    hermite_predict(i, i0, i1, data);
+    
     double omega = data.freq[i] * 2.0 * M_PI;
     double affine = (omega1 - omega0);
     double t = (omega - omega0)/affine;
     double t2 = t*t;
     double t3 = t2*t;
 
-    /*
-     * Interpolate k/c
-     */
     double A = 2.0*t3 - 3.0*t2 + 1.0;
     double B = t3 - 2.0*t2 + t;
     double C = -2.0*t3 + 3.0*t2;
     double D = t3 - t2;
 
-    data.predicted_k[i] = A*data.predicted_k[i0] + affine*B/data.predicted_group[i0] +
-      C*data.predicted_k[i1] + affine*D/data.predicted_group[i1];
-
-    data.predicted_phase[i] = omega/data.predicted_k[i];
-
-    /*
-     * Interpolate Group
-     */
-    double dA = 6.0*t2 - 6.0*t;
-    double dB = 3.0*t2 - 4.0*t + 1.0;
-    double dC = -6.0*t2 + 6.0*t;
-    double dD = 3.0*t2 - 2.0*t;
-    
-    data.predicted_group[i] = 1.0/(dA * data.predicted_k[i0]/affine +
-				   dB/data.predicted_group[i0] +
-				   dC * data.predicted_k[i1]/affine +
-				   dD/data.predicted_group[i1]);
-
     double u20 = data.predicted_group[i0] * data.predicted_group[i0];
     double u21 = data.predicted_group[i1] * data.predicted_group[i1];
 
@@ -211,6 +233,57 @@ void spline_fill(int offset, int i0, int i1,
   }
 }
 
+//
+// Samples solved in the pick likelihoods: the band ends and every pick
+// sample, descending as the solvers track the scale down in frequency.
+//
+void pick_samples(const DispersionData &data, std::vector<int> &samples)
+{
+  samples.clear();
+  samples.push_back(data.flast);
+  for (int p = (int)data.pick_index.size() - 1; p >= 0; p --) {
+    if (data.pick_index[p] < samples.back()) {
+      samples.push_back(data.pick_index[p]);
+    }
+  }
+  if (data.ffirst < samples.back()) {
+    samples.push_back(data.ffirst);
+  }
+}
+
+//
+// Residual, covariance and G rows of each pick at solved sample i from the
+// current dk/dp, accumulating the likelihood and its gradient.
+//
+void pick_rows(DispersionData &data,
+	       int i,
+	       double weight,
+	       const Spec1DMatrix<double> &dkdp,
+	       Spec1DMatrix<double> &dLdp,
+	       Spec1DMatrix<double> &G,
+	       Spec1DMatrix<double> &residual,
+	       Spec1DMatrix<double> &Cd,
+	       double &like)
+{
+  for (size_t p = 0; p < data.pick_index.size(); p ++) {
+    if (data.pick_index[p] != i) {
+      continue;
+    }
+    
+    double err = data.predicted_phase[i] - data.pick_phase[p];
+    double denom = data.pick_error[p] * data.pick_error[p];
+    double normed_residual = err/denom;
+    
+    for (int j = 0; j < dkdp.rows(); j ++) {
+      G(p, j) = weight * dkdp(j, 0);
+      dLdp(j, 0) += normed_residual * G(p, j);
+    }
+
+    residual(p, 0) = err;
+    Cd(p, 0) = denom;
+    like += err*err/(2.0 * denom);
+  }
+}
 
 double likelihood_love_spline(DispersionData &data,
 			      model_t &model,
@@ -416,6 +489,83 @@ double likelihood_love_spline(DispersionData &data,
 }
 
 
+//
+// Data term of the Love likelihood solved only at the pick samples, with
+// one row of G per pick weighted by its error. Predictions between the
+// solved samples are Hermite interpolated for output only.
+//
+double likelihood_love_picks(DispersionData &data,
+			     model_t &model,
+			     mesh_t &mesh,
+			     lovesolver_t &love,
+			     Spec1DMatrix<double> &dkdp,
+			     Spec1DMatrix<double> &dUdp,
+			     Spec1DMatrix<double> &dLdp,
+			     Spec1DMatrix<double> &G,
+			     Spec1DMatrix<double> &residual,
+			     Spec1DMatrix<double> &Cd,
+			     double threshold,
+			     int order,
+			     int highorder,
+			     int boundaryorder,
+			     double scale)
+{
+  std::vector<int> samples;
+  double autoscale = scale;
+  double like = 0.0;
+  size_t ndata = data.pick_index.size();
+
+  pick_samples(data, samples);
+  
+  for (size_t s = 0; s < samples.size(); s ++) {
+
+    int i = samples[s];
+    double weight;
+    double k = love_phase_compute(data,
+				  i,
+				  model,
+				  mesh,
+				  love,
+				  dkdp,
+				  dUdp,
+				  threshold,
+				  order,
+				  highorder,
+				  boundaryorder,
+				  autoscale,
+				  weight);
+
+    if (s == 0) {
+      G.resize(ndata, dkdp.rows());
+      residual.resize(ndata, 1);
+      Cd.resize(ndata, 1);
+      
+      dLdp.resize(dkdp.rows(), 1);
+      dLdp.setZero();
+    }
+
+    pick_rows(data, i, weight, dkdp, dLdp, G, residual, Cd, like);
+
+    if (s > 0) {
+      for (int j = i + 1; j < samples[s - 1]; j ++) {
+	hermite_predict(j, i, samples[s - 1], data);
+      }
+    }
+    
+    //
+    // Update autoscale
+    //
+    double omega = data.freq[i] * 2.0 * M_PI;
+    double v2 = mesh.boundary.L/mesh.boundary.rho;
+    double disc = k*k - omega*omega/v2;
+    if (disc > 0.0) {
+      autoscale = sqrt(disc);
+    }
+  }
+
+  return like;
+}
+
 double likelihood_love(DispersionData &data,
 		       model_t &model,
 		       model_t &reference,
@@ -460,6 +610,24 @@ double likelihood_love(DispersionData &data,
 
     dLdp.setZero();
     
+  } else if (data.picks_only) {
+
+    like = likelihood_love_picks(data,
+				 model,
+				 mesh,
+				 love,
+				 dkdp,
+				 dUdp,
+				 dLdp,
+				 G,
+				 residual,
+				 Cd,
+				 threshold,
+				 order,
+				 highorder,
+				 boundaryorder,
+				 scale);
+    
   } else {
 
     double last_freq = -1.0;
@@ -896,6 +1064,83 @@ double likelihood_rayleigh_spline(DispersionData &data,
     
 }
 
+//
+// Data term of the Rayleigh likelihood solved only at the pick samples, with
+// one row of G per pick weighted by its error. Predictions between the
+// solved samples are Hermite interpolated for output only.
+//
+double likelihood_rayleigh_picks(DispersionData &data,
+				 model_t &model,
+				 mesh_t &mesh,
+				 rayleighsolver_t &rayleigh,
+				 Spec1DMatrix<double> &dkdp,
+				 Spec1DMatrix<double> &dUdp,
+				 Spec1DMatrix<double> &dLdp,
+				 Spec1DMatrix<double> &G,
+				 Spec1DMatrix<double> &residual,
+				 Spec1DMatrix<double> &Cd,
+				 double threshold,
+				 int order,
+				 int highorder,
+				 int boundaryorder,
+				 double scale)
+{
+  std::vector<int> samples;
+  double autoscale = scale;
+  double like = 0.0;
+  size_t ndata = data.pick_index.size();
+
+  pick_samples(data, samples);
+  
+  for (size_t s = 0; s < samples.size(); s ++) {
+
+    int i = samples[s];
+    double weight;
+    double k = rayleigh_phase_compute(data,
+				      i,
+				      model,
+				      mesh,
+				      rayleigh,
+				      dkdp,
+				      dUdp,
+				      threshold,
+				      order,
+				      highorder,
+				      boundaryorder,
+				      autoscale,
+				      weight);
+
+    if (s == 0) {
+      G.resize(ndata, dkdp.rows());
+      residual.resize(ndata, 1);
+      Cd.resize(ndata, 1);
+      
+      dLdp.resize(dkdp.rows(), 1);
+      dLdp.setZero();
+    }
+
+    pick_rows(data, i, weight, dkdp, dLdp, G, residual, Cd, like);
+
+    if (s > 0) {
+      for (int j = i + 1; j < samples[s - 1]; j ++) {
+	hermite_predict(j, i, samples[s - 1], data);
+      }
+    }
+    
+    //
+    // Update autoscale: use the vp scale
+    //
+    double omega = data.freq[i] * 2.0 * M_PI;
+    double v2 = mesh.boundary.A/mesh.boundary.rho;
+    double disc = k*k - omega*omega/v2;
+    if (disc > 0.0) {
+      autoscale = sqrt(disc);
+    }
+  }
+
+  return like;
+}
+
 double likelihood_rayleigh(DispersionData &data,
 			   model_t &model,
 			   model_t &reference,
@@ -940,6 +1185,24 @@ double likelihood_rayleigh(DispersionData &data,
 
     dLdp.setZero();
     
+  } else if (data.picks_only) {
+
+    like = likelihood_rayleigh_picks(data,
+				     model,
+				     mesh,
+				     rayleigh,
+				     dkdp,
+				     dUdp,
+				     dLdp,
+				     G,
+				     residual,
+				     Cd,
+				     threshold,
+				     order,
+				     highorder,
+				     boundaryorder,
+				     scale);
+    
   } else {
 
     double last_freq = -1.0;
@@ -23,6 +23,7 @@
 //
 
 #include <exception>
+#include <thread>
 
 #include <stdio.h>
 #include <getopt.h>
@@ -33,7 +34,7 @@
 #include "simple.hpp"
 #include "quasinewton.hpp"
 
-static char short_options[] = "i:c:I:C:r:f:F:R:V:X:S:o:s:p:b:t:P:N:e:QWM:T:h";
+static char short_options[] = "i:c:I:C:r:f:F:R:V:X:S:o:s:p:b:t:P:N:e:QWM:T:kh";
 static struct option long_options[] = {
   {"input-love", required_argument, 0, 'i'},
   {"phase-love", required_argument, 0, 'c'},
@@ -64,6 +65,7 @@ static struct option long_options[] = {
   {"posterior", no_argument, 0, 'Q'},
   
   {"mode", required_argument, 0, 'M'},
+  {"picks", no_argument, 0, 'k'},
 
   {"thin", required_argument, 0, 'T'},
 
@@ -123,6 +125,7 @@ int main(int argc, char *argv[])
   bool nodata;
 
   int mode;
+  bool picks_only;
 
   int skip;
 
@@ -159,6 +162,7 @@ int main(int argc, char *argv[])
   nodata = false;
 
   mode = 0;
+  picks_only = false;
 
   skip = 0;
   
@@ -311,6 +315,10 @@ int main(int argc, char *argv[])
       }
       break;
 
+    case 'k':
+      picks_only = true;
+      break;
+
     case 'T':
       skip = atoi(optarg);
       if (skip < 0) {
@@ -360,7 +368,7 @@ int main(int argc, char *argv[])
   DispersionData data_love(fmin, fmax);
   DispersionData data_rayleigh(fmin, fmax);
 
-  if (!data_love.load(input_love)) {
+  if (!data_love.load(input_love, true)) {
     fprintf(stderr, "error: failed to load love data\n");
     return -1;
   }
@@ -373,11 +381,12 @@ int main(int argc, char *argv[])
 	 data_love.freq[data_love.ffirst],
 	 data_love.freq[data_love.flast]);
   data_love.initialise_target();
+  data_love.picks_only = picks_only;
   printf("Love Actual  range: %10.6f %10.6f\n",
 	 data_love.freq[data_love.ffirst],
 	 data_love.freq[data_love.flast]);
 
-  if (!data_rayleigh.load(input_rayleigh)) {
+  if (!data_rayleigh.load(input_rayleigh, true)) {
     fprintf(stderr, "error: failed to load rayleigh data\n");
     return -1;
   }
@@ -390,6 +399,7 @@ int main(int argc, char *argv[])
 	 data_rayleigh.freq[data_rayleigh.ffirst],
 	 data_rayleigh.freq[data_rayleigh.flast]);
   data_rayleigh.initialise_target();
+  data_rayleigh.picks_only = picks_only;
   printf("Rayleigh Actual  range: %10.6f %10.6f\n",
 	 data_rayleigh.freq[data_rayleigh.ffirst],
 	 data_rayleigh.freq[data_rayleigh.flast]);
@@ -445,6 +455,12 @@ int main(int argc, char *argv[])
     fprintf(stderr, "error: failed to save model\n");
     return -1;
   }
+
+  sprintf(filename, "%s.model.bin", output_file);
+  if (!snapshot_t::save(reference.model, filename)) {
+    fprintf(stderr, "error: failed to save model snapshot\n");
+    return -1;
+  }
   
   //
   // Save residuals
@@ -479,6 +495,7 @@ void usage(const char *pname)
           " -i|--input <filename>           Input model (required)\n"
           " -f|--frequency <float>          Frequency\n"
           " -s|--scale <float>              Laguerre scaling (initial)\n"
+          " -k|--picks                      Solve only at the picked frequencies\n"
           "\n"
           " -h|--help                       Show usage information\n"
           "\n",
@@ -553,93 +570,113 @@ static bool invert(DispersionData &data_love,
   double like_love;
   double like_rayleigh;
 
-  if (skip <= 1) {
-
-    like_love = likelihood_love(data_love,
-				model,
-				reference,
-				damping,
-				posterior,
-				mesh,
-				love,
-				dkdp_love,
-				dUdp_love,
-				dLdp_love,
-				G_love,
-				residuals_love,
-				Cd_love,
-				threshold,
-				order,
-				highorder,
-				boundaryorder,
-				scale,
-				frequency_thin);
-    
-    like_rayleigh = likelihood_rayleigh(data_rayleigh,
-					model,
-					reference,
-					damping,
-					posterior,
-					mesh,
-					rayleigh,
-					dkdp_rayleigh,
-					dUdp_rayleigh,
-					dLdp_rayleigh,
-					G_rayleigh,
-					residuals_rayleigh,
-					Cd_rayleigh,
-					threshold,
-					order,
-					highorder,
-					boundaryorder,
-					scale,
-					frequency_thin);
-  } else {
-
-    like_love = likelihood_love_spline(data_love,
-				       model,
-				       reference,
-				       damping,
-				       false,
-				       mesh,
-				       love,
-				       dkdp_love,
-				       dUdp_love,
-				       dLdp_love,
-				       G_love,
-				       Gk_love,
-				       GU_love,
-				       residuals_love,
-				       Cd_love,
-				       threshold,
-				       order,
-				       highorder,
-				       boundaryorder,
-				       scale,
-				       skip);
-    
-    like_rayleigh = likelihood_rayleigh_spline(data_rayleigh,
-					       model,
-					       reference,
-					       damping,
-					       false,
-					       mesh,
-					       rayleigh,
-					       dkdp_rayleigh,
-					       dUdp_rayleigh,
-					       dLdp_rayleigh,
-					       G_rayleigh,
-					       Gk_rayleigh,
-					       GU_rayleigh,
-					       residuals_rayleigh,
-					       Cd_rayleigh,
-					       threshold,
-					       order,
-					       highorder,
-					       boundaryorder,
-					       scale,
-					       skip);
-  }
+  //
+  // The Love and Rayleigh likelihoods are evaluated concurrently, each with
+  // its own mesh and model copy as projection writes into the model cells.
+  //
+  mesh_t mesh_rayleigh;
+  model_t model_rayleigh;
+  
+  auto evaluate_love = [&]() {
+    if (skip <= 1 || data_love.picks_only) {
+      like_love = likelihood_love(data_love,
+				  model,
+				  reference,
+				  damping,
+				  posterior,
+				  mesh,
+				  love,
+				  dkdp_love,
+				  dUdp_love,
+				  dLdp_love,
+				  G_love,
+				  residuals_love,
+				  Cd_love,
+				  threshold,
+				  order,
+				  highorder,
+				  boundaryorder,
+				  scale,
+				  frequency_thin);
+    } else {
+      like_love = likelihood_love_spline(data_love,
+					 model,
+					 reference,
+					 damping,
+					 false,
+					 mesh,
+					 love,
+					 dkdp_love,
+					 dUdp_love,
+					 dLdp_love,
+					 G_love,
+					 Gk_love,
+					 GU_love,
+					 residuals_love,
+					 Cd_love,
+					 threshold,
+					 order,
+					 highorder,
+					 boundaryorder,
+					 scale,
+					 skip);
+    }
+  };
+
+  auto evaluate_rayleigh = [&]() {
+    if (skip <= 1 || data_love.picks_only) {
+      like_rayleigh = likelihood_rayleigh(data_rayleigh,
+					  model_rayleigh,
+					  reference,
+					  damping,
+					  posterior,
+					  mesh_rayleigh,
+					  rayleigh,
+					  dkdp_rayleigh,
+					  dUdp_rayleigh,
+					  dLdp_rayleigh,
+					  G_rayleigh,
+					  residuals_rayleigh,
+					  Cd_rayleigh,
+					  threshold,
+					  order,
+					  highorder,
+					  boundaryorder,
+					  scale,
+					  frequency_thin);
+    } else {
+      like_rayleigh = likelihood_rayleigh_spline(data_rayleigh,
+						 model_rayleigh,
+						 reference,
+						 damping,
+						 false,
+						 mesh_rayleigh,
+						 rayleigh,
+						 dkdp_rayleigh,
+						 dUdp_rayleigh,
+						 dLdp_rayleigh,
+						 G_rayleigh,
+						 Gk_rayleigh,
+						 GU_rayleigh,
+						 residuals_rayleigh,
+						 Cd_rayleigh,
+						 threshold,
+						 order,
+						 highorder,
+						 boundaryorder,
+						 scale,
+						 skip);
+    }
+  };
+
+  auto evaluate = [&]() {
+    model_rayleigh = model;
+    std::thread rayleigh_task(evaluate_rayleigh);
+    evaluate_love();
+    rayleigh_task.join();
+  };
+
+  evaluate();
     
   double like = like_love + like_rayleigh;
   printf("init: %16.9e\n", like);
@@ -733,91 +770,7 @@ static bool invert(DispersionData &data_love,
       //
       last_like = like;
 
-      if (skip <= 1) {
-	like_love = likelihood_love(data_love,
-				    model,
-				    reference,
-				    damping,
-				    posterior,
-				    mesh,
-				    love,
-				    dkdp_love,
-				    dUdp_love,
-				    dLdp_love,
-				    G_love,
-				    residuals_love,
-				    Cd_love,
-				    threshold,
-				    order,
-				    highorder,
-				    boundaryorder,
-				    scale,
-				    frequency_thin);
-	
-	like_rayleigh = likelihood_rayleigh(data_rayleigh,
-					    model,
-					    reference,
-					    damping,
-					    posterior,
-					    mesh,
-					    rayleigh,
-					    dkdp_rayleigh,
-					    dUdp_rayleigh,
-					    dLdp_rayleigh,
-					    G_rayleigh,
-					    residuals_rayleigh,
-					    Cd_rayleigh,
-					    threshold,
-					    order,
-					    highorder,
-					    boundaryorder,
-					    scale,
-					    frequency_thin);
-      } else {
-	like_love = likelihood_love_spline(data_love,
-					   model,
-					   reference,
-					   damping,
-					   false,
-					   mesh,
-					   love,
-					   dkdp_love,
-					   dUdp_love,
-					   dLdp_love,
-					   G_love,
-					   Gk_love,
-					   GU_love,
-					   residuals_love,
-					   Cd_love,
-					   threshold,
-					   order,
-					   highorder,
-					   boundaryorder,
-					   scale,
-					   skip);
-	
-	like_rayleigh = likelihood_rayleigh_spline(data_rayleigh,
-						   model,
-						   reference,
-						   damping,
-						   false,
-						   mesh,
-						   rayleigh,
-						   dkdp_rayleigh,
-						   dUdp_rayleigh,
-						   dLdp_rayleigh,
-						   G_rayleigh,
-						   Gk_rayleigh,
-						   GU_rayleigh,
-						   residuals_rayleigh,
-						   Cd_rayleigh,
-						   threshold,
-						   order,
-						   highorder,
-						   boundaryorder,
-						   scale,
-						   skip);
-      }	
+      evaluate();
       
       like = like_love + like_rayleigh;
       
@@ -33,7 +33,7 @@
 #include "simple.hpp"
 #include "quasinewton.hpp"
 
-static char short_options[] = "i:C:r:f:F:R:V:X:S:o:s:p:b:t:P:e:N:QM:h";
+static char short_options[] = "i:C:r:f:F:R:V:X:S:o:s:p:b:t:P:e:N:QM:kh";
 static struct option long_options[] = {
   {"input", required_argument, 0, 'i'},
   {"phase", required_argument, 0, 'C'},
@@ -62,6 +62,7 @@ static struct option long_options[] = {
   {"posterior", no_argument, 0, 'Q'},
   
   {"mode", required_argument, 0, 'M'},
+  {"picks", no_argument, 0, 'k'},
 
   {"help", no_argument, 0, 'h'},
   
@@ -114,6 +115,7 @@ int main(int argc, char *argv[])
   char filename[1024];
 
   int mode;
+  bool picks_only;
 
   //
   // Defaults
@@ -144,6 +146,7 @@ int main(int argc, char *argv[])
   nodata = false;
 
   mode = 0;
+  picks_only = false;
   
   //
   // Command line parameters
@@ -270,6 +273,10 @@ int main(int argc, char *argv[])
       }
       break;
 
+    case 'k':
+      picks_only = true;
+      break;
+
     default:
       fprintf(stderr, "unknown option %c\n", c);
     case 'h':
@@ -300,7 +307,7 @@ int main(int argc, char *argv[])
 
   DispersionData data(fmin, fmax);
 
-  if (!data.load(input_file)) {
+  if (!data.load(input_file, true)) {
     return -1;
   }
 
@@ -310,6 +317,7 @@ int main(int argc, char *argv[])
 
   printf("Desired range: %10.6f %10.6f\n", data.freq[data.ffirst], data.freq[data.flast]);
   data.initialise_target();
+  data.picks_only = picks_only;
   printf("Actual  range: %10.6f %10.6f\n", data.freq[data.ffirst], data.freq[data.flast]);
 
     
@@ -369,6 +377,12 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  sprintf(filename, "%s.model.bin", output_file);
+  if (!snapshot_t::save(reference.model, filename)) {
+    fprintf(stderr, "error: failed to save model snapshot\n");
+    return -1;
+  }
+
   //
   // Save predictions
   //
@@ -390,6 +404,7 @@ void usage(const char *pname)
           " -i|--input <filename>           Input model (required)\n"
           " -f|--frequency <float>          Frequency\n"
           " -s|--scale <float>              Laguerre scaling (initial)\n"
+          " -k|--picks                      Solve only at the picked frequencies\n"
           "\n"
           " -h|--help                       Show usage information\n"
           "\n",
@@ -33,7 +33,7 @@
 #include "simple.hpp"
 #include "quasinewton.hpp"
 
-static char short_options[] = "i:C:r:f:F:R:V:X:S:o:s:p:b:t:P:e:N:QM:T:h";
+static char short_options[] = "i:C:r:f:F:R:V:X:S:o:s:p:b:t:P:e:N:QM:T:kh";
 static struct option long_options[] = {
   {"input", required_argument, 0, 'i'},
   {"phase", required_argument, 0, 'C'},
@@ -61,6 +61,7 @@ static struct option long_options[] = {
   {"posterior", no_argument, 0, 'Q'},
   
   {"mode", required_argument, 0, 'M'},
+  {"picks", no_argument, 0, 'k'},
 
   {"thin", required_argument, 0, 'T'},
 
@@ -117,6 +118,7 @@ int main(int argc, char *argv[])
   char filename[1024];
 
   int mode;
+  bool picks_only;
 
   int skip;
 
@@ -149,6 +151,7 @@ int main(int argc, char *argv[])
   nodata = false;
 
   mode = 0;
+  picks_only = false;
 
   skip = 0;
   
@@ -293,6 +296,10 @@ int main(int argc, char *argv[])
       }
       break;
 
+    case 'k':
+      picks_only = true;
+      break;
+
     case 'T':
       skip = atoi(optarg);
       if (skip < 0) {
@@ -331,7 +338,7 @@ int main(int argc, char *argv[])
 
   DispersionData data(fmin, fmax);
 
-  if (!data.load(input_file)) {
+  if (!data.load(input_file, true)) {
     return -1;
   }
 
@@ -341,6 +348,7 @@ int main(int argc, char *argv[])
 
   printf("Desired range: %10.6f %10.6f\n", data.freq[data.ffirst], data.freq[data.flast]);
   data.initialise_target();
+  data.picks_only = picks_only;
   printf("Actual  range: %10.6f %10.6f\n", data.freq[data.ffirst], data.freq[data.flast]);
 
   Mesh<double, MAXORDER> mesh;
@@ -396,6 +404,12 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  sprintf(filename, "%s.model.bin", output_file);
+  if (!snapshot_t::save(reference.model, filename)) {
+    fprintf(stderr, "error: failed to save model snapshot\n");
+    return -1;
+  }
+
   //
   // Save predictions
   //
@@ -417,6 +431,7 @@ void usage(const char *pname)
           " -i|--input <filename>           Input model (required)\n"
           " -f|--frequency <float>          Frequency\n"
           " -s|--scale <float>              Laguerre scaling (initial)\n"
+          " -k|--picks                      Solve only at the picked frequencies\n"
           "\n"
           " -h|--help                       Show usage information\n"
           "\n",
@@ -481,7 +496,7 @@ static bool invert(DispersionData &data,
   double like_rayleigh;
   double like;
   
-  if (skip <= 1) {
+  if (skip <= 1 || data.picks_only) {
 
     like_rayleigh = likelihood_rayleigh(data,
 					model,
@@ -604,7 +619,7 @@ static bool invert(DispersionData &data,
       //
       last_like = like;
 
-      if (skip <= 1) {
+      if (skip <= 1 || data.picks_only) {
 	like_rayleigh = likelihood_rayleigh(data,
 					    model,
 					    reference,
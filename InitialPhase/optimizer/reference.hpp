@@ -39,14 +39,14 @@ public:
   bool load(const char *filename, bool promote, size_t promote_order)
   {
 
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
+    TextReader in;
+    if (!in.open(filename)) {
       fprintf(stderr, "error: failed to open %s for reading\n", filename);
       return -1;
     }
     
     int nlayers;
-    if (fscanf(fp, "%d\n", &nlayers) != 1) {
+    if (!in.read_int(nlayers)) {
       fprintf(stderr, "error: failed to read no. layers\n");
       return false;
     }
@@ -57,7 +57,7 @@ public:
       int corder;
       double vs;
       double vsstd;
-      if (fscanf(fp, "%lf %d", &thicknesskm, &corder) != 2) {
+      if (!in.read_double(thicknesskm) || !in.read_int(corder)) {
 	fprintf(stderr, "error: failed to read line\n");
 	return false;
       }
@@ -74,7 +74,7 @@ public:
 	
 	if (corder == 0 && promote) {
 
-	  if (fscanf(fp, "%lf", &vs) != 1) {
+	  if (!in.read_double(vs)) {
 	    fprintf(stderr, "error: failed to read vs\n");
 	    return -1;
 	  }
@@ -96,7 +96,7 @@ public:
 	    model.cells[i].nodes[j] = cell_parameter_t(rho, vs, 1.0, vpvs);
 	  }
 
-	  if (fscanf(fp, "%lf", &vsstd) != 1) {
+	  if (!in.read_double(vsstd)) {
 	    fprintf(stderr, "error: failed to read vs error\n");
 	    return -1;
 	  }
@@ -112,7 +112,7 @@ public:
 	  
 	  for (int j = 0; j <= corder; j ++) {
 	    
-	    if (fscanf(fp, "%lf", &vs) != 1) {
+	    if (!in.read_double(vs)) {
 	      fprintf(stderr, "error: failed to read vs\n");
 	      return -1;
 	    }
@@ -126,14 +126,14 @@ public:
 	    model.cells[i].nodes[j] = cell_parameter_t(rho, vs, 1.0, vpvs);
 	  }
 	  
-	  if (fscanf(fp, "%lf", &vsstd) != 1) {
+	  if (!in.read_double(vsstd)) {
 	    fprintf(stderr, "error: failed to read vs error\n");
 	    return -1;
 	  }
 	}
 	
       } else {
-	if (fscanf(fp, "%lf %lf", &vs, &vsstd) != 2) {
+	if (!in.read_double(vs) || !in.read_double(vsstd)) {
 	  fprintf(stderr, "error: failed to read vs\n");
 	  return -1;
 	}
@@ -157,8 +157,9 @@ public:
       }
     }
       
-    fclose(fp);
+    in.close();
 
+    model.update_depth_index();
     reference = model;
     return true;
     
@@ -0,0 +1,237 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef autodiscretization_hpp
+#define autodiscretization_hpp
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include <math.h>
+
+#include "common.hpp"
+#include "dispersion.hpp"
+
+//
+// Automatic choice of the mesh order at each frequency.
+//
+// At sample frequencies spanning the band the wave number is computed at
+// increasing orders p and the smallest p with |k_p - k_{p+1}|/k_{p+1} below
+// the tolerance is taken as adequate, starting from the order needed to
+// represent the model cells. Each band between two samples uses the larger
+// of their orders. The table is cached against the cell structure of the
+// model (thicknesses and orders), which the iterations do not change.
+//
+class AutoDiscretization {
+public:
+
+  //
+  // Wave number at frequency index i with mesh order p, <= 0 on failure
+  //
+  typedef std::function<double(int i, int p)> wavenumber_t;
+
+  AutoDiscretization(double _tolerance, int _maxorder, int _samples = 8) :
+    tolerance(_tolerance),
+    maxorder(_maxorder),
+    samples(_samples),
+    minorder(0),
+    unconverged(0)
+  {
+  }
+
+  //
+  // Sets the per frequency orders of data, returns false if the wave
+  // numbers at the samples could not be computed.
+  //
+  bool update(DispersionData &data, const model_t &model, const wavenumber_t &wavenumber)
+  {
+    if (matches(model) && !orders.empty()) {
+      data.frequency_order = orders;
+      return true;
+    }
+
+    data.frequency_order.clear();
+    orders.clear();
+
+    minorder = 2;
+    for (auto &c : model.cells) {
+      for (int j = 0; j < (int)cell_parameter_t::NPARAMETERS; j ++) {
+	minorder = std::max(minorder, (int)c.order[j]);
+      }
+    }
+    minorder = std::min(minorder, maxorder);
+
+    //
+    // Sample frequencies and the smallest adequate order at each
+    //
+    int nsamples = std::min(samples, data.flast - data.ffirst + 1);
+    if (nsamples < 1) {
+      return false;
+    }
+
+    std::vector<int> sample_index;
+    std::vector<int> sample_order;
+    unconverged = 0;
+
+    for (int s = 0; s < nsamples; s ++) {
+      int i = data.ffirst;
+      if (nsamples > 1) {
+	i += (int)round((double)s * (data.flast - data.ffirst)/(double)(nsamples - 1));
+      }
+
+      int p = minorder;
+      double kp = solve(wavenumber, i, p);
+      double k = kp;
+      bool converged = false;
+
+      while (p < maxorder) {
+	double kq = solve(wavenumber, i, p + 1);
+	if (kp > 0.0 && kq > 0.0 && fabs(kp - kq)/kq < tolerance) {
+	  converged = true;
+	  k = kq;
+	  break;
+	}
+
+	p ++;
+	kp = kq;
+	k = kq;
+      }
+
+      if (k <= 0.0) {
+	fprintf(stderr, "error: failed to compute wave number at %f Hz\n", data.freq[i]);
+	return false;
+      }
+
+      if (!converged) {
+	unconverged ++;
+      }
+
+      sample_index.push_back(i);
+      sample_order.push_back(p);
+    }
+
+    //
+    // Order of each band
+    //
+    orders.assign(data.freq.size(), maxorder);
+    int j = 0;
+    for (int i = data.ffirst; i <= data.flast; i ++) {
+      while (j + 1 < (int)sample_index.size() && sample_index[j + 1] < i) {
+	j ++;
+      }
+
+      if (i <= sample_index[j] || j + 1 >= (int)sample_index.size()) {
+	orders[i] = sample_order[j];
+      } else {
+	orders[i] = std::max(sample_order[j], sample_order[j + 1]);
+      }
+    }
+
+    key_thickness.clear();
+    key_order.clear();
+    for (auto &c : model.cells) {
+      key_thickness.push_back(c.thickness);
+      for (int k = 0; k < (int)cell_parameter_t::NPARAMETERS; k ++) {
+	key_order.push_back(c.order[k]);
+      }
+    }
+
+    data.frequency_order = orders;
+    return true;
+  }
+
+  void print_summary(FILE *fp, const char *name, const DispersionData &data) const
+  {
+    int lo = maxorder;
+    int hi = minorder;
+    double mean = 0.0;
+    for (int i = data.ffirst; i <= data.flast; i ++) {
+      lo = std::min(lo, orders[i]);
+      hi = std::max(hi, orders[i]);
+      mean += orders[i];
+    }
+    mean /= (double)(data.flast - data.ffirst + 1);
+
+    fprintf(fp, "%s orders %d (%.3f Hz) to %d (%.3f Hz), range %d to %d, mean %.2f\n",
+	    name,
+	    orders[data.ffirst], data.freq[data.ffirst],
+	    orders[data.flast], data.freq[data.flast],
+	    lo, hi, mean);
+
+    if (unconverged > 0) {
+      fprintf(fp, "%s: %d samples did not reach tolerance by order %d\n", name, unconverged, maxorder);
+    }
+  }
+
+private:
+
+  static double solve(const wavenumber_t &wavenumber, int i, int p)
+  {
+    try {
+      return wavenumber(i, p);
+    } catch (std::exception &e) {
+      //
+      // Too coarse an order can fail the solver consistency checks
+      //
+      return -1.0;
+    }
+  }
+
+  bool matches(const model_t &model) const
+  {
+    if (key_thickness.size() != model.cells.size()) {
+      return false;
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < model.cells.size(); i ++) {
+      if (key_thickness[i] != model.cells[i].thickness) {
+	return false;
+      }
+      for (int j = 0; j < (int)cell_parameter_t::NPARAMETERS; j ++, k ++) {
+	if (key_order[k] != (int)model.cells[i].order[j]) {
+	  return false;
+	}
+      }
+    }
+
+    return true;
+  }
+
+  double tolerance;
+  int maxorder;
+  int samples;
+
+  int minorder;
+  int unconverged;
+
+  std::vector<int> orders;
+  std::vector<double> key_thickness;
+  std::vector<int> key_order;
+};
+
+#endif // autodiscretization_hpp
@@ -0,0 +1,165 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef broyden_hpp
+#define broyden_hpp
+
+#include <vector>
+
+#include <math.h>
+
+#include "likelihood.hpp"
+
+//
+// Broyden updated Jacobians between full recomputes.
+//
+// Each row of G is d realspec/dk dk/dp. The first factor oscillates with
+// k x over the interstation distance x so G itself is poorly tracked by
+// secant updates, while dk/dp (Gk) varies slowly with the model. After a
+// step dm evaluated with predictions only, Gk is corrected by the rank one
+// update
+//
+//   Gk <- Gk + (dk - Gk dm) (C_M^-1 dm)^T/(dm^T C_M^-1 dm)
+//
+// with dk the change in the predicted wave numbers, so that Gk dm = dk,
+// and G is rebuilt with the exact d realspec/dk of the new predictions.
+// The parameters differ in scale by orders of magnitude (densities and
+// velocities against ratios) so dm is measured in the prior metric
+// C_M^-1 rather than the Euclidean one, which would leave the ratio
+// columns untouched. The Love and Rayleigh sets share dm so the joint
+// Jacobian receives a block Broyden update.
+//
+class BroydenJacobian {
+public:
+
+  //
+  // A full recompute is forced once an updated step decreases the misfit
+  // by less than this fraction of the last step from computed Jacobians
+  //
+  static constexpr double STALL = 0.25;
+
+  //
+  // dk/dp rows as filled by a full likelihood
+  //
+  Spec1DMatrix<double> Gk;
+
+  //
+  // Stores the wave numbers of the rows after a full likelihood
+  //
+  void capture(const DispersionData &data, double frequency_thin)
+  {
+    rows(data, frequency_thin, k);
+  }
+
+  //
+  // After a prediction only likelihood for the step from old_model to
+  // new_model: updates Gk, rebuilds G and adds G^T C_d^-1 r to dLdp (the
+  // prediction only likelihoods leave only the damping term)
+  //
+  bool update(DispersionData &data,
+	      double frequency_thin,
+	      const Spec1DMatrix<double> &C_m,
+	      const Spec1DMatrix<double> &old_model,
+	      const Spec1DMatrix<double> &new_model,
+	      const Spec1DMatrix<double> &C_d,
+	      const Spec1DMatrix<double> &residuals,
+	      Spec1DMatrix<double> &G,
+	      Spec1DMatrix<double> &dLdp)
+  {
+    int Nd = Gk.rows();
+    int Nm = Gk.cols();
+
+    std::vector<double> k_new;
+    rows(data, frequency_thin, k_new);
+    if ((int)k_new.size() != Nd || (int)k.size() != Nd || residuals.rows() != Nd) {
+      return false;
+    }
+
+    std::vector<double> dm(Nm);
+    std::vector<double> w(Nm);
+    double norm = 0.0;
+    for (int j = 0; j < Nm; j ++) {
+      dm[j] = new_model(j, 0) - old_model(j, 0);
+      w[j] = dm[j]/C_m(j, 0);
+      norm += dm[j] * w[j];
+    }
+
+    if (norm > 0.0) {
+      for (int i = 0; i < Nd; i ++) {
+	double s = k_new[i] - k[i];
+	for (int j = 0; j < Nm; j ++) {
+	  s -= Gk(i, j) * dm[j];
+	}
+
+	s /= norm;
+	for (int j = 0; j < Nm; j ++) {
+	  Gk(i, j) += s * w[j];
+	}
+      }
+    }
+
+    k = k_new;
+
+    G.resize(Nd, Nm);
+    for (int r = 0; r < Nd; r ++) {
+      double dpbdk = bessel_prediction(data, index[r], k[r]);
+      double normed_residual = residuals(r, 0)/C_d(r, 0);
+      for (int j = 0; j < Nm; j ++) {
+	G(r, j) = dpbdk * Gk(r, j);
+	dLdp(j, 0) += normed_residual * G(r, j);
+      }
+    }
+
+    return true;
+  }
+
+private:
+
+  //
+  // Frequency index and predicted wave number of each row, in the order
+  // of the full likelihoods
+  //
+  void rows(const DispersionData &data, double frequency_thin, std::vector<double> &krows)
+  {
+    index.clear();
+    krows.clear();
+
+    double last_freq = -1.0;
+    for (int i = data.flast; i >= data.ffirst; i --) {
+      if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+	continue;
+      }
+      last_freq = data.freq[i];
+
+      index.push_back(i);
+      krows.push_back(data.freq[i] * 2.0 * M_PI/data.predicted_phase[i]);
+    }
+  }
+
+  std::vector<int> index;
+  std::vector<double> k;
+};
+
+#endif // broyden_hpp
@@ -25,14 +25,23 @@
 #ifndef common_hpp
 #define common_hpp
 
+#include <vector>
+
+#include <math.h>
+
 #include "spec1d/anisotropicrhovsxivpvs.hpp"
 #include "spec1d/anisotropicrhovsxivpvshalfspace.hpp"
 #include "spec1d/empiricalmodel.hpp"
 #include "spec1d/model.hpp"
 #include "spec1d/modelloader.hpp"
+#include "spec1d/modelsnapshot.hpp"
 #include "spec1d/lovematrices.hpp"
 #include "spec1d/rayleighmatrices.hpp"
 #include "spec1d/lobattoprojection.hpp"
+#include "spec1d/perfcounters.hpp"
+
+#include "compressedjacobian.hpp"
+#include "factoredjacobian.hpp"
 
 constexpr int MAXORDER = 20;
 constexpr int BOUNDARYORDER = MAXORDER;
@@ -43,10 +52,70 @@ typedef AnisotropicRhoVsXiVpVs<double> cell_parameter_t;
 typedef AnisotropicRhoVsXiVpVsHalfspace<double, MAXORDER> boundary_t;
 typedef Cell<double, cell_parameter_t, MAXORDER> cell_t;
 typedef Model<double, cell_parameter_t, boundary_t, MAXORDER> model_t;
+typedef ModelSnapshot<double, cell_parameter_t, boundary_t, MAXORDER> snapshot_t;
 typedef Mesh<double, MAXORDER> mesh_t;
 typedef LoveMatrices<double, MAXORDER> lovesolver_t;
 typedef RayleighMatrices<double, MAXORDER> rayleighsolver_t;
 
+//
+// In place upper Cholesky factor of the upper triangle of the leading n x n
+// block of R, false if it is not positive definite
+//
+inline bool upper_cholesky(Spec1DMatrix<double> &R, int n)
+{
+  for (int j = 0; j < n; j ++) {
+    double d = R(j, j);
+    for (int k = 0; k < j; k ++) {
+      d -= R(k, j) * R(k, j);
+    }
+    if (d <= 0.0) {
+      return false;
+    }
+    d = sqrt(d);
+    R(j, j) = d;
+
+    for (int i = j + 1; i < n; i ++) {
+      double s = R(j, i);
+      for (int k = 0; k < j; k ++) {
+	s -= R(k, j) * R(k, i);
+      }
+      R(j, i) = s/d;
+    }
+  }
+
+  return true;
+}
+
+//
+// x <- R^-1 x for the upper Cholesky factor R
+//
+inline void upper_cholesky_solve_R(const Spec1DMatrix<double> &R, std::vector<double> &x)
+{
+  int n = x.size();
+  for (int i = n - 1; i >= 0; i --) {
+    double s = x[i];
+    for (int k = i + 1; k < n; k ++) {
+      s -= R(i, k) * x[k];
+    }
+    x[i] = s/R(i, i);
+  }
+}
+
+//
+// x <- R^-T x for the upper Cholesky factor R
+//
+inline void upper_cholesky_solve_RT(const Spec1DMatrix<double> &R, std::vector<double> &x)
+{
+  int n = x.size();
+  for (int i = 0; i < n; i ++) {
+    double s = x[i];
+    for (int k = 0; k < i; k ++) {
+      s -= R(k, i) * x[k];
+    }
+    x[i] = s/R(i, i);
+  }
+}
+
 class LeastSquaresIterator {
 public:
 
@@ -152,6 +221,45 @@ public:
 				Spec1DMatrix<double> &current_model,
 				Spec1DMatrix<double> &prior_model,
 				Spec1DMatrix<double> &proposed_model) = 0;
+
+  //
+  // Joint step with low rank or spline factored Jacobians, by default
+  // expanded to dense form
+  //
+  virtual bool ComputeStepJointCompressed(double epsilon,
+					  Spec1DMatrix<double> &C_d_love,
+					  Spec1DMatrix<double> &C_d_rayleigh,
+					  Spec1DMatrix<double> &C_m,
+					  Spec1DMatrix<double> &residuals_love,
+					  Spec1DMatrix<double> &residuals_rayleigh,
+					  const JacobianOperator &G_love,
+					  const JacobianOperator &G_rayleigh,
+					  Spec1DMatrix<double> &dLdp,
+					  Spec1DMatrix<int> &model_mask,
+					  Spec1DMatrix<double> &current_model,
+					  Spec1DMatrix<double> &prior_model,
+					  Spec1DMatrix<double> &proposed_model)
+  {
+    Spec1DMatrix<double> dense_love;
+    Spec1DMatrix<double> dense_rayleigh;
+
+    G_love.expand(dense_love);
+    G_rayleigh.expand(dense_rayleigh);
+
+    return ComputeStepJoint(epsilon,
+			    C_d_love,
+			    C_d_rayleigh,
+			    C_m,
+			    residuals_love,
+			    residuals_rayleigh,
+			    dense_love,
+			    dense_rayleigh,
+			    dLdp,
+			    model_mask,
+			    current_model,
+			    prior_model,
+			    proposed_model);
+  }
 				
 };
 
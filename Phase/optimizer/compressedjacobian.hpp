@@ -0,0 +1,361 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef compressedjacobian_hpp
+#define compressedjacobian_hpp
+
+#include <vector>
+
+#include <stdio.h>
+#include <math.h>
+
+#include "spec1d/spec1dmatrix.hpp"
+
+#include "jacobianoperator.hpp"
+
+//
+// Low rank form G ~ T S of an Nd x Nm Jacobian where S (k x Nm) has
+// orthonormal rows and T = G S^T (Nd x k). The rows of S are found by
+// Gram-Schmidt with pivoting on the frequency (row) of largest remaining
+// norm, stopping when every residual row is below tolerance times the
+// largest row of G. The pivots are the frequencies that span the rest.
+//
+class CompressedJacobian : public JacobianOperator {
+public:
+
+  CompressedJacobian() :
+    nd(0),
+    nm(0)
+  {
+  }
+
+  bool compress(const Spec1DMatrix<double> &G, double tolerance)
+  {
+    nd = G.rows();
+    nm = G.cols();
+    pivots.clear();
+
+    if (nd == 0 || nm == 0) {
+      S.resize(0, 0);
+      T.resize(0, 0);
+      return true;
+    }
+
+    //
+    // Residual rows stored row major for the projections
+    //
+    std::vector<double> R(nd * nm);
+    std::vector<double> norm2(nd);
+    std::vector<double> basis;
+    double maxnorm2 = 0.0;
+    
+    for (int i = 0; i < nd; i ++) {
+      double s = 0.0;
+      for (int j = 0; j < nm; j ++) {
+	R[i * nm + j] = G(i, j);
+	s += G(i, j) * G(i, j);
+      }
+      norm2[i] = s;
+      if (s > maxnorm2) {
+	maxnorm2 = s;
+      }
+    }
+
+    //
+    // Residuals at round off level carry no direction
+    //
+    double floor = tolerance > 1.0e-13 ? tolerance : 1.0e-13;
+    double threshold2 = floor * floor * maxnorm2;
+    
+    while ((int)pivots.size() < nd && (int)pivots.size() < nm) {
+
+      int p = 0;
+      for (int i = 1; i < nd; i ++) {
+	if (norm2[i] > norm2[p]) {
+	  p = i;
+	}
+      }
+
+      if (norm2[p] <= threshold2 || norm2[p] <= 0.0) {
+	break;
+      }
+
+      //
+      // Reorthogonalise the pivot against the basis and recompute its norm
+      // as the running projections lose accuracy
+      //
+      double *q = R.data() + p * nm;
+      for (size_t l = 0; l < pivots.size(); l ++) {
+	const double *b = basis.data() + l * nm;
+	double d = 0.0;
+	for (int j = 0; j < nm; j ++) {
+	  d += q[j] * b[j];
+	}
+	for (int j = 0; j < nm; j ++) {
+	  q[j] -= d * b[j];
+	}
+      }
+      
+      double s = 0.0;
+      for (int j = 0; j < nm; j ++) {
+	s += q[j] * q[j];
+      }
+      if (s <= threshold2 || s <= 0.0) {
+	norm2[p] = s;
+	continue;
+      }
+      
+      s = 1.0/sqrt(s);
+      size_t offset = basis.size();
+      basis.resize(offset + nm);
+      for (int j = 0; j < nm; j ++) {
+	basis[offset + j] = q[j] * s;
+      }
+      const double *b = basis.data() + offset;
+
+      for (int i = 0; i < nd; i ++) {
+	double *r = R.data() + i * nm;
+	double d = 0.0;
+	for (int j = 0; j < nm; j ++) {
+	  d += r[j] * b[j];
+	}
+	for (int j = 0; j < nm; j ++) {
+	  r[j] -= d * b[j];
+	}
+	norm2[i] -= d * d;
+	if (norm2[i] < 0.0) {
+	  norm2[i] = 0.0;
+	}
+      }
+      norm2[p] = 0.0;
+
+      pivots.push_back(p);
+    }
+
+    int k = pivots.size();
+    
+    S.resize(k, nm);
+    for (int l = 0; l < k; l ++) {
+      for (int j = 0; j < nm; j ++) {
+	S(l, j) = basis[l * nm + j];
+      }
+    }
+
+    T.resize(nd, k);
+    for (int i = 0; i < nd; i ++) {
+      for (int l = 0; l < k; l ++) {
+	double s = 0.0;
+	for (int j = 0; j < nm; j ++) {
+	  s += G(i, j) * S(l, j);
+	}
+	T(i, l) = s;
+      }
+    }
+
+    return true;
+  }
+
+  virtual int rows() const
+  {
+    return nd;
+  }
+
+  virtual int cols() const
+  {
+    return nm;
+  }
+
+  int rank() const
+  {
+    return pivots.size();
+  }
+
+  //
+  // Ratio of dense to compressed storage
+  //
+  double ratio() const
+  {
+    int k = rank();
+    if (k == 0) {
+      return 0.0;
+    }
+    
+    return (double)(nd * nm)/(double)(k * (nd + nm));
+  }
+
+  virtual void expand(Spec1DMatrix<double> &G) const
+  {
+    int k = rank();
+    
+    G.resize(nd, nm);
+    for (int i = 0; i < nd; i ++) {
+      for (int j = 0; j < nm; j ++) {
+	double s = 0.0;
+	for (int l = 0; l < k; l ++) {
+	  s += T(i, l) * S(l, j);
+	}
+	G(i, j) = s;
+      }
+    }
+  }
+
+  //
+  // y = G x
+  //
+  virtual void multiply(const Spec1DMatrix<double> &x, Spec1DMatrix<double> &y) const
+  {
+    int k = rank();
+    std::vector<double> z(k, 0.0);
+
+    for (int l = 0; l < k; l ++) {
+      for (int j = 0; j < nm; j ++) {
+	z[l] += S(l, j) * x(j, 0);
+      }
+    }
+
+    y.resize(nd, 1);
+    for (int i = 0; i < nd; i ++) {
+      double s = 0.0;
+      for (int l = 0; l < k; l ++) {
+	s += T(i, l) * z[l];
+      }
+      y(i, 0) = s;
+    }
+  }
+
+  //
+  // g += G^T C_d^-1 r for diagonal C_d
+  //
+  virtual void add_weighted_transpose(const Spec1DMatrix<double> &Cd,
+				      const Spec1DMatrix<double> &r,
+				      Spec1DMatrix<double> &g) const
+  {
+    int k = rank();
+    std::vector<double> z(k, 0.0);
+
+    for (int i = 0; i < nd; i ++) {
+      double w = r(i, 0)/Cd(i, 0);
+      for (int l = 0; l < k; l ++) {
+	z[l] += T(i, l) * w;
+      }
+    }
+
+    for (int j = 0; j < nm; j ++) {
+      double s = 0.0;
+      for (int l = 0; l < k; l ++) {
+	s += S(l, j) * z[l];
+      }
+      g(j, 0) += s;
+    }
+  }
+
+  //
+  // A += G^T C_d^-1 G = S^T (T^T C_d^-1 T) S for diagonal C_d
+  //
+  virtual void add_normal(const Spec1DMatrix<double> &Cd, Spec1DMatrix<double> &A) const
+  {
+    int k = rank();
+    Spec1DMatrix<double> M;
+    Spec1DMatrix<double> B;
+
+    M.resize(k, k);
+    B.resize(k, nm);
+    M.setZero();
+    for (int i = 0; i < nd; i ++) {
+      double w = 1.0/Cd(i, 0);
+      for (int a = 0; a < k; a ++) {
+	double ta = T(i, a) * w;
+	for (int b = 0; b < k; b ++) {
+	  M(a, b) += ta * T(i, b);
+	}
+      }
+    }
+
+    for (int a = 0; a < k; a ++) {
+      for (int j = 0; j < nm; j ++) {
+	double s = 0.0;
+	for (int b = 0; b < k; b ++) {
+	  s += M(a, b) * S(b, j);
+	}
+	B(a, j) = s;
+      }
+    }
+
+    for (int i = 0; i < nm; i ++) {
+      for (int j = 0; j < nm; j ++) {
+	double s = 0.0;
+	for (int a = 0; a < k; a ++) {
+	  s += S(a, i) * B(a, j);
+	}
+	A(i, j) += s;
+      }
+    }
+  }
+
+  //
+  // Text format: "Nd Nm k", the k pivot rows, then S (k rows) and T (Nd rows)
+  //
+  bool save(const char *filename) const
+  {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "error: failed to create %s\n", filename);
+      return false;
+    }
+
+    int k = rank();
+    
+    fprintf(fp, "%d %d %d\n", nd, nm, k);
+    for (int l = 0; l < k; l ++) {
+      fprintf(fp, "%d ", pivots[l]);
+    }
+    fprintf(fp, "\n");
+    
+    for (int l = 0; l < k; l ++) {
+      for (int j = 0; j < nm; j ++) {
+	fprintf(fp, "%16.9e ", S(l, j));
+      }
+      fprintf(fp, "\n");
+    }
+    
+    for (int i = 0; i < nd; i ++) {
+      for (int l = 0; l < k; l ++) {
+	fprintf(fp, "%16.9e ", T(i, l));
+      }
+      fprintf(fp, "\n");
+    }
+
+    fclose(fp);
+    return true;
+  }
+
+  int nd;
+  int nm;
+  std::vector<int> pivots;
+  Spec1DMatrix<double> S;
+  Spec1DMatrix<double> T;
+};
+
+#endif // compressedjacobian_hpp
@@ -29,6 +29,10 @@
 #include <fftw3.h>
 #include <gsl/gsl_sf_bessel.h>
 
+#include "spec1d/textreader.hpp"
+
+#include "spectrumcache.hpp"
+
 class DispersionData {
 public:
 
@@ -45,26 +49,33 @@ public:
     fullenv(NULL),
     env_signal(NULL),
     env_spectrum(NULL),
-    noise_sigma(1.0)
+    noise_sigma(1.0),
+    cache_directory(nullptr)
   {
   }
 
-  bool load(const char *filename)
+  //
+  // With band_only set only the frequency column is parsed for rows outside
+  // [fmin, fmax] and their spectrum values are left as zero.
+  //
+  bool load(const char *filename, bool band_only = false)
   {
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
+    TextReader in;
+    if (!in.open(filename)) {
       fprintf(stderr, "error: failed to open %s for reading\n", filename);
       return false;
     }
 
-    if (fscanf(fp, "%lf %lf %lf %lf %lf\n",
-	       &lon1, &lat1, &lon2, &lat2, &distkm) != 5) {
+    if (!in.read_double(lon1) || !in.read_double(lat1) ||
+	!in.read_double(lon2) || !in.read_double(lat2) ||
+	!in.read_double(distkm)) {
       fprintf(stderr, "error: failed to parse line 1\n");
       return false;
     }
 
-    if (fscanf(fp, "%lf %d %lf %lf %d\n",
-	       &samplerate, &daycount, &asnr, &csnr, &samples) != 5) {
+    if (!in.read_double(samplerate) || !in.read_int(daycount) ||
+	!in.read_double(asnr) || !in.read_double(csnr) ||
+	!in.read_int(samples)) {
       fprintf(stderr, "error: failed to parse line 2\n");
       return false;
     }
@@ -87,11 +98,19 @@ public:
     for (int i = 0; i < samples; i ++) {
 
       
-      if (fscanf(fp,
-		 "%lf %lf %lf %lf %lf\n",
-		 &freq[i],
-		 &sreal[i], &simag[i],
-		 &ncfreal[i], &ncfimag[i]) != 5) {
+      if (!in.read_double(freq[i])) {
+	fprintf(stderr, "error: failed to read spectrum\n");
+	return false;
+      }
+
+      if (band_only && (freq[i] < fmin || freq[i] > fmax)) {
+	sreal[i] = 0.0;
+	simag[i] = 0.0;
+	ncfreal[i] = 0.0;
+	ncfimag[i] = 0.0;
+	in.skip_line();
+      } else if (!in.read_double(sreal[i]) || !in.read_double(simag[i]) ||
+		 !in.read_double(ncfreal[i]) || !in.read_double(ncfimag[i])) {
 	fprintf(stderr, "error: failed to read spectrum\n");
 	return false;
       }
@@ -106,7 +125,7 @@ public:
 
     }
 
-    fclose(fp);
+    in.close();
     
     return true;
   }
@@ -133,6 +152,29 @@ public:
     return true;
   }
 
+  //
+  // Content key of the loaded spectrum and band used for the preprocessing
+  // cache. Parameters specific to each preprocessing step are hashed on top.
+  //
+  uint64_t spectrum_key() const
+  {
+    uint64_t h = FNV1A_OFFSET;
+    
+    h = fnv1a(&samples, sizeof(samples), h);
+    h = fnv1a(&samplerate, sizeof(samplerate), h);
+    h = fnv1a(&distkm, sizeof(distkm), h);
+    h = fnv1a(&ffirst, sizeof(ffirst), h);
+    h = fnv1a(&flast, sizeof(flast), h);
+
+    h = fnv1a(freq.data(), sizeof(double) * freq.size(), h);
+    h = fnv1a(sreal.data(), sizeof(double) * sreal.size(), h);
+    h = fnv1a(simag.data(), sizeof(double) * simag.size(), h);
+    h = fnv1a(ncfreal.data(), sizeof(double) * ncfreal.size(), h);
+    h = fnv1a(ncfimag.data(), sizeof(double) * ncfimag.size(), h);
+
+    return h;
+  }
+  
   bool compute_ftan_envelope(double cfreq, double sigma, double *acausal, double *causal)
   {
     //
@@ -143,9 +185,16 @@ public:
     int N = N2 * 2;
     if (fullspec == NULL) {
 
-      fullspec = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * N);
+      //
+      // The filtered spectrum below is written up to index 2*samples - 1 so
+      // allocate past the N entries used by the transform
+      //
+      fullspec = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * 2 * samples);
       fullenv = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * N);
 
+      fullspec[0][0] = 0.0;
+      fullspec[0][1] = 0.0;
+
       plan = fftw_plan_dft_1d(N, fullspec, fullenv, FFTW_BACKWARD, FFTW_ESTIMATE);
     }
 
@@ -181,6 +230,16 @@ public:
     return true;
   }
 
+  bool selected(int i) const
+  {
+    return frequency_mask.empty() || frequency_mask[i] != 0;
+  }
+
+  int mesh_order(int i, int order) const
+  {
+    return frequency_order.empty() ? order : frequency_order[i];
+  }
+
   double env(double r, double i)
   {
     return sqrt(r*r + i*i);
@@ -222,6 +281,21 @@ public:
     int N2 = samples - 1;
     int N = N2 * 2;
 
+    uint64_t key = 0;
+    if (cache_directory != nullptr) {
+      int mt = (int)map_type;
+      key = spectrum_key();
+      key = fnv1a(&sigma, sizeof(sigma), key);
+      key = fnv1a(&mt, sizeof(mt), key);
+      key = fnv1a(&vmin, sizeof(vmin), key);
+      key = fnv1a(&vmax, sizeof(vmax), key);
+      key = fnv1a(&max_deltav, sizeof(max_deltav), key);
+
+      if (load_time_energy_map(key, N)) {
+	return true;
+      }
+    }
+    
     //
     // Create
     //
@@ -348,9 +422,83 @@ public:
     delete causal;
     delete acausal;
 
+    if (cache_directory != nullptr) {
+      save_time_energy_map(key, N);
+    }
+    
     return true;
   }
 
+  //
+  // Cache layout: max_amplitude, time[N], time_max[nf], amplitude_max[nf]
+  // then one row of N per frequency in [ffirst, flast]
+  //
+  bool load_time_energy_map(uint64_t key, int N)
+  {
+    SpectrumCache cache(cache_directory);
+    std::vector<double> values;
+    int nf = freq.size();
+    int nrows = flast - ffirst + 1;
+    
+    if (!cache.load("tmap", key, values) ||
+	(int)values.size() != 1 + N + 2*nf + nrows*N) {
+      return false;
+    }
+
+    time_energy_map.resize(nf);
+    amplitude_max.resize(nf);
+    time_max.resize(nf);
+    time.resize(N);
+
+    predicted_group.resize(nf);
+    predicted_phase.resize(nf);
+    predicted_bessel.resize(nf);
+    predicted_envelope.resize(nf);
+    predicted_realspec.resize(nf);
+
+    const double *v = values.data();
+    
+    max_amplitude = *v++;
+    for (int j = 0; j < N; j ++) {
+      time[j] = *v++;
+    }
+    for (int i = 0; i < nf; i ++) {
+      time_max[i] = *v++;
+    }
+    for (int i = 0; i < nf; i ++) {
+      amplitude_max[i] = *v++;
+    }
+
+    for (auto &t : time_energy_map) {
+      t = nullptr;
+    }
+    for (int i = ffirst; i <= flast; i ++) {
+      time_energy_map[i] = new double[N];
+      memcpy(time_energy_map[i], v, sizeof(double) * N);
+      v += N;
+    }
+
+    return true;
+  }
+
+  void save_time_energy_map(uint64_t key, int N)
+  {
+    SpectrumCache cache(cache_directory);
+    std::vector<double> values;
+    int nf = freq.size();
+
+    values.reserve(1 + N + 2*nf + (flast - ffirst + 1)*N);
+    values.push_back(max_amplitude);
+    values.insert(values.end(), time.begin(), time.end());
+    values.insert(values.end(), time_max.begin(), time_max.end());
+    values.insert(values.end(), amplitude_max.begin(), amplitude_max.end());
+    for (int i = ffirst; i <= flast; i ++) {
+      values.insert(values.end(), time_energy_map[i], time_energy_map[i] + N);
+    }
+
+    cache.save("tmap", key, values);
+  }
+
   bool save_max_time(const char *filename)
   {
     FILE *fp = fopen(filename, "w");
@@ -439,6 +587,25 @@ public:
     // the spectrum.  
     //
 
+    uint64_t key = 0;
+    if (cache_directory != nullptr) {
+      SpectrumCache cache(cache_directory);
+      std::vector<double> values;
+      
+      key = fnv1a(&gaussian_smooth_sigma, sizeof(gaussian_smooth_sigma), spectrum_key());
+
+      //
+      // Layout: noise_sigma then the envelope
+      //
+      if (cache.load("envelope", key, values) && (int)values.size() == samples + 1) {
+	noise_sigma = values[0];
+	for (int i = 0; i < samples; i ++) {
+	  predicted_envelope[i] = values[i + 1];
+	}
+	return;
+      }
+    }
+
 
     //
     // Compute the envelope of the real part of the spectrum. Once off
@@ -547,6 +714,17 @@ public:
 	
     }
 
+    if (cache_directory != nullptr) {
+      SpectrumCache cache(cache_directory);
+      std::vector<double> values(samples + 1);
+
+      values[0] = noise_sigma;
+      for (int i = 0; i < samples; i ++) {
+	values[i + 1] = predicted_envelope[i];
+      }
+
+      cache.save("envelope", key, values);
+    }
   }
   
   double lon1, lat1;
@@ -585,7 +763,23 @@ public:
   std::vector<double> predicted_envelope;
   std::vector<double> predicted_realspec;
 
+  //
+  // Frequencies used by the full likelihoods, all when empty
+  //
+  std::vector<char> frequency_mask;
+
+  //
+  // Mesh order per frequency from automatic discretization, the global
+  // order when empty
+  //
+  std::vector<int> frequency_order;
+
   double noise_sigma;
+
+  //
+  // Preprocessing cache directory, disabled when null
+  //
+  const char *cache_directory;
 };
 
 #endif // dispersion_hpp
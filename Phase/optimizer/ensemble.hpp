@@ -0,0 +1,209 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef ensemble_hpp
+#define ensemble_hpp
+
+#include <random>
+#include <vector>
+
+#include <stdio.h>
+#include <math.h>
+
+#include "dispersion.hpp"
+
+//
+// Noise realisations of the fitted real spectra and the spread of the
+// dispersion curves inverted from them.
+//
+// Each realisation adds independent Gaussian noise of standard deviation
+// noise_sigma (the data error of the likelihood) to ncfreal over the fitted
+// band. The envelopes are those of the observed spectra so the predictions
+// and dk/dp at the starting model are the same for every realisation. The
+// noise of realisation r is drawn from seed + 2r (Love) and seed + 2r + 1
+// (Rayleigh) so results do not depend on the order in which realisations
+// are run.
+//
+class NoiseEnsemble {
+public:
+
+  NoiseEnsemble(int _size, unsigned int _seed) :
+    size(_size),
+    seed(_seed),
+    love(_size),
+    rayleigh(_size),
+    likelihood(_size, 0.0),
+    completed(_size, 0)
+  {
+  }
+
+  //
+  // Perturbs the spectra of data for realisation r of wave type w (0 Love,
+  // 1 Rayleigh)
+  //
+  void perturb(DispersionData &data, int r, int w) const
+  {
+    std::mt19937 generator(seed + 2*r + w);
+    std::normal_distribution<double> noise(0.0, data.noise_sigma);
+
+    for (int i = data.ffirst; i <= data.flast; i ++) {
+      data.ncfreal[i] += noise(generator);
+    }
+  }
+
+  //
+  // Records the final predictions of realisation r
+  //
+  void set(int r,
+	   const DispersionData &data_love,
+	   const DispersionData &data_rayleigh,
+	   double like)
+  {
+    love[r].capture(data_love);
+    rayleigh[r].capture(data_rayleigh);
+    likelihood[r] = like;
+    completed[r] = 1;
+  }
+
+  int count() const
+  {
+    int n = 0;
+    for (auto c : completed) {
+      if (c) {
+	n ++;
+      }
+    }
+    return n;
+  }
+
+  //
+  // Writes frequency, mean and standard deviation of the phase then of
+  // the group velocity over the completed realisations
+  //
+  bool save_love(const char *filename, const DispersionData &data) const
+  {
+    return save(filename, data, love);
+  }
+
+  bool save_rayleigh(const char *filename, const DispersionData &data) const
+  {
+    return save(filename, data, rayleigh);
+  }
+
+  //
+  // Final likelihood of each realisation, 0 for those that failed
+  //
+  bool save_likelihoods(const char *filename) const
+  {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "error: failed to create %s\n", filename);
+      return false;
+    }
+
+    for (int r = 0; r < size; r ++) {
+      fprintf(fp, "%d %16.9e\n", r, completed[r] ? likelihood[r] : 0.0);
+    }
+
+    fclose(fp);
+    return true;
+  }
+
+private:
+
+  struct curves {
+    void capture(const DispersionData &data)
+    {
+      phase.assign(data.predicted_phase.begin() + data.ffirst,
+		   data.predicted_phase.begin() + data.flast + 1);
+      group.assign(data.predicted_group.begin() + data.ffirst,
+		   data.predicted_group.begin() + data.flast + 1);
+    }
+
+    std::vector<double> phase;
+    std::vector<double> group;
+  };
+
+  bool save(const char *filename, const DispersionData &data, const std::vector<curves> &realisations) const
+  {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "error: failed to create %s\n", filename);
+      return false;
+    }
+
+    int ndata = data.flast - data.ffirst + 1;
+    for (int i = 0; i < ndata; i ++) {
+
+      //
+      // Welford mean and variance
+      //
+      int n = 0;
+      double mean_phase = 0.0;
+      double m2_phase = 0.0;
+      double mean_group = 0.0;
+      double m2_group = 0.0;
+
+      for (int r = 0; r < size; r ++) {
+	if (!completed[r] || (int)realisations[r].phase.size() != ndata) {
+	  continue;
+	}
+
+	n ++;
+
+	double c = realisations[r].phase[i];
+	double delta = c - mean_phase;
+	mean_phase += delta/(double)n;
+	m2_phase += delta * (c - mean_phase);
+
+	double U = realisations[r].group[i];
+	delta = U - mean_group;
+	mean_group += delta/(double)n;
+	m2_group += delta * (U - mean_group);
+      }
+
+      double std_phase = n > 1 ? sqrt(m2_phase/(double)(n - 1)) : 0.0;
+      double std_group = n > 1 ? sqrt(m2_group/(double)(n - 1)) : 0.0;
+
+      fprintf(fp, "%15.9f %15.9f %15.9f %15.9f %15.9f\n",
+	      data.freq[data.ffirst + i],
+	      mean_phase, std_phase,
+	      mean_group, std_group);
+    }
+
+    fclose(fp);
+    return true;
+  }
+
+  int size;
+  unsigned int seed;
+
+  std::vector<curves> love;
+  std::vector<curves> rayleigh;
+  std::vector<double> likelihood;
+  std::vector<char> completed;
+};
+
+#endif // ensemble_hpp
@@ -0,0 +1,263 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+
+#pragma once
+#ifndef factoredjacobian_hpp
+#define factoredjacobian_hpp
+
+#include <vector>
+
+#include "spec1d/spec1dmatrix.hpp"
+
+#include "jacobianoperator.hpp"
+
+//
+// Spline interpolated Jacobian G = D S H of the skip path. H holds the
+// dk/dp and dU/dp rows of the solved anchor frequencies (rows 2a and
+// 2a + 1 of anchor a), S the Hermite weights of each frequency on its
+// two bracketing anchors (at most 4 per row) and D the diagonal dpbdk
+// scaling to the Bessel prediction. Products go through the small
+// 2 anchors x 2 anchors core S^T D C_d^-1 D S.
+//
+class FactoredJacobian : public JacobianOperator {
+public:
+
+  enum {
+    MAXWEIGHTS = 4
+  };
+  
+  FactoredJacobian() :
+    nd(0),
+    nm(0),
+    na(0)
+  {
+  }
+
+  void resize(int _nd, int anchors, int _nm)
+  {
+    nd = _nd;
+    nm = _nm;
+    na = anchors;
+
+    H.resize(2 * na, nm);
+    scale.assign(nd, 0.0);
+    count.assign(nd, 0);
+    column.assign(nd * MAXWEIGHTS, 0);
+    weight.assign(nd * MAXWEIGHTS, 0.0);
+  }
+
+  //
+  // Row i is the solved anchor a
+  //
+  void set_anchor(int i, int a, double dpbdk,
+		  const Spec1DMatrix<double> &dkdp,
+		  const Spec1DMatrix<double> &dUdp)
+  {
+    for (int j = 0; j < nm; j ++) {
+      H(2 * a, j) = dkdp(j, 0);
+      H(2 * a + 1, j) = dUdp(j, 0);
+    }
+
+    scale[i] = dpbdk;
+    count[i] = 1;
+    column[i * MAXWEIGHTS] = 2 * a;
+    weight[i * MAXWEIGHTS] = 1.0;
+  }
+
+  //
+  // Row i interpolated between anchors a0 and a1 with weights on their
+  // dk/dp (wk) and dU/dp (wU) rows
+  //
+  void set_interpolated(int i, int a0, int a1, double dpbdk,
+			double wk0, double wU0,
+			double wk1, double wU1)
+  {
+    int o = i * MAXWEIGHTS;
+    
+    scale[i] = dpbdk;
+    count[i] = 4;
+    column[o] = 2 * a0;
+    weight[o] = wk0;
+    column[o + 1] = 2 * a0 + 1;
+    weight[o + 1] = wU0;
+    column[o + 2] = 2 * a1;
+    weight[o + 2] = wk1;
+    column[o + 3] = 2 * a1 + 1;
+    weight[o + 3] = wU1;
+  }
+
+  virtual int rows() const
+  {
+    return nd;
+  }
+
+  virtual int cols() const
+  {
+    return nm;
+  }
+
+  int anchors() const
+  {
+    return na;
+  }
+
+  //
+  // Dense dk/dp rows S H (without the dpbdk scaling)
+  //
+  void expand_k(Spec1DMatrix<double> &Gk) const
+  {
+    Gk.resize(nd, nm);
+    for (int i = 0; i < nd; i ++) {
+      for (int j = 0; j < nm; j ++) {
+	Gk(i, j) = row(i, j);
+      }
+    }
+  }
+
+  virtual void expand(Spec1DMatrix<double> &G) const
+  {
+    G.resize(nd, nm);
+    for (int i = 0; i < nd; i ++) {
+      for (int j = 0; j < nm; j ++) {
+	G(i, j) = scale[i] * row(i, j);
+      }
+    }
+  }
+
+  //
+  // y = G x
+  //
+  virtual void multiply(const Spec1DMatrix<double> &x, Spec1DMatrix<double> &y) const
+  {
+    std::vector<double> z(2 * na, 0.0);
+
+    for (int a = 0; a < 2 * na; a ++) {
+      for (int j = 0; j < nm; j ++) {
+	z[a] += H(a, j) * x(j, 0);
+      }
+    }
+
+    y.resize(nd, 1);
+    for (int i = 0; i < nd; i ++) {
+      double s = 0.0;
+      for (int l = 0; l < count[i]; l ++) {
+	s += weight[i * MAXWEIGHTS + l] * z[column[i * MAXWEIGHTS + l]];
+      }
+      y(i, 0) = scale[i] * s;
+    }
+  }
+
+  //
+  // g += G^T C_d^-1 r = H^T (S^T D C_d^-1 r) for diagonal C_d
+  //
+  virtual void add_weighted_transpose(const Spec1DMatrix<double> &Cd,
+				      const Spec1DMatrix<double> &r,
+				      Spec1DMatrix<double> &g) const
+  {
+    std::vector<double> z(2 * na, 0.0);
+
+    for (int i = 0; i < nd; i ++) {
+      double w = scale[i] * r(i, 0)/Cd(i, 0);
+      for (int l = 0; l < count[i]; l ++) {
+	z[column[i * MAXWEIGHTS + l]] += weight[i * MAXWEIGHTS + l] * w;
+      }
+    }
+
+    for (int j = 0; j < nm; j ++) {
+      double s = 0.0;
+      for (int a = 0; a < 2 * na; a ++) {
+	s += H(a, j) * z[a];
+      }
+      g(j, 0) += s;
+    }
+  }
+
+  //
+  // A += G^T C_d^-1 G = H^T (S^T D C_d^-1 D S) H for diagonal C_d
+  //
+  virtual void add_normal(const Spec1DMatrix<double> &Cd, Spec1DMatrix<double> &A) const
+  {
+    int k = 2 * na;
+    Spec1DMatrix<double> M;
+    Spec1DMatrix<double> B;
+
+    M.resize(k, k);
+    M.setZero();
+    for (int i = 0; i < nd; i ++) {
+      double w = scale[i] * scale[i]/Cd(i, 0);
+      int o = i * MAXWEIGHTS;
+      for (int l = 0; l < count[i]; l ++) {
+	double wl = weight[o + l] * w;
+	for (int n = 0; n < count[i]; n ++) {
+	  M(column[o + l], column[o + n]) += wl * weight[o + n];
+	}
+      }
+    }
+
+    B.resize(k, nm);
+    for (int j = 0; j < nm; j ++) {
+      for (int a = 0; a < k; a ++) {
+	double s = 0.0;
+	for (int b = 0; b < k; b ++) {
+	  s += M(a, b) * H(b, j);
+	}
+	B(a, j) = s;
+      }
+    }
+
+    for (int j = 0; j < nm; j ++) {
+      for (int i = 0; i < nm; i ++) {
+	double s = 0.0;
+	for (int a = 0; a < k; a ++) {
+	  s += H(a, i) * B(a, j);
+	}
+	A(i, j) += s;
+      }
+    }
+  }
+
+  int nd;
+  int nm;
+  int na;
+  Spec1DMatrix<double> H;
+  std::vector<double> scale;
+  std::vector<int> count;
+  std::vector<int> column;
+  std::vector<double> weight;
+
+private:
+
+  double row(int i, int j) const
+  {
+    double s = 0.0;
+    for (int l = 0; l < count[i]; l ++) {
+      s += weight[i * MAXWEIGHTS + l] * H(column[i * MAXWEIGHTS + l], j);
+    }
+    return s;
+  }
+  
+};
+
+#endif // factoredjacobian_hpp
@@ -0,0 +1,259 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef frequencyselection_hpp
+#define frequencyselection_hpp
+
+#include <algorithm>
+#include <vector>
+
+#include <math.h>
+
+#include "likelihood.hpp"
+
+//
+// Information based selection of the frequencies used while iterating.
+//
+// Each row g_i of the Jacobian of a full likelihood is d realspec/dk dk/dp
+// with variance Cd_i, and d realspec/dk scales with the predicted envelope,
+// so g_i g_i^T/Cd_i is the envelope SNR weighted information of frequency
+// i. With the Fisher information F = sum_i g_i g_i^T/Cd_i + C_M^-1 of the
+// joint problem, the leverage h_i = g_i^T F^-1 g_i/Cd_i is the share of the
+// information of row i (the leverages sum to the number of parameters
+// resolved by the data). Rows are chosen in order of decreasing leverage
+// until the chosen leverages reach a fraction of the total. The rows of
+// the frequencies left out are removed from G, the residuals and Cd along
+// with their contributions to dLdp and the likelihood, so iteration can
+// continue from the current evaluation without new forward solves.
+//
+class FrequencySelection {
+public:
+
+  struct block {
+    DispersionData *data;
+    Spec1DMatrix<double> *G;
+    Spec1DMatrix<double> *residual;
+    Spec1DMatrix<double> *Cd;
+    Spec1DMatrix<double> *dLdp;
+    double *like;
+
+    int selected;
+    int rows;
+  };
+
+  //
+  // Returns the fraction of the leverage retained or a negative value on
+  // failure. The frequency_thin must be that of the evaluation of the
+  // blocks so that their rows can be matched to frequencies.
+  //
+  double select(int nblocks,
+		block *blocks,
+		const Spec1DMatrix<double> &Cm,
+		double frequency_thin,
+		double fraction)
+  {
+    if (nblocks < 1) {
+      return -1.0;
+    }
+
+    int Nm = blocks[0].G->cols();
+
+    //
+    // Fisher information F = G^T C_D^-1 G + C_M^-1, undamped parameters
+    // are given a small ridge to keep F positive definite
+    //
+    R.resize(Nm, Nm);
+    R.setZero();
+
+    for (int b = 0; b < nblocks; b ++) {
+      const Spec1DMatrix<double> &G = *blocks[b].G;
+      const Spec1DMatrix<double> &Cd = *blocks[b].Cd;
+
+      for (int r = 0; r < G.rows(); r ++) {
+	double w = 1.0/Cd(r, 0);
+	for (int j = 0; j < Nm; j ++) {
+	  double gj = G(r, j) * w;
+	  for (int i = 0; i <= j; i ++) {
+	    R(i, j) += G(r, i) * gj;
+	  }
+	}
+      }
+    }
+
+    double maxdiag = 0.0;
+    for (int j = 0; j < Nm; j ++) {
+      maxdiag = std::max(maxdiag, R(j, j));
+    }
+
+    for (int j = 0; j < Nm; j ++) {
+      if (Cm(j, 0) > 0.0) {
+	R(j, j) += 1.0/Cm(j, 0);
+      } else {
+	R(j, j) += RIDGE * maxdiag;
+      }
+    }
+
+    if (!upper_cholesky(R, Nm)) {
+      fprintf(stderr, "error: Fisher information is not positive definite\n");
+      return -1.0;
+    }
+
+    //
+    // Leverage of each row h_i = | R^-T g_i |^2/Cd_i
+    //
+    std::vector<leverage> h;
+    std::vector<double> y(Nm);
+    double total = 0.0;
+
+    for (int b = 0; b < nblocks; b ++) {
+      const Spec1DMatrix<double> &G = *blocks[b].G;
+      const Spec1DMatrix<double> &Cd = *blocks[b].Cd;
+
+      for (int r = 0; r < G.rows(); r ++) {
+	for (int j = 0; j < Nm; j ++) {
+	  y[j] = G(r, j);
+	}
+	upper_cholesky_solve_RT(R, y);
+
+	double s = 0.0;
+	for (int j = 0; j < Nm; j ++) {
+	  s += y[j] * y[j];
+	}
+
+	leverage l = {s/Cd(r, 0), b, r};
+	h.push_back(l);
+	total += l.h;
+      }
+    }
+
+    std::sort(h.begin(), h.end(), [](const leverage &a, const leverage &b) {
+	return a.h > b.h;
+      });
+
+    std::vector<std::vector<char>> keep(nblocks);
+    for (int b = 0; b < nblocks; b ++) {
+      keep[b].assign(blocks[b].G->rows(), 0);
+      blocks[b].selected = 0;
+      blocks[b].rows = blocks[b].G->rows();
+    }
+
+    double retained = 0.0;
+    for (auto &l : h) {
+      if (retained >= fraction * total && blocks[l.b].selected > 0) {
+	continue;
+      }
+
+      keep[l.b][l.r] = 1;
+      blocks[l.b].selected ++;
+      retained += l.h;
+    }
+
+    //
+    // Set the masks and remove the rows left out
+    //
+    for (int b = 0; b < nblocks; b ++) {
+      restrict(blocks[b], keep[b], frequency_thin);
+    }
+
+    return total > 0.0 ? retained/total : 1.0;
+  }
+
+private:
+
+  static constexpr double RIDGE = 1.0e-12;
+
+  struct leverage {
+    double h;
+    int b;
+    int r;
+  };
+
+  static void restrict(block &blk, const std::vector<char> &keep, double frequency_thin)
+  {
+    DispersionData &data = *blk.data;
+    Spec1DMatrix<double> &G = *blk.G;
+    Spec1DMatrix<double> &residual = *blk.residual;
+    Spec1DMatrix<double> &Cd = *blk.Cd;
+    Spec1DMatrix<double> &dLdp = *blk.dLdp;
+
+    int Nm = G.cols();
+
+    std::vector<char> mask(data.freq.size(), 0);
+
+    //
+    // Rows are in decreasing frequency as formed by the full likelihoods
+    //
+    Spec1DMatrix<double> Gs;
+    Spec1DMatrix<double> residuals;
+    Spec1DMatrix<double> Cds;
+
+    Gs.resize(blk.selected, Nm);
+    residuals.resize(blk.selected, 1);
+    Cds.resize(blk.selected, 1);
+
+    double last_freq = -1.0;
+    int r = 0;
+    int s = 0;
+    for (int i = data.flast; i >= data.ffirst; i --) {
+
+      if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+	continue;
+      }
+      last_freq = data.freq[i];
+
+      if (keep[r]) {
+	mask[i] = 1;
+
+	for (int j = 0; j < Nm; j ++) {
+	  Gs(s, j) = G(r, j);
+	}
+	residuals(s, 0) = residual(r, 0);
+	Cds(s, 0) = Cd(r, 0);
+	s ++;
+
+      } else {
+
+	double normed_residual = residual(r, 0)/Cd(r, 0);
+
+	*blk.like -= residual(r, 0) * normed_residual/2.0;
+	for (int j = 0; j < Nm; j ++) {
+	  dLdp(j, 0) -= normed_residual * G(r, j);
+	}
+      }
+
+      r ++;
+    }
+
+    data.frequency_mask = mask;
+
+    G = Gs;
+    residual = residuals;
+    Cd = Cds;
+  }
+
+  Spec1DMatrix<double> R;
+};
+
+#endif // frequencyselection_hpp
@@ -0,0 +1,389 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef incremental_hpp
+#define incremental_hpp
+
+#include <vector>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "common.hpp"
+#include "dispersion.hpp"
+#include "likelihood.hpp"
+#include "spectrumcache.hpp"
+
+//
+// Per wave type record of the final accepted model of a run: the fitted
+// band of the real spectrum and the predictions and dk/dp (one row per
+// frequency from ffirst) at that model. Frequencies left out of a full
+// likelihood have zero rows.
+//
+class WaveState {
+public:
+
+  WaveState()
+  {
+  }
+
+  void capture(const DispersionData &data, const Spec1DMatrix<double> &_Gk)
+  {
+    int ndata = data.flast - data.ffirst + 1;
+    int i0 = data.ffirst;
+    int i1 = data.flast + 1;
+
+    ncfreal.assign(data.ncfreal.begin() + i0, data.ncfreal.begin() + i1);
+    predicted_k.assign(data.predicted_k.begin() + i0, data.predicted_k.begin() + i1);
+    predicted_phase.assign(data.predicted_phase.begin() + i0, data.predicted_phase.begin() + i1);
+    predicted_group.assign(data.predicted_group.begin() + i0, data.predicted_group.begin() + i1);
+
+    if (_Gk.rows() == ndata) {
+      Gk = _Gk;
+    } else {
+      Gk.resize(0, 0);
+    }
+  }
+
+  //
+  // As capture for the dk/dp of the full likelihoods, whose rows run from
+  // flast down without the thinned or unselected frequencies
+  //
+  void capture(const DispersionData &data, const Spec1DMatrix<double> &_Gk, double frequency_thin)
+  {
+    capture(data, Spec1DMatrix<double>());
+
+    std::vector<int> index;
+    full_index(data, frequency_thin, index);
+    if (index.empty() || _Gk.rows() != (int)index.size()) {
+      return;
+    }
+
+    Gk.resize(data.flast - data.ffirst + 1, _Gk.cols());
+    Gk.setZero();
+    for (size_t r = 0; r < index.size(); r ++) {
+      for (int j = 0; j < Gk.cols(); j ++) {
+	Gk(index[r], j) = _Gk(r, j);
+      }
+    }
+  }
+
+  //
+  // Whether the stored dk/dp can stand in for a forward solve on data, for
+  // the spline (skip > 1) or full likelihoods
+  //
+  bool reusable(const DispersionData &data, int skip, double frequency_thin) const
+  {
+    int ndata = data.flast - data.ffirst + 1;
+    
+    if (!((int)predicted_k.size() == ndata &&
+	  Gk.rows() == ndata &&
+	  Gk.cols() > 0)) {
+      return false;
+    }
+
+    double last_freq = -1.0;
+    for (int i = data.flast; i >= data.ffirst; i --) {
+      if (skip <= 1 && frequency_skipped(data, i, frequency_thin, last_freq)) {
+	continue;
+      }
+      last_freq = data.freq[i];
+
+      if (!captured(i - data.ffirst)) {
+	return false;
+      }
+    }
+
+    return true;
+  }
+
+  //
+  // Gk in the row order of the full likelihoods
+  //
+  void full_rows(const DispersionData &data, double frequency_thin, Spec1DMatrix<double> &G) const
+  {
+    std::vector<int> index;
+    full_index(data, frequency_thin, index);
+
+    G.resize(index.size(), Gk.cols());
+    for (size_t r = 0; r < index.size(); r ++) {
+      for (int j = 0; j < Gk.cols(); j ++) {
+	G(r, j) = Gk(index[r], j);
+      }
+    }
+  }
+
+  //
+  // Restores the predictions into data, false if the band differs
+  //
+  bool restore(DispersionData &data) const
+  {
+    if ((int)predicted_k.size() != data.flast - data.ffirst + 1) {
+      return false;
+    }
+
+    for (size_t i = 0; i < predicted_k.size(); i ++) {
+      data.predicted_k[data.ffirst + i] = predicted_k[i];
+      data.predicted_phase[data.ffirst + i] = predicted_phase[i];
+      data.predicted_group[data.ffirst + i] = predicted_group[i];
+    }
+
+    return true;
+  }
+
+  //
+  // Relative change ||new - old||/||old|| of the fitted real spectrum, or
+  // a negative value if the band differs
+  //
+  double relative_change(const DispersionData &data) const
+  {
+    if ((int)ncfreal.size() != data.flast - data.ffirst + 1) {
+      return -1.0;
+    }
+
+    double num = 0.0;
+    double den = 0.0;
+    for (size_t i = 0; i < ncfreal.size(); i ++) {
+      double d = data.ncfreal[data.ffirst + i] - ncfreal[i];
+      num += d*d;
+      den += ncfreal[i]*ncfreal[i];
+    }
+
+    if (den <= 0.0) {
+      return -1.0;
+    }
+    
+    return sqrt(num/den);
+  }
+
+  void encode(std::vector<double> &values) const
+  {
+    values.push_back((double)ncfreal.size());
+    values.push_back((double)Gk.cols());
+    values.insert(values.end(), ncfreal.begin(), ncfreal.end());
+    values.insert(values.end(), predicted_k.begin(), predicted_k.end());
+    values.insert(values.end(), predicted_phase.begin(), predicted_phase.end());
+    values.insert(values.end(), predicted_group.begin(), predicted_group.end());
+    for (int i = 0; i < Gk.rows(); i ++) {
+      for (int j = 0; j < Gk.cols(); j ++) {
+	values.push_back(Gk(i, j));
+      }
+    }
+  }
+
+  bool decode(const std::vector<double> &values, size_t &offset)
+  {
+    if (offset + 2 > values.size()) {
+      return false;
+    }
+    
+    int ndata = (int)values[offset];
+    int nparam = (int)values[offset + 1];
+    offset += 2;
+
+    if (ndata < 0 || nparam < 0 ||
+	offset + 4*ndata + (size_t)ndata*nparam > values.size()) {
+      return false;
+    }
+
+    const double *v = values.data() + offset;
+    ncfreal.assign(v, v + ndata);
+    predicted_k.assign(v + ndata, v + 2*ndata);
+    predicted_phase.assign(v + 2*ndata, v + 3*ndata);
+    predicted_group.assign(v + 3*ndata, v + 4*ndata);
+    v += 4*ndata;
+    
+    if (nparam > 0) {
+      Gk.resize(ndata, nparam);
+      for (int i = 0; i < ndata; i ++) {
+	for (int j = 0; j < nparam; j ++) {
+	  Gk(i, j) = *v++;
+	}
+      }
+    } else {
+      Gk.resize(0, 0);
+    }
+
+    offset += 4*ndata + (size_t)ndata*nparam;
+    return true;
+  }
+
+private:
+
+  //
+  // Row of Gk (offset from ffirst) of each row of the full likelihoods
+  //
+  static void full_index(const DispersionData &data, double frequency_thin, std::vector<int> &index)
+  {
+    index.clear();
+    
+    double last_freq = -1.0;
+    for (int i = data.flast; i >= data.ffirst; i --) {
+      if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+	continue;
+      }
+      last_freq = data.freq[i];
+
+      index.push_back(i - data.ffirst);
+    }
+  }
+
+  //
+  // Whether row i of Gk was filled, left out frequencies have zero rows
+  //
+  bool captured(int i) const
+  {
+    for (int j = 0; j < Gk.cols(); j ++) {
+      if (Gk(i, j) != 0.0) {
+	return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  
+  std::vector<double> ncfreal;
+  std::vector<double> predicted_k;
+  std::vector<double> predicted_phase;
+  std::vector<double> predicted_group;
+  Spec1DMatrix<double> Gk;
+};
+
+//
+// State carried between incremental runs of the joint inversion. The binary
+// state file is keyed by a hash of the final model so it is only ever applied
+// to a warm start from exactly that model (the .model.bin snapshot, the text
+// .model is rounded and will not match).
+//
+class IncrementalState {
+public:
+
+  IncrementalState() :
+    valid(false),
+    model_hash(0),
+    likelihood(0.0),
+    iterations(0)
+  {
+  }
+
+  static uint64_t hash_model(const model_t &model)
+  {
+    int size = model.encode_size();
+    char *buffer = new char[size];
+    int offset = 0;
+    uint64_t h = 0;
+    
+    if (model.encode(buffer, offset, size) >= 0) {
+      h = fnv1a(buffer, offset);
+    }
+    
+    delete [] buffer;
+    return h;
+  }
+
+  bool load(const char *filename, const model_t &model)
+  {
+    std::vector<double> values;
+    size_t offset = 0;
+
+    model_hash = hash_model(model);
+    valid = (SpectrumCache::load_file(filename, "state", model_hash, values) &&
+	     values.size() >= 2);
+
+    if (valid) {
+      likelihood = values[0];
+      iterations = (int)values[1];
+      offset = 2;
+      
+      valid = (love.decode(values, offset) &&
+	       rayleigh.decode(values, offset));
+    }
+    
+    return valid;
+  }
+
+  bool save(const char *filename, const model_t &model)
+  {
+    std::vector<double> values;
+
+    model_hash = hash_model(model);
+    values.push_back(likelihood);
+    values.push_back((double)iterations);
+    love.encode(values);
+    rayleigh.encode(values);
+    
+    return SpectrumCache::save_file(filename, "state", model_hash, values);
+  }
+
+  //
+  // Human readable summary of the run used by the incremental mode
+  //
+  bool save_manifest(const char *filename,
+		     const char *input_love,
+		     const DispersionData &data_love,
+		     const char *input_rayleigh,
+		     const DispersionData &data_rayleigh,
+		     const char *status)
+  {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "error: failed to create %s\n", filename);
+      return false;
+    }
+
+    fprintf(fp, "status %s\n", status);
+    fprintf(fp, "love_input %s\n", input_love);
+    fprintf(fp, "love_hash %016llx\n", (unsigned long long)data_love.spectrum_key());
+    fprintf(fp, "love_daycount %d\n", data_love.daycount);
+    fprintf(fp, "rayleigh_input %s\n", input_rayleigh);
+    fprintf(fp, "rayleigh_hash %016llx\n", (unsigned long long)data_rayleigh.spectrum_key());
+    fprintf(fp, "rayleigh_daycount %d\n", data_rayleigh.daycount);
+    fprintf(fp, "model_hash %016llx\n", (unsigned long long)model_hash);
+    fprintf(fp, "likelihood %16.9e\n", likelihood);
+    fprintf(fp, "iterations %d\n", iterations);
+
+    fclose(fp);
+    return true;
+  }
+  
+  bool valid;
+  uint64_t model_hash;
+  double likelihood;
+  int iterations;
+  
+  WaveState love;
+  WaveState rayleigh;
+
+  //
+  // The same at the starting model of the run (not saved), from which the
+  // realisations of a noise ensemble start
+  //
+  WaveState initial_love;
+  WaveState initial_rayleigh;
+};
+
+#endif // incremental_hpp
@@ -0,0 +1,67 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef jacobianoperator_hpp
+#define jacobianoperator_hpp
+
+#include "spec1d/spec1dmatrix.hpp"
+
+//
+// An Nd x Nm Jacobian held in some structured form, providing the
+// products the step engines need without forming the dense matrix.
+//
+class JacobianOperator {
+public:
+
+  virtual ~JacobianOperator()
+  {
+  }
+
+  virtual int rows() const = 0;
+
+  virtual int cols() const = 0;
+
+  virtual void expand(Spec1DMatrix<double> &G) const = 0;
+
+  //
+  // y = G x
+  //
+  virtual void multiply(const Spec1DMatrix<double> &x, Spec1DMatrix<double> &y) const = 0;
+
+  //
+  // g += G^T C_d^-1 r for diagonal C_d
+  //
+  virtual void add_weighted_transpose(const Spec1DMatrix<double> &Cd,
+				      const Spec1DMatrix<double> &r,
+				      Spec1DMatrix<double> &g) const = 0;
+
+  //
+  // A += G^T C_d^-1 G for diagonal C_d
+  //
+  virtual void add_normal(const Spec1DMatrix<double> &Cd, Spec1DMatrix<double> &A) const = 0;
+  
+};
+
+#endif // jacobianoperator_hpp
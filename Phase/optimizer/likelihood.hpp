@@ -86,6 +86,98 @@ void likelihood_damping(model_t &model,
   }
 }
 
+//
+// Whether frequency i is left out of a full likelihood or Jacobian, either
+// by the frequency mask of the data or by thinning to a spacing of at least
+// frequency_thin below the last frequency used
+//
+bool frequency_skipped(const DispersionData &data, int i, double frequency_thin, double last_freq)
+{
+  if (!data.selected(i)) {
+    return true;
+  }
+
+  return frequency_thin > 0.0 && last_freq > 0.0 && last_freq - data.freq[i] < frequency_thin;
+}
+
+//
+// Bessel prediction of the real spectrum at index i for wave number k. Sets
+// predicted_bessel and predicted_realspec and returns d realspec/dk.
+//
+double bessel_prediction(DispersionData &data, int i, double k)
+{
+  PerfRegion region("bessel_prediction");
+  
+  double pJ0 = gsl_sf_bessel_J0(k * data.distkm * 1.0e3);
+  double pJ1 = gsl_sf_bessel_J1(k * data.distkm * 1.0e3);
+  double pY0 = gsl_sf_bessel_Y0(k * data.distkm * 1.0e3);
+  double pY1 = gsl_sf_bessel_Y1(k * data.distkm * 1.0e3);
+      
+  data.predicted_bessel[i] = pJ0;
+  
+  double benv2 = pJ0*pJ0 + pY0*pY0;
+  double benv = sqrt(benv2);
+  double s = data.predicted_envelope[i]/benv;
+  data.predicted_realspec[i] = s * data.predicted_bessel[i];
+  
+  return data.predicted_envelope[i] *
+    (- (pJ1 * data.distkm * 1.0e3)/benv
+     + (pJ0*(pJ0*pJ1 + pY0*pY1) * data.distkm * 1.0e3)/(benv2*benv));
+}
+
+//
+// d/du of J0(u)/|H0(u)|, the normalised Bessel prediction at u = k x
+//
+double bessel_ratio_slope(double u)
+{
+  double J0 = gsl_sf_bessel_J0(u);
+  double J1 = gsl_sf_bessel_J1(u);
+  double Y0 = gsl_sf_bessel_Y0(u);
+  double Y1 = gsl_sf_bessel_Y1(u);
+
+  double benv2 = J0*J0 + Y0*Y0;
+  double benv = sqrt(benv2);
+
+  return -J1/benv + J0*(J0*J1 + Y0*Y1)/(benv2*benv);
+}
+
+//
+// d^2/du^2 of J0(u)/|H0(u)|. With E = J0^2 + Y0^2 and P = J0 J1 + Y0 Y1,
+// E' = -2P and P' = E - (J1^2 + Y1^2) - P/u.
+//
+double bessel_ratio_curvature(double u)
+{
+  double J0 = gsl_sf_bessel_J0(u);
+  double J1 = gsl_sf_bessel_J1(u);
+  double Y0 = gsl_sf_bessel_Y0(u);
+  double Y1 = gsl_sf_bessel_Y1(u);
+
+  double benv2 = J0*J0 + Y0*Y0;
+  double benv = sqrt(benv2);
+  double P = J0*J1 + Y0*Y1;
+  double dP = benv2 - (J1*J1 + Y1*Y1) - P/u;
+
+  return -(J0 - J1/u)/benv
+    - 2.0*J1*P/(benv2*benv)
+    + J0*dP/(benv2*benv)
+    + 3.0*J0*P*P/(benv2*benv2*benv);
+}
+
+//
+// Second derivative of the misfit err^2/(2 denom) at index i with respect to
+// the wave number k, (b'^2 + err b'')/denom, for the Bessel prediction b(k)
+//
+double bessel_misfit_curvature(const DispersionData &data, int i, double k, double err, double denom)
+{
+  double x = data.distkm * 1.0e3;
+  double u = k * x;
+
+  double d1 = data.predicted_envelope[i] * x * bessel_ratio_slope(u);
+  double d2 = data.predicted_envelope[i] * x * x * bessel_ratio_curvature(u);
+
+  return (d1*d1 + err*d2)/denom;
+}
+
 bool love_jacobian(DispersionData &data,
 		   model_t &model,
 		   model_t &reference,
@@ -114,11 +206,8 @@ bool love_jacobian(DispersionData &data,
   size_t ndata = 0;
   for (int i = data.flast; i >= data.ffirst; i --) {
     
-    if (frequency_thin > 0.0 && last_freq > 0.0) {
-      if (last_freq - data.freq[i] < frequency_thin) {
-	// printf("%15.9f skipped\n", data.freq[i]);
-	continue;
-      }
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
     }
     
     last_freq = data.freq[i];
@@ -130,18 +219,15 @@ bool love_jacobian(DispersionData &data,
   
   for (int i = data.flast; i >= data.ffirst; i --) {
     
-    if (frequency_thin > 0.0 && last_freq > 0.0) {
-      if (last_freq - data.freq[i] < frequency_thin) {
-	  // printf("%15.9f skipped\n", data.freq[i]);
-	continue;
-      }
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
     }
     
     last_freq = data.freq[i];
     
     if (threshold <= 0.0) {
       
-      model.project_gradient(mesh, order);
+      model.project_gradient(mesh, data.mesh_order(i, order));
       
     } else {
       printf("Unimplemented\n");
@@ -216,7 +302,7 @@ double love_bessel_compute(DispersionData &data,
 {
   if (threshold <= 0.0) {
     
-    model.project_gradient(mesh, order);
+    model.project_gradient(mesh, data.mesh_order(i, order));
     
   } else {
     printf("Unimplemented\n");
@@ -256,93 +342,84 @@ double love_bessel_compute(DispersionData &data,
   data.predicted_phase[i] = c_pred;
   data.predicted_group[i] = U_pred;
   
-  double pJ0 = gsl_sf_bessel_J0(k * data.distkm * 1.0e3);
-  double pJ1 = gsl_sf_bessel_J1(k * data.distkm * 1.0e3);
-  double pY0 = gsl_sf_bessel_Y0(k * data.distkm * 1.0e3);
-  double pY1 = gsl_sf_bessel_Y1(k * data.distkm * 1.0e3);
-      
-  data.predicted_bessel[i] = pJ0;
-  
-  double benv2 = pJ0*pJ0 + pY0*pY0;
-  double benv = sqrt(benv2);
-  double s = data.predicted_envelope[i]/benv;
-  data.predicted_realspec[i] = s * data.predicted_bessel[i];
-      
-  
-  double dpbdk = data.predicted_envelope[i] *
-    (- (pJ1 * data.distkm * 1.0e3)/benv
-     - (pJ0*(pJ0*pJ1 + pY0*pY1) * data.distkm * 1.0e3)/(benv2*benv));
-  
-  weight = dpbdk;
+  weight = bessel_prediction(data, i, k);
   
   return k;
 }
 
+//
+// Hermite interpolated predictions at i between anchors i0 and i1,
+// returning dpbdk and the weights of the Jacobian at i on the anchor dk/dp
+// (wk) and dU/dp (wU) rows.
+//
+double spline_predict(int i, int i0, int i1,
+		      DispersionData &data,
+		      double &wk0,
+		      double &wU0,
+		      double &wk1,
+		      double &wU1)
+{
+  double omega0 = data.freq[i0] * 2.0 * M_PI;
+  double omega1 = data.freq[i1] * 2.0 * M_PI;
+  double omega = data.freq[i] * 2.0 * M_PI;
+  double affine = (omega1 - omega0);
+  double t = (omega - omega0)/affine;
+  double t2 = t*t;
+  double t3 = t2*t;
+
+  /*
+   * Interpolate k/c
+   */
+  double A = 2.0*t3 - 3.0*t2 + 1.0;
+  double B = t3 - 2.0*t2 + t;
+  double C = -2.0*t3 + 3.0*t2;
+  double D = t3 - t2;
+
+  data.predicted_k[i] = A*data.predicted_k[i0] + affine*B/data.predicted_group[i0] +
+    C*data.predicted_k[i1] + affine*D/data.predicted_group[i1];
+
+  data.predicted_phase[i] = omega/data.predicted_k[i];
+
+  /*
+   * Interpolate Group
+   */
+  double dA = 6.0*t2 - 6.0*t;
+  double dB = 3.0*t2 - 4.0*t + 1.0;
+  double dC = -6.0*t2 + 6.0*t;
+  double dD = 3.0*t2 - 2.0*t;
+    
+  data.predicted_group[i] = 1.0/(dA * data.predicted_k[i0]/affine +
+				 dB/data.predicted_group[i0] +
+				 dC * data.predicted_k[i1]/affine +
+				 dD/data.predicted_group[i1]);
+
+  /*
+   * Interpolated Jacobian weights
+   */
+  double u20 = data.predicted_group[i0] * data.predicted_group[i0];
+  double u21 = data.predicted_group[i1] * data.predicted_group[i1];
+
+  wk0 = A;
+  wU0 = -affine * B/u20;
+  wk1 = C;
+  wU1 = -affine * D/u21;
+
+  /*
+   * Compute Bessel based on k
+   */
+  return bessel_prediction(data, i, data.predicted_k[i]);
+}
+
 void spline_fill(int offset, int i0, int i1,
 		 DispersionData &data,
 		 Spec1DMatrix<double> &G,
 		 Spec1DMatrix<double> &Gk,
 		 Spec1DMatrix<double> &GU)
 {
-  double omega0 = data.freq[i0] * 2.0 * M_PI;
-  double omega1 = data.freq[i1] * 2.0 * M_PI;
-  
   for (int i = i0 + 1; i < i1; i ++) {
 
-    double omega = data.freq[i] * 2.0 * M_PI;
-    double affine = (omega1 - omega0);
-    double t = (omega - omega0)/affine;
-    double t2 = t*t;
-    double t3 = t2*t;
-
-    /*
-     * Interpolate k/c
-     */
-    double A = 2.0*t3 - 3.0*t2 + 1.0;
-    double B = t3 - 2.0*t2 + t;
-    double C = -2.0*t3 + 3.0*t2;
-    double D = t3 - t2;
-
-    data.predicted_k[i] = A*data.predicted_k[i0] + affine*B/data.predicted_group[i0] +
-      C*data.predicted_k[i1] + affine*D/data.predicted_group[i1];
-
-    data.predicted_phase[i] = omega/data.predicted_k[i];
-
-    /*
-     * Interpolate Group
-     */
-    double dA = 6.0*t2 - 6.0*t;
-    double dB = 3.0*t2 - 4.0*t + 1.0;
-    double dC = -6.0*t2 + 6.0*t;
-    double dD = 3.0*t2 - 2.0*t;
-    
-    data.predicted_group[i] = 1.0/(dA * data.predicted_k[i0]/affine +
-				   dB/data.predicted_group[i0] +
-				   dC * data.predicted_k[i1]/affine +
-				   dD/data.predicted_group[i1]);
-
-    /*
-     * Compute Bessel based on k
-     */
-    double u20 = data.predicted_group[i0] * data.predicted_group[i0];
-    double u21 = data.predicted_group[i1] * data.predicted_group[i1];
-
-    double pJ0 = gsl_sf_bessel_J0(data.predicted_k[i] * data.distkm * 1.0e3);
-    double pJ1 = gsl_sf_bessel_J1(data.predicted_k[i] * data.distkm * 1.0e3);
-    double pY0 = gsl_sf_bessel_Y0(data.predicted_k[i] * data.distkm * 1.0e3);
-    double pY1 = gsl_sf_bessel_Y1(data.predicted_k[i] * data.distkm * 1.0e3);
-    
-    data.predicted_bessel[i] = pJ0;
-  
-    double benv2 = pJ0*pJ0 + pY0*pY0;
-    double benv = sqrt(benv2);
-    double s = data.predicted_envelope[i]/benv;
-    data.predicted_realspec[i] = s * data.predicted_bessel[i];
-    
-  
-    double dpbdk = data.predicted_envelope[i] *
-      (- (pJ1 * data.distkm * 1.0e3)/benv
-       - (pJ0*(pJ0*pJ1 + pY0*pY1) * data.distkm * 1.0e3)/(benv2*benv));
+    double wk0, wU0, wk1, wU1;
+    double dpbdk = spline_predict(i, i0, i1, data, wk0, wU0, wk1, wU1);
     
     /*
      * Compute Interpolated Jacobians
@@ -350,15 +427,45 @@ void spline_fill(int offset, int i0, int i1,
     int datai = i - offset;
     for (int j = 0; j < G.cols(); j ++) {
       Gk(datai, j) =
-	A * Gk(i0 - offset, j) -
-	affine * B * GU(i0 - offset, j)/u20 +
-	C * Gk(i1 - offset, j) -
-	affine * D * GU(i1 - offset, j)/u21;
+	wk0 * Gk(i0 - offset, j) +
+	wU0 * GU(i0 - offset, j) +
+	wk1 * Gk(i1 - offset, j) +
+	wU1 * GU(i1 - offset, j);
       
       G(datai, j) = dpbdk * Gk(datai, j);
     }
   }
 }
+
+//
+// As above storing only the interpolation weights on anchors a0 (at i0)
+// and a1 (at i1)
+//
+void spline_fill(int offset, int i0, int i1, int a0, int a1,
+		 DispersionData &data,
+		 FactoredJacobian &G)
+{
+  for (int i = i0 + 1; i < i1; i ++) {
+
+    double wk0, wU0, wk1, wU1;
+    double dpbdk = spline_predict(i, i0, i1, data, wk0, wU0, wk1, wU1);
+
+    G.set_interpolated(i - offset, a0, a1, dpbdk, wk0, wU0, wk1, wU1);
+  }
+}
+
+//
+// Number of anchor frequencies solved by the spline likelihoods
+//
+int spline_anchors(const DispersionData &data, int skip)
+{
+  int span = data.flast - data.ffirst;
+  int anchors = span/skip + 1;
+  if (span % skip != 0) {
+    anchors ++;
+  }
+  return anchors;
+}
 			   
 double likelihood_love_bessel_spline(DispersionData &data,
 				     model_t &model,
@@ -380,7 +487,8 @@ double likelihood_love_bessel_spline(DispersionData &data,
 				     int highorder,
 				     int boundaryorder,
 				     double scale,
-				     int skip)
+				     int skip,
+				     FactoredJacobian *factored = nullptr)
 {
   double autoscale = scale;
   bool first = true;
@@ -414,7 +522,8 @@ double likelihood_love_bessel_spline(DispersionData &data,
     // Compue every skip'th frequency
     //
     int i;
-    for (i = data.flast; i >= data.ffirst; i -= skip) {
+    int anchor = 0;
+    for (i = data.flast; i >= data.ffirst; i -= skip, anchor ++) {
 
       double weight;
       double k = love_bessel_compute(data,
@@ -436,9 +545,13 @@ double likelihood_love_bessel_spline(DispersionData &data,
       }
 
       if (first) {
-	G.resize(ndata, dkdp.rows());
-	Gk.resize(ndata, dkdp.rows());
-	GU.resize(ndata, dkdp.rows());
+	if (factored != nullptr) {
+	  factored->resize(ndata, spline_anchors(data, skip), dkdp.rows());
+	} else {
+	  G.resize(ndata, dkdp.rows());
+	  Gk.resize(ndata, dkdp.rows());
+	  GU.resize(ndata, dkdp.rows());
+	}
 	residual.resize(ndata, 1);
 	Cd.resize(ndata, 1);
       
@@ -452,12 +565,16 @@ double likelihood_love_bessel_spline(DispersionData &data,
       // residual(idata, 0) = err;
       // Cd(idata, 0) = denom;
       
-      for (int j = 0; j < dkdp.rows(); j ++) {
+      if (factored != nullptr) {
+	factored->set_anchor(idata, anchor, weight, dkdp, dUdp);
+      } else {
+	for (int j = 0; j < dkdp.rows(); j ++) {
 
-	G(idata, j) = weight * dkdp(j, 0);
+	  G(idata, j) = weight * dkdp(j, 0);
 
-	Gk(idata, j) = dkdp(j, 0);
-	GU(idata, j) = dUdp(j, 0);
+	  Gk(idata, j) = dkdp(j, 0);
+	  GU(idata, j) = dUdp(j, 0);
+	}
       }
       
       // like += L;
@@ -498,12 +615,16 @@ double likelihood_love_bessel_spline(DispersionData &data,
 	return 0.0;
       }
 	
-      for (int j = 0; j < dkdp.rows(); j ++) {
+      if (factored != nullptr) {
+	factored->set_anchor(0, anchor, weight, dkdp, dUdp);
+      } else {
+	for (int j = 0; j < dkdp.rows(); j ++) {
 
-	G(0, j) = weight * dkdp(j, 0);
+	  G(0, j) = weight * dkdp(j, 0);
 
-	Gk(0, j) = dkdp(j, 0);
-	GU(0, j) = dUdp(j, 0);
+	  Gk(0, j) = dkdp(j, 0);
+	  GU(0, j) = dUdp(j, 0);
+	}
       }
     }
 
@@ -511,14 +632,19 @@ double likelihood_love_bessel_spline(DispersionData &data,
     //
     // Fill in missing values of G matrix and predictions with cubic spline
     //
-    for (i = data.flast; i >= data.ffirst; i -= skip) {
+    anchor = 0;
+    for (i = data.flast; i >= data.ffirst; i -= skip, anchor ++) {
 
       int j = i - skip;
       if (j < data.ffirst) {
 	j = data.ffirst;
       }
 
-      spline_fill(data.ffirst, j, i, data, G, Gk, GU);
+      if (factored != nullptr) {
+	spline_fill(data.ffirst, j, i, anchor + 1, anchor, data, *factored);
+      } else {
+	spline_fill(data.ffirst, j, i, data, G, Gk, GU);
+      }
     }
 
 	
@@ -535,7 +661,13 @@ double likelihood_love_bessel_spline(DispersionData &data,
 
       int datai = i - data.ffirst;
       
-      if (i == data.flast) {
+      if (factored != nullptr) {
+
+	//
+	// Gradient formed from the anchor rows after the loop
+	//
+	
+      } else if (i == data.flast) {
 
 	for (int j = 0; j < dkdp.rows(); j ++) {
 	  dLdp(j, 0) = normed_residual * G(datai, j);
@@ -553,13 +685,23 @@ double likelihood_love_bessel_spline(DispersionData &data,
       Cd(datai, 0) = denom;
       like += L;
     }
+
+    if (factored != nullptr) {
+      dLdp.setZero();
+      factored->add_weighted_transpose(Cd, residual, dLdp);
+    }
   }
 
   return like;
     
 }
 
-
+//
+// If scales is given it holds the Laguerre scale of each frequency used,
+// recorded if empty and otherwise used in place of the scales from the
+// previous frequency, so that the discretisation is the same for nearby
+// models (see tests/check_gradients)
+//
 double likelihood_love_bessel(DispersionData &data,
 			      model_t &model,
 			      model_t &reference,
@@ -578,7 +720,9 @@ double likelihood_love_bessel(DispersionData &data,
 			      int highorder,
 			      int boundaryorder,
 			      double scale,
-			      double frequency_thin)
+			      double frequency_thin,
+			      Spec1DMatrix<double> *Gk = nullptr,
+			      std::vector<double> *scales = nullptr)
 {
   double autoscale = scale;
   bool first = true;
@@ -614,11 +758,8 @@ double likelihood_love_bessel(DispersionData &data,
     size_t ndata = 0;
     for (int i = data.flast; i >= data.ffirst; i --) {
 
-      if (frequency_thin > 0.0 && last_freq > 0.0) {
-	if (last_freq - data.freq[i] < frequency_thin) {
-	  // printf("%15.9f skipped\n", data.freq[i]);
-	  continue;
-	}
+      if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+	continue;
       }
 
       last_freq = data.freq[i];
@@ -630,18 +771,15 @@ double likelihood_love_bessel(DispersionData &data,
 
     for (int i = data.flast; i >= data.ffirst; i --) {
 
-      if (frequency_thin > 0.0 && last_freq > 0.0) {
-	if (last_freq - data.freq[i] < frequency_thin) {
-	  // printf("%15.9f skipped\n", data.freq[i]);
-	  continue;
-	}
+      if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+	continue;
       }
 
       last_freq = data.freq[i];
       
       if (threshold <= 0.0) {
 	
-        model.project_gradient(mesh, order);
+        model.project_gradient(mesh, data.mesh_order(i, order));
         
       } else {
         printf("Unimplemented\n");
@@ -653,6 +791,14 @@ double likelihood_love_bessel(DispersionData &data,
 	
       }
       
+      if (scales != nullptr) {
+	if (data_i < (int)scales->size()) {
+	  autoscale = (*scales)[data_i];
+	} else {
+	  scales->push_back(autoscale);
+	}
+      }
+      
       love.recompute(mesh, boundaryorder, autoscale);
       
       double normA, normB, normC;
@@ -677,6 +823,7 @@ double likelihood_love_bessel(DispersionData &data,
       double c_pred = omega/k;
       double U_pred = (k * normB)/(omega * normA);
 
+      data.predicted_k[i] = k;
       data.predicted_phase[i] = c_pred;
       data.predicted_group[i] = U_pred;
 
@@ -704,7 +851,7 @@ double likelihood_love_bessel(DispersionData &data,
 
       double dpbdk = data.predicted_envelope[i] *
 	(- (pJ1 * data.distkm * 1.0e3)/benv
-	 - (pJ0*(pJ0*pJ1 + pY0*pY1) * data.distkm * 1.0e3)/(benv2*benv));
+	 + (pJ0*(pJ0*pJ1 + pY0*pY1) * data.distkm * 1.0e3)/(benv2*benv));
       
       double weight = dpbdk;
       double normed_residual = err/denom;
@@ -712,6 +859,9 @@ double likelihood_love_bessel(DispersionData &data,
       if (first) {
 	G.resize(ndata, dkdp.rows());
 	residual.resize(ndata, 1);
+	if (Gk != nullptr) {
+	  Gk->resize(ndata, dkdp.rows());
+	}
 	Cd.resize(ndata, 1);
       
         dLdp.resize(dkdp.rows(), 1);
@@ -727,6 +877,11 @@ double likelihood_love_bessel(DispersionData &data,
 
 	G(data_i, j) = weight * dkdp(j, 0);
       }
+      if (Gk != nullptr) {
+	for (int j = 0; j < dkdp.rows(); j ++) {
+	  (*Gk)(data_i, j) = dkdp(j, 0);
+	}
+      }
       
       like += L;
       data_i ++;
@@ -751,6 +906,331 @@ double likelihood_love_bessel(DispersionData &data,
   return like;
 }
 
+//
+// Predictions, residuals and likelihood of likelihood_love_bessel without
+// the gradient solves (no G). dLdp, sized by an earlier full evaluation,
+// is set to the damping term only.
+//
+double likelihood_love_bessel_predict(DispersionData &data,
+				      model_t &model,
+				      model_t &reference,
+				      const double *damping,
+				      mesh_t &mesh,
+				      lovesolver_t &love,
+				      Spec1DMatrix<double> &dLdp,
+				      Spec1DMatrix<double> &residual,
+				      Spec1DMatrix<double> &Cd,
+				      double threshold,
+				      int order,
+				      int highorder,
+				      int boundaryorder,
+				      double scale,
+				      double frequency_thin)
+{
+  PerfRegion region("likelihood_love_bessel_predict");
+  
+  double autoscale = scale;
+  double like = 0.0;
+
+  double last_freq = -1.0;
+  size_t ndata = 0;
+  for (int i = data.flast; i >= data.ffirst; i --) {
+
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
+    }
+
+    last_freq = data.freq[i];
+    ndata ++;
+  }
+
+  residual.resize(ndata, 1);
+  Cd.resize(ndata, 1);
+  dLdp.setZero();
+
+  last_freq = -1.0;
+  int data_i = 0;
+
+  for (int i = data.flast; i >= data.ffirst; i --) {
+
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
+    }
+
+    last_freq = data.freq[i];
+
+    if (threshold <= 0.0) {
+      model.project_gradient(mesh, data.mesh_order(i, order));
+    } else {
+      printf("Unimplemented\n");
+      model.project_threshold(mesh,
+			      threshold,
+			      highorder,
+			      0.0,
+			      order);
+    }
+      
+    love.recompute(mesh, boundaryorder, autoscale);
+
+    double normA, normB, normC;
+    double omega = data.freq[i] * 2.0 * M_PI;
+    double k = love.solve_fundamental_sep(omega, normA, normB, normC);
+    if (k <= 0.0) {
+      fprintf(stderr, "error: failed to compute wave number (%f, %f %f %f)\n",
+	      omega,
+	      love.A(0, 0),
+	      love.B(0, 0),
+	      love.C(0, 0));
+      exit(-1);
+    }
+
+    //
+    // Group velocity from the right eigenvector (see LoveDepthPanel)
+    //
+    normA = 0.0;
+    normB = 0.0;
+    for (size_t j = 0; j < love.size; j ++) {
+      normA += love.v(j, 0) * love.A(j, j) * love.v(j, 0);
+      normB += love.v(j, 0) * love.B(j, j) * love.v(j, 0);
+    }
+
+    data.predicted_k[i] = k;
+    data.predicted_phase[i] = omega/k;
+    data.predicted_group[i] = (k * normB)/(omega * normA);
+
+    bessel_prediction(data, i, k);
+
+    double err = data.predicted_realspec[i] - data.ncfreal[i];
+    double denom = data.noise_sigma * data.noise_sigma;
+
+    residual(data_i, 0) = err;
+    Cd(data_i, 0) = denom;
+
+    like += err*err/(2.0 * denom);
+    data_i ++;
+
+    double vs2 = mesh.boundary.L/mesh.boundary.rho;
+    double disc = k*k - omega*omega/vs2;
+    if (disc > 0.0) {
+      autoscale = sqrt(disc);
+    }
+  }
+
+  likelihood_damping(model,
+		     reference,
+		     damping,
+		     dLdp,
+		     like);
+
+  return like;
+}
+
+//
+// Data misfit Hessian of a full Bessel likelihood at one model, from
+// likelihood_love_bessel_hessian_prepare or its Rayleigh counterpart. H is
+// the part that does not depend on the curvature of the projection, summed
+// over frequencies. For each frequency there is the mesh order, the weight
+// err b'/Cd of d^2k/dp^2 and the mode for the curvature term.
+//
+template
+<
+  typename state_t
+>
+class BesselHessian {
+public:
+
+  void clear()
+  {
+    H.resize(0, 0);
+    mesh_order.clear();
+    weight.clear();
+    states.clear();
+  }
+
+  Spec1DMatrix<double> H;
+  std::vector<int> mesh_order;
+  std::vector<double> weight;
+  std::vector<state_t> states;
+};
+
+typedef BesselHessian<LoveHessianState<double>> love_hessian_t;
+typedef BesselHessian<RayleighHessianState<double>> rayleigh_hessian_t;
+
+//
+// Adds the weighted Hessian of k at frequency i to hessian.H,
+//
+//   (b'^2 + err_i b'')/Cd_i dk_i/dp dk_i/dp^T + err_i b'/Cd_i K_i
+//
+// Neither term is clipped so the Hessian may be indefinite.
+//
+template
+<
+  typename state_t
+>
+void bessel_hessian_add(DispersionData &data,
+			int i,
+			int mesh_order,
+			double k,
+			const Spec1DMatrix<double> &dkdp,
+			const Spec1DMatrix<double> &K,
+			BesselHessian<state_t> &hessian)
+{
+  int nparameters = dkdp.rows();
+  Spec1DMatrix<double> &H = hessian.H;
+  if (H.rows() == 0) {
+    H.resize(nparameters, nparameters);
+    H.setZero();
+  }
+
+  double dpbdk = bessel_prediction(data, i, k);
+  double err = data.predicted_realspec[i] - data.ncfreal[i];
+  double denom = data.noise_sigma * data.noise_sigma;
+  double w = bessel_misfit_curvature(data, i, k, err, denom);
+  double a = err * dpbdk/denom;
+
+  for (int l = 0; l < nparameters; l ++) {
+    double wl = w * dkdp(l, 0);
+    for (int j = 0; j < nparameters; j ++) {
+      H(j, l) += wl * dkdp(j, 0) + a * K(j, l);
+    }
+  }
+
+  hessian.mesh_order.push_back(mesh_order);
+  hessian.weight.push_back(a);
+}
+
+//
+// Evaluates the Hessian of the data part of likelihood_love_bessel at model
+// over the same frequencies, with one eigen solve per frequency. Products
+// are then taken with likelihood_love_bessel_hessian for any number of
+// directions without further solves.
+//
+void likelihood_love_bessel_hessian_prepare(DispersionData &data,
+					    model_t &model,
+					    mesh_t &mesh,
+					    lovesolver_t &love,
+					    love_hessian_t &hessian,
+					    int order,
+					    int boundaryorder,
+					    double scale,
+					    double frequency_thin)
+{
+  PerfRegion region("likelihood_love_bessel_hessian_prepare");
+  
+  Spec1DMatrix<double> dkdp;
+  Spec1DMatrix<double> K;
+  double autoscale = scale;
+  double last_freq = -1.0;
+
+  hessian.clear();
+  
+  for (int i = data.flast; i >= data.ffirst; i --) {
+
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
+    }
+
+    last_freq = data.freq[i];
+
+    int mesh_order = data.mesh_order(i, order);
+    model.project_gradient(mesh, mesh_order);
+    
+    love.recompute(mesh, boundaryorder, autoscale);
+
+    double omega = data.freq[i] * 2.0 * M_PI;
+    hessian.states.emplace_back();
+    double k = love.solve_fundamental_hessian_prepare(mesh,
+						      boundaryorder,
+						      omega,
+						      dkdp,
+						      K,
+						      hessian.states.back());
+    if (k <= 0.0) {
+      fprintf(stderr, "error: failed to compute wave number (%f, %f %f %f)\n",
+	      omega,
+	      love.A(0, 0),
+	      love.B(0, 0),
+	      love.C(0, 0));
+      exit(-1);
+    }
+
+    bessel_hessian_add(data, i, mesh_order, k, dkdp, K, hessian);
+
+    double vs2 = mesh.boundary.L/mesh.boundary.rho;
+    double disc = k*k - omega*omega/vs2;
+    if (disc > 0.0) {
+      autoscale = sqrt(disc);
+    }
+  }
+}
+
+//
+// Product of the prepared Hessian with direction, added to Hd (sized by
+// the caller). model must be the one the Hessian was prepared at. Only the
+// curvature term depends on the direction: curvature is a second mesh for
+// the directional derivatives of the projection jacobians, projected once
+// per mesh order, and the stored modes are reused so no eigen problems are
+// solved.
+//
+template
+<
+  typename state_t,
+  typename solver_t
+>
+void likelihood_bessel_hessian_product(model_t &model,
+				       mesh_t &curvature,
+				       solver_t &solver,
+				       BesselHessian<state_t> &hessian,
+				       const Spec1DMatrix<double> &direction,
+				       Spec1DMatrix<double> &Hd,
+				       int boundaryorder)
+{
+  const Spec1DMatrix<double> &H = hessian.H;
+  int nparameters = H.rows();
+  
+  for (int j = 0; j < nparameters; j ++) {
+    double s = 0.0;
+    for (int l = 0; l < nparameters; l ++) {
+      s += H(j, l) * direction(l, 0);
+    }
+    Hd(j, 0) += s;
+  }
+
+  Spec1DMatrix<double> d2kdp;
+  int projected = -1;
+  
+  for (size_t f = 0; f < hessian.states.size(); f ++) {
+
+    if (hessian.mesh_order[f] != projected) {
+      projected = hessian.mesh_order[f];
+      model.project_hessian(curvature, projected, direction);
+    }
+
+    solver.solve_fundamental_hessian_curvature(curvature,
+					       boundaryorder,
+					       hessian.states[f],
+					       d2kdp);
+
+    double a = hessian.weight[f];
+    for (int j = 0; j < d2kdp.rows(); j ++) {
+      Hd(j, 0) += a * d2kdp(j, 0);
+    }
+  }
+}
+
+void likelihood_love_bessel_hessian(model_t &model,
+				    mesh_t &curvature,
+				    lovesolver_t &love,
+				    love_hessian_t &hessian,
+				    const Spec1DMatrix<double> &direction,
+				    Spec1DMatrix<double> &Hd,
+				    int boundaryorder)
+{
+  PerfRegion region("likelihood_love_bessel_hessian");
+
+  likelihood_bessel_hessian_product(model, curvature, love, hessian, direction, Hd, boundaryorder);
+}
+
 bool rayleigh_jacobian(DispersionData &data,
 		       model_t &model,
 		       model_t &reference,
@@ -779,11 +1259,8 @@ bool rayleigh_jacobian(DispersionData &data,
   size_t ndata = 0;
   for (int i = data.flast; i >= data.ffirst; i --) {
     
-    if (frequency_thin > 0.0 && last_freq > 0.0) {
-      if (last_freq - data.freq[i] < frequency_thin) {
-	// printf("%15.9f skipped\n", data.freq[i]);
-	continue;
-      }
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
     }
     
     last_freq = data.freq[i];
@@ -795,18 +1272,15 @@ bool rayleigh_jacobian(DispersionData &data,
   
   for (int i = data.flast; i >= data.ffirst; i --) {
     
-    if (frequency_thin > 0.0 && last_freq > 0.0) {
-      if (last_freq - data.freq[i] < frequency_thin) {
-	// printf("%15.9f skipped\n", data.freq[i]);
-	continue;
-      }
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
     }
     
     last_freq = data.freq[i];
     
     if (threshold <= 0.0) {
       
-      model.project_gradient(mesh, order);
+      model.project_gradient(mesh, data.mesh_order(i, order));
       
     } else {
       printf("Unimplemented\n");
@@ -916,7 +1390,7 @@ double rayleigh_bessel_compute(DispersionData &data,
 {
   if (threshold <= 0.0) {
     
-    model.project_gradient(mesh, order);
+    model.project_gradient(mesh, data.mesh_order(i, order));
     
   } else {
     printf("Unimplemented\n");
@@ -988,24 +1462,7 @@ double rayleigh_bessel_compute(DispersionData &data,
   data.predicted_phase[i] = c_pred;
   data.predicted_group[i] = U_pred;
   
-  double pJ0 = gsl_sf_bessel_J0(k * data.distkm * 1.0e3);
-  double pJ1 = gsl_sf_bessel_J1(k * data.distkm * 1.0e3);
-  double pY0 = gsl_sf_bessel_Y0(k * data.distkm * 1.0e3);
-  double pY1 = gsl_sf_bessel_Y1(k * data.distkm * 1.0e3);
-      
-  data.predicted_bessel[i] = pJ0;
-  
-  double benv2 = pJ0*pJ0 + pY0*pY0;
-  double benv = sqrt(benv2);
-  double s = data.predicted_envelope[i]/benv;
-  data.predicted_realspec[i] = s * data.predicted_bessel[i];
-      
-  
-  double dpbdk = data.predicted_envelope[i] *
-    (- (pJ1 * data.distkm * 1.0e3)/benv
-     - (pJ0*(pJ0*pJ1 + pY0*pY1) * data.distkm * 1.0e3)/(benv2*benv));
-  
-  weight = dpbdk;
+  weight = bessel_prediction(data, i, k);
   
   return k;
 }
@@ -1030,7 +1487,8 @@ double likelihood_rayleigh_bessel_spline(DispersionData &data,
 					 int highorder,
 					 int boundaryorder,
 					 double scale,
-					 int skip)
+					 int skip,
+					 FactoredJacobian *factored = nullptr)
 {
   double autoscale = scale;
   bool first = true;
@@ -1064,7 +1522,8 @@ double likelihood_rayleigh_bessel_spline(DispersionData &data,
     // Compue every skip'th frequency
     //
     int i;
-    for (i = data.flast; i >= data.ffirst; i -= skip) {
+    int anchor = 0;
+    for (i = data.flast; i >= data.ffirst; i -= skip, anchor ++) {
 
       double weight;
       double k = rayleigh_bessel_compute(data,
@@ -1086,9 +1545,13 @@ double likelihood_rayleigh_bessel_spline(DispersionData &data,
       }
 
       if (first) {
-	G.resize(ndata, dkdp.rows());
-	Gk.resize(ndata, dkdp.rows());
-	GU.resize(ndata, dkdp.rows());
+	if (factored != nullptr) {
+	  factored->resize(ndata, spline_anchors(data, skip), dkdp.rows());
+	} else {
+	  G.resize(ndata, dkdp.rows());
+	  Gk.resize(ndata, dkdp.rows());
+	  GU.resize(ndata, dkdp.rows());
+	}
 	residual.resize(ndata, 1);
 	Cd.resize(ndata, 1);
       
@@ -1102,12 +1565,16 @@ double likelihood_rayleigh_bessel_spline(DispersionData &data,
       // residual(idata, 0) = err;
       // Cd(idata, 0) = denom;
       
-      for (int j = 0; j < dkdp.rows(); j ++) {
+      if (factored != nullptr) {
+	factored->set_anchor(idata, anchor, weight, dkdp, dUdp);
+      } else {
+	for (int j = 0; j < dkdp.rows(); j ++) {
 
-	G(idata, j) = weight * dkdp(j, 0);
+	  G(idata, j) = weight * dkdp(j, 0);
 
-	Gk(idata, j) = dkdp(j, 0);
-	GU(idata, j) = dUdp(j, 0);
+	  Gk(idata, j) = dkdp(j, 0);
+	  GU(idata, j) = dUdp(j, 0);
+	}
       }
       
       // like += L;
@@ -1151,12 +1618,16 @@ double likelihood_rayleigh_bessel_spline(DispersionData &data,
 	return 0.0;
       }
 	
-      for (int j = 0; j < dkdp.rows(); j ++) {
+      if (factored != nullptr) {
+	factored->set_anchor(0, anchor, weight, dkdp, dUdp);
+      } else {
+	for (int j = 0; j < dkdp.rows(); j ++) {
 
-	G(0, j) = weight * dkdp(j, 0);
+	  G(0, j) = weight * dkdp(j, 0);
 
-	Gk(0, j) = dkdp(j, 0);
-	GU(0, j) = dUdp(j, 0);
+	  Gk(0, j) = dkdp(j, 0);
+	  GU(0, j) = dUdp(j, 0);
+	}
       }
     }
 
@@ -1164,14 +1635,19 @@ double likelihood_rayleigh_bessel_spline(DispersionData &data,
     //
     // Fill in missing values of G matrix and predictions with cubic spline
     //
-    for (i = data.flast; i >= data.ffirst; i -= skip) {
+    anchor = 0;
+    for (i = data.flast; i >= data.ffirst; i -= skip, anchor ++) {
 
       int j = i - skip;
       if (j < data.ffirst) {
 	j = data.ffirst;
       }
 
-      spline_fill(data.ffirst, j, i, data, G, Gk, GU);
+      if (factored != nullptr) {
+	spline_fill(data.ffirst, j, i, anchor + 1, anchor, data, *factored);
+      } else {
+	spline_fill(data.ffirst, j, i, data, G, Gk, GU);
+      }
     }
 
 	
@@ -1188,7 +1664,13 @@ double likelihood_rayleigh_bessel_spline(DispersionData &data,
 
       int datai = i - data.ffirst;
       
-      if (i == data.flast) {
+      if (factored != nullptr) {
+
+	//
+	// Gradient formed from the anchor rows after the loop
+	//
+	
+      } else if (i == data.flast) {
 
 	for (int j = 0; j < dkdp.rows(); j ++) {
 	  dLdp(j, 0) = normed_residual * G(datai, j);
@@ -1206,12 +1688,20 @@ double likelihood_rayleigh_bessel_spline(DispersionData &data,
       Cd(datai, 0) = denom;
       like += L;
     }
+
+    if (factored != nullptr) {
+      dLdp.setZero();
+      factored->add_weighted_transpose(Cd, residual, dLdp);
+    }
   }
 
   return like;
     
 }
 
+//
+// Rayleigh counterpart of likelihood_love_bessel
+//
 double likelihood_rayleigh_bessel(DispersionData &data,
 				  model_t &model,
 				  model_t &reference,
@@ -1230,7 +1720,9 @@ double likelihood_rayleigh_bessel(DispersionData &data,
 				  int highorder,
 				  int boundaryorder,
 				  double scale,
-				  double frequency_thin)
+				  double frequency_thin,
+				  Spec1DMatrix<double> *Gk = nullptr,
+				  std::vector<double> *scales = nullptr)
 {
   double autoscale = scale;
   bool first = true;
@@ -1266,11 +1758,8 @@ double likelihood_rayleigh_bessel(DispersionData &data,
     size_t ndata = 0;
     for (int i = data.flast; i >= data.ffirst; i --) {
 
-      if (frequency_thin > 0.0 && last_freq > 0.0) {
-	if (last_freq - data.freq[i] < frequency_thin) {
-	  // printf("%15.9f skipped\n", data.freq[i]);
-	  continue;
-	}
+      if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+	continue;
       }
 
       last_freq = data.freq[i];
@@ -1282,18 +1771,15 @@ double likelihood_rayleigh_bessel(DispersionData &data,
 
     for (int i = data.flast; i >= data.ffirst; i --) {
 
-      if (frequency_thin > 0.0 && last_freq > 0.0) {
-	if (last_freq - data.freq[i] < frequency_thin) {
-	  // printf("%15.9f skipped\n", data.freq[i]);
-	  continue;
-	}
+      if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+	continue;
       }
 
       last_freq = data.freq[i];
       
       if (threshold <= 0.0) {
 	
-        model.project_gradient(mesh, order);
+        model.project_gradient(mesh, data.mesh_order(i, order));
         
       } else {
         printf("Unimplemented\n");
@@ -1305,6 +1791,14 @@ double likelihood_rayleigh_bessel(DispersionData &data,
 	
       }
       
+      if (scales != nullptr) {
+	if (data_i < (int)scales->size()) {
+	  autoscale = (*scales)[data_i];
+	} else {
+	  scales->push_back(autoscale);
+	}
+      }
+      
       rayleigh.recompute(mesh, boundaryorder, autoscale, autoscale);
       
       double normA, normB, normC, normD;
@@ -1361,6 +1855,7 @@ double likelihood_rayleigh_bessel(DispersionData &data,
 	k = -k;
       }
       
+      data.predicted_k[i] = k;
       data.predicted_phase[i] = c_pred;
       data.predicted_group[i] = U_pred;
 
@@ -1385,7 +1880,7 @@ double likelihood_rayleigh_bessel(DispersionData &data,
       
       double dpbdk = data.predicted_envelope[i] *
 	(- (pJ1 * data.distkm * 1.0e3)/benv
-	 - (pJ0*(pJ0*pJ1 + pY0*pY1) * data.distkm * 1.0e3)/(benv2*benv));
+	 + (pJ0*(pJ0*pJ1 + pY0*pY1) * data.distkm * 1.0e3)/(benv2*benv));
       
       double weight = dpbdk;
       double normed_residual = err/denom;
@@ -1394,6 +1889,9 @@ double likelihood_rayleigh_bessel(DispersionData &data,
 	G.resize(ndata, dkdp.rows());
 	Cd.resize(ndata, 1);
 	residual.resize(ndata, 1);
+	if (Gk != nullptr) {
+	  Gk->resize(ndata, dkdp.rows());
+	}
 
         dLdp.resize(dkdp.rows(), 1);
         dLdp.setZero();
@@ -1407,6 +1905,11 @@ double likelihood_rayleigh_bessel(DispersionData &data,
         dLdp(j, 0) += weight * normed_residual * dkdp(j, 0);
 	G(data_i, j) = weight * dkdp(j, 0);
       }
+      if (Gk != nullptr) {
+	for (int j = 0; j < dkdp.rows(); j ++) {
+	  (*Gk)(data_i, j) = dkdp(j, 0);
+	}
+      }
       
       like += L;
       data_i ++;
@@ -1432,6 +1935,306 @@ double likelihood_rayleigh_bessel(DispersionData &data,
 }
 
 
+//
+// Predictions, residuals and likelihood of likelihood_rayleigh_bessel
+// without the gradient solves (no G). dLdp, sized by an earlier full
+// evaluation, is set to the damping term only.
+//
+double likelihood_rayleigh_bessel_predict(DispersionData &data,
+					  model_t &model,
+					  model_t &reference,
+					  const double *damping,
+					  mesh_t &mesh,
+					  rayleighsolver_t &rayleigh,
+					  Spec1DMatrix<double> &dLdp,
+					  Spec1DMatrix<double> &residual,
+					  Spec1DMatrix<double> &Cd,
+					  double threshold,
+					  int order,
+					  int highorder,
+					  int boundaryorder,
+					  double scale,
+					  double frequency_thin)
+{
+  PerfRegion region("likelihood_rayleigh_bessel_predict");
+  
+  double autoscale = scale;
+  double like = 0.0;
+
+  double last_freq = -1.0;
+  size_t ndata = 0;
+  for (int i = data.flast; i >= data.ffirst; i --) {
+
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
+    }
+
+    last_freq = data.freq[i];
+    ndata ++;
+  }
+
+  residual.resize(ndata, 1);
+  Cd.resize(ndata, 1);
+  dLdp.setZero();
+
+  last_freq = -1.0;
+  int data_i = 0;
+
+  for (int i = data.flast; i >= data.ffirst; i --) {
+
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
+    }
+
+    last_freq = data.freq[i];
+
+    if (threshold <= 0.0) {
+      model.project_gradient(mesh, data.mesh_order(i, order));
+    } else {
+      printf("Unimplemented\n");
+      model.project_threshold(mesh,
+			      threshold,
+			      highorder,
+			      0.0,
+			      order);
+    }
+      
+    rayleigh.recompute(mesh, boundaryorder, autoscale, autoscale);
+
+    double normA, normB, normC, normD, gamma, delta;
+    double omega = data.freq[i] * 2.0 * M_PI;
+    double k = rayleigh.solve_fundamental_scaled(omega, normA, normB, normC, normD, gamma, delta);
+    if (k == 0.0) {
+      fprintf(stderr, "error: failed to compute wave number (%f, %f %f %f)\n",
+	      omega,
+	      rayleigh.Ax(0, 0),
+	      rayleigh.Bx(0, 0),
+	      rayleigh.Cx(0, 0));
+      exit(-1);
+    }
+
+    //
+    // Group velocity from the right eigenvector, whose W is negated for
+    // the -k root (see RayleighDepthPanel)
+    //
+    double sw = 1.0;
+    if (k < 0.0) {
+      k = -k;
+      sw = -1.0;
+    }
+
+    size_t size = rayleigh.size;
+    normA = 0.0;
+    normB = 0.0;
+    normC = 0.0;
+    for (size_t j = 0; j < size; j ++) {
+      double vx = rayleigh.v(j, 0);
+      double vz = sw * rayleigh.v(size + j, 0);
+      
+      normA += vx * rayleigh.Ax(j, j) * vx + vz * rayleigh.Az(j, j) * vz;
+      normB += vx * rayleigh.Bx(j, j) * vx + vz * rayleigh.Bz(j, j) * vz;
+
+      double cx = 0.0;
+      double cz = 0.0;
+      for (size_t l = 0; l < size; l ++) {
+	cx += rayleigh.Cx(j, l) * sw * rayleigh.v(size + l, 0);
+	cz += rayleigh.Cz(j, l) * rayleigh.v(l, 0);
+      }
+      normC += vx * cx + vz * cz;
+    }
+
+    data.predicted_k[i] = k;
+    data.predicted_phase[i] = omega/k;
+    data.predicted_group[i] = (2.0*normB*k + normC)/(2.0*omega*normA);
+
+    bessel_prediction(data, i, k);
+
+    double err = data.predicted_realspec[i] - data.ncfreal[i];
+    double denom = data.noise_sigma * data.noise_sigma;
+
+    residual(data_i, 0) = err;
+    Cd(data_i, 0) = denom;
+
+    like += err*err/(2.0 * denom);
+    data_i ++;
+
+    double vp2 = mesh.boundary.A/mesh.boundary.rho;
+    double disc = k*k - omega*omega/vp2;
+    if (disc > 0.0) {
+      autoscale = sqrt(disc);
+    }
+  }
+
+  likelihood_damping(model,
+		     reference,
+		     damping,
+		     dLdp,
+		     like);
+
+  return like;
+}
+
+
+//
+// Rayleigh counterparts of likelihood_love_bessel_hessian_prepare and
+// likelihood_love_bessel_hessian for likelihood_rayleigh_bessel
+//
+void likelihood_rayleigh_bessel_hessian_prepare(DispersionData &data,
+						model_t &model,
+						mesh_t &mesh,
+						rayleighsolver_t &rayleigh,
+						rayleigh_hessian_t &hessian,
+						int order,
+						int boundaryorder,
+						double scale,
+						double frequency_thin)
+{
+  PerfRegion region("likelihood_rayleigh_bessel_hessian_prepare");
+  
+  Spec1DMatrix<double> dkdp;
+  Spec1DMatrix<double> K;
+  double autoscale = scale;
+  double last_freq = -1.0;
+
+  hessian.clear();
+  
+  for (int i = data.flast; i >= data.ffirst; i --) {
+
+    if (frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
+    }
+
+    last_freq = data.freq[i];
+
+    int mesh_order = data.mesh_order(i, order);
+    model.project_gradient(mesh, mesh_order);
+    
+    rayleigh.recompute(mesh, boundaryorder, autoscale, autoscale);
+
+    double omega = data.freq[i] * 2.0 * M_PI;
+    hessian.states.emplace_back();
+    double k = rayleigh.solve_fundamental_hessian_prepare(mesh,
+							  boundaryorder,
+							  omega,
+							  dkdp,
+							  K,
+							  hessian.states.back());
+    if (k == 0.0) {
+      fprintf(stderr, "error: failed to compute wave number (%f, %f %f %f)\n",
+	      omega,
+	      rayleigh.Ax(0, 0),
+	      rayleigh.Bx(0, 0),
+	      rayleigh.Cx(0, 0));
+      exit(-1);
+    }
+
+    bessel_hessian_add(data, i, mesh_order, k, dkdp, K, hessian);
+
+    double vp2 = mesh.boundary.A/mesh.boundary.rho;
+    double disc = k*k - omega*omega/vp2;
+    if (disc > 0.0) {
+      autoscale = sqrt(disc);
+    }
+  }
+}
+
+void likelihood_rayleigh_bessel_hessian(model_t &model,
+					mesh_t &curvature,
+					rayleighsolver_t &rayleigh,
+					rayleigh_hessian_t &hessian,
+					const Spec1DMatrix<double> &direction,
+					Spec1DMatrix<double> &Hd,
+					int boundaryorder)
+{
+  PerfRegion region("likelihood_rayleigh_bessel_hessian");
+
+  likelihood_bessel_hessian_product(model, curvature, rayleigh, hessian, direction, Hd, boundaryorder);
+}
+
+//
+// Likelihood of the band from stored predictions and dk/dp (Gk, one row per
+// frequency from ffirst, see WaveState) of the same model. Only the Bessel
+// weights depend on the data, so this rebuilds G, residuals and dL/dp for a
+// new spectrum without any forward solves. For skip > 1 the rows are those
+// of the spline likelihoods, otherwise those of the full likelihoods: from
+// flast down without the thinned or unselected frequencies, with their
+// damping of model towards reference.
+//
+double likelihood_bessel_reuse(DispersionData &data,
+			       model_t &model,
+			       model_t &reference,
+			       const double *damping,
+			       const Spec1DMatrix<double> &Gk,
+			       Spec1DMatrix<double> &dLdp,
+			       Spec1DMatrix<double> &G,
+			       Spec1DMatrix<double> &residual,
+			       Spec1DMatrix<double> &Cd,
+			       int skip,
+			       double frequency_thin)
+{
+  bool full = skip <= 1;
+  int nparam = Gk.cols();
+  double like = 0.0;
+
+  size_t ndata = 0;
+  double last_freq = -1.0;
+  for (int i = data.flast; i >= data.ffirst; i --) {
+    
+    if (full && frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
+    }
+    
+    last_freq = data.freq[i];
+    ndata ++;
+  }
+  
+  G.resize(ndata, nparam);
+  residual.resize(ndata, 1);
+  Cd.resize(ndata, 1);
+  dLdp.resize(nparam, 1);
+  dLdp.setZero();
+
+  last_freq = -1.0;
+  int data_i = 0;
+  
+  for (int i = data.flast; i >= data.ffirst; i --) {
+
+    if (full && frequency_skipped(data, i, frequency_thin, last_freq)) {
+      continue;
+    }
+
+    last_freq = data.freq[i];
+
+    int gki = i - data.ffirst;
+    int datai = full ? data_i : gki;
+    double dpbdk = bessel_prediction(data, i, data.predicted_k[i]);
+
+    double err = data.predicted_realspec[i] - data.ncfreal[i];
+    double denom = data.noise_sigma * data.noise_sigma;
+    double normed_residual = err/denom;
+
+    for (int j = 0; j < nparam; j ++) {
+      G(datai, j) = dpbdk * Gk(gki, j);
+      dLdp(j, 0) += normed_residual * G(datai, j);
+    }
+
+    residual(datai, 0) = err;
+    Cd(datai, 0) = denom;
+    like += err*err/(2.0 * denom);
+    data_i ++;
+  }
+
+  if (full) {
+    likelihood_damping(model,
+		       reference,
+		       damping,
+		       dLdp,
+		       like);
+  }
+
+  return like;
+}
+
 #endif // likelihood_hpp
 
 
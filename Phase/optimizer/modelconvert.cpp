@@ -0,0 +1,151 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#include <stdio.h>
+#include <getopt.h>
+
+#include "common.hpp"
+#include "reference.hpp"
+
+static char short_options[] = "i:o:bth";
+static struct option long_options[] = {
+  {"input", required_argument, 0, 'i'},
+  {"output", required_argument, 0, 'o'},
+
+  {"binary", no_argument, 0, 'b'},
+  {"text", no_argument, 0, 't'},
+  
+  {"help", no_argument, 0, 'h'},
+  
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *pname);
+
+int main(int argc, char *argv[])
+{
+  int c;
+  int option_index;
+
+  char *input_file;
+  char *output_file;
+
+  int format;
+
+  input_file = nullptr;
+  output_file = nullptr;
+
+  //
+  // -1 : opposite of the input format, 0 : text, 1 : binary
+  //
+  format = -1;
+  
+  option_index = 0;
+  while (true) {
+
+    c = getopt_long(argc, argv, short_options, long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+
+    case 'i':
+      input_file = optarg;
+      break;
+
+    case 'o':
+      output_file = optarg;
+      break;
+
+    case 'b':
+      format = 1;
+      break;
+
+    case 't':
+      format = 0;
+      break;
+
+    default:
+      fprintf(stderr, "unknown option %c\n", c);
+    case 'h':
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (input_file == nullptr) {
+    fprintf(stderr, "error: missing input file parameter\n");
+    return -1;
+  }
+
+  if (output_file == nullptr) {
+    fprintf(stderr, "error: missing output file parameter\n");
+    return -1;
+  }
+
+  if (format < 0) {
+    format = snapshot_t::is_snapshot(input_file) ? 0 : 1;
+  }
+
+  ReferenceModel reference;
+
+  if (!reference.load_model(input_file)) {
+    fprintf(stderr, "error: failed to load model from %s\n", input_file);
+    return -1;
+  }
+
+  if (format == 1) {
+    if (!snapshot_t::save(reference.model, output_file)) {
+      fprintf(stderr, "error: failed to save model snapshot\n");
+      return -1;
+    }
+  } else {
+    if (!reference.model.save(output_file)) {
+      fprintf(stderr, "error: failed to save model\n");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void usage(const char *pname)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "where options is one or more of:\n"
+          "\n"
+          " -i|--input <filename>           Input text or binary model (required)\n"
+          " -o|--output <filename>          Output model (required)\n"
+          "\n"
+          " -b|--binary                     Write a binary snapshot\n"
+          " -t|--text                       Write a text model\n"
+          "\n"
+          " The default is to convert to the opposite format of the input.\n"
+          "\n"
+          " -h|--help                       Show usage information\n"
+          "\n",
+          pname);
+}
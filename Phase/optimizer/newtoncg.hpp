@@ -0,0 +1,418 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef newtoncg_hpp
+#define newtoncg_hpp
+
+#include <vector>
+
+#include <math.h>
+
+#include "common.hpp"
+
+//
+// Product of the data part of the misfit Hessian with a vector. The Hessian
+// of k itself is needed so this is supplied by the optimizer owning the
+// models, meshes and solvers at the current model.
+//
+class HessianOperator {
+public:
+
+  virtual ~HessianOperator()
+  {
+  }
+
+  //
+  // Evaluates whatever the products need at the current model, once per
+  // step before any products
+  //
+  virtual void prepare() = 0;
+
+  //
+  // y = H_D x
+  //
+  virtual void product(const Spec1DMatrix<double> &x, Spec1DMatrix<double> &y) = 0;
+};
+
+//
+// Truncated Newton step. The step p approximately solves H p = -g with
+//
+//   g = G^T C_D^-1 r + C_M^-1 (m_n - m_0)
+//   H = H_D + C_M^-1
+//
+// by conjugate gradients using only products H v. H_D is the exact Hessian
+// of the data misfit from the HessianOperator, including the second
+// derivatives of the Bessel prediction and of k, so it is indefinite away
+// from the minimum. CG is preconditioned with the Gauss-Newton matrix
+//
+//   A = G^T C_D^-1 G + C_M^-1
+//
+// of the quasi-Newton step, so its first iterate is along the quasi-Newton
+// direction and later ones correct it with the second order terms. CG stops
+// at the forcing tolerance or on a direction of negative curvature, in which
+// case the step so far is taken, or on the first iteration the quasi-Newton
+// step -A^-1 g. The proposed model is m_n + epsilon p.
+//
+class NewtonCG : public LeastSquaresIterator {
+public:
+
+  //
+  // CG stops when the residual of H p = -g falls below FORCING |g|
+  //
+  static constexpr double FORCING = 0.1;
+
+  NewtonCG(HessianOperator &_hessian,
+	   int _iterations) :
+    hessian(_hessian),
+    iterations(_iterations)
+  {
+  }
+
+  virtual bool ComputeStep(double epsilon,
+			   Spec1DMatrix<double> &C_d,
+			   Spec1DMatrix<double> &C_m,
+			   Spec1DMatrix<double> &residuals,
+			   Spec1DMatrix<double> &G,
+			   Spec1DMatrix<double> &dLdp,
+			   Spec1DMatrix<int> &model_mask,
+			   Spec1DMatrix<double> &current_model,
+			   Spec1DMatrix<double> &prior_model,
+			   Spec1DMatrix<double> &proposed_model)
+  {
+    block b[1] = {{&C_d, &residuals, &G, nullptr}};
+
+    return step(epsilon, 1, b, C_m, current_model, prior_model, proposed_model);
+  }
+
+  virtual bool ComputeStepJoint(double epsilon,
+				Spec1DMatrix<double> &C_d_love,
+				Spec1DMatrix<double> &C_d_rayleigh,
+				Spec1DMatrix<double> &C_m,
+				Spec1DMatrix<double> &residuals_love,
+				Spec1DMatrix<double> &residuals_rayleigh,
+				Spec1DMatrix<double> &G_love,
+				Spec1DMatrix<double> &G_rayleigh,
+				Spec1DMatrix<double> &dLdp,
+				Spec1DMatrix<int> &model_mask,
+				Spec1DMatrix<double> &current_model,
+				Spec1DMatrix<double> &prior_model,
+				Spec1DMatrix<double> &proposed_model)
+  {
+    block b[2] = {
+      {&C_d_love, &residuals_love, &G_love, nullptr},
+      {&C_d_rayleigh, &residuals_rayleigh, &G_rayleigh, nullptr}
+    };
+
+    return step(epsilon, 2, b, C_m, current_model, prior_model, proposed_model);
+  }
+
+  //
+  // The gradient only needs G^T u so the compressed forms are used directly
+  //
+  virtual bool ComputeStepJointCompressed(double epsilon,
+					  Spec1DMatrix<double> &C_d_love,
+					  Spec1DMatrix<double> &C_d_rayleigh,
+					  Spec1DMatrix<double> &C_m,
+					  Spec1DMatrix<double> &residuals_love,
+					  Spec1DMatrix<double> &residuals_rayleigh,
+					  const JacobianOperator &G_love,
+					  const JacobianOperator &G_rayleigh,
+					  Spec1DMatrix<double> &dLdp,
+					  Spec1DMatrix<int> &model_mask,
+					  Spec1DMatrix<double> &current_model,
+					  Spec1DMatrix<double> &prior_model,
+					  Spec1DMatrix<double> &proposed_model)
+  {
+    block b[2] = {
+      {&C_d_love, &residuals_love, nullptr, &G_love},
+      {&C_d_rayleigh, &residuals_rayleigh, nullptr, &G_rayleigh}
+    };
+
+    return step(epsilon, 2, b, C_m, current_model, prior_model, proposed_model);
+  }
+
+private:
+
+  struct block {
+    const Spec1DMatrix<double> *Cd;
+    const Spec1DMatrix<double> *r;
+    const Spec1DMatrix<double> *G;
+    const JacobianOperator *J;
+  };
+
+  bool step(double epsilon,
+	    int nblocks,
+	    block *blocks,
+	    const Spec1DMatrix<double> &C_m,
+	    const Spec1DMatrix<double> &current_model,
+	    const Spec1DMatrix<double> &prior_model,
+	    Spec1DMatrix<double> &proposed_model)
+  {
+    PerfRegion region("NewtonCG::step");
+
+    int Nm = current_model.rows();
+
+    //
+    // Gradient g = G^T C_D^-1 r + C_M^-1 (m_n - m_0)
+    //
+    g.resize(Nm, 1);
+    for (int j = 0; j < Nm; j ++) {
+      g(j, 0) = (current_model(j, 0) - prior_model(j, 0))/C_m(j, 0);
+    }
+
+    for (int b = 0; b < nblocks; b ++) {
+      const block &blk = blocks[b];
+      if (blk.G != nullptr) {
+	const Spec1DMatrix<double> &G = *blk.G;
+	for (int i = 0; i < G.rows(); i ++) {
+	  double w = (*blk.r)(i, 0)/(*blk.Cd)(i, 0);
+	  for (int j = 0; j < Nm; j ++) {
+	    g(j, 0) += G(i, j) * w;
+	  }
+	}
+      } else {
+	blk.J->add_weighted_transpose(*blk.Cd, *blk.r, g);
+      }
+    }
+
+    double gnorm = norm(g);
+    if (gnorm == 0.0) {
+      proposed_model = current_model;
+      return true;
+    }
+
+    //
+    // p does not depend on epsilon, so the retries after a prior violation
+    // or a backtrack from the same model and gradient reuse it rather than
+    // repeating the Hessian products
+    //
+    if (!same(current_model, last_model) || !same(g, last_g)) {
+      if (!precondition(nblocks, blocks, C_m)) {
+	return false;
+      }
+      solve(C_m, gnorm);
+      last_model = current_model;
+      last_g = g;
+    }
+
+    for (int j = 0; j < Nm; j ++) {
+      proposed_model(j, 0) = current_model(j, 0) + epsilon * p[j];
+    }
+
+    return true;
+  }
+
+  //
+  // Upper Cholesky factor of the Gauss-Newton matrix A
+  //
+  bool precondition(int nblocks,
+		    block *blocks,
+		    const Spec1DMatrix<double> &C_m)
+  {
+    int Nm = C_m.rows();
+
+    A.resize(Nm, Nm);
+    A.setZero();
+    for (int j = 0; j < Nm; j ++) {
+      A(j, j) = 1.0/C_m(j, 0);
+    }
+
+    for (int b = 0; b < nblocks; b ++) {
+      const block &blk = blocks[b];
+      if (blk.G != nullptr) {
+	const Spec1DMatrix<double> &G = *blk.G;
+	for (int i = 0; i < G.rows(); i ++) {
+	  double w = 1.0/(*blk.Cd)(i, 0);
+	  for (int l = 0; l < Nm; l ++) {
+	    double gl = w * G(i, l);
+	    for (int j = 0; j <= l; j ++) {
+	      A(j, l) += G(i, j) * gl;
+	    }
+	  }
+	}
+      } else {
+	blk.J->add_normal(*blk.Cd, A);
+      }
+    }
+
+    if (!upper_cholesky(A, Nm)) {
+      fprintf(stderr, "error: Gauss-Newton matrix is not positive definite\n");
+      return false;
+    }
+
+    return true;
+  }
+
+  //
+  // Truncated preconditioned CG on H p = -g from p = 0
+  //
+  void solve(const Spec1DMatrix<double> &C_m, double gnorm)
+  {
+    int Nm = g.rows();
+    double tolerance = FORCING * gnorm;
+
+    hessian.prepare();
+
+    p.assign(Nm, 0.0);
+    res.resize(Nm, 1);
+    d.resize(Nm, 1);
+    z.resize(Nm);
+    for (int j = 0; j < Nm; j ++) {
+      res(j, 0) = -g(j, 0);
+    }
+
+    double rz = apply_preconditioner();
+    for (int j = 0; j < Nm; j ++) {
+      d(j, 0) = z[j];
+    }
+
+    int k = 0;
+    bool negative = false;
+
+    for (; k < iterations; k ++) {
+
+      hessian_product(C_m, d, Hd);
+
+      double dHd = 0.0;
+      for (int j = 0; j < Nm; j ++) {
+	dHd += d(j, 0) * Hd(j, 0);
+      }
+
+      if (dHd <= 0.0) {
+	negative = true;
+	if (k == 0) {
+	  //
+	  // Quasi-Newton step, d = -A^-1 g
+	  //
+	  for (int j = 0; j < Nm; j ++) {
+	    p[j] = d(j, 0);
+	  }
+	}
+	break;
+      }
+
+      double alpha = rz/dHd;
+      double rr_next = 0.0;
+      for (int j = 0; j < Nm; j ++) {
+	p[j] += alpha * d(j, 0);
+	res(j, 0) -= alpha * Hd(j, 0);
+	rr_next += res(j, 0) * res(j, 0);
+      }
+
+      if (sqrt(rr_next) < tolerance) {
+	k ++;
+	break;
+      }
+
+      double rz_next = apply_preconditioner();
+      double beta = rz_next/rz;
+      for (int j = 0; j < Nm; j ++) {
+	d(j, 0) = z[j] + beta * d(j, 0);
+      }
+      rz = rz_next;
+    }
+
+    if (negative && k == 0) {
+      printf("NewtonCG: negative curvature, quasi-Newton step\n");
+    } else {
+      printf("NewtonCG: %d iterations%s\n", k, negative ? " (negative curvature)" : "");
+    }
+  }
+
+  //
+  // z = A^-1 res, returning res^T z
+  //
+  double apply_preconditioner()
+  {
+    int Nm = res.rows();
+    for (int j = 0; j < Nm; j ++) {
+      z[j] = res(j, 0);
+    }
+
+    upper_cholesky_solve_RT(A, z);
+    upper_cholesky_solve_R(A, z);
+
+    double rz = 0.0;
+    for (int j = 0; j < Nm; j ++) {
+      rz += res(j, 0) * z[j];
+    }
+    return rz;
+  }
+
+  //
+  // y = (H_D + C_M^-1) x
+  //
+  void hessian_product(const Spec1DMatrix<double> &C_m,
+		       const Spec1DMatrix<double> &x,
+		       Spec1DMatrix<double> &y)
+  {
+    int Nm = x.rows();
+
+    y.resize(Nm, 1);
+    y.setZero();
+    hessian.product(x, y);
+    
+    for (int j = 0; j < Nm; j ++) {
+      y(j, 0) += x(j, 0)/C_m(j, 0);
+    }
+  }
+
+  static bool same(const Spec1DMatrix<double> &a, const Spec1DMatrix<double> &b)
+  {
+    if (a.rows() != b.rows()) {
+      return false;
+    }
+    for (int j = 0; j < a.rows(); j ++) {
+      if (a(j, 0) != b(j, 0)) {
+	return false;
+      }
+    }
+    return true;
+  }
+
+  static double norm(const Spec1DMatrix<double> &x)
+  {
+    double s = 0.0;
+    for (int j = 0; j < x.rows(); j ++) {
+      s += x(j, 0) * x(j, 0);
+    }
+    return sqrt(s);
+  }
+
+  HessianOperator &hessian;
+  int iterations;
+
+  Spec1DMatrix<double> g;
+  Spec1DMatrix<double> res;
+  Spec1DMatrix<double> d;
+  Spec1DMatrix<double> Hd;
+  Spec1DMatrix<double> A;
+  std::vector<double> z;
+  Spec1DMatrix<double> last_model;
+  Spec1DMatrix<double> last_g;
+  std::vector<double> p;
+};
+
+#endif // newtoncg_hpp
@@ -22,17 +22,27 @@
 //
 //
 
+#include <atomic>
 #include <exception>
+#include <thread>
+#include <vector>
 
 #include <stdio.h>
 #include <getopt.h>
 
 #include "likelihood.hpp"
+#include "incremental.hpp"
+#include "frequencyselection.hpp"
+#include "autodiscretization.hpp"
+#include "broyden.hpp"
+#include "ensemble.hpp"
 
 #include "simple.hpp"
 #include "quasinewton.hpp"
+#include "sketched.hpp"
+#include "newtoncg.hpp"
 
-static char short_options[] = "i:I:r:Jf:F:R:V:X:S:o:s:p:b:t:P:e:N:QG:M:W:T:h";
+static char short_options[] = "i:I:r:Jf:F:R:V:X:S:o:s:p:b:t:P:e:N:QG:M:W:T:C:U:Y:K:Z:A:L:c:H:n:E:a:B:k:x:j:h";
 static struct option long_options[] = {
   {"input-love", required_argument, 0, 'i'},
   {"input-rayleigh", required_argument, 0, 'I'},
@@ -65,8 +75,29 @@ static struct option long_options[] = {
   
   {"gaussian-smooth", required_argument, 0, 'G'},
   {"mode", required_argument, 0, 'M'},
+  {"sketch-factor", required_argument, 0, 'A'},
+  {"lsqr-iterations", required_argument, 0, 'L'},
+  {"cg-iterations", required_argument, 0, 'c'},
+
+  {"cache", required_argument, 0, 'C'},
+  {"counters", required_argument, 0, 'H'},
+
+  {"previous", required_argument, 0, 'U'},
+  {"change-threshold", required_argument, 0, 'Y'},
+  {"max-updates", required_argument, 0, 'K'},
+
+  {"compress", required_argument, 0, 'Z'},
 
   {"skip", required_argument, 0, 'T'},
+
+  {"frequency-thin", required_argument, 0, 'n'},
+  {"select-information", required_argument, 0, 'E'},
+  {"auto-order", required_argument, 0, 'a'},
+  {"broyden", required_argument, 0, 'B'},
+
+  {"ensemble", required_argument, 0, 'k'},
+  {"ensemble-seed", required_argument, 0, 'x'},
+  {"ensemble-threads", required_argument, 0, 'j'},
   
   {"help", no_argument, 0, 'h'},
   
@@ -74,6 +105,120 @@ static struct option long_options[] = {
 };
 
 static void usage(const char *pname);
+//
+// Data misfit Hessian products of the full Love and Rayleigh likelihoods
+// for the Newton-CG step. prepare evaluates the Hessians at the current
+// model with the same threading and model copy as the likelihoods, after
+// which products reuse the stored modes. The curvature meshes hold the
+// directional derivatives of the projection.
+//
+class JointHessian : public HessianOperator {
+public:
+
+  JointHessian(DispersionData &_data_love,
+	       DispersionData &_data_rayleigh,
+	       model_t &_model,
+	       model_t &_model_rayleigh,
+	       mesh_t &_mesh,
+	       mesh_t &_mesh_rayleigh,
+	       lovesolver_t &_love,
+	       rayleighsolver_t &_rayleigh,
+	       int _order,
+	       int _boundaryorder,
+	       double _scale,
+	       double _frequency_thin) :
+    data_love(_data_love),
+    data_rayleigh(_data_rayleigh),
+    model(_model),
+    model_rayleigh(_model_rayleigh),
+    mesh(_mesh),
+    mesh_rayleigh(_mesh_rayleigh),
+    love(_love),
+    rayleigh(_rayleigh),
+    order(_order),
+    boundaryorder(_boundaryorder),
+    scale(_scale),
+    frequency_thin(_frequency_thin)
+  {
+  }
+
+  virtual void prepare()
+  {
+    model_rayleigh = model;
+    std::thread rayleigh_task([&]() {
+	likelihood_rayleigh_bessel_hessian_prepare(data_rayleigh,
+						   model_rayleigh,
+						   mesh_rayleigh,
+						   rayleigh,
+						   hessian_rayleigh,
+						   order,
+						   boundaryorder,
+						   scale,
+						   frequency_thin);
+      });
+
+    likelihood_love_bessel_hessian_prepare(data_love,
+					   model,
+					   mesh,
+					   love,
+					   hessian_love,
+					   order,
+					   boundaryorder,
+					   scale,
+					   frequency_thin);
+    rayleigh_task.join();
+  }
+
+  virtual void product(const Spec1DMatrix<double> &x, Spec1DMatrix<double> &y)
+  {
+    Hx_rayleigh.resize(x.rows(), 1);
+    Hx_rayleigh.setZero();
+    
+    std::thread rayleigh_task([&]() {
+	likelihood_rayleigh_bessel_hessian(model_rayleigh,
+					   curvature_rayleigh,
+					   rayleigh,
+					   hessian_rayleigh,
+					   x,
+					   Hx_rayleigh,
+					   boundaryorder);
+      });
+
+    likelihood_love_bessel_hessian(model,
+				   curvature_love,
+				   love,
+				   hessian_love,
+				   x,
+				   y,
+				   boundaryorder);
+    rayleigh_task.join();
+
+    for (int j = 0; j < y.rows(); j ++) {
+      y(j, 0) += Hx_rayleigh(j, 0);
+    }
+  }
+
+private:
+
+  DispersionData &data_love;
+  DispersionData &data_rayleigh;
+  model_t &model;
+  model_t &model_rayleigh;
+  mesh_t &mesh;
+  mesh_t &mesh_rayleigh;
+  lovesolver_t &love;
+  rayleighsolver_t &rayleigh;
+  int order;
+  int boundaryorder;
+  double scale;
+  double frequency_thin;
+
+  mesh_t curvature_love;
+  mesh_t curvature_rayleigh;
+  love_hessian_t hessian_love;
+  rayleigh_hessian_t hessian_rayleigh;
+  Spec1DMatrix<double> Hx_rayleigh;
+};
 
 static bool invert(DispersionData &data_love,
 		   DispersionData &data_rayleigh,
@@ -93,9 +238,17 @@ static bool invert(DispersionData &data_love,
                    int maxiterations,
 		   const char *outputprefix,
 		   bool jacobians,
-		   double gaussian_smooth,
 		   int mode,
-		   int skip);
+		   int sketch_factor,
+		   int lsqr_iterations,
+		   int cg_iterations,
+		   int skip,
+		   double compress_tolerance,
+		   double frequency_thin,
+		   double select_fraction,
+		   double auto_tolerance,
+		   int broyden,
+		   IncrementalState *state);
 
 int main(int argc, char *argv[])
 {
@@ -107,6 +260,8 @@ int main(int argc, char *argv[])
   
   char *reference_file;
   char *output_file;
+  char *cache_directory;
+  char *counters_file;
   double threshold;
   int order;
   int highorder;
@@ -131,6 +286,27 @@ int main(int argc, char *argv[])
   int mode;
   int skip;
 
+  int sketch_factor;
+  int lsqr_iterations;
+  int cg_iterations;
+
+  char *previous_prefix;
+  double change_threshold;
+  int max_updates;
+
+  double compress_tolerance;
+
+  double frequency_thin;
+  double select_fraction;
+
+  double auto_tolerance;
+
+  int broyden;
+
+  int ensemble;
+  unsigned int ensemble_seed;
+  int ensemble_threads;
+
   //
   // Defaults
   //
@@ -138,6 +314,8 @@ int main(int argc, char *argv[])
   input_rayleigh = nullptr;
   reference_file = nullptr;
   output_file = nullptr;
+  cache_directory = nullptr;
+  counters_file = nullptr;
   threshold = 0.0;
 
   order = 5;
@@ -167,6 +345,30 @@ int main(int argc, char *argv[])
 
   mode = 0;
   skip = 0;
+
+  sketch_factor = 4;
+  lsqr_iterations = 0;
+  cg_iterations = 20;
+
+  previous_prefix = nullptr;
+  change_threshold = 1.0e-3;
+  max_updates = 3;
+
+  compress_tolerance = 0.0;
+
+  frequency_thin = 0.0;
+  select_fraction = 0.0;
+
+  auto_tolerance = 0.0;
+
+  broyden = 0;
+
+  ensemble = 0;
+  ensemble_seed = 983;
+  ensemble_threads = std::thread::hardware_concurrency()/2;
+  if (ensemble_threads < 1) {
+    ensemble_threads = 1;
+  }
   
   //
   // Command line parameters
@@ -315,8 +517,69 @@ int main(int argc, char *argv[])
 
     case 'M':
       mode = atoi(optarg);
-      if (mode < 0 || mode > 1) {
-	fprintf(stderr, "error: mode must be 0 (simple gradient desc.) or 1 (q-newton)\n");
+      if (mode < 0 || mode > 3) {
+	fprintf(stderr, "error: mode must be 0 (simple gradient desc.), 1 (q-newton), 2 (sketched q-newton) or 3 (newton-cg)\n");
+	return -1;
+      }
+      break;
+
+    case 'A':
+      sketch_factor = atoi(optarg);
+      if (sketch_factor < 2) {
+	fprintf(stderr, "error: sketch factor must be 2 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'L':
+      lsqr_iterations = atoi(optarg);
+      if (lsqr_iterations < 0) {
+	fprintf(stderr, "error: lsqr iterations must be 0 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'c':
+      cg_iterations = atoi(optarg);
+      if (cg_iterations < 1) {
+	fprintf(stderr, "error: cg iterations must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'C':
+      cache_directory = optarg;
+      break;
+
+    case 'H':
+      counters_file = optarg;
+      PerfCounters::enable();
+      break;
+
+    case 'U':
+      previous_prefix = optarg;
+      break;
+
+    case 'Y':
+      change_threshold = atof(optarg);
+      if (change_threshold < 0.0) {
+	fprintf(stderr, "error: change threshold must be 0 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'K':
+      max_updates = atoi(optarg);
+      if (max_updates < 1) {
+	fprintf(stderr, "error: need at least one update iteration\n");
+	return -1;
+      }
+      break;
+
+    case 'Z':
+      compress_tolerance = atof(optarg);
+      if (compress_tolerance < 0.0 || compress_tolerance >= 1.0) {
+	fprintf(stderr, "error: compression tolerance must be in [0, 1)\n");
 	return -1;
       }
       break;
@@ -329,6 +592,58 @@ int main(int argc, char *argv[])
       }
       break;
 
+    case 'n':
+      frequency_thin = atof(optarg);
+      if (frequency_thin < 0.0) {
+	fprintf(stderr, "error: frequency thin must be 0 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'E':
+      select_fraction = atof(optarg);
+      if (select_fraction < 0.0 || select_fraction > 1.0) {
+	fprintf(stderr, "error: selected information fraction must be in [0, 1]\n");
+	return -1;
+      }
+      break;
+
+    case 'a':
+      auto_tolerance = atof(optarg);
+      if (auto_tolerance < 0.0) {
+	fprintf(stderr, "error: automatic order tolerance must be 0 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'B':
+      broyden = atoi(optarg);
+      if (broyden < 0 || broyden == 1) {
+	fprintf(stderr, "error: broyden interval must be 0 (off) or 2 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'k':
+      ensemble = atoi(optarg);
+      if (ensemble < 0 || ensemble == 1) {
+	fprintf(stderr, "error: ensemble size must be 0 (off) or 2 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'x':
+      ensemble_seed = atoi(optarg);
+      break;
+
+    case 'j':
+      ensemble_threads = atoi(optarg);
+      if (ensemble_threads < 1) {
+	fprintf(stderr, "error: ensemble threads must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
     default:
       fprintf(stderr, "unknown option %c\n", c);
     case 'h':
@@ -357,8 +672,31 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  if ((frequency_thin > 0.0 || select_fraction > 0.0) && skip > 1) {
+    fprintf(stderr, "error: frequency thinning and selection require the full likelihood (skip 0 or 1)\n");
+    return -1;
+  }
+
+  if (broyden > 0 && (skip > 1 || compress_tolerance > 0.0 || select_fraction > 0.0)) {
+    fprintf(stderr, "error: broyden updates require the dense full likelihood (skip 0 or 1, no compression or selection)\n");
+    return -1;
+  }
+
+  if (mode == 3 && skip > 1) {
+    fprintf(stderr, "error: newton-cg requires the full likelihood (skip 0 or 1)\n");
+    return -1;
+  }
+
+  if (auto_tolerance > 0.0 && (highorder < order || highorder >= MAXORDER)) {
+    fprintf(stderr, "error: automatic orders require order <= high order < %d\n", MAXORDER);
+    return -1;
+  }
+
   DispersionData data_love(fmin, fmax);
   DispersionData data_rayleigh(fmin, fmax);
+
+  data_love.cache_directory = cache_directory;
+  data_rayleigh.cache_directory = cache_directory;
   
   if (!data_love.load(input_love)) {
     return -1;
@@ -374,6 +712,13 @@ int main(int argc, char *argv[])
   data_rayleigh.estimate_sigma(noise_frequency);
   printf("Rayleigh Estimated noise: %16.9e\n", data_rayleigh.noise_sigma);
 
+  //
+  // Build envelopes, these depend only on the observed spectra and are
+  // shared by the realisations of an ensemble
+  //
+  data_love.compute_envelope(gaussian_smooth);
+  data_rayleigh.compute_envelope(gaussian_smooth);
+
   Mesh<double, MAXORDER> mesh;
   MeshAmplitude<double, MAXORDER, MAXORDER> amplitude;
 
@@ -387,38 +732,117 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  char filename[1024];
+  IncrementalState state;
+  const char *status = "inverted";
+  int ensemble_iterations = maxiterations;
+
+  if (previous_prefix != nullptr) {
+
+    //
+    // Incremental update: warm start from the previous result (the snapshot
+    // if present as it is exact) keeping the prior from the reference file.
+    //
+    ReferenceModel previous;
+
+    sprintf(filename, "%s.model.bin", previous_prefix);
+    if (!snapshot_t::is_snapshot(filename)) {
+      sprintf(filename, "%s.model", previous_prefix);
+    }
+    
+    if (!previous.load_model(filename)) {
+      fprintf(stderr, "error: failed to load previous model from %s\n", filename);
+      return -1;
+    }
+
+    reference.model = previous.model;
+    
+    sprintf(filename, "%s.state", previous_prefix);
+    if (state.load(filename, reference.model)) {
+
+      double change_love = state.love.relative_change(data_love);
+      double change_rayleigh = state.rayleigh.relative_change(data_rayleigh);
+
+      printf("Love change: %16.9e Rayleigh change: %16.9e\n", change_love, change_rayleigh);
+      
+      if (change_love >= 0.0 && change_love < change_threshold &&
+	  change_rayleigh >= 0.0 && change_rayleigh < change_threshold &&
+	  state.love.restore(data_love) &&
+	  state.rayleigh.restore(data_rayleigh)) {
+
+	//
+	// Spectra effectively unchanged: keep the previous model and
+	// predictions, and retain the stored state for the next update
+	//
+	for (int i = data_love.ffirst; i <= data_love.flast; i ++) {
+	  bessel_prediction(data_love, i, data_love.predicted_k[i]);
+	}
+	for (int i = data_rayleigh.ffirst; i <= data_rayleigh.flast; i ++) {
+	  bessel_prediction(data_rayleigh, i, data_rayleigh.predicted_k[i]);
+	}
+
+	status = "skipped";
+	maxiterations = 0;
+      }
+      
+    } else {
+      printf("No reusable state for %s\n", previous_prefix);
+    }
+
+    if (maxiterations > max_updates) {
+      maxiterations = max_updates;
+    }
+    if (ensemble_iterations > max_updates) {
+      ensemble_iterations = max_updates;
+    }
+
+    if (maxiterations > 0) {
+      status = "warm";
+    }
+  }
+
   LoveMatrices<double, MAXORDER, BOUNDARYORDER> love;
   RayleighMatrices<double, MAXORDER, BOUNDARYORDER> rayleigh;
 
-  printf("Begining \n");
+  model_t start_model = reference.model;
+
+  if (maxiterations > 0) {
+    printf("Begining \n");
     
-  if (!invert(data_love,
-	      data_rayleigh,
-	      reference.model,
-	      reference.reference,
-	      damping,
-	      nodata,
-	      mesh,
-	      love,
-	      rayleigh,
-	      threshold,
-	      order,
-	      highorder,
-	      boundaryorder,
-	      scale,
-	      epsilon,
-	      maxiterations,
-	      output_file,
-	      jacobians,
-	      gaussian_smooth,
-	      mode,
-	      skip)) {
-    fprintf(stderr, "error: failed to invert\n");
-    return -1;
+    if (!invert(data_love,
+		data_rayleigh,
+		reference.model,
+		reference.reference,
+		damping,
+		nodata,
+		mesh,
+		love,
+		rayleigh,
+		threshold,
+		order,
+		highorder,
+		boundaryorder,
+		scale,
+		epsilon,
+		maxiterations,
+		output_file,
+		jacobians,
+		mode,
+		sketch_factor,
+		lsqr_iterations,
+		cg_iterations,
+		skip,
+		compress_tolerance,
+		frequency_thin,
+		select_fraction,
+		auto_tolerance,
+		broyden,
+		&state)) {
+      fprintf(stderr, "error: failed to invert\n");
+      return -1;
+    }
   }
   
-  char filename[1024];
-  
   //
   // Save model
   //
@@ -427,6 +851,12 @@ int main(int argc, char *argv[])
     fprintf(stderr, "error: failed to save model\n");
     return -1;
   }
+
+  sprintf(filename, "%s.model.bin", output_file);
+  if (!snapshot_t::save(reference.model, filename)) {
+    fprintf(stderr, "error: failed to save model snapshot\n");
+    return -1;
+  }
   
   //
   // Save residuals
@@ -448,6 +878,139 @@ int main(int argc, char *argv[])
     fprintf(stderr, "error: failed to save predictions\n");
     return -1;
   }
+
+  //
+  // Save state and manifest for subsequent incremental updates
+  //
+  sprintf(filename, "%s.state", output_file);
+  if (!state.save(filename, reference.model)) {
+    fprintf(stderr, "error: failed to save incremental state\n");
+    return -1;
+  }
+
+  sprintf(filename, "%s.manifest", output_file);
+  if (!state.save_manifest(filename,
+			   input_love,
+			   data_love,
+			   input_rayleigh,
+			   data_rayleigh,
+			   status)) {
+    return -1;
+  }
+
+  if (ensemble > 0) {
+
+    //
+    // Noise ensemble: each realisation inverts perturbed spectra from the
+    // starting model of the run. The envelopes and the predictions and dk/dp
+    // at the starting model are shared so the realisations begin without
+    // forward solves. Workers take realisations in turn, each with its own
+    // mesh and solvers.
+    //
+    NoiseEnsemble noise(ensemble, ensemble_seed);
+    std::atomic<int> next(0);
+    std::atomic<int> failed(0);
+
+    auto worker = [&]() {
+      Mesh<double, MAXORDER> mesh_r;
+      LoveMatrices<double, MAXORDER, BOUNDARYORDER> love_r;
+      RayleighMatrices<double, MAXORDER, BOUNDARYORDER> rayleigh_r;
+
+      for (int r = next++; r < ensemble; r = next++) {
+	DispersionData realisation_love = data_love;
+	DispersionData realisation_rayleigh = data_rayleigh;
+	realisation_love.frequency_mask.clear();
+	realisation_rayleigh.frequency_mask.clear();
+	
+	noise.perturb(realisation_love, r, 0);
+	noise.perturb(realisation_rayleigh, r, 1);
+
+	model_t model_r = start_model;
+
+	IncrementalState state_r;
+	state_r.love = state.initial_love;
+	state_r.rayleigh = state.initial_rayleigh;
+	state_r.valid = true;
+
+	try {
+	  if (invert(realisation_love,
+		     realisation_rayleigh,
+		     model_r,
+		     reference.reference,
+		     damping,
+		     nodata,
+		     mesh_r,
+		     love_r,
+		     rayleigh_r,
+		     threshold,
+		     order,
+		     highorder,
+		     boundaryorder,
+		     scale,
+		     epsilon,
+		     ensemble_iterations,
+		     nullptr,
+		     false,
+		     mode,
+		     sketch_factor,
+		     lsqr_iterations,
+		     cg_iterations,
+		     skip,
+		     compress_tolerance,
+		     frequency_thin,
+		     select_fraction,
+		     auto_tolerance,
+		     broyden,
+		     &state_r)) {
+	    noise.set(r, realisation_love, realisation_rayleigh, state_r.likelihood);
+	    printf("ensemble %d: %16.9e\n", r, state_r.likelihood);
+	    continue;
+	  }
+	} catch (std::exception &e) {
+	  fprintf(stderr, "error: ensemble %d: %s\n", r, e.what());
+	}
+
+	fprintf(stderr, "error: failed to invert ensemble realisation %d\n", r);
+	failed ++;
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < ensemble_threads && t < ensemble; t ++) {
+      workers.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto &w : workers) {
+      w.join();
+    }
+
+    printf("Ensemble: %d of %d realisations\n", noise.count(), ensemble);
+    if (noise.count() < 2) {
+      fprintf(stderr, "error: too few realisations for the ensemble spread\n");
+      return -1;
+    }
+
+    sprintf(filename, "%s.ensemble-love", output_file);
+    if (!noise.save_love(filename, data_love)) {
+      return -1;
+    }
+
+    sprintf(filename, "%s.ensemble-rayleigh", output_file);
+    if (!noise.save_rayleigh(filename, data_rayleigh)) {
+      return -1;
+    }
+
+    sprintf(filename, "%s.ensemble-likelihood", output_file);
+    if (!noise.save_likelihoods(filename)) {
+      return -1;
+    }
+  }
+  
+  if (counters_file != nullptr) {
+    if (!PerfCounters::report(counters_file)) {
+      return -1;
+    }
+  }
   
   return 0;
 }
@@ -461,6 +1024,23 @@ void usage(const char *pname)
           " -i|--input <filename>           Input model (required)\n"
           " -f|--frequency <float>          Frequency\n"
           " -s|--scale <float>              Laguerre scaling (initial)\n"
+          " -C|--cache <dir>                Preprocessed spectra cache directory\n"
+          " -H|--counters <file>            Write per region hardware counters to file\n"
+          " -U|--previous <prefix>          Incremental update from a previous output prefix\n"
+          " -Y|--change-threshold <float>   Relative spectrum change below which the update is skipped\n"
+          " -K|--max-updates <int>          Maximum iterations for an incremental update (default 3)\n"
+          " -M|--mode <int>                 Step 0 gradient, 1 quasi-Newton, 2 sketched quasi-Newton, 3 Newton-CG\n"
+          " -A|--sketch-factor <int>        Sketch rows as a multiple of model parameters (default 4)\n"
+          " -L|--lsqr-iterations <int>      Preconditioned LSQR refinement of sketched step (default 0)\n"
+          " -c|--cg-iterations <int>        Maximum CG iterations of the Newton-CG step (default 20)\n"
+          " -Z|--compress <float>           Low rank Jacobian tolerance relative to largest row (0 = dense)\n"
+          " -n|--frequency-thin <float>     Minimum frequency spacing (Hz) while iterating (default 0)\n"
+          " -E|--select-information <float> Iterate on frequencies keeping this fraction of the information (0 = all)\n"
+          " -a|--auto-order <float>         Choose mesh order per frequency to this relative wave number error, up to the high order (0 = off)\n"
+          " -B|--broyden <int>              Full Jacobians every n iterations, Broyden updated between (0 = off)\n"
+          " -k|--ensemble <int>             Noise realisations for uncertainty of the curves (default 0)\n"
+          " -x|--ensemble-seed <int>        Seed of the noise realisations (default 983)\n"
+          " -j|--ensemble-threads <int>     Realisations run concurrently (default half the cores)\n"
           "\n"
           " -h|--help                       Show usage information\n"
           "\n",
@@ -486,9 +1066,17 @@ static bool invert(DispersionData &data_love,
                    int maxiterations,
 		   const char *output_prefix,
 		   bool jacobians,
-		   double gaussian_smooth,
 		   int mode,
-		   int skip)
+		   int sketch_factor,
+		   int lsqr_iterations,
+		   int cg_iterations,
+		   int skip,
+		   double compress_tolerance,
+		   double frequency_thin,
+		   double select_fraction,
+		   double auto_tolerance,
+		   int broyden,
+		   IncrementalState *state)
 {
   Spec1DMatrix<double> dkdp_love;
   Spec1DMatrix<double> dUdp_love;
@@ -504,6 +1092,30 @@ static bool invert(DispersionData &data_love,
   Spec1DMatrix<double> old_G_love;
   Spec1DMatrix<double> old_G_rayleigh;
   Spec1DMatrix<double> old_dLdp_love;
+
+  //
+  // Jacobians dk/dp for Broyden updates between full evaluations
+  //
+  BroydenJacobian broyden_love;
+  BroydenJacobian broyden_rayleigh;
+  BroydenJacobian old_broyden_love;
+  BroydenJacobian old_broyden_rayleigh;
+
+  CompressedJacobian CG_love;
+  CompressedJacobian CG_rayleigh;
+  CompressedJacobian old_CG_love;
+  CompressedJacobian old_CG_rayleigh;
+  bool compress = compress_tolerance > 0.0;
+
+  //
+  // Spline interpolated Jacobians of the skip path kept as anchor rows and
+  // Hermite weights
+  //
+  FactoredJacobian FG_love;
+  FactoredJacobian FG_rayleigh;
+  FactoredJacobian old_FG_love;
+  FactoredJacobian old_FG_rayleigh;
+  bool factored = skip > 1 && !compress;
   
   Spec1DMatrix<double> dkdp_rayleigh;
   Spec1DMatrix<double> dUdp_rayleigh;
@@ -514,157 +1126,428 @@ static bool invert(DispersionData &data_love,
   Spec1DMatrix<double> residuals_rayleigh;
   Spec1DMatrix<double> Cd_rayleigh;
 
+  //
+  // dk/dp rows of the full likelihoods, kept for the Broyden updates or
+  // the stored state
+  //
+  Spec1DMatrix<double> *Gk_full_love = nullptr;
+  Spec1DMatrix<double> *Gk_full_rayleigh = nullptr;
+  if (broyden > 1) {
+    Gk_full_love = &broyden_love.Gk;
+    Gk_full_rayleigh = &broyden_rayleigh.Gk;
+  } else if (state != nullptr) {
+    Gk_full_love = &Gk_love;
+    Gk_full_rayleigh = &Gk_rayleigh;
+  }
+
   Spec1DMatrix<int> model_mask;
   Spec1DMatrix<double> model_v;
   Spec1DMatrix<double> model_v_proposed;
   Spec1DMatrix<double> model_0;
   Spec1DMatrix<double> Cm;
 
-  double epsilon[2];
-  LeastSquaresIterator *step[2];
+  double epsilon[4];
+  LeastSquaresIterator *step[4];
 
   double PRIOR_MIN[4] = {0.1e3, 0.5e3, 0.5, 1.0};
   double PRIOR_MAX[4] = {8.0e3, 10.0e3, 1.5, 2.5};
 
   epsilon[0] = _epsilon;
   epsilon[1] = _epsilon/8.0;
+  epsilon[2] = _epsilon/8.0;
+  epsilon[3] = _epsilon/8.0;
 
   step[0] = new SimpleStep();
   step[1] = new QuasiNewton();
+  step[2] = new SketchedStep(sketch_factor, lsqr_iterations);
 
-  double frequency_thin = 0.0; // not used
+  double like_love;
+  double like_rayleigh;
 
   //
-  // Build envelopes
+  // The Love and Rayleigh likelihoods are evaluated concurrently, each with
+  // its own mesh and model copy as projection writes into the model cells.
+  // The spline likelihoods of the initial model are evaluated without
+  // posterior so that the Jacobians are formed.
   //
-  data_love.compute_envelope(gaussian_smooth);
-  data_rayleigh.compute_envelope(gaussian_smooth);
+  mesh_t mesh_rayleigh;
+  model_t model_rayleigh;
 
-  double like_love;
-  double like_rayleigh;
+  JointHessian hessian(data_love, data_rayleigh, model, model_rayleigh, mesh, mesh_rayleigh,
+		       love, rayleigh, order, boundaryorder, scale, frequency_thin);
+  step[3] = new NewtonCG(hessian, cg_iterations);
   
-  if (skip <= 1) {
-    like_love = likelihood_love_bessel(data_love,
-				       model,
-				       reference,
-				       damping,
-				       posterior,
-				       mesh,
-				       love,
-				       dkdp_love,
-				       dUdp_love,
-				       dLdp_love,
-				       G_love,
-				       residuals_love,
-				       Cd_love,
-				       threshold,
-				       order,
-				       highorder,
-				       boundaryorder,
-				       scale,
-				       frequency_thin);
+  auto evaluate_love = [&](bool spline_posterior) {
+    if (skip <= 1) {
+      like_love = likelihood_love_bessel(data_love,
+					 model,
+					 reference,
+					 damping,
+					 posterior,
+					 mesh,
+					 love,
+					 dkdp_love,
+					 dUdp_love,
+					 dLdp_love,
+					 G_love,
+					 residuals_love,
+					 Cd_love,
+					 threshold,
+					 order,
+					 highorder,
+					 boundaryorder,
+					 scale,
+					 frequency_thin,
+					 Gk_full_love);
+      if (broyden > 1) {
+	broyden_love.capture(data_love, frequency_thin);
+      }
+    } else {
+      like_love = likelihood_love_bessel_spline(data_love,
+						model,
+						reference,
+						damping,
+						spline_posterior,
+						mesh,
+						love,
+						dkdp_love,
+						dUdp_love,
+						dLdp_love,
+						G_love,
+						Gk_love,
+						GU_love,
+						residuals_love,
+						Cd_love,
+						threshold,
+						order,
+						highorder,
+						boundaryorder,
+						scale,
+						skip,
+						factored ? &FG_love : nullptr);
+    }
+  };
+
+  auto evaluate_rayleigh = [&](bool spline_posterior) {
+    if (skip <= 1) {
+      like_rayleigh = likelihood_rayleigh_bessel(data_rayleigh,
+						 model_rayleigh,
+						 reference,
+						 damping,
+						 posterior,
+						 mesh_rayleigh,
+						 rayleigh,
+						 dkdp_rayleigh,
+						 dUdp_rayleigh,
+						 dLdp_rayleigh,
+						 G_rayleigh,
+						 residuals_rayleigh,
+						 Cd_rayleigh,
+						 threshold,
+						 order,
+						 highorder,
+						 boundaryorder,
+						 scale,
+						 frequency_thin,
+						 Gk_full_rayleigh);
+      if (broyden > 1) {
+	broyden_rayleigh.capture(data_rayleigh, frequency_thin);
+      }
+    } else {
+      like_rayleigh = likelihood_rayleigh_bessel_spline(data_rayleigh,
+							model_rayleigh,
+							reference,
+							damping,
+							spline_posterior,
+							mesh_rayleigh,
+							rayleigh,
+							dkdp_rayleigh,
+							dUdp_rayleigh,
+							dLdp_rayleigh,
+							G_rayleigh,
+							Gk_rayleigh,
+							GU_rayleigh,
+							residuals_rayleigh,
+							Cd_rayleigh,
+							threshold,
+							order,
+							highorder,
+							boundaryorder,
+							scale,
+							skip,
+							factored ? &FG_rayleigh : nullptr);
+    }
+  };
+
+  auto evaluate = [&](bool spline_posterior) {
+    model_rayleigh = model;
+    std::thread rayleigh_task(evaluate_rayleigh, spline_posterior);
+    evaluate_love(spline_posterior);
+    rayleigh_task.join();
+  };
+
+  //
+  // Predictions and residuals only, the Jacobians are then Broyden updated
+  // from the step between model_v and model_v_proposed
+  //
+  auto evaluate_predict = [&]() {
+    model_rayleigh = model;
+    std::thread rayleigh_task([&]() {
+	like_rayleigh = likelihood_rayleigh_bessel_predict(data_rayleigh,
+							   model_rayleigh,
+							   reference,
+							   damping,
+							   mesh_rayleigh,
+							   rayleigh,
+							   dLdp_rayleigh,
+							   residuals_rayleigh,
+							   Cd_rayleigh,
+							   threshold,
+							   order,
+							   highorder,
+							   boundaryorder,
+							   scale,
+							   frequency_thin);
+      });
     
-    like_rayleigh = likelihood_rayleigh_bessel(data_rayleigh,
+    like_love = likelihood_love_bessel_predict(data_love,
 					       model,
 					       reference,
 					       damping,
-					       posterior,
 					       mesh,
-					       rayleigh,
-					       dkdp_rayleigh,
-					       dUdp_rayleigh,
-					       dLdp_rayleigh,
-					       G_rayleigh,
-					       residuals_rayleigh,
-					       Cd_rayleigh,
+					       love,
+					       dLdp_love,
+					       residuals_love,
+					       Cd_love,
 					       threshold,
 					       order,
 					       highorder,
 					       boundaryorder,
 					       scale,
 					       frequency_thin);
+    rayleigh_task.join();
+
+    broyden_love.update(data_love, frequency_thin, Cm, model_v, model_v_proposed,
+			Cd_love, residuals_love, G_love, dLdp_love);
+    broyden_rayleigh.update(data_rayleigh, frequency_thin, Cm, model_v, model_v_proposed,
+			    Cd_rayleigh, residuals_rayleigh, G_rayleigh, dLdp_rayleigh);
+  };
+
+  //
+  // Mesh order per frequency from the local wavelength, calibrated on the
+  // initial model and cached for the fixed cell structure
+  //
+  if (auto_tolerance > 0.0) {
+    AutoDiscretization auto_love(auto_tolerance, highorder);
+    AutoDiscretization auto_rayleigh(auto_tolerance, highorder);
+    bool love_valid;
+    bool rayleigh_valid;
+
+    model_rayleigh = model;
+    std::thread rayleigh_task([&]() {
+	rayleigh_valid = auto_rayleigh.update(data_rayleigh, model_rayleigh, [&](int i, int p) {
+	    double w;
+	    return rayleigh_bessel_compute(data_rayleigh, i, model_rayleigh, mesh_rayleigh, rayleigh,
+					   dkdp_rayleigh, dUdp_rayleigh,
+					   threshold, p, highorder, boundaryorder, scale, w);
+	  });
+      });
+
+    love_valid = auto_love.update(data_love, model, [&](int i, int p) {
+	double w;
+	return love_bessel_compute(data_love, i, model, mesh, love,
+				   dkdp_love, dUdp_love,
+				   threshold, p, highorder, boundaryorder, scale, w);
+      });
+    rayleigh_task.join();
+
+    if (!love_valid || !rayleigh_valid) {
+      fprintf(stderr, "error: failed to determine mesh orders\n");
+      return false;
+    }
+
+    auto_love.print_summary(stdout, "Love", data_love);
+    auto_rayleigh.print_summary(stdout, "Rayleigh", data_rayleigh);
+  }
+
+  //
+  // Model state at the last accepted model
+  //
+  WaveState accepted_love;
+  WaveState accepted_rayleigh;
+  bool reused = false;
+
+  //
+  // Captures the predictions and dk/dp of the last evaluation into the
+  // states, from the stored (one row per frequency) dk/dp after a warm
+  // start
+  //
+  auto capture = [&](WaveState &love_state, WaveState &rayleigh_state) {
+    if (skip > 1 || reused) {
+      if (factored) {
+	FG_love.expand_k(Gk_love);
+	FG_rayleigh.expand_k(Gk_rayleigh);
+      }
+      love_state.capture(data_love, Gk_love);
+      rayleigh_state.capture(data_rayleigh, Gk_rayleigh);
+    } else {
+      love_state.capture(data_love, *Gk_full_love, frequency_thin);
+      rayleigh_state.capture(data_rayleigh, *Gk_full_rayleigh, frequency_thin);
+    }
+  };
+
+  if (state != nullptr && state->valid &&
+      state->love.reusable(data_love, skip, frequency_thin) &&
+      state->rayleigh.reusable(data_rayleigh, skip, frequency_thin)) {
+
+    //
+    // Warm start from the model of the stored state: only the data has
+    // changed so reuse its predictions and dk/dp without forward solves
+    //
+    printf("Reusing stored Jacobians\n");
+
+    state->love.restore(data_love);
+    state->rayleigh.restore(data_rayleigh);
+
+    Gk_love = state->love.Gk;
+    Gk_rayleigh = state->rayleigh.Gk;
+    reused = true;
+
+    //
+    // The stored Jacobians are dense so stay dense for this run
+    //
+    factored = false;
     
-  } else {
-    like_love = likelihood_love_bessel_spline(data_love,
-					      model,
-					      reference,
-					      damping,
-					      false,
-					      mesh,
-					      love,
-					      dkdp_love,
-					      dUdp_love,
-					      dLdp_love,
-					      G_love,
-					      Gk_love,
-					      GU_love,
-					      residuals_love,
-					      Cd_love,
-					      threshold,
-					      order,
-					      highorder,
-					      boundaryorder,
-					      scale,
-					      skip);
+    like_love = likelihood_bessel_reuse(data_love,
+					model,
+					reference,
+					damping,
+					Gk_love,
+					dLdp_love,
+					G_love,
+					residuals_love,
+					Cd_love,
+					skip,
+					frequency_thin);
+
+    like_rayleigh = likelihood_bessel_reuse(data_rayleigh,
+					    model,
+					    reference,
+					    damping,
+					    Gk_rayleigh,
+					    dLdp_rayleigh,
+					    G_rayleigh,
+					    residuals_rayleigh,
+					    Cd_rayleigh,
+					    skip,
+					    frequency_thin);
+
+    if (broyden > 1) {
+      state->love.full_rows(data_love, frequency_thin, broyden_love.Gk);
+      state->rayleigh.full_rows(data_rayleigh, frequency_thin, broyden_rayleigh.Gk);
+      broyden_love.capture(data_love, frequency_thin);
+      broyden_rayleigh.capture(data_rayleigh, frequency_thin);
+    }
     
-    like_rayleigh = likelihood_rayleigh_bessel_spline(data_rayleigh,
-						      model,
-						      reference,
-						      damping,
-						      false,
-						      mesh,
-						      rayleigh,
-						      dkdp_rayleigh,
-						      dUdp_rayleigh,
-						      dLdp_rayleigh,
-						      G_rayleigh,
-						      Gk_rayleigh,
-						      GU_rayleigh,
-						      residuals_rayleigh,
-						      Cd_rayleigh,
-						      threshold,
-						      order,
-						      highorder,
-						      boundaryorder,
-						      scale,
-						      skip);
+  } else {
+    evaluate(false);
   }
 
-  size_t nparam = G_love.cols();
+  //
+  // The starting state, before the frequency selection changes the rows
+  //
+  if (state != nullptr) {
+    capture(accepted_love, accepted_rayleigh);
+    state->initial_love = accepted_love;
+    state->initial_rayleigh = accepted_rayleigh;
+  }
+  reused = false;
+
+  size_t nparam = factored ? FG_love.cols() : G_love.cols();
+
+  //
+  // Diagonal model covariance matrices
+  //
+  Cm.resize(nparam, 1);
+  LeastSquaresIterator::initialize_Cm(model, damping, Cm);
+
+  //
+  // Restrict the iterations to the most informative frequencies, the rows
+  // of the remaining frequencies are removed from the initial evaluation
+  //
+  if (select_fraction > 0.0) {
+    FrequencySelection selection;
+    FrequencySelection::block blocks[2] = {
+      {&data_love, &G_love, &residuals_love, &Cd_love, &dLdp_love, &like_love, 0, 0},
+      {&data_rayleigh, &G_rayleigh, &residuals_rayleigh, &Cd_rayleigh, &dLdp_rayleigh, &like_rayleigh, 0, 0}
+    };
+
+    double retained = selection.select(2, blocks, Cm, frequency_thin, select_fraction);
+    if (retained < 0.0) {
+      fprintf(stderr, "error: failed to select frequencies\n");
+      return false;
+    }
+
+    printf("Selected %d of %d Love and %d of %d Rayleigh frequencies (%.1f%% of information)\n",
+	   blocks[0].selected, blocks[0].rows,
+	   blocks[1].selected, blocks[1].rows,
+	   100.0 * retained);
+  }
 
   //
   // Store parameters for perturbing current model
   //
   old_residuals_love = residuals_love;
   old_residuals_rayleigh = residuals_rayleigh;
-  old_G_love = G_love;
-  old_G_rayleigh = G_rayleigh;
+  old_broyden_love = broyden_love;
+  old_broyden_rayleigh = broyden_rayleigh;
+  if (compress) {
+    CG_love.compress(G_love, compress_tolerance);
+    CG_rayleigh.compress(G_rayleigh, compress_tolerance);
+    printf("Compressed Jacobians: Love rank %d of %d (%.1fx) Rayleigh rank %d of %d (%.1fx)\n",
+	   CG_love.rank(), CG_love.rows(), CG_love.ratio(),
+	   CG_rayleigh.rank(), CG_rayleigh.rows(), CG_rayleigh.ratio());
+    
+    old_CG_love = CG_love;
+    old_CG_rayleigh = CG_rayleigh;
+  } else if (factored) {
+    printf("Factored Jacobians: Love %d anchors of %d Rayleigh %d anchors of %d\n",
+	   FG_love.anchors(), FG_love.rows(),
+	   FG_rayleigh.anchors(), FG_rayleigh.rows());
+    
+    old_FG_love = FG_love;
+    old_FG_rayleigh = FG_rayleigh;
+  } else {
+    old_G_love = G_love;
+    old_G_rayleigh = G_rayleigh;
+  }
 
   for (size_t i = 0; i < nparam; i ++) {
     dLdp_love(i, 0) += dLdp_rayleigh(i, 0);
   }
 
   old_dLdp_love = dLdp_love;
-  
 
   double like = like_love + like_rayleigh;
   printf("init: %16.9e\n", like);
   double last_like = like;
 
   //
-  // Save initial predictions
+  // Save initial predictions (not for ensemble realisations)
   //
-  char filename[1024];
-  sprintf(filename, "%s.initpred-love", output_prefix);
-  if (!data_love.save_predictions(filename)) {
-    fprintf(stderr, "error: failed to save initial predictions\n");
-    return false;
-  }
+  if (output_prefix != nullptr) {
+    char filename[1024];
+    sprintf(filename, "%s.initpred-love", output_prefix);
+    if (!data_love.save_predictions(filename)) {
+      fprintf(stderr, "error: failed to save initial predictions\n");
+      return false;
+    }
 
-  sprintf(filename, "%s.initpred-rayleigh", output_prefix);
-  if (!data_rayleigh.save_predictions(filename)) {
-    fprintf(stderr, "error: failed to save initial predictions\n");
-    return false;
+    sprintf(filename, "%s.initpred-rayleigh", output_prefix);
+    if (!data_rayleigh.save_predictions(filename)) {
+      fprintf(stderr, "error: failed to save initial predictions\n");
+      return false;
+    }
   }
   
   //
@@ -672,12 +1555,6 @@ static bool invert(DispersionData &data_love,
   // and will be correct size.
   //
 
-  //
-  // Diagonal model covariance matrices
-  //
-  Cm.resize(nparam, 1);
-  LeastSquaresIterator::initialize_Cm(model, damping, Cm);
-  
   //
   // Model vectors
   //
@@ -690,6 +1567,17 @@ static bool invert(DispersionData &data_love,
 
   int iterations = 0;
 
+  //
+  // Broyden state: whether G is an updated rather than computed Jacobian,
+  // the prediction only evaluations since the last full one, the decrease
+  // of the last step from a computed Jacobian and whether the next
+  // evaluation must be full as the updated steps have stalled
+  //
+  bool approximate = false;
+  int since_full = 0;
+  double full_decrease = 0.0;
+  bool force_full = false;
+
   do {
       
     //
@@ -697,23 +1585,56 @@ static bool invert(DispersionData &data_love,
     //
     LeastSquaresIterator::copy(model, model_v, model_mask);
 
-    int m = 0; //iterations % 2;
+    int m = mode; //iterations % 2;
     bool valid = false;
 
     do {
-      if (!step[m]->ComputeStepJoint(epsilon[m],
-				     Cd_love,
-				     Cd_rayleigh,
-				     Cm,
-				     residuals_love,
-				     residuals_rayleigh,
-				     G_love,
-				     G_rayleigh,
-				     dLdp_love,
-				     model_mask,
-				     model_v,
-				     model_0,
-				     model_v_proposed)) {
+      bool stepped;
+      if (compress) {
+	stepped = step[m]->ComputeStepJointCompressed(epsilon[m],
+						      Cd_love,
+						      Cd_rayleigh,
+						      Cm,
+						      residuals_love,
+						      residuals_rayleigh,
+						      CG_love,
+						      CG_rayleigh,
+						      dLdp_love,
+						      model_mask,
+						      model_v,
+						      model_0,
+						      model_v_proposed);
+      } else if (factored) {
+	stepped = step[m]->ComputeStepJointCompressed(epsilon[m],
+						      Cd_love,
+						      Cd_rayleigh,
+						      Cm,
+						      residuals_love,
+						      residuals_rayleigh,
+						      FG_love,
+						      FG_rayleigh,
+						      dLdp_love,
+						      model_mask,
+						      model_v,
+						      model_0,
+						      model_v_proposed);
+      } else {
+	stepped = step[m]->ComputeStepJoint(epsilon[m],
+					    Cd_love,
+					    Cd_rayleigh,
+					    Cm,
+					    residuals_love,
+					    residuals_rayleigh,
+					    G_love,
+					    G_rayleigh,
+					    dLdp_love,
+					    model_mask,
+					    model_v,
+					    model_0,
+					    model_v_proposed);
+      }
+      
+      if (!stepped) {
 	fprintf(stderr, "error: failed to compute step\n");
 	return false;
       }
@@ -740,95 +1661,25 @@ static bool invert(DispersionData &data_love,
       //
       last_like = like;
 
-      if (skip <= 1) {
-	like_love = likelihood_love_bessel(data_love,
-					   model,
-					   reference,
-					   damping,
-					   posterior,
-					   mesh,
-					   love,
-					   dkdp_love,
-					   dUdp_love,
-					   dLdp_love,
-					   G_love,
-					   residuals_love,
-					   Cd_love,
-					   threshold,
-					   order,
-					   highorder,
-					   boundaryorder,
-					   scale,
-					   frequency_thin);
-	
-	like_rayleigh = likelihood_rayleigh_bessel(data_rayleigh,
-						   model,
-						   reference,
-						   damping,
-						   posterior,
-						   mesh,
-						   rayleigh,
-						   dkdp_rayleigh,
-						   dUdp_rayleigh,
-						   dLdp_rayleigh,
-						   G_rayleigh,
-						   residuals_rayleigh,
-						   Cd_rayleigh,
-						   threshold,
-						   order,
-						   highorder,
-						   boundaryorder,
-						   scale,
-						   frequency_thin);
-
+      bool approximate_step = approximate;
+      bool predicted = broyden > 1 && !posterior && !force_full && since_full + 1 < broyden;
+      if (predicted) {
+	evaluate_predict();
+	approximate = true;
+	since_full ++;
       } else {
-	like_love = likelihood_love_bessel_spline(data_love,
-						  model,
-						  reference,
-						  damping,
-						  posterior,
-						  mesh,
-						  love,
-						  dkdp_love,
-						  dUdp_love,
-						  dLdp_love,
-						  G_love,
-						  Gk_love,
-						  GU_love,
-						  residuals_love,
-						  Cd_love,
-						  threshold,
-						  order,
-						  highorder,
-						  boundaryorder,
-						  scale,
-						  skip);
-	
-	like_rayleigh = likelihood_rayleigh_bessel_spline(data_rayleigh,
-							  model,
-							  reference,
-							  damping,
-							  posterior,
-							  mesh,
-							  rayleigh,
-							  dkdp_rayleigh,
-							  dUdp_rayleigh,
-							  dLdp_rayleigh,
-							  G_rayleigh,
-							  Gk_rayleigh,
-							  GU_rayleigh,
-							  residuals_rayleigh,
-							  Cd_rayleigh,
-							  threshold,
-							  order,
-							  highorder,
-							  boundaryorder,
-							  scale,
-							  skip);
-	
+	evaluate(posterior);
+	approximate = false;
+	since_full = 0;
       }
+      force_full = false;
       
       like = like_love + like_rayleigh;
+
+      if (compress) {
+	CG_love.compress(G_love, compress_tolerance);
+	CG_rayleigh.compress(G_rayleigh, compress_tolerance);
+      }
       
       if (like > last_like) {
 	
@@ -852,13 +1703,51 @@ static bool invert(DispersionData &data_love,
 	//
 	residuals_love = old_residuals_love;
 	residuals_rayleigh = old_residuals_rayleigh;
-	G_love = old_G_love;
-	G_rayleigh = old_G_rayleigh;
+	broyden_love = old_broyden_love;
+	broyden_rayleigh = old_broyden_rayleigh;
+	if (compress) {
+	  CG_love = old_CG_love;
+	  CG_rayleigh = old_CG_rayleigh;
+	} else if (factored) {
+	  FG_love = old_FG_love;
+	  FG_rayleigh = old_FG_rayleigh;
+	} else {
+	  G_love = old_G_love;
+	  G_rayleigh = old_G_rayleigh;
+	}
 	dLdp_love = old_dLdp_love;
 	
 	like = last_like;
-
-	epsilon[m] *= 0.5;
+	approximate = approximate_step;
+
+	if (approximate) {
+	  //
+	  // The step came from an updated Jacobian: recompute it at the
+	  // current model and retry with the same epsilon
+	  //
+	  printf("%4d: Recomputing Jacobians\n", iterations);
+	  
+	  evaluate(posterior);
+	  like = like_love + like_rayleigh;
+	  approximate = false;
+	  since_full = 0;
+
+	  old_residuals_love = residuals_love;
+	  old_residuals_rayleigh = residuals_rayleigh;
+	  old_broyden_love = broyden_love;
+	  old_broyden_rayleigh = broyden_rayleigh;
+	  old_G_love = G_love;
+	  old_G_rayleigh = G_rayleigh;
+	  
+	  for (size_t i = 0; i < nparam; i ++) {
+	    dLdp_love(i, 0) += dLdp_rayleigh(i, 0);
+	  }
+	  old_dLdp_love = dLdp_love;
+	  
+	} else {
+	  
+	  epsilon[m] *= 0.5;
+	}
 	
       } else {
 
@@ -867,16 +1756,41 @@ static bool invert(DispersionData &data_love,
 	//
 	old_residuals_love = residuals_love;
 	old_residuals_rayleigh = residuals_rayleigh;
-	old_G_love = G_love;
-	old_G_rayleigh = G_rayleigh;
+	old_broyden_love = broyden_love;
+	old_broyden_rayleigh = broyden_rayleigh;
+	if (compress) {
+	  old_CG_love = CG_love;
+	  old_CG_rayleigh = CG_rayleigh;
+	} else if (factored) {
+	  old_FG_love = FG_love;
+	  old_FG_rayleigh = FG_rayleigh;
+	} else {
+	  old_G_love = G_love;
+	  old_G_rayleigh = G_rayleigh;
+	}
 	
 	for (size_t i = 0; i < nparam; i ++) {
 	  dLdp_love(i, 0) += dLdp_rayleigh(i, 0);
 	}
 	
 	old_dLdp_love = dLdp_love;
+
+	if (state != nullptr) {
+	  capture(accepted_love, accepted_rayleigh);
+	}
 	
-	printf("%4d: %16.9e %16.9e\n", iterations, like, epsilon[m]);
+	//
+	// Fall back to a full evaluation when the updated Jacobians give much
+	// less decrease than the last computed one did
+	//
+	if (!approximate_step) {
+	  full_decrease = last_like - like;
+	}
+	if (predicted && last_like - like < BroydenJacobian::STALL * full_decrease) {
+	  force_full = true;
+	}
+	
+	printf("%4d: %16.9e %16.9e%s\n", iterations, like, epsilon[m], predicted ? " (broyden)" : "");
 	
 	iterations ++;
       }
@@ -888,26 +1802,77 @@ static bool invert(DispersionData &data_love,
     
   } while (iterations < maxiterations);
 
+  if (approximate && jacobians && frequency_thin <= 0.0 && select_fraction <= 0.0) {
+    //
+    // The written Jacobians must be computed rather than updated ones
+    //
+    evaluate(posterior);
+    like = like_love + like_rayleigh;
+  }
+
+  if (frequency_thin > 0.0 || select_fraction > 0.0) {
+    //
+    // Iterations used a subset of the frequencies, so evaluate the final
+    // model over the full band for the outputs
+    //
+    data_love.frequency_mask.clear();
+    data_rayleigh.frequency_mask.clear();
+    frequency_thin = 0.0;
+
+    evaluate(posterior);
+    like = like_love + like_rayleigh;
+    printf("final: %16.9e\n", like);
+
+    if (compress) {
+      CG_love.compress(G_love, compress_tolerance);
+      CG_rayleigh.compress(G_rayleigh, compress_tolerance);
+    }
+
+    if (state != nullptr) {
+      capture(accepted_love, accepted_rayleigh);
+    }
+  }
+
+  if (state != nullptr) {
+    state->love = accepted_love;
+    state->rayleigh = accepted_rayleigh;
+    state->likelihood = like;
+    state->iterations = iterations;
+    state->valid = true;
+  }
+
   if (jacobians) {
     //
     // Write matrices etc for posterior covariance: Cd Cm G 
     //
     char filename[1024];
     FILE *fp;
-    
-    sprintf(filename, "%s.love_G", output_prefix);
-    fp = fopen(filename, "w");
-    if (fp == NULL) {
-      fprintf(stderr, "error: failed to create %s\n", filename);
-      return false;
+
+    if (factored) {
+      FG_love.expand(G_love);
+      FG_rayleigh.expand(G_rayleigh);
     }
-    for (int i = 0; i < G_love.rows(); i ++) {
-      for (int j = 0; j < G_love.cols(); j ++) {
-	fprintf(fp, "%16.9e ", G_love(i, j));
+    
+    if (compress) {
+      sprintf(filename, "%s.love_G.lowrank", output_prefix);
+      if (!CG_love.save(filename)) {
+	return false;
       }
-      fprintf(fp, "\n");
+    } else {
+      sprintf(filename, "%s.love_G", output_prefix);
+      fp = fopen(filename, "w");
+      if (fp == NULL) {
+	fprintf(stderr, "error: failed to create %s\n", filename);
+	return false;
+      }
+      for (int i = 0; i < G_love.rows(); i ++) {
+	for (int j = 0; j < G_love.cols(); j ++) {
+	  fprintf(fp, "%16.9e ", G_love(i, j));
+	}
+	fprintf(fp, "\n");
+      }
+      fclose(fp);
     }
-    fclose(fp);
 
     sprintf(filename, "%s.love_Cd", output_prefix);
     fp = fopen(filename, "w");
@@ -920,19 +1885,26 @@ static bool invert(DispersionData &data_love,
     }
     fclose(fp);
 
-    sprintf(filename, "%s.rayleigh_G", output_prefix);
-    fp = fopen(filename, "w");
-    if (fp == NULL) {
-      fprintf(stderr, "error: failed to create %s\n", filename);
-      return false;
-    }
-    for (int i = 0; i < G_rayleigh.rows(); i ++) {
-      for (int j = 0; j < G_rayleigh.cols(); j ++) {
-	fprintf(fp, "%16.9e ", G_rayleigh(i, j));
+    if (compress) {
+      sprintf(filename, "%s.rayleigh_G.lowrank", output_prefix);
+      if (!CG_rayleigh.save(filename)) {
+	return false;
+      }
+    } else {
+      sprintf(filename, "%s.rayleigh_G", output_prefix);
+      fp = fopen(filename, "w");
+      if (fp == NULL) {
+	fprintf(stderr, "error: failed to create %s\n", filename);
+	return false;
+      }
+      for (int i = 0; i < G_rayleigh.rows(); i ++) {
+	for (int j = 0; j < G_rayleigh.cols(); j ++) {
+	  fprintf(fp, "%16.9e ", G_rayleigh(i, j));
+	}
+	fprintf(fp, "\n");
       }
-      fprintf(fp, "\n");
+      fclose(fp);
     }
-    fclose(fp);
 
     sprintf(filename, "%s.rayleigh_Cd", output_prefix);
     fp = fopen(filename, "w");
@@ -979,33 +1951,51 @@ static bool invert(DispersionData &data_love,
       return false;
     }
 
-    sprintf(filename, "%s.love_Jc", output_prefix);
-    fp = fopen(filename, "w");
-    if (fp == NULL) {
-      fprintf(stderr, "error: failed to create %s\n", filename);
-      return false;
-    }
-    for (int i = 0; i < Jc.rows(); i ++) {
-      for (int j = 0; j < Jc.cols(); j ++) {
-	fprintf(fp, "%16.9e ", Jc(i, j));
+    if (compress) {
+      CompressedJacobian CJ;
+      CJ.compress(Jc, compress_tolerance);
+      sprintf(filename, "%s.love_Jc.lowrank", output_prefix);
+      if (!CJ.save(filename)) {
+	return false;
+      }
+    } else {
+      sprintf(filename, "%s.love_Jc", output_prefix);
+      fp = fopen(filename, "w");
+      if (fp == NULL) {
+	fprintf(stderr, "error: failed to create %s\n", filename);
+	return false;
       }
-      fprintf(fp, "\n");
+      for (int i = 0; i < Jc.rows(); i ++) {
+	for (int j = 0; j < Jc.cols(); j ++) {
+	  fprintf(fp, "%16.9e ", Jc(i, j));
+	}
+	fprintf(fp, "\n");
+      }
+      fclose(fp);
     }
-    fclose(fp);
     
-    sprintf(filename, "%s.love_JU", output_prefix);
-    fp = fopen(filename, "w");
-    if (fp == NULL) {
-      fprintf(stderr, "error: failed to create %s\n", filename);
-      return false;
-    }
-    for (int i = 0; i < JU.rows(); i ++) {
-      for (int j = 0; j < JU.cols(); j ++) {
-	fprintf(fp, "%16.9e ", JU(i, j));
+    if (compress) {
+      CompressedJacobian CJ;
+      CJ.compress(JU, compress_tolerance);
+      sprintf(filename, "%s.love_JU.lowrank", output_prefix);
+      if (!CJ.save(filename)) {
+	return false;
+      }
+    } else {
+      sprintf(filename, "%s.love_JU", output_prefix);
+      fp = fopen(filename, "w");
+      if (fp == NULL) {
+	fprintf(stderr, "error: failed to create %s\n", filename);
+	return false;
       }
-      fprintf(fp, "\n");
+      for (int i = 0; i < JU.rows(); i ++) {
+	for (int j = 0; j < JU.cols(); j ++) {
+	  fprintf(fp, "%16.9e ", JU(i, j));
+	}
+	fprintf(fp, "\n");
+      }
+      fclose(fp);
     }
-    fclose(fp);
 
     if (!rayleigh_jacobian(data_rayleigh,
 			   model,
@@ -1027,33 +2017,51 @@ static bool invert(DispersionData &data_love,
       return false;
     }
 
-    sprintf(filename, "%s.rayleigh_Jc", output_prefix);
-    fp = fopen(filename, "w");
-    if (fp == NULL) {
-      fprintf(stderr, "error: failed to create %s\n", filename);
-      return false;
-    }
-    for (int i = 0; i < Jc.rows(); i ++) {
-      for (int j = 0; j < Jc.cols(); j ++) {
-	fprintf(fp, "%16.9e ", Jc(i, j));
+    if (compress) {
+      CompressedJacobian CJ;
+      CJ.compress(Jc, compress_tolerance);
+      sprintf(filename, "%s.rayleigh_Jc.lowrank", output_prefix);
+      if (!CJ.save(filename)) {
+	return false;
+      }
+    } else {
+      sprintf(filename, "%s.rayleigh_Jc", output_prefix);
+      fp = fopen(filename, "w");
+      if (fp == NULL) {
+	fprintf(stderr, "error: failed to create %s\n", filename);
+	return false;
+      }
+      for (int i = 0; i < Jc.rows(); i ++) {
+	for (int j = 0; j < Jc.cols(); j ++) {
+	  fprintf(fp, "%16.9e ", Jc(i, j));
+	}
+	fprintf(fp, "\n");
       }
-      fprintf(fp, "\n");
+      fclose(fp);
     }
-    fclose(fp);
     
-    sprintf(filename, "%s.rayleigh_JU", output_prefix);
-    fp = fopen(filename, "w");
-    if (fp == NULL) {
-      fprintf(stderr, "error: failed to create %s\n", filename);
-      return false;
-    }
-    for (int i = 0; i < JU.rows(); i ++) {
-      for (int j = 0; j < JU.cols(); j ++) {
-	fprintf(fp, "%16.9e ", JU(i, j));
+    if (compress) {
+      CompressedJacobian CJ;
+      CJ.compress(JU, compress_tolerance);
+      sprintf(filename, "%s.rayleigh_JU.lowrank", output_prefix);
+      if (!CJ.save(filename)) {
+	return false;
       }
-      fprintf(fp, "\n");
+    } else {
+      sprintf(filename, "%s.rayleigh_JU", output_prefix);
+      fp = fopen(filename, "w");
+      if (fp == NULL) {
+	fprintf(stderr, "error: failed to create %s\n", filename);
+	return false;
+      }
+      for (int i = 0; i < JU.rows(); i ++) {
+	for (int j = 0; j < JU.cols(); j ++) {
+	  fprintf(fp, "%16.9e ", JU(i, j));
+	}
+	fprintf(fp, "\n");
+      }
+      fclose(fp);
     }
-    fclose(fp);
     
   }
   
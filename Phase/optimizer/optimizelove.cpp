@@ -32,7 +32,7 @@
 #include "simple.hpp"
 #include "quasinewton.hpp"
 
-static char short_options[] = "i:r:f:F:JR:V:X:S:o:s:p:b:t:P:e:N:QG:M:h";
+static char short_options[] = "i:r:f:F:JR:V:X:S:o:s:p:b:t:P:e:N:QG:M:C:H:h";
 static struct option long_options[] = {
   {"input", required_argument, 0, 'i'},
   {"reference", required_argument, 0, 'r'},
@@ -62,6 +62,9 @@ static struct option long_options[] = {
 
   {"gaussian-smooth", required_argument, 0, 'G'},
   {"mode", required_argument, 0, 'M'},
+
+  {"cache", required_argument, 0, 'C'},
+  {"counters", required_argument, 0, 'H'},
   
   {"help", no_argument, 0, 'h'},
   
@@ -98,6 +101,8 @@ int main(int argc, char *argv[])
   char *input_file;
   char *reference_file;
   char *output_file;
+  char *cache_directory;
+  char *counters_file;
 
   double fmin;
   double fmax;
@@ -131,6 +136,8 @@ int main(int argc, char *argv[])
   input_file = nullptr;
   reference_file = nullptr;
   output_file = nullptr;
+  cache_directory = nullptr;
+  counters_file = nullptr;
   threshold = 0.0;
 
   fmin = 1.0/40.0;
@@ -293,6 +300,15 @@ int main(int argc, char *argv[])
       }
       break;
 
+    case 'C':
+      cache_directory = optarg;
+      break;
+
+    case 'H':
+      counters_file = optarg;
+      PerfCounters::enable();
+      break;
+
     default:
       fprintf(stderr, "unknown option %c\n", c);
     case 'h':
@@ -317,6 +333,7 @@ int main(int argc, char *argv[])
   }
 
   DispersionData data(fmin, fmax);
+  data.cache_directory = cache_directory;
 
   if (!data.load(input_file)) {
     return -1;
@@ -378,6 +395,12 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  sprintf(filename, "%s.model.bin", output_file);
+  if (!snapshot_t::save(reference.model, filename)) {
+    fprintf(stderr, "error: failed to save model snapshot\n");
+    return -1;
+  }
+
   //
   // Save predictions
   //
@@ -387,6 +410,12 @@ int main(int argc, char *argv[])
     return -1;
   }
   
+  if (counters_file != nullptr) {
+    if (!PerfCounters::report(counters_file)) {
+      return -1;
+    }
+  }
+  
   return 0;
 }
 
@@ -399,6 +428,8 @@ void usage(const char *pname)
           " -i|--input <filename>           Input model (required)\n"
           " -f|--frequency <float>          Frequency\n"
           " -s|--scale <float>              Laguerre scaling (initial)\n"
+          " -C|--cache <dir>                Preprocessed spectra cache directory\n"
+          " -H|--counters <file>            Write per region hardware counters to file\n"
           "\n"
           " -h|--help                       Show usage information\n"
           "\n",
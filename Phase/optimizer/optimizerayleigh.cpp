@@ -32,7 +32,7 @@
 #include "simple.hpp"
 #include "quasinewton.hpp"
 
-static char short_options[] = "i:r:f:F:JR:V:X:S:o:s:p:b:t:P:e:N:D:QG:M:T:h";
+static char short_options[] = "i:r:f:F:JR:V:X:S:o:s:p:b:t:P:e:N:D:QG:M:T:C:H:h";
 static struct option long_options[] = {
   {"input", required_argument, 0, 'i'},
   {"reference", required_argument, 0, 'r'},
@@ -62,6 +62,9 @@ static struct option long_options[] = {
   
   {"gaussian-smooth", required_argument, 0, 'G'},
   {"mode", required_argument, 0, 'M'},
+
+  {"cache", required_argument, 0, 'C'},
+  {"counters", required_argument, 0, 'H'},
   
   {"skip", required_argument, 0, 'T'},
   
@@ -100,6 +103,8 @@ int main(int argc, char *argv[])
   char *input_file;
   char *reference_file;
   char *output_file;
+  char *cache_directory;
+  char *counters_file;
 
   double fmin;
   double fmax;
@@ -133,6 +138,8 @@ int main(int argc, char *argv[])
   input_file = nullptr;
   reference_file = nullptr;
   output_file = nullptr;
+  cache_directory = nullptr;
+  counters_file = nullptr;
   threshold = 0.0;
 
   fmin = 1.0/40.0;
@@ -312,6 +319,15 @@ int main(int argc, char *argv[])
       }
       break;
 
+    case 'C':
+      cache_directory = optarg;
+      break;
+
+    case 'H':
+      counters_file = optarg;
+      PerfCounters::enable();
+      break;
+
     case 'T':
       skip = atoi(optarg);
       if (skip < 0) {
@@ -344,6 +360,7 @@ int main(int argc, char *argv[])
   }
 
   DispersionData data(fmin, fmax);
+  data.cache_directory = cache_directory;
 
   if (!data.load(input_file)) {
     return -1;
@@ -405,6 +422,12 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  sprintf(filename, "%s.model.bin", output_file);
+  if (!snapshot_t::save(reference.model, filename)) {
+    fprintf(stderr, "error: failed to save model snapshot\n");
+    return -1;
+  }
+
   //
   // Save predictions
   //
@@ -414,6 +437,12 @@ int main(int argc, char *argv[])
     return -1;
   }
   
+  if (counters_file != nullptr) {
+    if (!PerfCounters::report(counters_file)) {
+      return -1;
+    }
+  }
+  
   return 0;
 }
 
@@ -426,6 +455,8 @@ void usage(const char *pname)
           " -i|--input <filename>           Input model (required)\n"
           " -f|--frequency <float>          Frequency\n"
           " -s|--scale <float>              Laguerre scaling (initial)\n"
+          " -C|--cache <dir>                Preprocessed spectra cache directory\n"
+          " -H|--counters <file>            Write per region hardware counters to file\n"
           "\n"
           " -h|--help                       Show usage information\n"
           "\n",
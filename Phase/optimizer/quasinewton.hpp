@@ -167,6 +167,8 @@ public:
 				Spec1DMatrix<double> &prior_model,
 				Spec1DMatrix<double> &proposed_model)
   {
+    PerfRegion region("QuasiNewton::ComputeStepJoint");
+    
     int Nd_love = residuals_love.rows();
     int Nd_rayleigh = residuals_rayleigh.rows();
     int Nd = Nd_love + Nd_rayleigh;
@@ -277,6 +279,87 @@ public:
     return true;
   }
 
+  virtual bool ComputeStepJointCompressed(double epsilon,
+					  Spec1DMatrix<double> &C_d_love,
+					  Spec1DMatrix<double> &C_d_rayleigh,
+					  Spec1DMatrix<double> &C_m,
+					  Spec1DMatrix<double> &residuals_love,
+					  Spec1DMatrix<double> &residuals_rayleigh,
+					  const JacobianOperator &G_love,
+					  const JacobianOperator &G_rayleigh,
+					  Spec1DMatrix<double> &dLdp,
+					  Spec1DMatrix<int> &model_mask,
+					  Spec1DMatrix<double> &current_model,
+					  Spec1DMatrix<double> &prior_model,
+					  Spec1DMatrix<double> &proposed_model)
+  {
+    PerfRegion region("QuasiNewton::ComputeStepJointCompressed");
+    
+    int Nm = current_model.rows();
+    
+    allocate(0, Nm);
+
+    //
+    // A = G^T C_d^-1 G + C_m^-1 assembled through the small cores of
+    // the structured Jacobians
+    //
+    Spec1DMatrix<double> normal;
+    normal.resize(Nm, Nm);
+    normal.setZero();
+    for (int i = 0; i < Nm; i ++) {
+      normal(i, i) = 1.0/C_m(i, 0);
+    }
+
+    G_love.add_normal(C_d_love, normal);
+    G_rayleigh.add_normal(C_d_rayleigh, normal);
+
+    //
+    // G^T C_d^-1 residuals
+    //
+    Spec1DMatrix<double> gradient;
+    gradient.resize(Nm, 1);
+    gradient.setZero();
+
+    G_love.add_weighted_transpose(C_d_love, residuals_love, gradient);
+    G_rayleigh.add_weighted_transpose(C_d_rayleigh, residuals_rayleigh, gradient);
+
+    //
+    // Set y vector (A m_current - mu [G^T Cd^-1 residuals + Cm^-1 (m_current - m_0)])
+    //
+    for (int i = 0; i < Nm; i ++) {
+
+      double s = -epsilon * (current_model(i, 0) - prior_model(i, 0))/C_m(i, 0);
+
+      for (int j = 0; j < Nm; j ++) {
+	gsl_matrix_set(A, i, j, normal(i, j));
+	s += normal(i, j) * current_model(j, 0);
+      }
+
+      s -= epsilon * gradient(i, 0);
+
+      gsl_vector_set(y, i, s);
+    }
+
+    //
+    // Solve A m_{n + 1} = y
+    //
+    int signum = 0;
+    if (gsl_linalg_LU_decomp(A, perm, &signum) < 0) {
+      fprintf(stderr, "error: failed to LU decomp matrix\n");
+      return false;
+    }
+
+    if (gsl_linalg_LU_solve(A, perm, y, mnp1) < 0) {
+      fprintf(stderr, "error: failed to LU solve new position\n");
+      return false;
+    }
+
+    for (int i = 0; i < Nm; i ++) {
+      proposed_model(i, 0) = gsl_vector_get(mnp1, i);
+    }
+
+    return true;
+  }
   
   void allocate(int Nd, int Nm)
   {
@@ -287,7 +370,8 @@ public:
       A = gsl_matrix_alloc(Nm, Nm);
     }
 
-    if (GTCdinv == nullptr || (int)GTCdinv->size1 != Nm || (int)GTCdinv->size2 != Nd) {
+    if (Nd > 0 &&
+	(GTCdinv == nullptr || (int)GTCdinv->size1 != Nm || (int)GTCdinv->size2 != Nd)) {
       if (GTCdinv != nullptr) {
 	gsl_matrix_free(GTCdinv);
       }
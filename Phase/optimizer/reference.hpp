@@ -38,15 +38,25 @@ public:
 
   bool load_model(const char *filename)
   {
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
+    if (snapshot_t::is_snapshot(filename)) {
+      if (!snapshot_t::load(model, filename)) {
+	fprintf(stderr, "error: failed to load model snapshot\n");
+	return false;
+      }
+
+      reference = model;
+      return true;
+    }
+    
+    TextReader in;
+    if (!in.open(filename)) {
       return false;
     }
 
     char cell[1024];
     char hs[1024];
 
-    if (fscanf(fp, "%s\n%s\n", cell, hs) != 2) {
+    if (!in.read_word(cell, sizeof(cell)) || !in.read_word(hs, sizeof(hs))) {
       fprintf(stderr, "error: failed to read cell and halfspace types\n");
       return false;
     }
@@ -60,17 +70,17 @@ public:
     }
     
     int maxorder;
-    if (fscanf(fp, "%d", &maxorder) != 1) {
+    if (!in.read_int(maxorder)) {
       fprintf(stderr, "error: failed to read max order\n");
       return false;
     }
 
-    if (!model.read(fp)) {
+    if (!model.read(in)) {
       fprintf(stderr, "error: failed to parse model\n");
       return false;
     }
 
-    fclose(fp);
+    in.close();
     
     
     reference = model;
@@ -81,14 +91,14 @@ public:
   bool load(const char *filename)
   {
 
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
+    TextReader in;
+    if (!in.open(filename)) {
       fprintf(stderr, "error: failed to open %s for reading\n", filename);
       return -1;
     }
     
     int nlayers;
-    if (fscanf(fp, "%d\n", &nlayers) != 1) {
+    if (!in.read_int(nlayers)) {
       fprintf(stderr, "error: failed to read no. layers\n");
       return false;
     }
@@ -99,7 +109,7 @@ public:
       int corder;
       double vs;
       double vsstd;
-      if (fscanf(fp, "%lf %d", &thicknesskm, &corder) != 2) {
+      if (!in.read_double(thicknesskm) || !in.read_int(corder)) {
 	fprintf(stderr, "error: failed to read line\n");
 	return false;
       }
@@ -123,7 +133,7 @@ public:
 	
 	for (int j = 0; j <= corder; j ++) {
 	  
-	  if (fscanf(fp, "%lf", &vs) != 1) {
+	  if (!in.read_double(vs)) {
 	    fprintf(stderr, "error: failed to read vs\n");
 	    return -1;
 	  }
@@ -137,13 +147,13 @@ public:
 	  model.cells[i].nodes[j] = cell_parameter_t(rho, vs, 1.0, vpvs);
 	}
 	
-	if (fscanf(fp, "%lf", &vsstd) != 1) {
+	if (!in.read_double(vsstd)) {
 	  fprintf(stderr, "error: failed to read vs error\n");
 	    return -1;
 	}
       
       } else {
-	if (fscanf(fp, "%lf %lf", &vs, &vsstd) != 2) {
+	if (!in.read_double(vs) || !in.read_double(vsstd)) {
 	  fprintf(stderr, "error: failed to read vs\n");
 	  return -1;
 	}
@@ -167,8 +177,9 @@ public:
       }
     }
       
-    fclose(fp);
+    in.close();
 
+    model.update_depth_index();
     reference = model;
     return true;
     
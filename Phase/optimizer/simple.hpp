@@ -147,6 +147,40 @@ public:
 
     return true;
   }
+
+  virtual bool ComputeStepJointCompressed(double epsilon,
+					  Spec1DMatrix<double> &C_d_love,
+					  Spec1DMatrix<double> &C_d_rayleigh,
+					  Spec1DMatrix<double> &C_m,
+					  Spec1DMatrix<double> &residuals_love,
+					  Spec1DMatrix<double> &residuals_rayleigh,
+					  const JacobianOperator &G_love,
+					  const JacobianOperator &G_rayleigh,
+					  Spec1DMatrix<double> &dLdp,
+					  Spec1DMatrix<int> &model_mask,
+					  Spec1DMatrix<double> &current_model,
+					  Spec1DMatrix<double> &prior_model,
+					  Spec1DMatrix<double> &proposed_model)
+  {
+    //
+    // Gradient step does not use the Jacobians
+    //
+    Spec1DMatrix<double> unused;
+    
+    return ComputeStepJoint(epsilon,
+			    C_d_love,
+			    C_d_rayleigh,
+			    C_m,
+			    residuals_love,
+			    residuals_rayleigh,
+			    unused,
+			    unused,
+			    dLdp,
+			    model_mask,
+			    current_model,
+			    prior_model,
+			    proposed_model);
+  }
   
 };
 
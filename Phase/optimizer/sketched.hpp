@@ -0,0 +1,375 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef sketched_hpp
+#define sketched_hpp
+
+#include <random>
+#include <vector>
+
+#include <math.h>
+
+#include "common.hpp"
+
+//
+// Sketched quasi-Newton step. The step of QuasiNewton solves
+//
+//   min || [C_D^-1/2 G; C_M^-1/2] dm + epsilon [C_D^-1/2 r; C_M^-1/2 (m_n - m_0)] ||
+//
+// Here the data rows are compressed by a sparse sign sketch (each row is
+// added with random sign to NONZEROS of factor x Nm sketch rows) and the
+// small problem solved through its Cholesky factor R. Optionally LSQR on
+// the full problem, right preconditioned by R^-1, refines the solution; as
+// the preconditioned system is well conditioned few iterations are needed.
+//
+class SketchedStep : public LeastSquaresIterator {
+public:
+
+  static constexpr int NONZEROS = 8;
+  static constexpr unsigned int SEED = 983;
+
+  SketchedStep(int _factor, int _lsqr_iterations) :
+    factor(_factor),
+    lsqr_iterations(_lsqr_iterations),
+    generator(SEED)
+  {
+  }
+  
+  virtual bool ComputeStep(double epsilon,
+			   Spec1DMatrix<double> &C_d,
+			   Spec1DMatrix<double> &C_m,
+			   Spec1DMatrix<double> &residuals,
+			   Spec1DMatrix<double> &G,
+			   Spec1DMatrix<double> &dLdp,
+			   Spec1DMatrix<int> &model_mask,
+			   Spec1DMatrix<double> &current_model,
+			   Spec1DMatrix<double> &prior_model,
+			   Spec1DMatrix<double> &proposed_model)
+  {
+    block b[1] = {{&C_d, &residuals, &G}};
+    
+    return step(epsilon, 1, b, C_m, current_model, prior_model, proposed_model);
+  }
+
+  virtual bool ComputeStepJoint(double epsilon,
+				Spec1DMatrix<double> &C_d_love,
+				Spec1DMatrix<double> &C_d_rayleigh,
+				Spec1DMatrix<double> &C_m,
+				Spec1DMatrix<double> &residuals_love,
+				Spec1DMatrix<double> &residuals_rayleigh,
+				Spec1DMatrix<double> &G_love,
+				Spec1DMatrix<double> &G_rayleigh,
+				Spec1DMatrix<double> &dLdp,
+				Spec1DMatrix<int> &model_mask,
+				Spec1DMatrix<double> &current_model,
+				Spec1DMatrix<double> &prior_model,
+				Spec1DMatrix<double> &proposed_model)
+  {
+    block b[2] = {
+      {&C_d_love, &residuals_love, &G_love},
+      {&C_d_rayleigh, &residuals_rayleigh, &G_rayleigh}
+    };
+    
+    return step(epsilon, 2, b, C_m, current_model, prior_model, proposed_model);
+  }
+
+private:
+
+  struct block {
+    const Spec1DMatrix<double> *Cd;
+    const Spec1DMatrix<double> *r;
+    const Spec1DMatrix<double> *G;
+  };
+
+  bool step(double epsilon,
+	    int nblocks,
+	    const block *blocks,
+	    const Spec1DMatrix<double> &C_m,
+	    const Spec1DMatrix<double> &current_model,
+	    const Spec1DMatrix<double> &prior_model,
+	    Spec1DMatrix<double> &proposed_model)
+  {
+    PerfRegion region("SketchedStep::step");
+    
+    int Nm = current_model.rows();
+    int Ns = factor * Nm;
+
+    //
+    // Sketch of C_D^-1/2 [G | r], r scaled by epsilon
+    //
+    SG.resize(Ns, Nm);
+    SG.setZero();
+    Sr.assign(Ns, 0.0);
+
+    std::uniform_int_distribution<int> row(0, Ns - 1);
+    double scale = 1.0/sqrt((double)NONZEROS);
+    
+    for (int b = 0; b < nblocks; b ++) {
+      const Spec1DMatrix<double> &G = *blocks[b].G;
+      const Spec1DMatrix<double> &Cd = *blocks[b].Cd;
+      const Spec1DMatrix<double> &r = *blocks[b].r;
+      
+      for (int i = 0; i < G.rows(); i ++) {
+	double w = 1.0/sqrt(Cd(i, 0));
+	
+	for (int l = 0; l < NONZEROS; l ++) {
+	  int h = row(generator);
+	  double s = (generator() & 1) ? w * scale : -w * scale;
+
+	  for (int j = 0; j < Nm; j ++) {
+	    SG(h, j) += s * G(i, j);
+	  }
+	  Sr[h] += s * epsilon * r(i, 0);
+	}
+      }
+    }
+
+    //
+    // Sketched normal equations N = (SG)^T SG + C_M^-1 = R^T R and
+    // right hand side -(SG)^T Sr - epsilon C_M^-1 (m_n - m_0)
+    //
+    R.resize(Nm, Nm);
+    dm.assign(Nm, 0.0);
+    for (int i = 0; i < Nm; i ++) {
+      for (int j = i; j < Nm; j ++) {
+	double s = (i == j) ? 1.0/C_m(i, 0) : 0.0;
+	for (int k = 0; k < Ns; k ++) {
+	  s += SG(k, i) * SG(k, j);
+	}
+	R(i, j) = s;
+      }
+
+      double s = -epsilon * (current_model(i, 0) - prior_model(i, 0))/C_m(i, 0);
+      for (int k = 0; k < Ns; k ++) {
+	s -= SG(k, i) * Sr[k];
+      }
+      dm[i] = s;
+    }
+
+    if (!upper_cholesky(R, Nm)) {
+      fprintf(stderr, "error: sketched normal matrix not positive definite\n");
+      return false;
+    }
+
+    upper_cholesky_solve_RT(R, dm);
+    upper_cholesky_solve_R(R, dm);
+
+    if (lsqr_iterations > 0) {
+      lsqr(epsilon, nblocks, blocks, C_m, current_model, prior_model);
+    }
+    
+    for (int i = 0; i < Nm; i ++) {
+      proposed_model(i, 0) = current_model(i, 0) + dm[i];
+    }
+
+    return true;
+  }
+
+  //
+  // u = A x for A = [C_D^-1/2 G; C_M^-1/2], u has data rows then model rows
+  //
+  static void apply(int nblocks,
+		    const block *blocks,
+		    const Spec1DMatrix<double> &C_m,
+		    const std::vector<double> &x,
+		    std::vector<double> &u)
+  {
+    int Nm = x.size();
+    int o = 0;
+    for (int b = 0; b < nblocks; b ++) {
+      const Spec1DMatrix<double> &G = *blocks[b].G;
+      const Spec1DMatrix<double> &Cd = *blocks[b].Cd;
+      for (int i = 0; i < G.rows(); i ++, o ++) {
+	double s = 0.0;
+	for (int j = 0; j < Nm; j ++) {
+	  s += G(i, j) * x[j];
+	}
+	u[o] = s/sqrt(Cd(i, 0));
+      }
+    }
+
+    for (int j = 0; j < Nm; j ++, o ++) {
+      u[o] = x[j]/sqrt(C_m(j, 0));
+    }
+  }
+
+  //
+  // x = A^T u
+  //
+  static void apply_transpose(int nblocks,
+			      const block *blocks,
+			      const Spec1DMatrix<double> &C_m,
+			      const std::vector<double> &u,
+			      std::vector<double> &x)
+  {
+    int Nm = x.size();
+    int o = 0;
+
+    x.assign(Nm, 0.0);
+    for (int b = 0; b < nblocks; b ++) {
+      const Spec1DMatrix<double> &G = *blocks[b].G;
+      const Spec1DMatrix<double> &Cd = *blocks[b].Cd;
+      for (int i = 0; i < G.rows(); i ++, o ++) {
+	double w = u[o]/sqrt(Cd(i, 0));
+	for (int j = 0; j < Nm; j ++) {
+	  x[j] += G(i, j) * w;
+	}
+      }
+    }
+
+    for (int j = 0; j < Nm; j ++, o ++) {
+      x[j] += u[o]/sqrt(C_m(j, 0));
+    }
+  }
+
+  static double normalize(std::vector<double> &x)
+  {
+    double s = 0.0;
+    for (auto v : x) {
+      s += v*v;
+    }
+    s = sqrt(s);
+    if (s > 0.0) {
+      for (auto &v : x) {
+	v /= s;
+      }
+    }
+    return s;
+  }
+
+  //
+  // LSQR (Paige and Saunders 1982) for min ||A dm - c|| with
+  // c = -epsilon [C_D^-1/2 r; C_M^-1/2 (m_n - m_0)], on the operator A R^-1
+  // and started from the sketched solution in dm.
+  //
+  void lsqr(double epsilon,
+	    int nblocks,
+	    const block *blocks,
+	    const Spec1DMatrix<double> &C_m,
+	    const Spec1DMatrix<double> &current_model,
+	    const Spec1DMatrix<double> &prior_model)
+  {
+    int Nm = dm.size();
+    int Nd = 0;
+    for (int b = 0; b < nblocks; b ++) {
+      Nd += blocks[b].G->rows();
+    }
+
+    std::vector<double> u(Nd + Nm);
+    std::vector<double> v(Nm);
+    std::vector<double> w(Nm);
+    std::vector<double> x(Nm, 0.0);
+    std::vector<double> t(Nm);
+    std::vector<double> Au(Nd + Nm);
+
+    //
+    // u = c - A dm
+    //
+    apply(nblocks, blocks, C_m, dm, Au);
+    int o = 0;
+    for (int b = 0; b < nblocks; b ++) {
+      const Spec1DMatrix<double> &Cd = *blocks[b].Cd;
+      const Spec1DMatrix<double> &r = *blocks[b].r;
+      for (int i = 0; i < r.rows(); i ++, o ++) {
+	u[o] = -epsilon * r(i, 0)/sqrt(Cd(i, 0)) - Au[o];
+      }
+    }
+    for (int j = 0; j < Nm; j ++, o ++) {
+      u[o] = -epsilon * (current_model(j, 0) - prior_model(j, 0))/sqrt(C_m(j, 0)) - Au[o];
+    }
+
+    double beta = normalize(u);
+    if (beta == 0.0) {
+      return;
+    }
+    
+    apply_transpose(nblocks, blocks, C_m, u, v);
+    upper_cholesky_solve_RT(R, v);
+    double alpha = normalize(v);
+    
+    w = v;
+    double phibar = beta;
+    double rhobar = alpha;
+    double initial = alpha * beta;
+    int iterations = 0;
+    
+    for (; iterations < lsqr_iterations && initial > 0.0; iterations ++) {
+
+      t = v;
+      upper_cholesky_solve_R(R, t);
+      apply(nblocks, blocks, C_m, t, Au);
+      for (size_t i = 0; i < u.size(); i ++) {
+	u[i] = Au[i] - alpha * u[i];
+      }
+      beta = normalize(u);
+
+      apply_transpose(nblocks, blocks, C_m, u, t);
+      upper_cholesky_solve_RT(R, t);
+      for (int j = 0; j < Nm; j ++) {
+	v[j] = t[j] - beta * v[j];
+      }
+      alpha = normalize(v);
+
+      double rho = sqrt(rhobar*rhobar + beta*beta);
+      double c = rhobar/rho;
+      double s = beta/rho;
+      double theta = s * alpha;
+      rhobar = -c * alpha;
+      double phi = c * phibar;
+      phibar = s * phibar;
+
+      for (int j = 0; j < Nm; j ++) {
+	x[j] += (phi/rho) * w[j];
+	w[j] = v[j] - (theta/rho) * w[j];
+      }
+
+      //
+      // ||(A R^-1)^T residual|| relative to its initial value
+      //
+      if (fabs(phibar * alpha * c) < 1.0e-12 * initial) {
+	iterations ++;
+	break;
+      }
+    }
+
+    upper_cholesky_solve_R(R, x);
+    for (int j = 0; j < Nm; j ++) {
+      dm[j] += x[j];
+    }
+
+    printf("LSQR: %d iterations\n", iterations);
+  }
+
+  int factor;
+  int lsqr_iterations;
+  std::mt19937 generator;
+
+  Spec1DMatrix<double> SG;
+  std::vector<double> Sr;
+  Spec1DMatrix<double> R;
+  std::vector<double> dm;
+};
+
+#endif // sketched_hpp
@@ -0,0 +1,233 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef spectrumcache_hpp
+#define spectrumcache_hpp
+
+#include <vector>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spec1d/encodedecode.hpp"
+
+//
+// On disk cache of preprocessed spectra. Each entry is a single file named
+// by its content key in the cache directory. The file holds a fixed header
+// followed by the raw doubles, so it is mapped and copied out in one pass.
+//
+//   magic     8 bytes "AKICACHE"
+//   version   int
+//   kind      8 bytes, e.g. "envelope"
+//   key       uint64
+//   count     int64   no. doubles
+//   checksum  uint64  FNV-1a of the doubles
+//   values    count doubles
+//
+// The key is computed by the caller from the input spectrum and every
+// parameter that affects the result, so a stale entry is never matched.
+// Entries are written to a temporary file and renamed into place so
+// concurrent jobs sharing a cache directory never see partial files.
+//
+class SpectrumCache {
+public:
+
+  static constexpr int VERSION = 1;
+  static constexpr int HEADER_SIZE = 8 + sizeof(int) + 8 + 2*sizeof(uint64_t) + sizeof(int64_t);
+  
+  SpectrumCache(const char *_directory) :
+    directory(_directory)
+  {
+  }
+
+  bool load(const char *kind, uint64_t key, std::vector<double> &values) const
+  {
+    char filename[1024];
+    entry_filename(kind, key, filename, sizeof(filename));
+    return load_file(filename, kind, key, values);
+  }
+
+  bool save(const char *kind, uint64_t key, const std::vector<double> &values) const
+  {
+    char filename[1024];
+    entry_filename(kind, key, filename, sizeof(filename));
+    return save_file(filename, kind, key, values);
+  }
+
+  //
+  // Single entry access by file name for other users of the format. Loading
+  // fails unless the kind and key both match.
+  //
+  static bool load_file(const char *filename,
+			const char *kind,
+			uint64_t key,
+			std::vector<double> &values)
+  {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < HEADER_SIZE) {
+      close(fd);
+      return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+      return false;
+    }
+
+    bool r = decode_entry((const char*)m, size, kind, key, values);
+    munmap(m, size);
+    return r;
+  }
+
+  static bool save_file(const char *filename,
+			const char *kind,
+			uint64_t key,
+			const std::vector<double> &values)
+  {
+    char tmpfilename[1100];
+    snprintf(tmpfilename, sizeof(tmpfilename), "%s.%d.tmp", filename, (int)getpid());
+
+    char header[HEADER_SIZE];
+    char k[8];
+    int offset = 0;
+
+    int version = VERSION;
+
+    memset(k, 0, sizeof(k));
+    memcpy(k, kind, std::min(strlen(kind), sizeof(k)));
+    
+    memcpy(header, MAGIC(), 8);
+    offset += 8;
+    ::encode<int>(version, header, offset, HEADER_SIZE);
+    memcpy(header + offset, k, 8);
+    offset += 8;
+    ::encode<uint64_t>(key, header, offset, HEADER_SIZE);
+    ::encode<int64_t>((int64_t)values.size(), header, offset, HEADER_SIZE);
+    ::encode<uint64_t>(fnv1a(values.data(), values.size() * sizeof(double)), header, offset, HEADER_SIZE);
+
+    FILE *fp = fopen(tmpfilename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "warning: failed to create cache entry %s\n", tmpfilename);
+      return false;
+    }
+
+    bool r = (fwrite(header, HEADER_SIZE, 1, fp) == 1);
+    if (r && values.size() > 0) {
+      r = (fwrite(values.data(), sizeof(double) * values.size(), 1, fp) == 1);
+    }
+    if (fclose(fp) != 0) {
+      r = false;
+    }
+    
+    if (!r || rename(tmpfilename, filename) != 0) {
+      fprintf(stderr, "warning: failed to write cache entry %s\n", filename);
+      unlink(tmpfilename);
+      return false;
+    }
+
+    return true;
+  }
+
+private:
+
+  static const char *MAGIC()
+  {
+    return "AKICACHE";
+  }
+
+  void entry_filename(const char *kind, uint64_t key, char *filename, size_t size) const
+  {
+    snprintf(filename, size, "%s/%016llx.%s", directory, (unsigned long long)key, kind);
+  }
+
+  static bool decode_entry(const char *buffer,
+			   size_t size,
+			   const char *kind,
+			   uint64_t key,
+			   std::vector<double> &values)
+  {
+    int offset = 0;
+    int version;
+    char k[8];
+    uint64_t fkey;
+    int64_t count;
+    uint64_t sum;
+
+    if (memcmp(buffer, MAGIC(), 8) != 0) {
+      return false;
+    }
+    offset += 8;
+
+    if (::decode<int>(version, buffer, offset, HEADER_SIZE) < 0) {
+      return false;
+    }
+    memcpy(k, buffer + offset, 8);
+    offset += 8;
+    if (::decode<uint64_t>(fkey, buffer, offset, HEADER_SIZE) < 0 ||
+	::decode<int64_t>(count, buffer, offset, HEADER_SIZE) < 0 ||
+	::decode<uint64_t>(sum, buffer, offset, HEADER_SIZE) < 0) {
+      return false;
+    }
+
+    if (version != VERSION ||
+	strncmp(k, kind, sizeof(k)) != 0 ||
+	fkey != key ||
+	count < 0 ||
+	size != HEADER_SIZE + (size_t)count * sizeof(double)) {
+      return false;
+    }
+
+    const char *data = buffer + HEADER_SIZE;
+    if (fnv1a(data, count * sizeof(double)) != sum) {
+      fprintf(stderr, "warning: cache entry checksum mismatch, recomputing\n");
+      return false;
+    }
+
+    values.resize(count);
+    if (count > 0) {
+      memcpy(values.data(), data, count * sizeof(double));
+    }
+    return true;
+  }
+  
+  const char *directory;
+  
+};
+
+#endif // spectrumcache_hpp
@@ -0,0 +1,667 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+//
+// Checks the batched eigenfunction and depth kernel panels of
+// spec1d/depthpanel.hpp for a model. The panel eigenfunctions on a depth
+// grid are compared with the point-wise interpolate_eigenvector of the
+// solvers, and the Vs, Xi and rho kernels integrated over each model cell
+// and the halfspace with the quadrature of the mesh are compared with
+// central finite differences of k. Exits with a non zero status if the
+// largest relative error exceeds the tolerance.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "spec1d/depthpanel.hpp"
+
+#include "reference.hpp"
+
+typedef LoveDepthPanel<double, MAXORDER> lovepanel_t;
+typedef RayleighDepthPanel<double, MAXORDER> rayleighpanel_t;
+typedef MeshAmplitude<double, MAXORDER, MAXORDER> amplitude_t;
+
+static char short_options[] = "r:f:F:k:d:o:s:p:b:e:x:h";
+static struct option long_options[] = {
+  {"reference", required_argument, 0, 'r'},
+
+  {"fmin", required_argument, 0, 'f'},
+  {"fmax", required_argument, 0, 'F'},
+  {"frequencies", required_argument, 0, 'k'},
+  {"depths", required_argument, 0, 'd'},
+
+  {"output", required_argument, 0, 'o'},
+
+  {"scale", required_argument, 0, 's'},
+  {"order", required_argument, 0, 'p'},
+  {"boundaryorder", required_argument, 0, 'b'},
+
+  {"step", required_argument, 0, 'e'},
+  {"tolerance", required_argument, 0, 'x'},
+
+  {"help", no_argument, 0, 'h'},
+
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *pname);
+
+//
+// Kernel names and the index of the matching model parameter
+//
+static const char *kernel_names[3] = {"Kvs", "Kxi", "Krho"};
+static const int kernel_parameters[3] = {1, 2, 0};
+
+static double wavenumber(lovesolver_t &love,
+			 const mesh_t &mesh,
+			 int boundaryorder,
+			 double omega,
+			 double scale)
+{
+  double normA, normB, normC;
+  love.recompute(mesh, boundaryorder, scale);
+  return love.solve_fundamental_sep(omega, normA, normB, normC);
+}
+
+static double wavenumber(rayleighsolver_t &rayleigh,
+			 const mesh_t &mesh,
+			 int boundaryorder,
+			 double omega,
+			 double scale)
+{
+  double normA, normB, normC, normD, gamma, delta;
+  rayleigh.recompute(mesh, boundaryorder, scale, scale);
+  return fabs(rayleigh.solve_fundamental_scaled(omega, normA, normB, normC, normD, gamma, delta));
+}
+
+static double panel_scale(const lovepanel_t &p, int i)
+{
+  return p.scales[i];
+}
+
+static double panel_scale(const rayleighpanel_t &p, int i)
+{
+  return p.scalesx[i];
+}
+
+//
+// Largest difference of the panel eigenfunctions from the point-wise
+// interpolation relative to the largest value of each frequency
+//
+static double eigenfunction_error(lovepanel_t &p,
+				  const DepthPanel<double> &panel,
+				  const mesh_t &mesh,
+				  int boundaryorder)
+{
+  Spec1DMatrix<double> v;
+  v.resize(p.x.rows(), 1);
+  amplitude_t amplitude;
+
+  double worst = 0.0;
+  for (int i = 0; i < (int)panel.omega.size(); i ++) {
+
+    for (int j = 0; j < p.x.rows(); j ++) {
+      v(j, 0) = p.x(j, i);
+    }
+    amplitude.cells.clear();
+    p.solver.fill_amplitude(mesh, v, boundaryorder, amplitude);
+    p.solver.laguerrescale = p.scales[i];
+
+    double vmax = 0.0;
+    double emax = 0.0;
+    for (int d = 0; d < (int)panel.depth.size(); d ++) {
+      double V = p.solver.interpolate_eigenvector(amplitude, panel.depth[d]);
+      vmax = std::max(vmax, fabs(V));
+      emax = std::max(emax, fabs(V - panel.V(i, d)));
+    }
+
+    if (!(vmax > 0.0)) {
+      return INFINITY;
+    }
+    worst = std::max(worst, emax/vmax);
+  }
+
+  return worst;
+}
+
+static double eigenfunction_error(rayleighpanel_t &p,
+				  const DepthPanel<double> &panel,
+				  const mesh_t &mesh,
+				  int boundaryorder)
+{
+  Spec1DMatrix<double> v;
+  v.resize(p.x.rows(), 1);
+  amplitude_t amplitude;
+
+  double worst = 0.0;
+  for (int i = 0; i < (int)panel.omega.size(); i ++) {
+
+    for (int j = 0; j < p.x.rows(); j ++) {
+      v(j, 0) = p.x(j, i);
+    }
+    p.solver.fill_amplitude(mesh, v, boundaryorder, amplitude);
+    p.solver.laguerrescalex = p.scalesx[i];
+    p.solver.laguerrescalez = p.scalesz[i];
+
+    double vmax = 0.0;
+    double emax = 0.0;
+    for (int d = 0; d < (int)panel.depth.size(); d ++) {
+      double u, w;
+      p.solver.interpolate_eigenvector(amplitude, panel.depth[d], u, w);
+      vmax = std::max(vmax, std::max(fabs(u), fabs(w)));
+      emax = std::max(emax, std::max(fabs(u - panel.U(i, d)), fabs(w - panel.W(i, d))));
+    }
+
+    if (!(vmax > 0.0)) {
+      return INFINITY;
+    }
+    worst = std::max(worst, emax/vmax);
+  }
+
+  return worst;
+}
+
+static const Spec1DMatrix<double> &kernel(const DepthPanel<double> &panel, int t)
+{
+  switch (t) {
+  case 0:
+    return panel.Kvs;
+  case 1:
+    return panel.Kxi;
+  default:
+    return panel.Krho;
+  }
+}
+
+//
+// Eigenfunction and kernel checks of one wave type, returns the largest
+// relative error or infinity if a forward solve failed
+//
+template
+<
+  typename panel_t
+>
+static double check_wave(const char *name,
+			 panel_t &p,
+			 model_t &model,
+			 const std::vector<double> &omegas,
+			 int ndepths,
+			 int order,
+			 int boundaryorder,
+			 double scale,
+			 double step,
+			 FILE *fp_detail)
+{
+  constexpr double FLOOR = 1.0e-3;
+
+  typename panel_t::solver_t &solver = p.solver;
+  const mesh_t &mesh = p.mesh;
+  int nf = omegas.size();
+  int ncells = model.cells.size();
+
+  //
+  // Eigenfunctions on a regular grid through the cells and into the
+  // halfspace
+  //
+  double halfspace_top = 0.0;
+  for (auto &cell : mesh.cells) {
+    halfspace_top += cell.thickness;
+  }
+
+  std::vector<double> depths(ndepths);
+  for (int d = 0; d < ndepths; d ++) {
+    depths[d] = 1.5 * halfspace_top * (double)d/(double)ndepths;
+  }
+
+  DepthPanel<double> panel;
+  if (!p.compute(omegas, depths, scale, panel)) {
+    return INFINITY;
+  }
+
+  double worst = eigenfunction_error(p, panel, mesh, boundaryorder);
+  printf("%-6s %-8s %10.3e\n", "eigen", name, worst);
+
+  std::vector<double> scales(nf);
+  for (int i = 0; i < nf; i ++) {
+    scales[i] = panel_scale(p, i);
+  }
+
+  //
+  // Kernels at the Lobatto nodes of each cell, with the last node moved
+  // just above the cell bottom so that it takes the derivatives of its own
+  // cell, and the matching quadrature weights. Rows are the model cells and
+  // then the halfspace.
+  //
+  std::vector<double> weights;
+  std::vector<int> owner;
+  depths.clear();
+
+  double top = 0.0;
+  for (int c = 0; c < ncells; c ++) {
+    const LobattoQuadrature<double, MAXORDER> &lobatto = *solver.Lobatto[mesh.cells[c].order];
+    double thickness = mesh.cells[c].thickness;
+    for (size_t j = 0; j <= lobatto.n; j ++) {
+      double xi = lobatto.nodes[j];
+      if (j == lobatto.n) {
+	xi -= 1.0e-9;
+      }
+      depths.push_back(top + (xi + 1.0)/2.0 * thickness);
+      weights.push_back(lobatto.weights[j] * thickness/2.0);
+      owner.push_back(c);
+    }
+    top += thickness;
+  }
+
+  std::vector<std::vector<double>> adjoint(nf * 3, std::vector<double>(ncells + 1, 0.0));
+
+  if (!p.compute(omegas, depths, scale, panel)) {
+    return INFINITY;
+  }
+
+  for (int i = 0; i < nf; i ++) {
+    for (int t = 0; t < 3; t ++) {
+      const Spec1DMatrix<double> &K = kernel(panel, t);
+      for (size_t d = 0; d < depths.size(); d ++) {
+	adjoint[i * 3 + t][owner[d]] += weights[d] * K(i, d);
+      }
+    }
+  }
+
+  //
+  // The Laguerre scale of the halfspace changes with frequency so its
+  // kernels are integrated one frequency at a time
+  //
+  const LaguerreQuadrature<double, MAXORDER> &laguerre = *solver.Laguerre[boundaryorder];
+  for (int i = 0; i < nf; i ++) {
+
+    std::vector<double> omega(1, omegas[i]);
+    depths.clear();
+    for (size_t j = 0; j <= laguerre.n; j ++) {
+      depths.push_back(halfspace_top + laguerre.nodes[j]/scales[i]);
+    }
+
+    DepthPanel<double> halfspace;
+    if (!p.compute(omega, depths, scales[i], halfspace)) {
+      return INFINITY;
+    }
+
+    for (int t = 0; t < 3; t ++) {
+      const Spec1DMatrix<double> &K = kernel(halfspace, t);
+      for (size_t j = 0; j <= laguerre.n; j ++) {
+	adjoint[i * 3 + t][ncells] += laguerre.weights[j]/scales[i] * K(0, j);
+      }
+    }
+  }
+
+  //
+  // Central differences of k with the Laguerre scales of the panel
+  //
+  std::vector<std::vector<double>> difference(nf * 3, std::vector<double>(ncells + 1, NAN));
+  mesh_t perturbed;
+  std::vector<double> kplus(nf);
+  std::vector<double> kminus(nf);
+
+  for (int c = 0; c <= ncells; c ++) {
+    for (int t = 0; t < 3; t ++) {
+
+      int j = kernel_parameters[t];
+      double h;
+
+      if (c < ncells) {
+	cell_t &cell = model.cells[c];
+	double vmax = 0.0;
+	for (size_t n = 0; n <= cell.order[j]; n ++) {
+	  vmax = std::max(vmax, fabs(cell.nodes[n][j]));
+	}
+	h = step * vmax;
+      } else {
+	h = step * fabs(model.boundary.parameters[j]);
+      }
+
+      for (int sign = 1; sign >= -1; sign -= 2) {
+
+	if (c < ncells) {
+	  cell_t &cell = model.cells[c];
+	  for (size_t n = 0; n <= cell.order[j]; n ++) {
+	    cell.nodes[n][j] += sign * h;
+	  }
+	} else {
+	  model.boundary.parameters[j] += sign * h;
+	}
+
+	model.project_gradient(perturbed, order);
+	for (int i = 0; i < nf; i ++) {
+	  double k = wavenumber(solver, perturbed, boundaryorder, omegas[i], scales[i]);
+	  if (sign > 0) {
+	    kplus[i] = k;
+	  } else {
+	    kminus[i] = k;
+	  }
+	}
+
+	if (c < ncells) {
+	  cell_t &cell = model.cells[c];
+	  for (size_t n = 0; n <= cell.order[j]; n ++) {
+	    cell.nodes[n][j] -= sign * h;
+	  }
+	} else {
+	  model.boundary.parameters[j] -= sign * h;
+	}
+      }
+
+      for (int i = 0; i < nf; i ++) {
+	if (kplus[i] > 0.0 && kminus[i] > 0.0) {
+	  difference[i * 3 + t][c] = (kplus[i] - kminus[i])/(2.0 * h);
+	}
+      }
+    }
+  }
+
+  //
+  // Errors relative to the integrated kernel, or to a small fraction of the
+  // largest value over the cells for the near zero entries
+  //
+  for (int t = 0; t < 3; t ++) {
+
+    double maxerr = 0.0;
+    int worst_cell = -1;
+    double worst_frequency = 0.0;
+
+    for (int i = 0; i < nf; i ++) {
+      const std::vector<double> &a = adjoint[i * 3 + t];
+      const std::vector<double> &fd = difference[i * 3 + t];
+
+      double rowmax = 0.0;
+      for (auto v : a) {
+	rowmax = std::max(rowmax, fabs(v));
+      }
+
+      for (int c = 0; c <= ncells; c ++) {
+	double denom = std::max(fabs(a[c]), FLOOR * rowmax);
+	double e = 0.0;
+	if (std::isnan(fd[c])) {
+	  e = INFINITY;
+	} else if (denom > 0.0) {
+	  e = fabs(fd[c] - a[c])/denom;
+	}
+
+	if (fp_detail != nullptr) {
+	  fprintf(fp_detail, "%s %s %.6f %d %16.9e %16.9e %10.3e\n",
+		  kernel_names[t], name, omegas[i]/(2.0 * M_PI), c, a[c], fd[c], e);
+	}
+
+	if (e > maxerr || worst_cell < 0) {
+	  maxerr = std::max(maxerr, e);
+	  worst_cell = c;
+	  worst_frequency = omegas[i]/(2.0 * M_PI);
+	}
+      }
+    }
+
+    printf("%-6s %-8s %10.3e %5d %.6f\n", kernel_names[t], name, maxerr, worst_cell, worst_frequency);
+    worst = std::max(worst, maxerr);
+  }
+
+  return worst;
+}
+
+int main(int argc, char *argv[])
+{
+  int c;
+  int option_index;
+
+  char *reference_file;
+  char *output_file;
+  int order;
+  int boundaryorder;
+  double scale;
+
+  double fmin;
+  double fmax;
+  int nfrequencies;
+  int ndepths;
+
+  double step;
+  double tolerance;
+
+  //
+  // Defaults
+  //
+  reference_file = nullptr;
+  output_file = nullptr;
+
+  order = 5;
+  boundaryorder = 5;
+
+  scale = 1.0e-4;
+
+  fmin = 1.0/40.0;
+  fmax = 1.0/2.0;
+  nfrequencies = 4;
+  ndepths = 200;
+
+  step = 1.0e-5;
+  tolerance = 1.0e-4;
+
+  //
+  // Command line parameters
+  //
+  option_index = 0;
+  while (true) {
+
+    c = getopt_long(argc, argv, short_options, long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+
+    case 'r':
+      reference_file = optarg;
+      break;
+
+    case 'o':
+      output_file = optarg;
+      break;
+
+    case 'f':
+      fmin = atof(optarg);
+      if (fmin <= 0.0) {
+	fprintf(stderr, "error: fmin must be greater than 0\n");
+	return -1;
+      }
+      break;
+
+    case 'F':
+      fmax = atof(optarg);
+      if (fmax <= 0.0) {
+	fprintf(stderr, "error: fmax must be greater than 0\n");
+	return -1;
+      }
+      break;
+
+    case 'k':
+      nfrequencies = atoi(optarg);
+      if (nfrequencies < 1) {
+	fprintf(stderr, "error: frequencies must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'd':
+      ndepths = atoi(optarg);
+      if (ndepths < 1) {
+	fprintf(stderr, "error: depths must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 's':
+      scale = atof(optarg);
+      if (scale <= 0.0) {
+        fprintf(stderr, "error: scale must be positive\n");
+        return -1;
+      }
+      break;
+
+    case 'p':
+      order = atoi(optarg);
+      if (order < 1 || order > MAXORDER) {
+        fprintf(stderr, "error: order must be between 1 and %d\n", MAXORDER);
+        return -1;
+      }
+      break;
+
+    case 'b':
+      boundaryorder = atoi(optarg);
+      if (boundaryorder < 1 || boundaryorder > BOUNDARYORDER) {
+        fprintf(stderr, "error: boundary order must be between 1 and %d\n", BOUNDARYORDER);
+        return -1;
+      }
+      break;
+
+    case 'e':
+      step = atof(optarg);
+      if (step <= 0.0) {
+	fprintf(stderr, "error: step must be positive\n");
+	return -1;
+      }
+      break;
+
+    case 'x':
+      tolerance = atof(optarg);
+      if (tolerance <= 0.0) {
+	fprintf(stderr, "error: tolerance must be positive\n");
+	return -1;
+      }
+      break;
+
+    default:
+      fprintf(stderr, "unknown option %c\n", c);
+    case 'h':
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (reference_file == nullptr) {
+    fprintf(stderr, "error: missing reference file parameter\n");
+    return -1;
+  }
+
+  if (fmax <= fmin) {
+    fprintf(stderr, "error: fmax must be greater than fmin\n");
+    return -1;
+  }
+
+  ReferenceModel reference;
+  if (!reference.load_model(reference_file)) {
+    fprintf(stderr, "error: failed to load model from %s\n", reference_file);
+    return -1;
+  }
+
+  //
+  // Frequencies from high to low as the panels update the Laguerre scale
+  // from each solution
+  //
+  std::vector<double> omegas(nfrequencies);
+  for (int i = 0; i < nfrequencies; i ++) {
+    double f = fmax;
+    if (nfrequencies > 1) {
+      f -= (fmax - fmin) * (double)i/(double)(nfrequencies - 1);
+    }
+    omegas[i] = 2.0 * M_PI * f;
+  }
+
+  FILE *fp_detail = nullptr;
+  if (output_file != nullptr) {
+    fp_detail = fopen(output_file, "w");
+    if (fp_detail == NULL) {
+      fprintf(stderr, "error: failed to create %s\n", output_file);
+      return -1;
+    }
+
+    fprintf(fp_detail, "# kernel wave frequency cell integrated difference relerr\n");
+  }
+
+  model_t &model = reference.model;
+  mesh_t mesh;
+  model.project_gradient(mesh, order);
+
+  lovesolver_t love;
+  rayleighsolver_t rayleigh;
+  lovepanel_t love_panel(love, mesh, boundaryorder);
+  rayleighpanel_t rayleigh_panel(rayleigh, mesh, boundaryorder);
+
+  printf("Checking %d frequencies over %d cells and the halfspace\n", nfrequencies, (int)model.cells.size());
+  printf("# quantity wave max_relerr worst_cell worst_frequency\n");
+
+  double worst = 0.0;
+  worst = std::max(worst, check_wave("love", love_panel, model, omegas, ndepths,
+				     order, boundaryorder, scale, step, fp_detail));
+  worst = std::max(worst, check_wave("rayleigh", rayleigh_panel, model, omegas, ndepths,
+				     order, boundaryorder, scale, step, fp_detail));
+
+  if (fp_detail != nullptr) {
+    fclose(fp_detail);
+  }
+
+  if (!(worst <= tolerance)) {
+    printf("FAIL: largest relative error %10.3e exceeds %10.3e\n", worst, tolerance);
+    return 1;
+  }
+
+  printf("PASS: largest relative error %10.3e\n", worst);
+  return 0;
+}
+
+void usage(const char *pname)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "where options is one or more of:\n"
+          "\n"
+          " -r|--reference <filename>             Model (required)\n"
+          " -f|--fmin <float>                     Minimum frequency\n"
+          " -F|--fmax <float>                     Maximum frequency\n"
+          " -k|--frequencies <int>                Frequencies checked per wave type (default 4)\n"
+          " -d|--depths <int>                     Eigenfunction check depths (default 200)\n"
+          " -o|--output <filename>                Per cell kernel errors (default none)\n"
+          " -s|--scale <float>                    Laguerre scaling (initial)\n"
+          " -p|--order <int>                      Mesh order\n"
+          " -b|--boundaryorder <int>              Boundary order\n"
+          "\n"
+          " -e|--step <float>                     Relative finite difference step (default 1e-5)\n"
+          " -x|--tolerance <float>                Largest relative error accepted (default 1e-4)\n"
+          "\n"
+          " -h|--help                             Show usage information\n"
+          "\n",
+          pname);
+}
@@ -0,0 +1,1052 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+//
+// Checks the adjoint gradients of k, U, the Bessel prediction and the
+// likelihood against central finite differences at a few frequencies of a
+// station pair. The perturbed forward solves are spread over worker
+// threads, one parameter at a time. The Hessian-vector products of k and of
+// the likelihood (Newton-CG) in a random direction are checked against
+// central differences of the adjoint gradients along it. Exits with a non
+// zero status if the largest relative error exceeds the tolerance.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "likelihood.hpp"
+
+static char short_options[] = "i:I:r:f:F:o:s:p:b:t:P:G:k:n:S:e:x:j:h";
+static struct option long_options[] = {
+  {"input-love", required_argument, 0, 'i'},
+  {"input-rayleigh", required_argument, 0, 'I'},
+
+  {"reference", required_argument, 0, 'r'},
+
+  {"fmin", required_argument, 0, 'f'},
+  {"fmax", required_argument, 0, 'F'},
+
+  {"output", required_argument, 0, 'o'},
+
+  {"scale", required_argument, 0, 's'},
+  {"order", required_argument, 0, 'p'},
+  {"boundaryorder", required_argument, 0, 'b'},
+  {"threshold", required_argument, 0, 't'},
+  {"high-order", required_argument, 0, 'P'},
+
+  {"gaussian-smooth", required_argument, 0, 'G'},
+
+  {"frequencies", required_argument, 0, 'k'},
+  {"parameters", required_argument, 0, 'n'},
+  {"seed", required_argument, 0, 'S'},
+  {"step", required_argument, 0, 'e'},
+  {"tolerance", required_argument, 0, 'x'},
+
+  {"threads", required_argument, 0, 'j'},
+
+  {"help", no_argument, 0, 'h'},
+
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *pname);
+
+//
+// Inputs and work space of one worker thread
+//
+struct GradientWorker {
+
+  GradientWorker(double fmin, double fmax) :
+    data_love(fmin, fmax),
+    data_rayleigh(fmin, fmax)
+  {
+  }
+
+  DispersionData data_love;
+  DispersionData data_rayleigh;
+  ReferenceModel reference;
+
+  mesh_t mesh;
+  mesh_t curvature;
+  lovesolver_t love;
+  rayleighsolver_t rayleigh;
+  love_hessian_t hessian_love;
+  rayleigh_hessian_t hessian_rayleigh;
+};
+
+//
+// Predictions at the checked frequencies, Love followed by Rayleigh
+//
+struct GradientPoint {
+  double like;
+  std::vector<double> k;
+  std::vector<double> U;
+  std::vector<double> bessel;
+};
+
+//
+// Adjoint gradients with one row per checked frequency
+//
+struct GradientAdjoint {
+  std::vector<std::vector<double>> dk;
+  std::vector<std::vector<double>> dU;
+  std::vector<std::vector<double>> dbessel;
+  std::vector<double> dLdp;
+};
+
+//
+// Central differences, [frequency][sampled parameter] and [sampled parameter]
+//
+struct GradientDifference {
+
+  void resize(int nfrequencies, int nsampled)
+  {
+    dk.assign(nfrequencies, std::vector<double>(nsampled, NAN));
+    dU.assign(nfrequencies, std::vector<double>(nsampled, NAN));
+    dbessel.assign(nfrequencies, std::vector<double>(nsampled, NAN));
+    dLdp.assign(nsampled, NAN);
+  }
+
+  std::vector<std::vector<double>> dk;
+  std::vector<std::vector<double>> dU;
+  std::vector<std::vector<double>> dbessel;
+  std::vector<double> dLdp;
+};
+
+//
+// Laguerre scales of the full likelihoods, recorded by the evaluation at
+// the model and reused by the perturbed ones. The adjoint gradients hold
+// the discretisation fixed, so the differences must not include the change
+// of the scales with the wave numbers of the previous frequencies.
+//
+struct LaguerreScales {
+  std::vector<double> love;
+  std::vector<double> rayleigh;
+};
+
+static bool evaluate(GradientWorker &worker,
+		     const Spec1DMatrix<double> &model_v,
+		     double threshold,
+		     int order,
+		     int highorder,
+		     int boundaryorder,
+		     double scale,
+		     LaguerreScales &scales,
+		     GradientPoint &point,
+		     GradientAdjoint *adjoint);
+
+static bool evaluate_hessian(GradientWorker &worker,
+			     const Spec1DMatrix<double> &model_v,
+			     const Spec1DMatrix<double> &direction,
+			     int order,
+			     int boundaryorder,
+			     double scale,
+			     GradientAdjoint &hessian);
+
+static void check(const char *quantity,
+		  const std::vector<int> &rows,
+		  const std::vector<std::vector<double>> &adjoint,
+		  const std::vector<std::vector<double>> &difference,
+		  const std::vector<int> &sampled,
+		  const Spec1DMatrix<int> &model_mask,
+		  int nlove,
+		  const DispersionData &data_love,
+		  const DispersionData &data_rayleigh,
+		  FILE *fp_detail,
+		  double &worst);
+
+int main(int argc, char *argv[])
+{
+  int c;
+  int option_index;
+
+  char *input_love;
+  char *input_rayleigh;
+
+  char *reference_file;
+  char *output_file;
+  double threshold;
+  int order;
+  int highorder;
+  int boundaryorder;
+  double scale;
+
+  double fmin;
+  double fmax;
+
+  double noise_frequency;
+
+  double gaussian_smooth;
+
+  int nfrequencies;
+  int nparameters;
+  int seed;
+  double step;
+  double tolerance;
+
+  int threads;
+
+  //
+  // Defaults
+  //
+  input_love = nullptr;
+  input_rayleigh = nullptr;
+  reference_file = nullptr;
+  output_file = nullptr;
+  threshold = 0.0;
+
+  order = 5;
+  highorder = 5;
+  boundaryorder = 5;
+
+  scale = 1.0e-4;
+
+  fmin = 1.0/40.0;
+  fmax = 1.0/2.0;
+
+  noise_frequency = 0.5;
+
+  gaussian_smooth = 0.0;
+
+  nfrequencies = 4;
+  nparameters = 0;
+  seed = 983;
+  step = 1.0e-6;
+  tolerance = 1.0e-2;
+
+  threads = std::thread::hardware_concurrency();
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  //
+  // Command line parameters
+  //
+  option_index = 0;
+  while (true) {
+
+    c = getopt_long(argc, argv, short_options, long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+
+    case 'i':
+      input_love = optarg;
+      break;
+
+    case 'I':
+      input_rayleigh = optarg;
+      break;
+
+    case 'r':
+      reference_file = optarg;
+      break;
+
+    case 'o':
+      output_file = optarg;
+      break;
+
+    case 'f':
+      fmin = atof(optarg);
+      if (fmin <= 0.0) {
+	fprintf(stderr, "error: fmin must be greater than 0\n");
+	return -1;
+      }
+      break;
+
+    case 'F':
+      fmax = atof(optarg);
+      if (fmax <= 0.0) {
+	fprintf(stderr, "error: fmax must be greater than 0\n");
+	return -1;
+      }
+      break;
+
+    case 's':
+      scale = atof(optarg);
+      if (scale <= 0.0) {
+        fprintf(stderr, "error: scale must be positive\n");
+        return -1;
+      }
+      break;
+
+    case 'p':
+      order = atoi(optarg);
+      if (order < 1 || order > MAXORDER) {
+        fprintf(stderr, "error: order must be between 1 and %d\n", MAXORDER);
+        return -1;
+      }
+      break;
+
+    case 'b':
+      boundaryorder = atoi(optarg);
+      if (boundaryorder < 1 || boundaryorder > BOUNDARYORDER) {
+        fprintf(stderr, "error: boundary order must be between 1 and %d\n", BOUNDARYORDER);
+        return -1;
+      }
+      break;
+
+    case 't':
+      threshold = atof(optarg);
+      break;
+
+    case 'P':
+      highorder = atoi(optarg);
+      if (highorder < 1) {
+        fprintf(stderr, "error: high order must be 1 or greater\n");
+        return -1;
+      }
+      break;
+
+    case 'G':
+      gaussian_smooth = atof(optarg);
+      if (gaussian_smooth < 0.0) {
+	fprintf(stderr, "error: gaussian smooth must be 0 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'k':
+      nfrequencies = atoi(optarg);
+      if (nfrequencies < 1) {
+	fprintf(stderr, "error: frequencies must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'n':
+      nparameters = atoi(optarg);
+      if (nparameters < 0) {
+	fprintf(stderr, "error: parameters must be 0 (all) or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'S':
+      seed = atoi(optarg);
+      break;
+
+    case 'e':
+      step = atof(optarg);
+      if (step <= 0.0) {
+	fprintf(stderr, "error: step must be positive\n");
+	return -1;
+      }
+      break;
+
+    case 'x':
+      tolerance = atof(optarg);
+      if (tolerance <= 0.0) {
+	fprintf(stderr, "error: tolerance must be positive\n");
+	return -1;
+      }
+      break;
+
+    case 'j':
+      threads = atoi(optarg);
+      if (threads < 1) {
+	fprintf(stderr, "error: threads must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
+    default:
+      fprintf(stderr, "unknown option %c\n", c);
+    case 'h':
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (input_love == nullptr) {
+    fprintf(stderr, "error: missing input love file paramter\n");
+    return -1;
+  }
+
+  if (input_rayleigh == nullptr) {
+    fprintf(stderr, "error: missing input rayleigh file parameter\n");
+    return -1;
+  }
+
+  if (reference_file == nullptr) {
+    fprintf(stderr, "error: missing reference file parameter\n");
+    return -1;
+  }
+
+  //
+  // Each worker has its own copy of the data and model. The data loading
+  // (fftw planning) is not thread safe so is done here serially.
+  //
+  std::vector<std::unique_ptr<GradientWorker>> workers;
+  for (int i = 0; i < threads; i ++) {
+
+    workers.emplace_back(new GradientWorker(fmin, fmax));
+    GradientWorker &w = *workers.back();
+
+    if (!w.data_love.load(input_love) ||
+	!w.data_rayleigh.load(input_rayleigh)) {
+      return -1;
+    }
+
+    w.data_love.estimate_sigma(noise_frequency);
+    w.data_rayleigh.estimate_sigma(noise_frequency);
+
+    w.data_love.compute_envelope(gaussian_smooth);
+    w.data_rayleigh.compute_envelope(gaussian_smooth);
+
+    if (!w.reference.load_model(reference_file)) {
+      fprintf(stderr, "error: failed to load model from %s\n", reference_file);
+      return -1;
+    }
+  }
+
+  //
+  // Checked frequencies evenly spaced over the band, the likelihoods are
+  // restricted to these through the frequency masks
+  //
+  std::vector<int> rows;
+  int nlove = 0;
+  for (auto data : {&workers[0]->data_love, &workers[0]->data_rayleigh}) {
+    int n = std::min(nfrequencies, data->flast - data->ffirst + 1);
+    for (int s = 0; s < n; s ++) {
+      int i = data->ffirst;
+      if (n > 1) {
+	i += (int)round((double)s * (data->flast - data->ffirst)/(double)(n - 1));
+      }
+      rows.push_back(i);
+    }
+    if (data == &workers[0]->data_love) {
+      nlove = rows.size();
+    }
+  }
+
+  for (auto &w : workers) {
+    w->data_love.frequency_mask.assign(w->data_love.freq.size(), 0);
+    w->data_rayleigh.frequency_mask.assign(w->data_rayleigh.freq.size(), 0);
+    for (int r = 0; r < (int)rows.size(); r ++) {
+      if (r < nlove) {
+	w->data_love.frequency_mask[rows[r]] = 1;
+      } else {
+	w->data_rayleigh.frequency_mask[rows[r]] = 1;
+      }
+    }
+  }
+
+  //
+  // Model vector and the sampled parameters
+  //
+  const model_t &model = workers[0]->reference.model;
+  int nparam = 4;
+  for (auto &cell : model.cells) {
+    for (int j = 0; j < 4; j ++) {
+      nparam += cell.order[j] + 1;
+    }
+  }
+
+  Spec1DMatrix<double> model_v;
+  Spec1DMatrix<int> model_mask;
+  model_v.resize(nparam, 1);
+  model_mask.resize(nparam, 1);
+  LeastSquaresIterator::copy(model, model_v, model_mask);
+
+  std::vector<int> sampled(nparam);
+  for (int j = 0; j < nparam; j ++) {
+    sampled[j] = j;
+  }
+  if (nparameters > 0 && nparameters < nparam) {
+    std::mt19937 random(seed);
+    std::shuffle(sampled.begin(), sampled.end(), random);
+    sampled.resize(nparameters);
+    std::sort(sampled.begin(), sampled.end());
+  }
+
+  if (threads > (int)sampled.size()) {
+    threads = sampled.size();
+  }
+
+  printf("Checking %d of %d parameters at %d Love and %d Rayleigh frequencies\n",
+	 (int)sampled.size(), nparam, nlove, (int)rows.size() - nlove);
+
+  //
+  // Adjoint gradients at the model
+  //
+  GradientPoint base;
+  GradientAdjoint adjoint;
+  LaguerreScales scales;
+  if (!evaluate(*workers[0], model_v, threshold, order, highorder, boundaryorder, scale, scales, base, &adjoint)) {
+    fprintf(stderr, "error: failed to compute adjoint gradients\n");
+    return -1;
+  }
+
+  if ((int)adjoint.dLdp.size() != nparam) {
+    fprintf(stderr, "error: gradient size mismatch %d != %d\n", (int)adjoint.dLdp.size(), nparam);
+    return -1;
+  }
+
+  //
+  // Central differences over the sampled parameters
+  //
+  GradientDifference difference;
+  difference.resize(rows.size(), sampled.size());
+
+  std::atomic<size_t> next(0);
+  auto run = [&](GradientWorker *w) {
+    Spec1DMatrix<double> v = model_v;
+    GradientPoint plus;
+    GradientPoint minus;
+
+    size_t s;
+    while ((s = next++) < sampled.size()) {
+      int j = sampled[s];
+      double h = step * std::max(fabs(model_v(j, 0)), 1.0e-3);
+
+      v(j, 0) = model_v(j, 0) + h;
+      bool valid = evaluate(*w, v, threshold, order, highorder, boundaryorder, scale, scales, plus, nullptr);
+
+      v(j, 0) = model_v(j, 0) - h;
+      valid = valid && evaluate(*w, v, threshold, order, highorder, boundaryorder, scale, scales, minus, nullptr);
+
+      v(j, 0) = model_v(j, 0);
+
+      if (!valid) {
+	fprintf(stderr, "error: perturbed evaluation failed for parameter %d\n", j);
+	continue;
+      }
+
+      for (size_t r = 0; r < rows.size(); r ++) {
+	difference.dk[r][s] = (plus.k[r] - minus.k[r])/(2.0 * h);
+	difference.dU[r][s] = (plus.U[r] - minus.U[r])/(2.0 * h);
+	difference.dbessel[r][s] = (plus.bessel[r] - minus.bessel[r])/(2.0 * h);
+      }
+      difference.dLdp[s] = (plus.like - minus.like)/(2.0 * h);
+    }
+  };
+
+  std::vector<std::thread> tasks;
+  for (int i = 1; i < threads; i ++) {
+    tasks.push_back(std::thread(run, workers[i].get()));
+  }
+  run(workers[0].get());
+  for (auto &t : tasks) {
+    t.join();
+  }
+
+  //
+  // Hessian-vector products in a random direction scaled by the parameter
+  // magnitudes against central differences of the adjoint gradients along
+  // it. The Hessian products need second derivatives of the projection
+  // which are only implemented for the vertex (non threshold) projection.
+  //
+  GradientAdjoint hessian;
+  GradientDifference hessian_difference;
+  bool hessian_checked = threshold <= 0.0;
+  if (hessian_checked) {
+    
+    Spec1DMatrix<double> direction;
+    direction.resize(nparam, 1);
+    std::mt19937 random(seed + 1);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    for (int j = 0; j < nparam; j ++) {
+      direction(j, 0) = normal(random) * std::max(fabs(model_v(j, 0)), 1.0e-3);
+    }
+
+    if (!evaluate_hessian(*workers[0], model_v, direction, order, boundaryorder, scale, hessian)) {
+      fprintf(stderr, "error: failed to compute Hessian-vector products\n");
+      return -1;
+    }
+
+    Spec1DMatrix<double> v = model_v;
+    GradientPoint point;
+    GradientAdjoint plus;
+    GradientAdjoint minus;
+    for (int j = 0; j < nparam; j ++) {
+      v(j, 0) = model_v(j, 0) + step * direction(j, 0);
+    }
+    bool valid = evaluate(*workers[0], v, threshold, order, highorder, boundaryorder, scale, scales, point, &plus);
+    for (int j = 0; j < nparam; j ++) {
+      v(j, 0) = model_v(j, 0) - step * direction(j, 0);
+    }
+    valid = valid && evaluate(*workers[0], v, threshold, order, highorder, boundaryorder, scale, scales, point, &minus);
+    if (!valid) {
+      fprintf(stderr, "error: perturbed evaluation failed for the Hessian direction\n");
+      return -1;
+    }
+
+    hessian_difference.resize(rows.size(), sampled.size());
+    for (size_t s = 0; s < sampled.size(); s ++) {
+      int j = sampled[s];
+      for (size_t r = 0; r < rows.size(); r ++) {
+	hessian_difference.dk[r][s] = (plus.dk[r][j] - minus.dk[r][j])/(2.0 * step);
+      }
+      hessian_difference.dLdp[s] = (plus.dLdp[j] - minus.dLdp[j])/(2.0 * step);
+    }
+  }
+
+  FILE *fp_detail = nullptr;
+  if (output_file != nullptr) {
+    fp_detail = fopen(output_file, "w");
+    if (fp_detail == NULL) {
+      fprintf(stderr, "error: failed to create %s\n", output_file);
+      return -1;
+    }
+
+    fprintf(fp_detail, "# quantity wave frequency parameter type adjoint difference relerr\n");
+  }
+
+  //
+  // Errors are relative to the adjoint value, or to a small fraction of
+  // the largest value of the row for the near zero entries
+  //
+  printf("# quantity wave max_relerr rms_relerr worst_parameter worst_frequency\n");
+
+  double worst = 0.0;
+  check("k", rows, adjoint.dk, difference.dk, sampled, model_mask, nlove,
+	workers[0]->data_love, workers[0]->data_rayleigh, fp_detail, worst);
+  check("U", rows, adjoint.dU, difference.dU, sampled, model_mask, nlove,
+	workers[0]->data_love, workers[0]->data_rayleigh, fp_detail, worst);
+  check("bessel", rows, adjoint.dbessel, difference.dbessel, sampled, model_mask, nlove,
+	workers[0]->data_love, workers[0]->data_rayleigh, fp_detail, worst);
+
+  std::vector<int> like_row = {-1};
+  std::vector<std::vector<double>> adjoint_dLdp = {adjoint.dLdp};
+  std::vector<std::vector<double>> difference_dLdp = {difference.dLdp};
+  check("like", like_row, adjoint_dLdp, difference_dLdp, sampled, model_mask, 0,
+	workers[0]->data_love, workers[0]->data_rayleigh, fp_detail, worst);
+
+  if (hessian_checked) {
+    check("d2k", rows, hessian.dk, hessian_difference.dk, sampled, model_mask, nlove,
+	  workers[0]->data_love, workers[0]->data_rayleigh, fp_detail, worst);
+
+    std::vector<std::vector<double>> hessian_dLdp = {hessian.dLdp};
+    std::vector<std::vector<double>> difference_hessian_dLdp = {hessian_difference.dLdp};
+    check("hvp", like_row, hessian_dLdp, difference_hessian_dLdp, sampled, model_mask, 0,
+	  workers[0]->data_love, workers[0]->data_rayleigh, fp_detail, worst);
+  }
+
+  if (fp_detail != nullptr) {
+    fclose(fp_detail);
+  }
+
+  if (!(worst <= tolerance)) {
+    printf("FAIL: largest relative error %10.3e exceeds %10.3e\n", worst, tolerance);
+    return 1;
+  }
+
+  printf("PASS: largest relative error %10.3e\n", worst);
+  return 0;
+}
+
+void usage(const char *pname)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "where options is one or more of:\n"
+          "\n"
+          " -i|--input-love <filename>            Input Love dispersion (required)\n"
+          " -I|--input-rayleigh <filename>        Input Rayleigh dispersion (required)\n"
+          " -r|--reference <filename>             Model (required)\n"
+          " -f|--fmin <float>                     Minimum frequency\n"
+          " -F|--fmax <float>                     Maximum frequency\n"
+          " -o|--output <filename>                Per parameter errors (default none)\n"
+          " -s|--scale <float>                    Laguerre scaling (initial)\n"
+          " -p|--order <int>                      Mesh order\n"
+          " -b|--boundaryorder <int>              Boundary order\n"
+          " -t|--threshold <float>                High order threshold depth\n"
+          " -P|--high-order <int>                 High order above threshold\n"
+          " -G|--gaussian-smooth <float>          Envelope smoothing\n"
+          "\n"
+          " -k|--frequencies <int>                Frequencies checked per wave type (default 4)\n"
+          " -n|--parameters <int>                 Randomly sampled parameters (default 0 = all)\n"
+          " -S|--seed <int>                       Parameter sampling seed\n"
+          " -e|--step <float>                     Relative finite difference step (default 1e-6)\n"
+          " -x|--tolerance <float>                Largest relative error accepted (default 1e-2)\n"
+          " -j|--threads <int>                    Worker threads (default no. cores)\n"
+          "\n"
+          " -h|--help                             Show usage information\n"
+          "\n",
+          pname);
+}
+
+static void append_adjoint(std::vector<std::vector<double>> &rows, const Spec1DMatrix<double> &g, double weight)
+{
+  std::vector<double> row(g.rows());
+  for (int j = 0; j < g.rows(); j ++) {
+    row[j] = weight * g(j, 0);
+  }
+  rows.push_back(row);
+}
+
+//
+// Predictions at the checked frequencies and the likelihood restricted to
+// them, and if adjoint is given their gradients. The likelihood uses the
+// Laguerre scales in scales, recorded if empty. Failed forward solves
+// return false.
+//
+static bool evaluate(GradientWorker &worker,
+		     const Spec1DMatrix<double> &model_v,
+		     double threshold,
+		     int order,
+		     int highorder,
+		     int boundaryorder,
+		     double scale,
+		     LaguerreScales &scales,
+		     GradientPoint &point,
+		     GradientAdjoint *adjoint)
+{
+  Spec1DMatrix<double> dkdp;
+  Spec1DMatrix<double> dUdp;
+  Spec1DMatrix<double> dLdp_love;
+  Spec1DMatrix<double> dLdp_rayleigh;
+  Spec1DMatrix<double> G;
+  Spec1DMatrix<double> residuals;
+  Spec1DMatrix<double> Cd;
+
+  //
+  // No damping so only the forward gradients are checked
+  //
+  double damping[4] = {0.0, 0.0, 0.0, 0.0};
+
+  model_t &model = worker.reference.model;
+  LeastSquaresIterator::copy(model_v, model);
+
+  point.k.clear();
+  point.U.clear();
+  point.bessel.clear();
+
+  try {
+
+    double like_love = likelihood_love_bessel(worker.data_love,
+					      model,
+					      worker.reference.reference,
+					      damping,
+					      false,
+					      worker.mesh,
+					      worker.love,
+					      dkdp,
+					      dUdp,
+					      dLdp_love,
+					      G,
+					      residuals,
+					      Cd,
+					      threshold,
+					      order,
+					      highorder,
+					      boundaryorder,
+					      scale,
+					      0.0,
+					      nullptr,
+					      &scales.love);
+
+    double like_rayleigh = likelihood_rayleigh_bessel(worker.data_rayleigh,
+						      model,
+						      worker.reference.reference,
+						      damping,
+						      false,
+						      worker.mesh,
+						      worker.rayleigh,
+						      dkdp,
+						      dUdp,
+						      dLdp_rayleigh,
+						      G,
+						      residuals,
+						      Cd,
+						      threshold,
+						      order,
+						      highorder,
+						      boundaryorder,
+						      scale,
+						      0.0,
+						      nullptr,
+						      &scales.rayleigh);
+
+    point.like = like_love + like_rayleigh;
+
+    if (adjoint != nullptr) {
+      adjoint->dLdp.resize(dLdp_love.rows());
+      for (int j = 0; j < dLdp_love.rows(); j ++) {
+	adjoint->dLdp[j] = dLdp_love(j, 0) + dLdp_rayleigh(j, 0);
+      }
+    }
+
+    //
+    // Per frequency predictions with the fixed Laguerre scale so that they
+    // do not depend on the previous frequency
+    //
+    for (auto data : {&worker.data_love, &worker.data_rayleigh}) {
+      for (int i = data->ffirst; i <= data->flast; i ++) {
+
+	if (!data->selected(i)) {
+	  continue;
+	}
+
+	double weight;
+	double k;
+	if (data == &worker.data_love) {
+	  k = love_bessel_compute(*data, i, model, worker.mesh, worker.love,
+				  dkdp, dUdp,
+				  threshold, order, highorder, boundaryorder, scale, weight);
+	} else {
+	  k = rayleigh_bessel_compute(*data, i, model, worker.mesh, worker.rayleigh,
+				      dkdp, dUdp,
+				      threshold, order, highorder, boundaryorder, scale, weight);
+	}
+
+	point.k.push_back(k);
+	point.U.push_back(data->predicted_group[i]);
+	point.bessel.push_back(data->predicted_realspec[i]);
+
+	if (adjoint != nullptr) {
+	  append_adjoint(adjoint->dk, dkdp, 1.0);
+	  append_adjoint(adjoint->dU, dUdp, 1.0);
+	  append_adjoint(adjoint->dbessel, dkdp, weight);
+	}
+      }
+    }
+
+  } catch (std::exception &e) {
+    return false;
+  }
+
+  return true;
+}
+
+//
+// Products of the Hessians of k at the checked frequencies (dk rows) and of
+// the likelihood (dLdp) with direction
+//
+static bool evaluate_hessian(GradientWorker &worker,
+			     const Spec1DMatrix<double> &model_v,
+			     const Spec1DMatrix<double> &direction,
+			     int order,
+			     int boundaryorder,
+			     double scale,
+			     GradientAdjoint &hessian)
+{
+  Spec1DMatrix<double> dkdp;
+  Spec1DMatrix<double> d2kdp;
+  Spec1DMatrix<double> Hd;
+
+  model_t &model = worker.reference.model;
+  LeastSquaresIterator::copy(model_v, model);
+
+  try {
+
+    Hd.resize(direction.rows(), 1);
+    Hd.setZero();
+
+    likelihood_love_bessel_hessian_prepare(worker.data_love,
+					   model,
+					   worker.mesh,
+					   worker.love,
+					   worker.hessian_love,
+					   order,
+					   boundaryorder,
+					   scale,
+					   0.0);
+    likelihood_love_bessel_hessian(model,
+				   worker.curvature,
+				   worker.love,
+				   worker.hessian_love,
+				   direction,
+				   Hd,
+				   boundaryorder);
+
+    likelihood_rayleigh_bessel_hessian_prepare(worker.data_rayleigh,
+					       model,
+					       worker.mesh,
+					       worker.rayleigh,
+					       worker.hessian_rayleigh,
+					       order,
+					       boundaryorder,
+					       scale,
+					       0.0);
+    likelihood_rayleigh_bessel_hessian(model,
+				       worker.curvature,
+				       worker.rayleigh,
+				       worker.hessian_rayleigh,
+				       direction,
+				       Hd,
+				       boundaryorder);
+
+    hessian.dLdp.resize(Hd.rows());
+    for (int j = 0; j < Hd.rows(); j ++) {
+      hessian.dLdp[j] = Hd(j, 0);
+    }
+
+    //
+    // Per frequency with the fixed Laguerre scale as in evaluate
+    //
+    for (auto data : {&worker.data_love, &worker.data_rayleigh}) {
+      for (int i = data->ffirst; i <= data->flast; i ++) {
+
+	if (!data->selected(i)) {
+	  continue;
+	}
+
+	double omega = data->freq[i] * 2.0 * M_PI;
+	int mesh_order = data->mesh_order(i, order);
+	model.project_gradient(worker.mesh, mesh_order);
+	model.project_hessian(worker.curvature, mesh_order, direction);
+
+	double k;
+	if (data == &worker.data_love) {
+	  worker.love.recompute(worker.mesh, boundaryorder, scale);
+	  k = worker.love.solve_fundamental_hessian_sep(worker.mesh,
+							worker.curvature,
+							boundaryorder,
+							omega,
+							direction,
+							dkdp,
+							d2kdp);
+	} else {
+	  worker.rayleigh.recompute(worker.mesh, boundaryorder, scale, scale);
+	  k = worker.rayleigh.solve_fundamental_hessian_generic(worker.mesh,
+								worker.curvature,
+								boundaryorder,
+								omega,
+								direction,
+								dkdp,
+								d2kdp);
+	}
+
+	if (k <= 0.0) {
+	  return false;
+	}
+
+	append_adjoint(hessian.dk, d2kdp, 1.0);
+      }
+    }
+
+  } catch (std::exception &e) {
+    return false;
+  }
+
+  return true;
+}
+
+//
+// Reports the largest and rms relative error of one quantity over the
+// checked frequencies (rows) and sampled parameters. A row of -1 is the
+// likelihood.
+//
+static void check(const char *quantity,
+		  const std::vector<int> &rows,
+		  const std::vector<std::vector<double>> &adjoint,
+		  const std::vector<std::vector<double>> &difference,
+		  const std::vector<int> &sampled,
+		  const Spec1DMatrix<int> &model_mask,
+		  int nlove,
+		  const DispersionData &data_love,
+		  const DispersionData &data_rayleigh,
+		  FILE *fp_detail,
+		  double &worst)
+{
+  constexpr double FLOOR = 1.0e-3;
+
+  for (int wave = 0; wave < 2; wave ++) {
+
+    int r0 = (wave == 0) ? 0 : nlove;
+    int r1 = (wave == 0) ? nlove : rows.size();
+    if (rows[0] < 0) {
+      if (wave == 1) {
+	break;
+      }
+      r0 = 0;
+      r1 = 1;
+    }
+
+    const char *name = (rows[0] < 0) ? "joint" : ((wave == 0) ? "love" : "rayleigh");
+
+    double maxerr = 0.0;
+    double rmserr = 0.0;
+    int n = 0;
+    int worst_parameter = -1;
+    double worst_frequency = 0.0;
+
+    for (int r = r0; r < r1; r ++) {
+
+      //
+      // The error floor is relative to the largest entry of the whole
+      // adjoint row, not just the sampled parameters, so that a small
+      // sample of deep cells is not judged against its own noise.
+      //
+      double rowmax = 0.0;
+      for (auto a : adjoint[r]) {
+	rowmax = std::max(rowmax, fabs(a));
+      }
+
+      double frequency = 0.0;
+      if (rows[r] >= 0) {
+	frequency = (r < nlove) ? data_love.freq[rows[r]] : data_rayleigh.freq[rows[r]];
+      }
+
+      for (size_t s = 0; s < sampled.size(); s ++) {
+	int j = sampled[s];
+	double a = adjoint[r][j];
+	double d = difference[r][s];
+
+	double denom = std::max(fabs(a), FLOOR * rowmax);
+	double e = 0.0;
+	if (std::isnan(d)) {
+	  e = INFINITY;
+	} else if (denom > 0.0) {
+	  e = fabs(d - a)/denom;
+	}
+
+	if (fp_detail != nullptr) {
+	  fprintf(fp_detail, "%s %s %.6f %d %d %16.9e %16.9e %10.3e\n",
+		  quantity, name, frequency, j, model_mask(j, 0), a, d, e);
+	}
+
+	if (e > maxerr || worst_parameter < 0) {
+	  maxerr = std::max(maxerr, e);
+	  worst_parameter = j;
+	  worst_frequency = frequency;
+	}
+	rmserr += e*e;
+	n ++;
+      }
+    }
+
+    if (n > 0) {
+      rmserr = sqrt(rmserr/n);
+    }
+
+    printf("%-6s %-8s %10.3e %10.3e %5d %.6f\n",
+	   quantity, name, maxerr, rmserr, worst_parameter, worst_frequency);
+
+    worst = std::max(worst, maxerr);
+  }
+}
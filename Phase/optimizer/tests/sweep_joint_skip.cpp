@@ -0,0 +1,770 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+//
+// Sweeps the spline skip (and optionally the mesh and boundary orders) of
+// the joint likelihood for one station pair and model, and tabulates the
+// error of each setting against the full evaluation together with its time
+// and number of forward solves.
+//
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <thread>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "likelihood.hpp"
+
+static char short_options[] = "i:I:r:f:F:o:s:p:b:t:P:G:T:O:B:j:h";
+static struct option long_options[] = {
+  {"input-love", required_argument, 0, 'i'},
+  {"input-rayleigh", required_argument, 0, 'I'},
+
+  {"reference", required_argument, 0, 'r'},
+
+  {"fmin", required_argument, 0, 'f'},
+  {"fmax", required_argument, 0, 'F'},
+
+  {"output", required_argument, 0, 'o'},
+
+  {"scale", required_argument, 0, 's'},
+  {"order", required_argument, 0, 'p'},
+  {"boundaryorder", required_argument, 0, 'b'},
+  {"threshold", required_argument, 0, 't'},
+  {"high-order", required_argument, 0, 'P'},
+
+  {"gaussian-smooth", required_argument, 0, 'G'},
+
+  {"skip", required_argument, 0, 'T'},
+  {"sweep-order", required_argument, 0, 'O'},
+  {"sweep-boundaryorder", required_argument, 0, 'B'},
+
+  {"threads", required_argument, 0, 'j'},
+
+  {"help", no_argument, 0, 'h'},
+
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *pname);
+
+static bool parse_list(const char *s, int minimum, int maximum, std::vector<int> &values);
+
+//
+// Inputs and work space of one worker thread
+//
+struct SweepWorker {
+
+  SweepWorker(double fmin, double fmax) :
+    data_love(fmin, fmax),
+    data_rayleigh(fmin, fmax)
+  {
+  }
+
+  DispersionData data_love;
+  DispersionData data_rayleigh;
+  ReferenceModel reference;
+
+  mesh_t mesh;
+  lovesolver_t love;
+  rayleighsolver_t rayleigh;
+};
+
+//
+// One setting of the sweep and, once evaluated, its results
+//
+struct SweepResult {
+
+  SweepResult(int _order, int _boundaryorder, int _skip) :
+    order(_order),
+    boundaryorder(_boundaryorder),
+    skip(_skip),
+    valid(false),
+    solves(0),
+    seconds(0.0),
+    cpuseconds(0.0),
+    like(0.0)
+  {
+  }
+
+  int order;
+  int boundaryorder;
+  int skip;
+
+  bool valid;
+  int solves;
+  double seconds;
+  double cpuseconds;
+  double like;
+
+  //
+  // Love predictions followed by Rayleigh over [ffirst, flast]
+  //
+  std::vector<double> phase;
+  std::vector<double> group;
+  std::vector<double> realspec;
+  std::vector<double> noise;
+
+  std::vector<double> dLdp;
+};
+
+static void evaluate(SweepWorker &worker,
+		     SweepResult &result,
+		     double threshold,
+		     int highorder,
+		     double scale);
+
+static void evaluate_setting(SweepWorker &worker,
+			     SweepResult &result,
+			     double threshold,
+			     int highorder,
+			     double scale);
+
+static void max_rms(const std::vector<double> &a,
+		    const std::vector<double> &b,
+		    const std::vector<double> *scale,
+		    double &maxerr,
+		    double &rmserr);
+
+int main(int argc, char *argv[])
+{
+  int c;
+  int option_index;
+
+  char *input_love;
+  char *input_rayleigh;
+
+  char *reference_file;
+  char *output_file;
+  double threshold;
+  int order;
+  int highorder;
+  int boundaryorder;
+  double scale;
+
+  double fmin;
+  double fmax;
+
+  double noise_frequency;
+
+  double gaussian_smooth;
+
+  std::vector<int> skips;
+  std::vector<int> orders;
+  std::vector<int> boundaryorders;
+
+  int threads;
+
+  //
+  // Defaults
+  //
+  input_love = nullptr;
+  input_rayleigh = nullptr;
+  reference_file = nullptr;
+  output_file = nullptr;
+  threshold = 0.0;
+
+  order = 5;
+  highorder = 5;
+  boundaryorder = 5;
+
+  scale = 1.0e-4;
+
+  fmin = 1.0/40.0;
+  fmax = 1.0/2.0;
+
+  noise_frequency = 0.5;
+
+  gaussian_smooth = 0.0;
+
+  threads = std::thread::hardware_concurrency();
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  //
+  // Command line parameters
+  //
+  option_index = 0;
+  while (true) {
+
+    c = getopt_long(argc, argv, short_options, long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+
+    case 'i':
+      input_love = optarg;
+      break;
+
+    case 'I':
+      input_rayleigh = optarg;
+      break;
+
+    case 'r':
+      reference_file = optarg;
+      break;
+
+    case 'o':
+      output_file = optarg;
+      break;
+
+    case 'f':
+      fmin = atof(optarg);
+      if (fmin <= 0.0) {
+	fprintf(stderr, "error: fmin must be greater than 0\n");
+	return -1;
+      }
+      break;
+
+    case 'F':
+      fmax = atof(optarg);
+      if (fmax <= 0.0) {
+	fprintf(stderr, "error: fmax must be greater than 0\n");
+	return -1;
+      }
+      break;
+
+    case 's':
+      scale = atof(optarg);
+      if (scale <= 0.0) {
+        fprintf(stderr, "error: scale must be positive\n");
+        return -1;
+      }
+      break;
+
+    case 'p':
+      order = atoi(optarg);
+      if (order < 1 || order > MAXORDER) {
+        fprintf(stderr, "error: order must be between 1 and %d\n", MAXORDER);
+        return -1;
+      }
+      break;
+
+    case 'b':
+      boundaryorder = atoi(optarg);
+      if (boundaryorder < 1 || boundaryorder > BOUNDARYORDER) {
+        fprintf(stderr, "error: boundary order must be between 1 and %d\n", BOUNDARYORDER);
+        return -1;
+      }
+      break;
+
+    case 't':
+      threshold = atof(optarg);
+      break;
+
+    case 'P':
+      highorder = atoi(optarg);
+      if (highorder < 1) {
+        fprintf(stderr, "error: high order must be 1 or greater\n");
+        return -1;
+      }
+      break;
+
+    case 'G':
+      gaussian_smooth = atof(optarg);
+      if (gaussian_smooth < 0.0) {
+	fprintf(stderr, "error: gaussian smooth must be 0 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'T':
+      if (!parse_list(optarg, 1, 1000000, skips)) {
+	fprintf(stderr, "error: invalid skip list %s\n", optarg);
+	return -1;
+      }
+      break;
+
+    case 'O':
+      if (!parse_list(optarg, 1, MAXORDER, orders)) {
+	fprintf(stderr, "error: invalid order list %s\n", optarg);
+	return -1;
+      }
+      break;
+
+    case 'B':
+      if (!parse_list(optarg, 1, BOUNDARYORDER, boundaryorders)) {
+	fprintf(stderr, "error: invalid boundary order list %s\n", optarg);
+	return -1;
+      }
+      break;
+
+    case 'j':
+      threads = atoi(optarg);
+      if (threads < 1) {
+	fprintf(stderr, "error: threads must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
+    default:
+      fprintf(stderr, "unknown option %c\n", c);
+    case 'h':
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (input_love == nullptr) {
+    fprintf(stderr, "error: missing input love file paramter\n");
+    return -1;
+  }
+
+  if (input_rayleigh == nullptr) {
+    fprintf(stderr, "error: missing input rayleigh file parameter\n");
+    return -1;
+  }
+
+  if (reference_file == nullptr) {
+    fprintf(stderr, "error: missing reference file parameter\n");
+    return -1;
+  }
+
+  if (skips.empty()) {
+    skips = {2, 4, 8, 16, 32};
+  }
+
+  if (orders.empty()) {
+    orders.push_back(order);
+  }
+
+  if (boundaryorders.empty()) {
+    boundaryorders.push_back(boundaryorder);
+  }
+
+  std::vector<SweepResult> results;
+  for (auto o : orders) {
+    for (auto b : boundaryorders) {
+      for (auto s : skips) {
+	results.push_back(SweepResult(o, b, s));
+      }
+    }
+  }
+
+  if (threads > (int)results.size()) {
+    threads = results.size();
+  }
+
+  //
+  // Each worker has its own copy of the data and model. The data loading
+  // (fftw planning) is not thread safe so is done here serially.
+  //
+  std::vector<std::unique_ptr<SweepWorker>> workers;
+  for (int i = 0; i < threads; i ++) {
+
+    workers.emplace_back(new SweepWorker(fmin, fmax));
+    SweepWorker &w = *workers.back();
+
+    if (!w.data_love.load(input_love) ||
+	!w.data_rayleigh.load(input_rayleigh)) {
+      return -1;
+    }
+
+    w.data_love.estimate_sigma(noise_frequency);
+    w.data_rayleigh.estimate_sigma(noise_frequency);
+
+    w.data_love.compute_envelope(gaussian_smooth);
+    w.data_rayleigh.compute_envelope(gaussian_smooth);
+
+    if (!w.reference.load_model(reference_file)) {
+      fprintf(stderr, "error: failed to load model from %s\n", reference_file);
+      return -1;
+    }
+  }
+
+  printf("Love Estimated noise: %16.9e\n", workers[0]->data_love.noise_sigma);
+  printf("Rayleigh Estimated noise: %16.9e\n", workers[0]->data_rayleigh.noise_sigma);
+
+  //
+  // Full evaluation at the base orders
+  //
+  SweepResult full(order, boundaryorder, 1);
+  evaluate_setting(*workers[0], full, threshold, highorder, scale);
+  if (!full.valid) {
+    fprintf(stderr, "error: failed to compute full likelihood\n");
+    return -1;
+  }
+
+  printf("Full: %16.9e (%d solves, %.3f s)\n", full.like, full.solves, full.seconds);
+
+  std::atomic<size_t> next(0);
+  auto run = [&](SweepWorker *w) {
+    size_t i;
+    while ((i = next++) < results.size()) {
+      evaluate_setting(*w, results[i], threshold, highorder, scale);
+    }
+  };
+
+  std::vector<std::thread> tasks;
+  for (int i = 1; i < threads; i ++) {
+    tasks.push_back(std::thread(run, workers[i].get()));
+  }
+  run(workers[0].get());
+  for (auto &t : tasks) {
+    t.join();
+  }
+
+  FILE *fp = stdout;
+  if (output_file != nullptr) {
+    fp = fopen(output_file, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "error: failed to create %s\n", output_file);
+      return -1;
+    }
+  }
+
+  //
+  // Phase and group errors are in m/s, Bessel spectrum errors relative to
+  // the estimated noise, likelihood and dLdp errors relative to the full
+  // evaluation
+  //
+  fprintf(fp, "# order boundaryorder skip valid solves seconds cpuseconds like like_relerr "
+	  "phase_max phase_rms group_max group_rms bessel_max bessel_rms dLdp_max dLdp_rms\n");
+  fprintf(fp, "%d %d %d %d %d %.6f %.6f %16.9e %10.3e "
+	  "%10.3e %10.3e %10.3e %10.3e %10.3e %10.3e %10.3e %10.3e\n",
+	  full.order, full.boundaryorder, full.skip, 1, full.solves, full.seconds, full.cpuseconds,
+	  full.like, 0.0,
+	  0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+
+  double dLdp_max = 0.0;
+  double dLdp_rms = 0.0;
+  for (auto g : full.dLdp) {
+    dLdp_max = std::max(dLdp_max, fabs(g));
+    dLdp_rms += g*g;
+  }
+  dLdp_rms = sqrt(dLdp_rms/full.dLdp.size());
+
+  for (auto &r : results) {
+
+    double phase_max, phase_rms;
+    double group_max, group_rms;
+    double bessel_max, bessel_rms;
+    double g_max, g_rms;
+    double like_relerr;
+
+    if (r.valid) {
+      like_relerr = fabs(r.like - full.like)/fabs(full.like);
+      max_rms(r.phase, full.phase, nullptr, phase_max, phase_rms);
+      max_rms(r.group, full.group, nullptr, group_max, group_rms);
+      max_rms(r.realspec, full.realspec, &full.noise, bessel_max, bessel_rms);
+      max_rms(r.dLdp, full.dLdp, nullptr, g_max, g_rms);
+    } else {
+      like_relerr = NAN;
+      phase_max = phase_rms = group_max = group_rms = NAN;
+      bessel_max = bessel_rms = g_max = g_rms = NAN;
+    }
+
+    fprintf(fp, "%d %d %d %d %d %.6f %.6f %16.9e %10.3e "
+	    "%10.3e %10.3e %10.3e %10.3e %10.3e %10.3e %10.3e %10.3e\n",
+	    r.order, r.boundaryorder, r.skip, (int)r.valid, r.solves, r.seconds, r.cpuseconds,
+	    r.like, like_relerr,
+	    phase_max, phase_rms,
+	    group_max, group_rms,
+	    bessel_max, bessel_rms,
+	    g_max/dLdp_max, g_rms/dLdp_rms);
+  }
+
+  if (fp != stdout) {
+    fclose(fp);
+  }
+
+  return 0;
+}
+
+void usage(const char *pname)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "where options is one or more of:\n"
+          "\n"
+          " -i|--input-love <filename>            Input Love dispersion (required)\n"
+          " -I|--input-rayleigh <filename>        Input Rayleigh dispersion (required)\n"
+          " -r|--reference <filename>             Model (required)\n"
+          " -f|--fmin <float>                     Minimum frequency\n"
+          " -F|--fmax <float>                     Maximum frequency\n"
+          " -o|--output <filename>                Output table (default stdout)\n"
+          " -s|--scale <float>                    Laguerre scaling (initial)\n"
+          " -p|--order <int>                      Mesh order of the full evaluation\n"
+          " -b|--boundaryorder <int>              Boundary order of the full evaluation\n"
+          " -t|--threshold <float>                High order threshold depth\n"
+          " -P|--high-order <int>                 High order above threshold\n"
+          " -G|--gaussian-smooth <float>          Envelope smoothing\n"
+          "\n"
+          " -T|--skip <list>                      Skips to sweep, e.g. 2,4,8 (default 2,4,8,16,32)\n"
+          " -O|--sweep-order <list>               Mesh orders to sweep (default -p)\n"
+          " -B|--sweep-boundaryorder <list>       Boundary orders to sweep (default -b)\n"
+          " -j|--threads <int>                    Worker threads (default no. cores)\n"
+          "\n"
+          " -h|--help                             Show usage information\n"
+          "\n",
+          pname);
+}
+
+static bool parse_list(const char *s, int minimum, int maximum, std::vector<int> &values)
+{
+  values.clear();
+
+  while (*s != '\0') {
+    char *end;
+    long v = strtol(s, &end, 10);
+
+    if (end == s || v < minimum || v > maximum) {
+      return false;
+    }
+    values.push_back(v);
+
+    s = end;
+    if (*s == ',') {
+      s ++;
+    } else if (*s != '\0') {
+      return false;
+    }
+  }
+
+  return !values.empty();
+}
+
+static double thread_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + 1.0e-9*ts.tv_nsec;
+}
+
+static void append_predictions(const DispersionData &data, SweepResult &result)
+{
+  for (int i = data.ffirst; i <= data.flast; i ++) {
+    result.phase.push_back(data.predicted_phase[i]);
+    result.group.push_back(data.predicted_group[i]);
+    result.realspec.push_back(data.predicted_realspec[i]);
+    result.noise.push_back(data.noise_sigma);
+  }
+}
+
+static void evaluate(SweepWorker &worker,
+		     SweepResult &result,
+		     double threshold,
+		     int highorder,
+		     double scale)
+{
+  Spec1DMatrix<double> dkdp_love;
+  Spec1DMatrix<double> dUdp_love;
+  Spec1DMatrix<double> dLdp_love;
+  Spec1DMatrix<double> G_love;
+  Spec1DMatrix<double> Gk_love;
+  Spec1DMatrix<double> GU_love;
+  Spec1DMatrix<double> residuals_love;
+  Spec1DMatrix<double> Cd_love;
+
+  Spec1DMatrix<double> dkdp_rayleigh;
+  Spec1DMatrix<double> dUdp_rayleigh;
+  Spec1DMatrix<double> dLdp_rayleigh;
+  Spec1DMatrix<double> G_rayleigh;
+  Spec1DMatrix<double> Gk_rayleigh;
+  Spec1DMatrix<double> GU_rayleigh;
+  Spec1DMatrix<double> residuals_rayleigh;
+  Spec1DMatrix<double> Cd_rayleigh;
+
+  //
+  // No damping so only the forward approximation is compared
+  //
+  double damping[4] = {0.0, 0.0, 0.0, 0.0};
+  double frequency_thin = 0.0;
+
+  DispersionData &data_love = worker.data_love;
+  DispersionData &data_rayleigh = worker.data_rayleigh;
+
+  double like_love;
+  double like_rayleigh;
+
+  auto t0 = std::chrono::steady_clock::now();
+  double c0 = thread_seconds();
+
+  if (result.skip <= 1) {
+    like_love = likelihood_love_bessel(data_love,
+				       worker.reference.model,
+				       worker.reference.reference,
+				       damping,
+				       false,
+				       worker.mesh,
+				       worker.love,
+				       dkdp_love,
+				       dUdp_love,
+				       dLdp_love,
+				       G_love,
+				       residuals_love,
+				       Cd_love,
+				       threshold,
+				       result.order,
+				       highorder,
+				       result.boundaryorder,
+				       scale,
+				       frequency_thin);
+
+    like_rayleigh = likelihood_rayleigh_bessel(data_rayleigh,
+					       worker.reference.model,
+					       worker.reference.reference,
+					       damping,
+					       false,
+					       worker.mesh,
+					       worker.rayleigh,
+					       dkdp_rayleigh,
+					       dUdp_rayleigh,
+					       dLdp_rayleigh,
+					       G_rayleigh,
+					       residuals_rayleigh,
+					       Cd_rayleigh,
+					       threshold,
+					       result.order,
+					       highorder,
+					       result.boundaryorder,
+					       scale,
+					       frequency_thin);
+
+    result.solves =
+      (data_love.flast - data_love.ffirst + 1) +
+      (data_rayleigh.flast - data_rayleigh.ffirst + 1);
+
+  } else {
+    like_love = likelihood_love_bessel_spline(data_love,
+					      worker.reference.model,
+					      worker.reference.reference,
+					      damping,
+					      false,
+					      worker.mesh,
+					      worker.love,
+					      dkdp_love,
+					      dUdp_love,
+					      dLdp_love,
+					      G_love,
+					      Gk_love,
+					      GU_love,
+					      residuals_love,
+					      Cd_love,
+					      threshold,
+					      result.order,
+					      highorder,
+					      result.boundaryorder,
+					      scale,
+					      result.skip);
+
+    like_rayleigh = likelihood_rayleigh_bessel_spline(data_rayleigh,
+						      worker.reference.model,
+						      worker.reference.reference,
+						      damping,
+						      false,
+						      worker.mesh,
+						      worker.rayleigh,
+						      dkdp_rayleigh,
+						      dUdp_rayleigh,
+						      dLdp_rayleigh,
+						      G_rayleigh,
+						      Gk_rayleigh,
+						      GU_rayleigh,
+						      residuals_rayleigh,
+						      Cd_rayleigh,
+						      threshold,
+						      result.order,
+						      highorder,
+						      result.boundaryorder,
+						      scale,
+						      result.skip);
+
+    result.solves =
+      spline_anchors(data_love, result.skip) +
+      spline_anchors(data_rayleigh, result.skip);
+  }
+
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  result.cpuseconds = thread_seconds() - c0;
+
+  //
+  // A zero likelihood indicates a failed forward solve
+  //
+  result.valid = (like_love != 0.0 && like_rayleigh != 0.0);
+  if (!result.valid) {
+    return;
+  }
+
+  result.like = like_love + like_rayleigh;
+
+  append_predictions(data_love, result);
+  append_predictions(data_rayleigh, result);
+
+  for (int i = 0; i < dLdp_love.rows(); i ++) {
+    result.dLdp.push_back(dLdp_love(i, 0) + dLdp_rayleigh(i, 0));
+  }
+}
+
+//
+// A failed forward solve is fatal to the evaluation of a setting but not to
+// the sweep
+//
+static void evaluate_setting(SweepWorker &worker,
+			     SweepResult &result,
+			     double threshold,
+			     int highorder,
+			     double scale)
+{
+  try {
+    evaluate(worker, result, threshold, highorder, scale);
+  } catch (std::exception &e) {
+    fprintf(stderr, "error: evaluation failed for order %d boundary order %d skip %d\n",
+	    result.order, result.boundaryorder, result.skip);
+    result.valid = false;
+  }
+}
+
+static void max_rms(const std::vector<double> &a,
+		    const std::vector<double> &b,
+		    const std::vector<double> *scale,
+		    double &maxerr,
+		    double &rmserr)
+{
+  maxerr = 0.0;
+  rmserr = 0.0;
+
+  for (size_t i = 0; i < a.size(); i ++) {
+    double e = fabs(a[i] - b[i]);
+    if (scale != nullptr) {
+      e /= (*scale)[i];
+    }
+
+    maxerr = std::max(maxerr, e);
+    rmserr += e*e;
+  }
+
+  if (!a.empty()) {
+    rmserr = sqrt(rmserr/a.size());
+  }
+}
@@ -0,0 +1,131 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+#pragma once
+#ifndef layermodel_hpp
+#define layermodel_hpp
+
+#include <vector>
+
+#include <stdio.h>
+
+#include "spec1d/model.hpp"
+#include "spec1d/textreader.hpp"
+
+//
+// Loads a layered Vs model as used by the reference tools: the no. layers,
+// then per layer the thickness (km), order, order + 1 node Vs values and a
+// Vs standard deviation (km/s), with a final halfspace layer of zero
+// thickness and order. The standard deviations are expanded to one per
+// model parameter in model_errors.
+//
+template
+<
+  typename real,
+  typename node_t,
+  typename boundary_t,
+  size_t maxorder
+>
+bool load_layer_model(const char *filename,
+		      Model<real, node_t, boundary_t, maxorder> &model,
+		      std::vector<double> &model_errors)
+{
+  TextReader in;
+  if (!in.open(filename)) {
+    fprintf(stderr, "error: failed to open %s for reading\n", filename);
+    return false;
+  }
+
+  int nlayers;
+  if (!in.read_int(nlayers)) {
+    fprintf(stderr, "error: failed to read no. layers\n");
+    return false;
+  }
+
+  for (int i = 0; i < nlayers; i ++) {
+
+    double thicknesskm;
+    int order;
+    if (!in.read_double(thicknesskm) || !in.read_int(order)) {
+      fprintf(stderr, "error: failed to read line\n");
+      return false;
+    }
+
+    if (i < (nlayers - 1)) {
+      //
+      // Add normal layer to model
+      //
+      if (thicknesskm <= 0.0) {
+	fprintf(stderr, "error: invalid layer thickness %f layer %d/%d\n", thicknesskm, i, nlayers);
+	return false;
+      }
+
+      model.cells.push_back(Cell<real, node_t, maxorder>());
+
+      model.cells[i].thickness = thicknesskm * 1.0e3;
+      model.cells[i].order[0] = order;
+
+      double vs, vsstd;
+      for (int j = 0; j <= order; j ++) {
+	if (!in.read_double(vs)) {
+	  fprintf(stderr, "error: failed to parse vs\n");
+	  return false;
+	}
+
+	model.cells[i].nodes[j] = node_t(vs * 1.0e3);
+      }
+      if (!in.read_double(vsstd)) {
+	fprintf(stderr, "error: failed to parse vsstd\n");
+	return false;
+      }
+
+      for (int j = 0; j <= order; j ++) {
+	model_errors.push_back(vsstd * 1.0e3);
+      }
+
+    } else {
+      //
+      // Add halfspace layer to model
+      //
+      if (thicknesskm != 0.0 || order != 0) {
+	fprintf(stderr, "error: halfspace layer thickness not zero: %10.6f\n", thicknesskm);
+	return false;
+      }
+
+      double vs, vsstd;
+      if (!in.read_double(vs) || !in.read_double(vsstd)) {
+	fprintf(stderr, "error: failed to parse vs, vsstd\n");
+	return false;
+      }
+
+      model.boundary = boundary_t(vs * 1.0e3);
+      model_errors.push_back(vsstd * 1.0e3);
+
+    }
+  }
+
+  in.close();
+  return true;
+}
+
+#endif // layermodel_hpp
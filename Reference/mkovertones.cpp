@@ -0,0 +1,395 @@
+//
+// Overtone dispersion curves: tracks the first M Love and/or Rayleigh modes
+// from high to low frequency and writes per mode phase and group velocity
+//
+#include <exception>
+#include <vector>
+
+#include <stdio.h>
+#include <getopt.h>
+
+#include "spec1d/isotropicvs.hpp"
+#include "spec1d/isotropicvshalfspace.hpp"
+
+#include "spec1d/empiricalmodel.hpp"
+#include "spec1d/model.hpp"
+#include "spec1d/lovematrices.hpp"
+#include "spec1d/rayleighmatrices.hpp"
+#include "spec1d/modesweep.hpp"
+
+#include "layermodel.hpp"
+
+constexpr int MAXORDER = 20;
+
+typedef BrocherEmpiricalModel<double> empiricalmodel_t;
+typedef IsotropicVs<double, empiricalmodel_t> node_t;
+typedef IsotropicVsHalfspace<double, empiricalmodel_t, MAXORDER> boundary_t;
+typedef Cell<double, node_t, MAXORDER> cell_t;
+
+typedef Model<double, node_t, boundary_t, MAXORDER> model_t;
+typedef Mesh<double, MAXORDER> mesh_t;
+typedef LoveMatrices<double, MAXORDER> lovesolver_t;
+typedef RayleighMatrices<double, MAXORDER> rayleighsolver_t;
+
+static char short_options[] = "i:o:O:J:m:f:F:S:H:s:p:b:h";
+static struct option long_options[] = {
+  {"input", required_argument, 0, 'i'},
+  {"output-love", required_argument, 0, 'o'},
+  {"output-rayleigh", required_argument, 0, 'O'},
+  {"jacobians", required_argument, 0, 'J'},
+
+  {"modes", required_argument, 0, 'm'},
+
+  {"frequency-min", required_argument, 0, 'f'},
+  {"frequency-max", required_argument, 0, 'F'},
+  {"frequency-samples", required_argument, 0, 'S'},
+  {"frequency-hertz", required_argument, 0, 'H'},
+
+  {"scale", required_argument, 0, 's'},
+  {"order", required_argument, 0, 'p'},
+  {"boundaryorder", required_argument, 0, 'b'},
+
+  {"help", no_argument, 0, 'h'},
+
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *pname);
+
+static bool save_modes(const char *filename,
+		       const std::vector<double> &f,
+		       const ModeSweepResult<double> &result);
+
+static bool save_jacobians(const char *prefix,
+			   const char *wave,
+			   const std::vector<double> &f,
+			   const ModeSweepResult<double> &result);
+
+int main(int argc, char *argv[])
+{
+  int c;
+  int option_index;
+
+  char *input_file;
+  char *love_file;
+  char *rayleigh_file;
+  char *jacobian_prefix;
+
+  int nmodes;
+  
+  double fmin;
+  double fmax;
+  double hertz;
+  int samples;
+
+  int order;
+  int boundaryorder;
+  double scale;
+
+  //
+  // Defaults
+  //
+  input_file = nullptr;
+  love_file = nullptr;
+  rayleigh_file = nullptr;
+  jacobian_prefix = nullptr;
+
+  nmodes = 3;
+  
+  order = 5;
+  boundaryorder = 5;
+  scale = 1.0e-4;
+
+  fmin = 1.0/40.0;
+  fmax = 1.0/2.0;
+
+  samples = 8192;
+  hertz = 2.0;
+
+  //
+  // Command line parameters
+  //
+  option_index = 0;
+  while (true) {
+
+    c = getopt_long(argc, argv, short_options, long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+
+    case 'i':
+      input_file = optarg;
+      break;
+
+    case 'o':
+      love_file = optarg;
+      break;
+
+    case 'O':
+      rayleigh_file = optarg;
+      break;
+
+    case 'J':
+      jacobian_prefix = optarg;
+      break;
+
+    case 'm':
+      nmodes = atoi(optarg);
+      if (nmodes < 1) {
+	fprintf(stderr, "error: modes must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'f':
+      fmin = atof(optarg);
+      if (fmin <= 0.0) {
+        fprintf(stderr, "error: fmin must be positive\n");
+        return -1;
+      }
+      break;
+
+    case 'F':
+      fmax = atof(optarg);
+      if (fmax <= 0.0) {
+        fprintf(stderr, "error: fmax must be positive\n");
+        return -1;
+      }
+      break;
+
+    case 'S':
+      samples = atoi(optarg);
+      if (samples <= 0 || samples % 2 != 0) {
+	fprintf(stderr, "error: samples must be greater than zero and even\n");
+	return -1;
+      }
+      break;
+
+    case 'H':
+      hertz = atof(optarg);
+      if (hertz <= 0.0) {
+	fprintf(stderr, "error: hertz must be greater than 0\n");
+	return -1;
+      }
+      break;
+
+    case 's':
+      scale = atof(optarg);
+      if (scale <= 0.0) {
+        fprintf(stderr, "error: scale must be positive\n");
+        return -1;
+      }
+      break;
+
+    case 'p':
+      order = atoi(optarg);
+      if (order < 1) {
+        fprintf(stderr, "error: order must be 1 or greater\n");
+        return -1;
+      }
+      break;
+
+    case 'b':
+      boundaryorder = atoi(optarg);
+      if (boundaryorder < 1) {
+        fprintf(stderr, "error: boundary order must be 1 or greater\n");
+        return -1;
+      }
+      break;
+
+    default:
+      fprintf(stderr, "unknown option %c\n", c);
+    case 'h':
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (input_file == nullptr) {
+    fprintf(stderr, "error: missing input file paramter\n");
+    return -1;
+  }
+
+  if (love_file == nullptr && rayleigh_file == nullptr) {
+    fprintf(stderr, "error: at least one of love or rayleigh output files required\n");
+    return -1;
+  }
+
+  model_t model;
+  std::vector<double> model_errors;
+  mesh_t mesh;
+
+  if (!load_layer_model(input_file, model, model_errors)) {
+    return -1;
+  }
+
+  if (jacobian_prefix != nullptr) {
+    model.project_gradient(mesh, order);
+  } else {
+    model.project(mesh, order);
+  }
+
+  //
+  // Sampled frequencies in range, high to low
+  //
+  std::vector<double> f;
+  std::vector<double> omegas;
+  int fsamples = samples/2 + 1;
+  for (int i = fsamples - 1; i >= 0; i --) {
+    double fi = (double)i * hertz/(double)samples;
+    if (fi >= fmin && fi <= fmax) {
+      f.push_back(fi);
+      omegas.push_back(2.0 * M_PI * fi);
+    }
+  }
+
+  if (f.empty()) {
+    fprintf(stderr, "error: no frequencies in range\n");
+    return -1;
+  }
+
+  if (love_file != nullptr) {
+    lovesolver_t love;
+    love.recompute(mesh, boundaryorder, scale);
+
+    LoveModeSweep<double, MAXORDER> sweep(love, mesh, boundaryorder, nmodes);
+    ModeSweepResult<double> result;
+    if (!sweep.sweep(omegas, result, jacobian_prefix != nullptr)) {
+      fprintf(stderr, "error: love mode sweep failed\n");
+      return -1;
+    }
+
+    printf("love: %d tracked, %d full solves\n", result.tracked_solves, result.full_solves);
+    
+    if (!save_modes(love_file, f, result)) {
+      return -1;
+    }
+
+    if (jacobian_prefix != nullptr && !save_jacobians(jacobian_prefix, "love", f, result)) {
+      return -1;
+    }
+  }
+
+  if (rayleigh_file != nullptr) {
+    rayleighsolver_t rayleigh;
+    rayleigh.recompute(mesh, boundaryorder, scale, scale);
+
+    RayleighModeSweep<double, MAXORDER> sweep(rayleigh, mesh, boundaryorder, nmodes);
+    ModeSweepResult<double> result;
+    if (!sweep.sweep(omegas, result, jacobian_prefix != nullptr)) {
+      fprintf(stderr, "error: rayleigh mode sweep failed\n");
+      return -1;
+    }
+
+    printf("rayleigh: %d tracked, %d full solves\n", result.tracked_solves, result.full_solves);
+
+    if (!save_modes(rayleigh_file, f, result)) {
+      return -1;
+    }
+
+    if (jacobian_prefix != nullptr && !save_jacobians(jacobian_prefix, "rayleigh", f, result)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void usage(const char *pname)
+{
+  fprintf(stderr,
+	  "usage: %s [options]\n"
+	  "where options is one or more of:\n"
+	  "\n"
+	  " -i|--input <filename>              Input layer model file (required)\n"
+	  " -o|--output-love <filename>        Love modes output file\n"
+	  " -O|--output-rayleigh <filename>    Rayleigh modes output file\n"
+	  " -J|--jacobians <prefix>            Write per mode phase velocity Jacobians\n"
+	  "\n"
+	  " -m|--modes <int>                   No. modes (fundamental + overtones)\n"
+	  "\n"
+	  " -f|--frequency-min <float>         Min. frequency (Hz)\n"
+	  " -F|--frequency-max <float>         Max. frequency (Hz)\n"
+	  " -S|--frequency-samples <int>       No. samples (even)\n"
+	  " -H|--frequency-hertz <float>       Sample rate (Hz)\n"
+	  "\n"
+	  " -s|--scale <float>                 Initial Laguerre scale\n"
+	  " -p|--order <int>                   Spectral element order\n"
+	  " -b|--boundaryorder <int>           Laguerre boundary order\n"
+	  "\n"
+	  " -h|--help                          Show usage information\n"
+	  "\n",
+	  pname);
+}
+
+//
+// Output: no. frequencies and modes, then per frequency (ascending) the
+// frequency and c, U for each mode (zero when cut off)
+//
+static bool save_modes(const char *filename,
+		       const std::vector<double> &f,
+		       const ModeSweepResult<double> &result)
+{
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "error: failed to create %s\n", filename);
+    return false;
+  }
+
+  int nf = (int)f.size();
+  int nmodes = result.c.cols();
+  fprintf(fp, "%d %d\n", nf, nmodes);
+
+  for (int i = nf - 1; i >= 0; i --) {
+    fprintf(fp, "%15.9f", f[i]);
+    for (int m = 0; m < nmodes; m ++) {
+      fprintf(fp, " %16.9e %16.9e", result.c(i, m), result.U(i, m));
+    }
+    fprintf(fp, "\n");
+  }
+
+  fclose(fp);
+  return true;
+}
+
+//
+// One file per mode: <prefix>.<wave>.<mode> with the frequency followed by
+// dc/dp for each frequency (ascending), only for frequencies where the mode exists
+//
+static bool save_jacobians(const char *prefix,
+			   const char *wave,
+			   const std::vector<double> &f,
+			   const ModeSweepResult<double> &result)
+{
+  int nf = (int)f.size();
+  
+  for (int m = 0; m < (int)result.dcdp.size(); m ++) {
+    char filename[1024];
+    sprintf(filename, "%s.%s.%d", prefix, wave, m);
+
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "error: failed to create %s\n", filename);
+      return false;
+    }
+
+    const Spec1DMatrix<double> &J = result.dcdp[m];
+    for (int i = nf - 1; i >= 0; i --) {
+      if (result.c(i, m) == 0.0) {
+	continue;
+      }
+      
+      fprintf(fp, "%15.9f", f[i]);
+      for (int j = 0; j < J.rows(); j ++) {
+	fprintf(fp, " %16.9e", J(j, i));
+      }
+      fprintf(fp, "\n");
+    }
+
+    fclose(fp);
+  }
+
+  return true;
+}
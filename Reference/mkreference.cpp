@@ -0,0 +1,757 @@
+//
+// Combined Love/Rayleigh reference dispersion generator. The model is read and
+// projected once, the band is split into chunks that are seeded from a coarse
+// serial pre-pass and then solved in parallel by a pool of worker threads.
+//
+#include <exception>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <string>
+
+#include <stdio.h>
+#include <getopt.h>
+
+#include "spec1d/isotropicvs.hpp"
+#include "spec1d/isotropicvshalfspace.hpp"
+
+#include "spec1d/empiricalmodel.hpp"
+#include "spec1d/model.hpp"
+#include "spec1d/modelloader.hpp"
+#include "spec1d/lovematrices.hpp"
+#include "spec1d/rayleighmatrices.hpp"
+#include "spec1d/lobattoprojection.hpp"
+
+#include "layermodel.hpp"
+#include "priorcovariance.hpp"
+
+constexpr int MAXORDER = 20;
+constexpr int BOUNDARYORDER = MAXORDER;
+
+typedef BrocherEmpiricalModel<double> empiricalmodel_t;
+typedef IsotropicVs<double, empiricalmodel_t> node_t;
+typedef IsotropicVsHalfspace<double, empiricalmodel_t, MAXORDER> boundary_t;
+typedef Cell<double, node_t, MAXORDER> cell_t;
+
+typedef Model<double, node_t, boundary_t, MAXORDER> model_t;
+typedef Mesh<double, MAXORDER> mesh_t;
+typedef LoveMatrices<double, MAXORDER> lovesolver_t;
+typedef RayleighMatrices<double, MAXORDER> rayleighsolver_t;
+
+//
+// Relative phase velocity jump between the end of one chunk and the pre-pass
+// solution at the start of the next above which a possible mode jump is reported
+//
+constexpr double MODE_JUMP_THRESHOLD = 0.05;
+
+enum {
+  WAVE_LOVE = 0,
+  WAVE_RAYLEIGH = 1,
+  WAVE_COUNT = 2
+};
+
+static const char *wave_names[WAVE_COUNT] = {"love", "rayleigh"};
+
+struct reference_output {
+  std::vector<double> f;
+  Spec1DMatrix<double> Jc;  // dc/dp rows per frequency
+  Spec1DMatrix<double> JU;  // dU/dp rows per frequency
+  std::vector<double> phase;
+  std::vector<double> phasestd;
+  std::vector<double> group;
+  std::vector<double> groupstd;
+};
+
+struct chunk {
+  int wave;
+  int ihigh;     // Highest frequency index (inclusive), solved first
+  int ilow;      // Lowest frequency index (inclusive)
+  double scale;  // Laguerre scale seeded by the pre-pass
+  double k;      // Pre-pass wave number at ihigh (0 if not available)
+};
+
+struct worker {
+  lovesolver_t love;
+  rayleighsolver_t rayleigh;
+
+  Spec1DMatrix<double> dkdp;
+  Spec1DMatrix<double> dUdp;
+  Spec1DMatrix<double> dgxdv;
+  Spec1DMatrix<double> dgzdv;
+  Spec1DMatrix<double> dGvdp;
+};
+
+static char short_options[] = "i:o:O:f:F:S:H:s:p:b:P:C:L:B:j:c:h";
+static struct option long_options[] = {
+  {"input", required_argument, 0, 'i'},
+  {"output-love", required_argument, 0, 'o'},
+  {"output-rayleigh", required_argument, 0, 'O'},
+
+  {"frequency-min", required_argument, 0, 'f'},
+  {"frequency-max", required_argument, 0, 'F'},
+  {"frequency-samples", required_argument, 0, 'S'},
+  {"frequency-hertz", required_argument, 0, 'H'},
+
+  {"scale", required_argument, 0, 's'},
+  {"order", required_argument, 0, 'p'},
+  {"boundaryorder", required_argument, 0, 'b'},
+  {"high-order", required_argument, 0, 'P'},
+
+  {"prior-covariance", required_argument, 0, 'C'},
+  {"correlation-length", required_argument, 0, 'L'},
+  {"bandwidth", required_argument, 0, 'B'},
+
+  {"threads", required_argument, 0, 'j'},
+  {"chunks", required_argument, 0, 'c'},
+
+  {"help", no_argument, 0, 'h'},
+
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *pname);
+
+static bool solve_frequency(worker &w,
+			    int wave,
+			    const mesh_t &mesh,
+			    int boundaryorder,
+			    double omega,
+			    int i,
+			    reference_output &out,
+			    double &k);
+
+static bool update_scale(worker &w,
+			 int wave,
+			 const mesh_t &mesh,
+			 int boundaryorder,
+			 double omega,
+			 double k,
+			 double &scale);
+
+static void recompute(worker &w,
+		      int wave,
+		      const mesh_t &mesh,
+		      int boundaryorder,
+		      double scale);
+
+static bool save_output(const char *filename, const reference_output &out);
+
+int main(int argc, char *argv[])
+{
+  int c;
+  int option_index;
+
+  char *input_file;
+  char *output_file[WAVE_COUNT];
+
+  double fmin;
+  double fmax;
+  double hertz;
+  int samples;
+
+  int order;
+  int highorder;
+  int boundaryorder;
+  double scale;
+
+  char *covariance_file;
+  double correlation_length;
+  int bandwidth;
+
+  int nthreads;
+  int nchunks;
+
+  //
+  // Defaults
+  //
+  input_file = nullptr;
+  output_file[WAVE_LOVE] = nullptr;
+  output_file[WAVE_RAYLEIGH] = nullptr;
+
+  order = 5;
+  highorder = 5;
+  boundaryorder = 5;
+  scale = 1.0e-4;
+
+  fmin = 1.0/40.0;
+  fmax = 1.0/2.0;
+
+  samples = 8192;
+  hertz = 2.0;
+
+  covariance_file = nullptr;
+  correlation_length = 0.0;
+  bandwidth = 0;
+
+  nthreads = (int)std::thread::hardware_concurrency();
+  if (nthreads <= 0) {
+    nthreads = 1;
+  }
+  nchunks = 0;
+
+  //
+  // Command line parameters
+  //
+  option_index = 0;
+  while (true) {
+
+    c = getopt_long(argc, argv, short_options, long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+
+    case 'i':
+      input_file = optarg;
+      break;
+
+    case 'o':
+      output_file[WAVE_LOVE] = optarg;
+      break;
+
+    case 'O':
+      output_file[WAVE_RAYLEIGH] = optarg;
+      break;
+
+    case 'f':
+      fmin = atof(optarg);
+      if (fmin <= 0.0) {
+        fprintf(stderr, "error: fmin must be positive\n");
+        return -1;
+      }
+      break;
+
+    case 'F':
+      fmax = atof(optarg);
+      if (fmax <= 0.0) {
+        fprintf(stderr, "error: fmax must be positive\n");
+        return -1;
+      }
+      break;
+
+    case 'S':
+      samples = atoi(optarg);
+      if (samples <= 0 || samples % 2 != 0) {
+	fprintf(stderr, "error: samples must be greater than zero and even\n");
+	return -1;
+      }
+      break;
+
+    case 'H':
+      hertz = atof(optarg);
+      if (hertz <= 0.0) {
+	fprintf(stderr, "error: hertz must be greater than 0\n");
+	return -1;
+      }
+      break;
+
+    case 's':
+      scale = atof(optarg);
+      if (scale <= 0.0) {
+        fprintf(stderr, "error: scale must be positive\n");
+        return -1;
+      }
+      break;
+
+    case 'p':
+      order = atoi(optarg);
+      if (order < 1) {
+        fprintf(stderr, "error: order must be 1 or greater\n");
+        return -1;
+      }
+      break;
+
+    case 'b':
+      boundaryorder = atoi(optarg);
+      if (boundaryorder < 1) {
+        fprintf(stderr, "error: boundary order must be 1 or greater\n");
+        return -1;
+      }
+      break;
+
+    case 'P':
+      highorder = atoi(optarg);
+      if (highorder < 1) {
+        fprintf(stderr, "error: high order must be 1 or greater\n");
+        return -1;
+      }
+      break;
+
+    case 'C':
+      covariance_file = optarg;
+      break;
+
+    case 'L':
+      correlation_length = atof(optarg);
+      if (correlation_length <= 0.0) {
+	fprintf(stderr, "error: correlation length must be positive\n");
+	return -1;
+      }
+      break;
+
+    case 'B':
+      bandwidth = atoi(optarg);
+      if (bandwidth < 0) {
+	fprintf(stderr, "error: bandwidth must be 0 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'j':
+      nthreads = atoi(optarg);
+      if (nthreads < 1) {
+	fprintf(stderr, "error: threads must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
+    case 'c':
+      nchunks = atoi(optarg);
+      if (nchunks < 1) {
+	fprintf(stderr, "error: chunks must be 1 or greater\n");
+	return -1;
+      }
+      break;
+
+    default:
+      fprintf(stderr, "unknown option %c\n", c);
+    case 'h':
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (input_file == nullptr) {
+    fprintf(stderr, "error: missing input file paramter\n");
+    return -1;
+  }
+
+  if (output_file[WAVE_LOVE] == nullptr && output_file[WAVE_RAYLEIGH] == nullptr) {
+    fprintf(stderr, "error: at least one of love or rayleigh output files required\n");
+    return -1;
+  }
+
+  if (nchunks == 0) {
+    nchunks = 4 * nthreads;
+  }
+
+  model_t model;
+  std::vector<double> model_errors;
+  mesh_t mesh;
+
+  if (!load_layer_model(input_file, model, model_errors)) {
+    return -1;
+  }
+
+  //
+  // Single projection shared (read only) by all workers
+  //
+  model.project_gradient(mesh, order);
+
+  PriorCovariance prior;
+  if (!build_prior_covariance(prior,
+			      model,
+			      mesh,
+			      model_errors,
+			      covariance_file,
+			      correlation_length,
+			      bandwidth)) {
+    return -1;
+  }
+
+  int nparameters = (int)model_errors.size();
+
+  int fsamples = samples/2 + 1;
+
+  reference_output out[WAVE_COUNT];
+  std::vector<int> active;
+  for (int w = 0; w < WAVE_COUNT; w ++) {
+    out[w].f.resize(fsamples);
+    out[w].phase.assign(fsamples, 0.0);
+    out[w].phasestd.assign(fsamples, 0.0);
+    out[w].group.assign(fsamples, 0.0);
+    out[w].groupstd.assign(fsamples, 0.0);
+
+    out[w].Jc.resize(fsamples, nparameters);
+    out[w].Jc.setZero();
+    out[w].JU.resize(fsamples, nparameters);
+    out[w].JU.setZero();
+
+    for (int i = 0; i < fsamples; i ++) {
+      out[w].f[i] = (double)i * hertz/(double)samples;
+    }
+  }
+
+  //
+  // Active frequencies in descending order
+  //
+  for (int i = fsamples - 1; i >= 0; i --) {
+    double f = out[0].f[i];
+    if (f >= fmin && f <= fmax) {
+      active.push_back(i);
+    }
+  }
+
+  if (active.empty()) {
+    fprintf(stderr, "error: no frequencies in range\n");
+    return -1;
+  }
+
+  if (nchunks > (int)active.size()) {
+    nchunks = (int)active.size();
+  }
+
+  if (nthreads > nchunks * WAVE_COUNT) {
+    nthreads = nchunks * WAVE_COUNT;
+  }
+
+  //
+  // Solvers are constructed serially as quadrature construction shares a
+  // static polynomial cache
+  //
+  std::vector<worker*> workers;
+  for (int t = 0; t < nthreads; t ++) {
+    workers.push_back(new worker);
+  }
+
+  //
+  // Coarse pre-pass: walk the first frequency of each chunk from high to low
+  // with Laguerre scale continuation and record the scale and wave number
+  // that seeds each chunk.
+  //
+  std::vector<chunk> chunks;
+  for (int w = 0; w < WAVE_COUNT; w ++) {
+
+    if (output_file[w] == nullptr) {
+      continue;
+    }
+
+    double prescale = scale;
+    recompute(*workers[0], w, mesh, boundaryorder, prescale);
+
+    for (int j = 0; j < nchunks; j ++) {
+
+      chunk ch;
+      int jstart = (int)(((size_t)j * active.size())/nchunks);
+      int jend = (int)(((size_t)(j + 1) * active.size())/nchunks) - 1;
+
+      ch.wave = w;
+      ch.ihigh = active[jstart];
+      ch.ilow = active[jend];
+      ch.scale = prescale;
+      ch.k = 0.0;
+
+      double omega = out[w].f[ch.ihigh] * 2.0 * M_PI;
+      double k;
+      if (solve_frequency(*workers[0], w, mesh, boundaryorder, omega, ch.ihigh, out[w], k)) {
+	ch.k = k;
+	update_scale(*workers[0], w, mesh, boundaryorder, omega, k, prescale);
+      }
+
+      chunks.push_back(ch);
+    }
+  }
+
+  //
+  // Parallel pass over chunks
+  //
+  std::atomic<int> next_chunk(0);
+  std::atomic<int> completed(0);
+  std::atomic<bool> failed(false);
+  std::mutex progress_mutex;
+  int total = (int)(active.size() * (chunks.size()/nchunks));
+  int progress_step = total/20;
+  if (progress_step < 1) {
+    progress_step = 1;
+  }
+  std::vector<double> chunk_end_phase(chunks.size(), 0.0);
+
+  auto run = [&](worker *wk) {
+
+    while (!failed) {
+      int ci = next_chunk ++;
+      if (ci >= (int)chunks.size()) {
+	break;
+      }
+
+      const chunk &ch = chunks[ci];
+      reference_output &o = out[ch.wave];
+      double chscale = ch.scale;
+
+      recompute(*wk, ch.wave, mesh, boundaryorder, chscale);
+
+      for (int i = ch.ihigh; i >= ch.ilow; i --) {
+
+	double omega = o.f[i] * 2.0 * M_PI;
+
+	double k;
+	if (!solve_frequency(*wk, ch.wave, mesh, boundaryorder, omega, i, o, k)) {
+	  failed = true;
+	  break;
+	}
+
+	if (i == ch.ilow) {
+	  chunk_end_phase[ci] = o.phase[i];
+	}
+
+	update_scale(*wk, ch.wave, mesh, boundaryorder, omega, k, chscale);
+
+	int n = ++ completed;
+	if (n % progress_step == 0 || n == total) {
+	  std::lock_guard<std::mutex> lock(progress_mutex);
+	  printf("%3d%% (%d/%d)\n", (100 * n)/total, n, total);
+	  fflush(stdout);
+	}
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nthreads; t ++) {
+    threads.push_back(std::thread(run, workers[t]));
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  for (auto w : workers) {
+    delete w;
+  }
+
+  if (failed) {
+    return -1;
+  }
+
+  //
+  // Mode check: the end of each chunk should join smoothly onto the pre-pass
+  // solution that seeded the following chunk.
+  //
+  for (int ci = 0; ci < (int)chunks.size() - 1; ci ++) {
+    const chunk &next = chunks[ci + 1];
+    if (next.wave != chunks[ci].wave || next.k == 0.0) {
+      continue;
+    }
+
+    double cnext = out[next.wave].f[next.ihigh] * 2.0 * M_PI/next.k;
+    double cend = chunk_end_phase[ci];
+    if (cend > 0.0 && fabs(cnext - cend)/cend > MODE_JUMP_THRESHOLD) {
+      fprintf(stderr, "warning: %s phase velocity jump at %f Hz (%f -> %f), possible mode jump\n",
+	      wave_names[next.wave], out[next.wave].f[next.ihigh], cend, cnext);
+    }
+  }
+
+  //
+  // Linearized phase/group velocity uncertainties, diag(J C J^T), for all
+  // frequencies at once
+  //
+  for (int w = 0; w < WAVE_COUNT; w ++) {
+    if (output_file[w] != nullptr) {
+      prior.deviations(out[w].Jc, "phase velocity", out[w].phasestd.data());
+      prior.deviations(out[w].JU, "group velocity", out[w].groupstd.data());
+    }
+  }
+
+  //
+  // Save output files
+  //
+  for (int w = 0; w < WAVE_COUNT; w ++) {
+    if (output_file[w] != nullptr) {
+      if (!save_output(output_file[w], out[w])) {
+	return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+static void usage(const char *pname)
+{
+  fprintf(stderr,
+	  "usage: %s [options]\n"
+	  "where options is one or more of:\n"
+	  "\n"
+	  " -i|--input <filename>              Input layer model file (required)\n"
+	  " -o|--output-love <filename>        Love reference output file\n"
+	  " -O|--output-rayleigh <filename>    Rayleigh reference output file\n"
+	  "\n"
+	  " -f|--frequency-min <float>         Min. frequency (Hz)\n"
+	  " -F|--frequency-max <float>         Max. frequency (Hz)\n"
+	  " -S|--frequency-samples <int>       No. samples (even)\n"
+	  " -H|--frequency-hertz <float>       Sample rate (Hz)\n"
+	  "\n"
+	  " -s|--scale <float>                 Initial Laguerre scale\n"
+	  " -p|--order <int>                   Spectral element order\n"
+	  " -b|--boundaryorder <int>           Laguerre boundary order\n"
+	  "\n"
+	  " -C|--prior-covariance <filename>  Full prior model covariance (size then rows)\n"
+	  " -L|--correlation-length <float>   Prior depth correlation length (km)\n"
+	  " -B|--bandwidth <int>              Prior correlation band half width (0 for full)\n"
+	  "\n"
+	  " -j|--threads <int>                 No. worker threads (default all cores)\n"
+	  " -c|--chunks <int>                  No. frequency chunks per wave type (default 4 x threads)\n"
+	  "\n"
+	  " -h|--help                          Show usage information\n"
+	  "\n",
+	  pname);
+}
+
+static bool solve_frequency(worker &w,
+			    int wave,
+			    const mesh_t &mesh,
+			    int boundaryorder,
+			    double omega,
+			    int i,
+			    reference_output &out,
+			    double &k)
+{
+  double normA, normB, normC, normD;
+
+  if (wave == WAVE_LOVE) {
+    k = w.love.solve_fundamental_gradient_sep(mesh,
+					      boundaryorder,
+					      omega,
+					      w.dkdp,
+					      w.dUdp,
+					      normA,
+					      normB,
+					      normC);
+  } else {
+    w.dgxdv.resize(w.rayleigh.size, 1);
+    w.dgxdv.setZero();
+    w.dgxdv(0, 0) = 1.0;
+
+    w.dgzdv.resize(w.rayleigh.size, 1);
+    w.dgzdv.setZero();
+    w.dgzdv(0, 0) = 1.0;
+
+    double _eH;
+    double _eV;
+
+    k = w.rayleigh.solve_fundamental_gradient_generic(mesh,
+						      boundaryorder,
+						      omega,
+						      w.dgxdv,
+						      w.dgzdv,
+						      w.dkdp,
+						      w.dUdp,
+						      normA,
+						      normB,
+						      normC,
+						      normD,
+						      _eH,
+						      _eV,
+						      w.dGvdp);
+  }
+
+  if (k == 0.0) {
+    fprintf(stderr, "error: failed to compute %s wave number\n", wave_names[wave]);
+    return false;
+  }
+
+  int nparameters = w.dkdp.rows();
+  if (nparameters != out.Jc.cols()) {
+    fprintf(stderr, "error: unexpected no. parameters: %d != %d\n",
+	    nparameters, out.Jc.cols());
+    return false;
+  }
+
+  //
+  // Phase and group velocity and their Jacobian rows for the linearized
+  // uncertainties
+  //
+  out.phase[i] = omega/fabs(k);
+  for (int j = 0; j < nparameters; j ++) {
+    out.Jc(i, j) = -w.dkdp(j, 0) * omega/(k*k);
+  }
+
+  if (wave == WAVE_LOVE) {
+    out.group[i] = (normB*k)/(omega*normA);
+  } else {
+    out.group[i] = (2.0*normB*k + normC)/(2.0*omega*normA);
+  }
+  if (k < 0.0) {
+    out.group[i] = -out.group[i];
+  }
+  for (int j = 0; j < nparameters; j ++) {
+    out.JU(i, j) = w.dUdp(j, 0);
+  }
+
+  return true;
+}
+
+static bool update_scale(worker &w,
+			 int wave,
+			 const mesh_t &mesh,
+			 int boundaryorder,
+			 double omega,
+			 double k,
+			 double &scale)
+{
+  if (wave == WAVE_LOVE) {
+    double vs2 = mesh.boundary.L/mesh.boundary.rho;
+    double disc1 = k*k - omega*omega/vs2;
+
+    if (isnormal(disc1) && disc1 > 0.0) {
+      scale = sqrt(disc1);
+      w.love.recompute(mesh, boundaryorder, scale);
+      return true;
+    }
+
+  } else {
+    double vs2 = mesh.boundary.L/mesh.boundary.rho;
+    double vp2 = mesh.boundary.A/mesh.boundary.rho;
+
+    double disc1 = k*k - omega*omega/vs2;
+    double disc2 = k*k - omega*omega/vp2;
+
+    if (isnormal(disc1) && disc1 > 0.0 &&
+	isnormal(disc2) && disc2 > 0.0) {
+
+      //
+      // Experiments have shown that using the vp scale for both laguerre elements
+      // is the most accurate
+      //
+      scale = sqrt(disc2);
+      w.rayleigh.recompute(mesh, boundaryorder, scale, scale);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void recompute(worker &w,
+		      int wave,
+		      const mesh_t &mesh,
+		      int boundaryorder,
+		      double scale)
+{
+  if (wave == WAVE_LOVE) {
+    w.love.recompute(mesh, boundaryorder, scale);
+  } else {
+    w.rayleigh.recompute(mesh, boundaryorder, scale, scale);
+  }
+}
+
+static bool save_output(const char *filename, const reference_output &out)
+{
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "error: failed to create %s\n", filename);
+    return false;
+  }
+
+  int fsamples = (int)out.f.size();
+  fprintf(fp, "%d\n", fsamples);
+
+  for (int i = 0; i < fsamples; i ++) {
+    fprintf(fp, "%15.9f %16.9e %16.9e %16.9e %16.9e\n",
+	    out.f[i], out.phase[i], out.phasestd[i], out.group[i], out.groupstd[i]);
+  }
+
+  fclose(fp);
+  return true;
+}
@@ -12,6 +12,8 @@
 #include "spec1d/rayleighmatrices.hpp"
 #include "spec1d/lobattoprojection.hpp"
 
+#include "priorcovariance.hpp"
+
 constexpr int MAXORDER = 20;
 constexpr int BOUNDARYORDER = MAXORDER;
 
@@ -26,7 +28,7 @@ typedef RayleighMatrices<double, MAXORDER> rayleighsolver_t;
 
 //#define USE_K
 
-static char short_options[] = "i:o:f:F:S:H:p:b:P:h";
+static char short_options[] = "i:o:f:F:S:H:s:p:b:P:C:L:B:h";
 static struct option long_options[] = {
   {"input", required_argument, 0, 'i'},
   {"output", required_argument, 0, 'o'},
@@ -41,6 +43,10 @@ static struct option long_options[] = {
   {"boundaryorder", required_argument, 0, 'b'},
   {"high-order", required_argument, 0, 'P'},
 
+  {"prior-covariance", required_argument, 0, 'C'},
+  {"correlation-length", required_argument, 0, 'L'},
+  {"bandwidth", required_argument, 0, 'B'},
+
   {"help", no_argument, 0, 'h'},
   
   {0, 0, 0, 0}
@@ -66,6 +72,9 @@ int main(int argc, char *argv[])
   int boundaryorder;
   double scale;
 
+  char *covariance_file;
+  double correlation_length;
+  int bandwidth;
   
 
   //
@@ -88,6 +97,10 @@ int main(int argc, char *argv[])
   samples = 8192;
   hertz = 2.0;
 
+  covariance_file = nullptr;
+  correlation_length = 0.0;
+  bandwidth = 0;
+
   //
   // Command line parameters
   //
@@ -173,6 +186,26 @@ int main(int argc, char *argv[])
       }
       break;
 
+    case 'C':
+      covariance_file = optarg;
+      break;
+
+    case 'L':
+      correlation_length = atof(optarg);
+      if (correlation_length <= 0.0) {
+	fprintf(stderr, "error: correlation length must be positive\n");
+	return -1;
+      }
+      break;
+
+    case 'B':
+      bandwidth = atoi(optarg);
+      if (bandwidth < 0) {
+	fprintf(stderr, "error: bandwidth must be 0 or greater\n");
+	return -1;
+      }
+      break;
+
     default:
       fprintf(stderr, "unknown option %c\n", c);
     case 'h':
@@ -199,14 +232,14 @@ int main(int argc, char *argv[])
   //
   // Load the model
   //
-  FILE *fp = fopen(input_file, "r");
-  if (fp == NULL) {
+  TextReader in;
+  if (!in.open(input_file)) {
     fprintf(stderr, "error: failed to open %s for reading\n", input_file);
     return -1;
   }
 
   int nlayers;
-  if (fscanf(fp, "%d\n", &nlayers) != 1) {
+  if (!in.read_int(nlayers)) {
     fprintf(stderr, "error: failed to read no. layers\n");
     return -1;
   }
@@ -215,7 +248,7 @@ int main(int argc, char *argv[])
 
     double thicknesskm;
     int order;
-    if (fscanf(fp, "%lf %d ", &thicknesskm, &order) != 2) {
+    if (!in.read_double(thicknesskm) || !in.read_int(order)) {
       fprintf(stderr, "error: failed to read line\n");
       return -1;
     }
@@ -236,19 +269,22 @@ int main(int argc, char *argv[])
 
       double vs, vsstd;
       for (int j = 0; j <= order; j ++) {
-	if (fscanf(fp, "%lf", &vs) != 1) {
+	if (!in.read_double(vs)) {
 	  fprintf(stderr, "error: failed to parse vs\n");
 	  return -1;
 	}
 	
 	model.cells[i].nodes[j] = node_t(vs * 1.0e3);
-	model_errors.push_back(vsstd * 1.0e3);
       }
-      if (fscanf(fp, "%lf", &vsstd) != 1) {
+      if (!in.read_double(vsstd)) {
 	fprintf(stderr, "error: failed to parse vsstd\n");
 	return -1;
       }
 
+      for (int j = 0; j <= order; j ++) {
+	model_errors.push_back(vsstd * 1.0e3);
+      }
+
     } else {
       //
       // Add halfspace layer to model
@@ -259,7 +295,7 @@ int main(int argc, char *argv[])
       }
 
       double vs, vsstd;
-      if (fscanf(fp, "%lf %lf", &vs, &vsstd) != 2) {
+      if (!in.read_double(vs) || !in.read_double(vsstd)) {
 	fprintf(stderr, "error: failed to parse vs, vsstd\n");
 	return -1;
       }
@@ -270,7 +306,7 @@ int main(int argc, char *argv[])
     }
   }
 
-  fclose(fp);
+  in.close();
 
   //
   // Compute phase and group velocities and Jacobians and linearized estimates of
@@ -287,11 +323,24 @@ int main(int argc, char *argv[])
   
   model.project_gradient(mesh, order);
 
+  PriorCovariance prior;
+  if (!build_prior_covariance(prior,
+			      model,
+			      mesh,
+			      model_errors,
+			      covariance_file,
+			      correlation_length,
+			      bandwidth)) {
+    return -1;
+  }
+
   rayleigh.recompute(mesh, boundaryorder, scale, scale);
 
   int nparameters = -1;
   
   Spec1DMatrix<double> dkdp;
+  Spec1DMatrix<double> Jc;
+  Spec1DMatrix<double> JU;
   Spec1DMatrix<double> dUdp;
   Spec1DMatrix<double> dgxdv;
   Spec1DMatrix<double> dgzdv;
@@ -352,6 +401,11 @@ int main(int argc, char *argv[])
 		  nparameters, (int)model_errors.size());
 	  return -1;
 	}
+
+	Jc.resize(fsamples, nparameters);
+	Jc.setZero();
+	JU.resize(fsamples, nparameters);
+	JU.setZero();
       }
       
       //
@@ -359,11 +413,8 @@ int main(int argc, char *argv[])
       //
       phase[i] = omega/fabs(k);
       for (int j = 0; j < nparameters; j ++) {
-	double dcdp = -dkdp(j, 0) * omega/(k*k);
-	
-	phasestd[i] += (model_errors[j]*model_errors[j]) * (dcdp*dcdp);
+	Jc(i, j) = -dkdp(j, 0) * omega/(k*k);
       }
-      phasestd[i] = sqrt(phasestd[i]);
 
       //
       // Compute group velocity and linerized estimates of errors
@@ -373,9 +424,8 @@ int main(int argc, char *argv[])
 	group[i] = -group[i];
       }
       for (int j = 0; j < nparameters; j ++) {
-	groupstd[i] += (model_errors[j]*model_errors[j]) * (dUdp(j, 0)*dUdp(j, 0));
+	JU(i, j) = dUdp(j, 0);
       }
-      groupstd[i] = sqrt(groupstd[i]);
 
       //
       // Update Laguerre scale
@@ -403,11 +453,20 @@ int main(int argc, char *argv[])
   }
 
 
+  //
+  // Linearized phase/group velocity uncertainties, diag(J C J^T), for all
+  // frequencies at once
+  //
+  if (nparameters > 0) {
+    prior.deviations(Jc, "phase velocity", phasestd);
+    prior.deviations(JU, "group velocity", groupstd);
+  }
+
   //
   // Save output file
   //
 
-  fp = fopen(output_file, "w");
+  FILE *fp = fopen(output_file, "w");
   if (fp == NULL) {
     fprintf(stderr, "error: failed to create %s\n", output_file);
     return -1;
@@ -0,0 +1,386 @@
+//
+//    AkiEstimate : A method for the joint estimation of Love and Rayleigh surface wave
+//    dispersion from ambient noise cross-correlations.
+//
+//      Hawkins R. and Sambridge M., "An adjoint technique for estimation of interstation phase
+//    and group dispersion from ambient noise cross-correlations", BSSA, 2019
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+#pragma once
+#ifndef priorcovariance_hpp
+#define priorcovariance_hpp
+
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "spec1d/spec1dmatrix.hpp"
+#include "spec1d/textreader.hpp"
+
+//
+// Prior model covariance for the linearized reference uncertainties. The
+// covariance is either diagonal (the per layer standard deviations), built
+// from an exponential depth correlation kernel optionally tapered to a band,
+// or loaded as a full symmetric matrix from a file.
+//
+class PriorCovariance {
+public:
+
+  //
+  // Rows of J processed together in variances(), sized so that a block of
+  // each J column stays in cache while sweeping the covariance band.
+  //
+  static constexpr int ROW_BLOCK = 256;
+
+  //
+  // Relative asymmetry |C_ij - C_ji|/sqrt(C_ii C_jj) accepted in a loaded
+  // covariance (text round off), the matrix is then symmetrized.
+  //
+  static constexpr double SYMMETRY_TOLERANCE = 1.0e-6;
+
+  PriorCovariance() :
+    bandwidth(0),
+    diagonal(true)
+  {
+  }
+
+  void build_diagonal(const std::vector<double> &sigma)
+  {
+    int n = (int)sigma.size();
+    
+    C.resize(n, n);
+    C.setZero();
+    for (int i = 0; i < n; i ++) {
+      C(i, i) = sigma[i] * sigma[i];
+    }
+
+    bandwidth = 0;
+    diagonal = true;
+  }
+
+  //
+  // C_ij = s_i s_j exp(-|z_i - z_j|/length) t(|i - j|), where t is the
+  // Gaspari-Cohn taper vanishing beyond bandwidth parameters off the diagonal
+  // (bandwidth 0 for no taper). Cutting the kernel off at the band would not
+  // be positive semidefinite, the tapered product is.
+  //
+  void build_correlated(const std::vector<double> &sigma,
+			const std::vector<double> &depth,
+			double length,
+			int _bandwidth)
+  {
+    int n = (int)sigma.size();
+
+    C.resize(n, n);
+    C.setZero();
+
+    bandwidth = _bandwidth;
+    diagonal = false;
+
+    //
+    // Taper half support so that it is zero from bandwidth + 1 off the diagonal
+    //
+    double halfsupport = 0.5 * (double)(bandwidth + 1);
+    
+    for (int j = 0; j < n; j ++) {
+      int i0, i1;
+      band(j, n, i0, i1);
+      
+      for (int i = i0; i <= i1; i ++) {
+	double taper = 1.0;
+	if (bandwidth > 0) {
+	  taper = gaspari_cohn((double)abs(i - j)/halfsupport);
+	}
+	
+	C(i, j) = sigma[i] * sigma[j] * exp(-fabs(depth[i] - depth[j])/length) * taper;
+      }
+    }
+  }
+
+  //
+  // Full matrix file: the size followed by n rows of n values
+  //
+  bool load(const char *filename, int n)
+  {
+    TextReader in;
+    if (!in.open(filename)) {
+      fprintf(stderr, "error: failed to open %s for reading\n", filename);
+      return false;
+    }
+
+    int fn;
+    if (!in.read_int(fn)) {
+      fprintf(stderr, "error: failed to read covariance size\n");
+      return false;
+    }
+
+    if (fn != n) {
+      fprintf(stderr, "error: covariance size mismatch: %d != %d\n", fn, n);
+      return false;
+    }
+
+    C.resize(n, n);
+    for (int i = 0; i < n; i ++) {
+      for (int j = 0; j < n; j ++) {
+	if (!in.read_double(C(i, j))) {
+	  fprintf(stderr, "error: failed to read covariance entry %d %d\n", i, j);
+	  return false;
+	}
+      }
+    }
+
+    in.close();
+
+    for (int i = 0; i < n; i ++) {
+      if (C(i, i) < 0.0) {
+	fprintf(stderr, "error: negative covariance diagonal entry %d: %g\n", i, C(i, i));
+	return false;
+      }
+      
+      for (int j = 0; j < i; j ++) {
+	double scale = sqrt(C(i, i) * C(j, j));
+	if (fabs(C(i, j) - C(j, i)) > SYMMETRY_TOLERANCE * scale) {
+	  fprintf(stderr, "error: covariance is not symmetric: entries %d %d: %g != %g\n",
+		  i, j, C(i, j), C(j, i));
+	  return false;
+	}
+
+	double cij = 0.5 * (C(i, j) + C(j, i));
+	C(i, j) = cij;
+	C(j, i) = cij;
+      }
+    }
+
+    bandwidth = 0;
+    diagonal = false;
+    return true;
+  }
+
+  int size() const
+  {
+    return C.rows();
+  }
+  
+  //
+  // var_r = (J C J^T)_rr for every row r of J (rows x size()). Rows are
+  // processed in blocks so that each column of the covariance band is applied
+  // to a contiguous block of J. Returns the number of negative variances,
+  // which only a covariance that is not positive semidefinite can give.
+  //
+  int variances(const Spec1DMatrix<double> &J, std::vector<double> &var) const
+  {
+    int nrows = J.rows();
+    int n = C.rows();
+
+    if (J.cols() != n) {
+      FATAL("Jacobian/covariance size mismatch: %d != %d", J.cols(), n);
+    }
+
+    var.assign(nrows, 0.0);
+
+    const double *Jd = J.data();
+    const double *Cd = C.data();
+    double t[ROW_BLOCK];
+
+    for (int r0 = 0; r0 < nrows; r0 += ROW_BLOCK) {
+      int nr = nrows - r0;
+      if (nr > ROW_BLOCK) {
+	nr = ROW_BLOCK;
+      }
+
+      for (int k = 0; k < n; k ++) {
+
+	const double *Jk = Jd + (size_t)k * nrows + r0;
+	
+	if (diagonal) {
+	  double ckk = Cd[(size_t)k * n + k];
+	  for (int r = 0; r < nr; r ++) {
+	    var[r0 + r] += Jk[r] * Jk[r] * ckk;
+	  }
+	  continue;
+	}
+
+	//
+	// t = J(block, :) C(:, k)
+	//
+	for (int r = 0; r < nr; r ++) {
+	  t[r] = 0.0;
+	}
+	
+	int j0, j1;
+	band(k, n, j0, j1);
+	for (int j = j0; j <= j1; j ++) {
+	  double cjk = Cd[(size_t)k * n + j];
+	  if (cjk == 0.0) {
+	    continue;
+	  }
+	  
+	  const double *Jj = Jd + (size_t)j * nrows + r0;
+	  for (int r = 0; r < nr; r ++) {
+	    t[r] += Jj[r] * cjk;
+	  }
+	}
+
+	for (int r = 0; r < nr; r ++) {
+	  var[r0 + r] += t[r] * Jk[r];
+	}
+      }
+    }
+
+    int negative = 0;
+    for (int r = 0; r < nrows; r ++) {
+      if (var[r] < 0.0) {
+	negative ++;
+      }
+    }
+
+    return negative;
+  }
+
+  //
+  // Linearized standard deviations sqrt(var_r) into sd. Negative variances
+  // are reported as a warning (naming the quantity) and given a zero rather
+  // than a NaN deviation.
+  //
+  void deviations(const Spec1DMatrix<double> &J, const char *name, double *sd) const
+  {
+    std::vector<double> var;
+
+    int negative = variances(J, var);
+    if (negative > 0) {
+      fprintf(stderr, "warning: %d negative %s variances, prior covariance is not positive semidefinite\n",
+	      negative, name);
+    }
+
+    for (int r = 0; r < (int)var.size(); r ++) {
+      if (var[r] > 0.0) {
+	sd[r] = sqrt(var[r]);
+      } else {
+	sd[r] = 0.0;
+      }
+    }
+  }
+
+  Spec1DMatrix<double> C;
+  int bandwidth;
+  bool diagonal;
+
+private:
+
+  //
+  // Gaspari and Cohn (1999) compactly supported fifth order piecewise rational
+  // correlation function of r = distance/halfsupport, zero for r >= 2
+  //
+  static double gaspari_cohn(double r)
+  {
+    if (r <= 1.0) {
+      return (((-0.25 * r + 0.5) * r + 0.625) * r - 5.0/3.0) * r * r + 1.0;
+    } else if (r < 2.0) {
+      return ((((r/12.0 - 0.5) * r + 0.625) * r + 5.0/3.0) * r - 5.0) * r + 4.0 - 2.0/(3.0 * r);
+    } else {
+      return 0.0;
+    }
+  }
+
+  void band(int k, int n, int &i0, int &i1) const
+  {
+    if (bandwidth > 0) {
+      i0 = k - bandwidth;
+      if (i0 < 0) {
+	i0 = 0;
+      }
+      i1 = k + bandwidth;
+      if (i1 > n - 1) {
+	i1 = n - 1;
+      }
+    } else {
+      i0 = 0;
+      i1 = n - 1;
+    }
+  }
+  
+};
+
+//
+// Depth of each model parameter (cell nodes in order followed by the
+// halfspace) used by the depth correlation kernel
+//
+template
+<
+  typename model_t,
+  typename mesh_t
+>
+void parameter_depths(const model_t &model,
+		      const mesh_t &mesh,
+		      std::vector<double> &depth)
+{
+  depth.clear();
+  
+  for (int i = 0; i < (int)model.cells.size(); i ++) {
+    int order = model.cells[i].order[0];
+    for (int j = 0; j <= order; j ++) {
+      depth.push_back(model.compute_node_depth(mesh, i, order, j));
+    }
+  }
+
+  depth.push_back(model.halfspace_depth());
+}
+
+//
+// Selects the covariance from the command line options: a full matrix file if
+// given, otherwise a depth correlated covariance if a correlation length
+// (km) is given, otherwise the diagonal of the model errors.
+//
+template
+<
+  typename model_t,
+  typename mesh_t
+>
+bool build_prior_covariance(PriorCovariance &prior,
+			    const model_t &model,
+			    const mesh_t &mesh,
+			    const std::vector<double> &model_errors,
+			    const char *covariance_file,
+			    double correlation_length,
+			    int bandwidth)
+{
+  if (covariance_file != nullptr) {
+    return prior.load(covariance_file, (int)model_errors.size());
+  }
+
+  if (correlation_length > 0.0) {
+    std::vector<double> depth;
+    parameter_depths(model, mesh, depth);
+
+    if (depth.size() != model_errors.size()) {
+      fprintf(stderr, "error: parameter depth count mismatch: %d != %d\n",
+	      (int)depth.size(), (int)model_errors.size());
+      return false;
+    }
+
+    prior.build_correlated(model_errors, depth, correlation_length * 1.0e3, bandwidth);
+    return true;
+  }
+
+  prior.build_diagonal(model_errors);
+  return true;
+}
+
+#endif // priorcovariance_hpp
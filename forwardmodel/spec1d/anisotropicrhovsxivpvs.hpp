@@ -192,6 +192,82 @@ public:
     }
   }
 
+  virtual real d2rho(size_t i, size_t j, real depth) const
+  {
+    return 0.0;
+  }
+
+  virtual real d2A(size_t i, size_t j, real depth) const
+  {
+    // A = vs^2 vpvs^2 rho
+    switch (pair(i, j)) {
+    case 1: // rho vs
+      return 2.0*pVs()*pVpVs()*pVpVs();
+    case 3: // rho vpvs
+      return 2.0*pVs()*pVs()*pVpVs();
+    case 5: // vs vs
+      return 2.0*prho()*pVpVs()*pVpVs();
+    case 7: // vs vpvs
+      return 4.0*prho()*pVs()*pVpVs();
+    case 15: // vpvs vpvs
+      return 2.0*prho()*pVs()*pVs();
+    default:
+      return 0.0;
+    }
+  }
+
+  virtual real d2C(size_t i, size_t j, real depth) const
+  {
+    return d2A(i, j, depth);
+  }
+
+  virtual real d2F(size_t i, size_t j, real depth) const
+  {
+    // F = A - 2L
+    return d2A(i, j, depth) - 2.0*d2L(i, j, depth);
+  }
+
+  virtual real d2L(size_t i, size_t j, real depth) const
+  {
+    // L = 3 rho Vs^2 g, g = 1/(2 + xi)
+    real g = 1.0/(2.0 + pXi());
+    switch (pair(i, j)) {
+    case 1: // rho vs
+      return 6.0 * pVs() * g;
+    case 2: // rho xi
+      return -3.0 * pVs() * pVs() * g * g;
+    case 5: // vs vs
+      return 6.0 * prho() * g;
+    case 6: // vs xi
+      return -6.0 * prho() * pVs() * g * g;
+    case 10: // xi xi
+      return 6.0 * prho() * pVs() * pVs() * g * g * g;
+    default:
+      return 0.0;
+    }
+  }
+
+  virtual real d2N(size_t i, size_t j, real depth) const
+  {
+    // N = 3 rho vs^2 h, h = xi/(2 + xi), dh/dxi = 2 g^2
+    real g = 1.0/(2.0 + pXi());
+    real h = pXi() * g;
+    switch (pair(i, j)) {
+    case 1: // rho vs
+      return 6.0 * pVs() * h;
+    case 2: // rho xi
+      return 6.0 * pVs() * pVs() * g * g;
+    case 5: // vs vs
+      return 6.0 * prho() * h;
+    case 6: // vs xi
+      return 12.0 * prho() * pVs() * g * g;
+    case 10: // xi xi
+      return -12.0 * prho() * pVs() * pVs() * g * g * g;
+    default:
+      return 0.0;
+    }
+  }
+
   static const char *NAME()
   {
     return "AnisotropicRhoVsXiVpVs";
@@ -199,6 +275,14 @@ public:
 
 private:
 
+  //
+  // Symmetric index of the parameter pair (i, j) for the second derivatives
+  //
+  static size_t pair(size_t i, size_t j)
+  {
+    return i < j ? 4*i + j : 4*j + i;
+  }
+
   real &prho()
   {
     return this->operator[](0);
@@ -30,6 +30,7 @@
 #include "mesh.hpp"
 
 #include "halfspace.hpp"
+#include "anisotropicrhovsxivpvs.hpp"
 
 template
 <
@@ -141,6 +142,35 @@ public:
     mesh.boundary_jacobian(3, 5) = 0.0;
   }
 
+  //
+  // As project_gradient with the boundary jacobian replaced by its
+  // derivative in the direction of the model parameters
+  //
+  void project_hessian(size_t index,
+		       real depth,
+		       Mesh<real, maxorder> &mesh,
+		       const Spec1DMatrix<real> &direction) const
+  {
+    project_gradient(index, depth, mesh);
+
+    AnisotropicRhoVsXiVpVs<real> p((*this)[pRHO], (*this)[pVS], (*this)[pXI], (*this)[pVPVS]);
+    size_t doffset = mesh.boundary_parameter_offset;
+
+    mesh.boundary_jacobian.setZero();
+    for (size_t k = 0; k < 4; k ++) {
+      for (size_t l = 0; l < 4; l ++) {
+	real d = direction(doffset + l, 0);
+	
+	mesh.boundary_jacobian(k, 0) += p.d2rho(k, l, depth) * d;
+	mesh.boundary_jacobian(k, 1) += p.d2A(k, l, depth) * d;
+	mesh.boundary_jacobian(k, 2) += p.d2C(k, l, depth) * d;
+	mesh.boundary_jacobian(k, 3) += p.d2F(k, l, depth) * d;
+	mesh.boundary_jacobian(k, 4) += p.d2L(k, l, depth) * d;
+	mesh.boundary_jacobian(k, 5) += p.d2N(k, l, depth) * d;
+      }
+    }
+  }
+
   void project(size_t index,
 	       real basement,
 	       double min_basement,
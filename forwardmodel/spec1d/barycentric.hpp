@@ -0,0 +1,123 @@
+//
+//    Spec1D : A spectral element code for surface wave dispersion of Love
+//    and Rayleigh waves. See
+//
+//      R Hawkins, "A spectral element method for surface wave dispersion and adjoints",
+//      Geophysical Journal International, 2018, 215:1, 267 - 302
+//      https://doi.org/10.1093/gji/ggy277
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef barycentric_hpp
+#define barycentric_hpp
+
+#include <stddef.h>
+#include <math.h>
+
+//
+// Barycentric weights w_j = 1/prod_{k != j} (x_j - x_k) of the Lagrange
+// basis on nodes x_0 .. x_n.
+//
+template
+<
+  typename real
+>
+void BarycentricWeights(size_t n, const real *nodes, real *weights)
+{
+  for (size_t j = 0; j <= n; j ++) {
+    real p = 1.0;
+    for (size_t k = 0; k <= n; k ++) {
+      if (k != j) {
+	p *= nodes[j] - nodes[k];
+      }
+    }
+    weights[j] = 1.0/p;
+  }
+}
+
+//
+// All Lagrange basis values l[j] = l_j(x) and, if dl is not null, their
+// derivatives in O(n). The products and sums are formed about the node m
+// nearest x so that x at or near a node needs no special case and loses
+// no precision:
+//
+//   l_m  = w_m P,              l_m'  = w_m P s
+//   l_j  = w_j e Q_j,          l_j'  = w_j Q_j (1 + e (s - 1/(x - x_j)))
+//
+// with e = x - x_m, P = prod_{k != m} (x - x_k), s = sum_{k != m} 1/(x - x_k)
+// and Q_j = P/(x - x_j).
+//
+template
+<
+  typename real
+>
+void BarycentricCardinals(size_t n,
+			  const real *nodes,
+			  const real *weights,
+			  real x,
+			  real *l,
+			  real *dl)
+{
+  if (n == 0) {
+    l[0] = 1.0;
+    if (dl != nullptr) {
+      dl[0] = 0.0;
+    }
+    return;
+  }
+
+  size_t m = 0;
+  real emin = fabs(x - nodes[0]);
+  for (size_t k = 1; k <= n; k ++) {
+    real e = fabs(x - nodes[k]);
+    if (e < emin) {
+      emin = e;
+      m = k;
+    }
+  }
+
+  real e = x - nodes[m];
+  real P = 1.0;
+  real s = 0.0;
+  for (size_t k = 0; k <= n; k ++) {
+    if (k != m) {
+      real d = x - nodes[k];
+      P *= d;
+      s += 1.0/d;
+    }
+  }
+
+  for (size_t j = 0; j <= n; j ++) {
+    if (j == m) {
+      l[j] = weights[j] * P;
+      if (dl != nullptr) {
+	dl[j] = l[j] * s;
+      }
+    } else {
+      real d = x - nodes[j];
+      real Q = weights[j] * P/d;
+      l[j] = e * Q;
+      if (dl != nullptr) {
+	dl[j] = Q * (1.0 + e * (s - 1.0/d));
+      }
+    }
+  }
+}
+
+#endif // barycentric_hpp
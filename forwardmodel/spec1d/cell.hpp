@@ -33,6 +33,7 @@
 #include "lobattoprojection.hpp"
 
 #include "encodedecode.hpp"
+#include "textreader.hpp"
 
 template
 <
@@ -87,34 +88,100 @@ public:
     //
     // Project current order(s) for each parameter to specified order (nodes -> projected nodes)
     //
-    size_t poffset = 0;
-    for (size_t k = 0; k < parameterset::NPARAMETERS; k ++) {
+    node_project(mesh, mesh_order);
 
-      for (size_t j = 0; j <= mesh_order; j ++) {
-	projected_nodes[j][k] = 0.0;
+    //
+    // The TI parameters at projected node j depend on all cell parameters at
+    // that node, so their derivatives are evaluated at the projected node
+    // and not at the cell nodes (these differ when the mesh order is above
+    // the cell order).
+    //
+    for (size_t j = 0; j <= mesh_order; j ++) {
+      
+      real depth = offset + ((mesh.quadrature[maxorder]->nodes[j] + 1.0)/2.0) * thickness;
+      const parameterset &pj = projected_nodes[j];
 
-	real depth = offset + ((mesh.quadrature[maxorder]->nodes[k] + 1.0)/2.0) * thickness;
+      size_t poffset = 0;
+      for (size_t k = 0; k < parameterset::NPARAMETERS; k ++) {
 	
 	for (size_t i = 0; i <= order[k]; i ++) {
 
 	  double w = mesh.projection[mesh_order]->weight[order[k]][i][j];
 	  
-	  projected_nodes[j][k] += nodes[i][k] * w;
-
 	  //
 	  // Col offset is 6 * j
 	  // Row offset is dynamic = \sum_k (order_i + 1) == poffset
 	  //
-	  jacobian(poffset + i, 6*j + 0) += w * nodes[i].drho(k, depth);
-	  jacobian(poffset + i, 6*j + 1) += w * nodes[i].dA(k, depth);
-	  jacobian(poffset + i, 6*j + 2) += w * nodes[i].dC(k, depth);
-	  jacobian(poffset + i, 6*j + 3) += w * nodes[i].dF(k, depth);
-	  jacobian(poffset + i, 6*j + 4) += w * nodes[i].dL(k, depth);
-	  jacobian(poffset + i, 6*j + 5) += w * nodes[i].dN(k, depth);
+	  jacobian(poffset + i, 6*j + 0) += w * pj.drho(k, depth);
+	  jacobian(poffset + i, 6*j + 1) += w * pj.dA(k, depth);
+	  jacobian(poffset + i, 6*j + 2) += w * pj.dC(k, depth);
+	  jacobian(poffset + i, 6*j + 3) += w * pj.dF(k, depth);
+	  jacobian(poffset + i, 6*j + 4) += w * pj.dL(k, depth);
+	  jacobian(poffset + i, 6*j + 5) += w * pj.dN(k, depth);
+	}
+
+	poffset += (order[k] + 1);
+      }
+    }
+  }
+
+  //
+  // Derivative of the node_project_gradient jacobian in the direction given
+  // by rows doffset onwards of direction, ie the second derivatives of the
+  // TI parameters contracted with the direction
+  //
+  void node_project_hessian(real offset,
+			    real thickness,
+			    Mesh<real, maxorder> &mesh,
+			    Spec1DMatrix<real> &jacobian,
+			    size_t mesh_order,
+			    const Spec1DMatrix<real> &direction,
+			    size_t doffset) const
+  {
+    node_project(mesh, mesh_order);
+
+    for (size_t j = 0; j <= mesh_order; j ++) {
+
+      real depth = offset + ((mesh.quadrature[maxorder]->nodes[j] + 1.0)/2.0) * thickness;
+      const parameterset &pj = projected_nodes[j];
+
+      //
+      // Change of the projected parameters at node j in the direction
+      //
+      real dpj[parameterset::NPARAMETERS];
+      size_t poffset = 0;
+      for (size_t k = 0; k < parameterset::NPARAMETERS; k ++) {
+	dpj[k] = 0.0;
+	for (size_t i = 0; i <= order[k]; i ++) {
+	  dpj[k] += direction(doffset + poffset + i, 0) * mesh.projection[mesh_order]->weight[order[k]][i][j];
 	}
+	poffset += (order[k] + 1);
       }
 
-      poffset += (order[k] + 1);
+      poffset = 0;
+      for (size_t k = 0; k < parameterset::NPARAMETERS; k ++) {
+
+	real h[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+	for (size_t l = 0; l < parameterset::NPARAMETERS; l ++) {
+	  h[0] += pj.d2rho(k, l, depth) * dpj[l];
+	  h[1] += pj.d2A(k, l, depth) * dpj[l];
+	  h[2] += pj.d2C(k, l, depth) * dpj[l];
+	  h[3] += pj.d2F(k, l, depth) * dpj[l];
+	  h[4] += pj.d2L(k, l, depth) * dpj[l];
+	  h[5] += pj.d2N(k, l, depth) * dpj[l];
+	}
+
+	for (size_t i = 0; i <= order[k]; i ++) {
+
+	  double w = mesh.projection[mesh_order]->weight[order[k]][i][j];
+
+	  for (size_t t = 0; t < 6; t ++) {
+	    jacobian(poffset + i, 6*j + t) += w * h[t];
+	  }
+	}
+
+	poffset += (order[k] + 1);
+      }
     }
   }
 
@@ -195,6 +262,25 @@ public:
 
   }
 
+  //
+  // As project_gradient with the jacobian replaced by its derivative in the
+  // direction of the model parameters (see node_project_hessian)
+  //
+  void project_hessian(size_t index,
+		       real offset,
+		       Mesh<real, maxorder> &mesh,
+		       size_t mesh_order,
+		       const Spec1DMatrix<real> &direction) const
+  {
+    project_gradient(index, offset, mesh, mesh_order);
+
+    size_t doffset = mesh.cell_parameter_offsets[mesh.cell_parameter_offsets.size() - 2];
+    MeshCell<real, maxorder> &mcell = mesh.cells[mesh.cells.size() - 1];
+
+    mcell.jacobian.setZero();
+    node_project_hessian(offset, thickness, mesh, mcell.jacobian, mesh_order, direction, doffset);
+  }
+
   void cell_project(LobattoUpProjector<real, maxorder> &up_projector,
 		    LobattoDownProjector<real, maxorder> &down_projector,
 		    Cell &cell) const
@@ -477,18 +563,19 @@ public:
 	  real xi = 2.0 * zp/thickness - 1.0;
 	  
 	  mcell.nodes[j].zero();
+
+	  real l[maxorder + 1];
+	  mesh.quadrature[mesh_order]->cardinals(xi, l);
 	  
 	  for (size_t k = 0; k <= mesh_order; k ++) {
-	    double l = mesh.quadrature[mesh_order]->cardinal[k].value(xi);
-
 	    real depth = offset + ((xi + 1.0)/2.0 * thickness);
 	      
-	    mcell.nodes[j].rho += projected_nodes[k].rho(depth) * l;
-	    mcell.nodes[j].A += projected_nodes[k].A(depth) * l;
-	    mcell.nodes[j].C += projected_nodes[k].C(depth) * l;
-	    mcell.nodes[j].F += projected_nodes[k].F(depth) * l;
-	    mcell.nodes[j].L += projected_nodes[k].L(depth) * l;
-	    mcell.nodes[j].N += projected_nodes[k].N(depth) * l;
+	    mcell.nodes[j].rho += projected_nodes[k].rho(depth) * l[k];
+	    mcell.nodes[j].A += projected_nodes[k].A(depth) * l[k];
+	    mcell.nodes[j].C += projected_nodes[k].C(depth) * l[k];
+	    mcell.nodes[j].F += projected_nodes[k].F(depth) * l[k];
+	    mcell.nodes[j].L += projected_nodes[k].L(depth) * l[k];
+	    mcell.nodes[j].N += projected_nodes[k].N(depth) * l[k];
 	  }
 	  
 	}
@@ -533,18 +620,19 @@ public:
 	  real xi = 2.0 * zp/thickness - 1.0;
 	  
 	  mcell.nodes[j].zero();
+
+	  real l[maxorder + 1];
+	  mesh.quadrature[mesh_order]->cardinals(xi, l);
 	  
 	  for (size_t k = 0; k <= mesh_order; k ++) {
-	    double l = mesh.quadrature[mesh_order]->cardinal[k].value(xi);
-
 	    real depth = offset + ((xi + 1.0)/2.0 * thickness);
 	      
-	    mcell.nodes[j].rho += projected_nodes[k].rho(depth) * l;
-	    mcell.nodes[j].A += projected_nodes[k].A(depth) * l;
-	    mcell.nodes[j].C += projected_nodes[k].C(depth) * l;
-	    mcell.nodes[j].F += projected_nodes[k].F(depth) * l;
-	    mcell.nodes[j].L += projected_nodes[k].L(depth) * l;
-	    mcell.nodes[j].N += projected_nodes[k].N(depth) * l;
+	    mcell.nodes[j].rho += projected_nodes[k].rho(depth) * l[k];
+	    mcell.nodes[j].A += projected_nodes[k].A(depth) * l[k];
+	    mcell.nodes[j].C += projected_nodes[k].C(depth) * l[k];
+	    mcell.nodes[j].F += projected_nodes[k].F(depth) * l[k];
+	    mcell.nodes[j].L += projected_nodes[k].L(depth) * l[k];
+	    mcell.nodes[j].N += projected_nodes[k].N(depth) * l[k];
 	  }
 	  
 	}
@@ -570,11 +658,11 @@ public:
     }
   }
 
-  bool read(FILE *fp)
+  bool read(TextReader &in)
   {
     double fthickness;
     int fparameters;
-    if (fscanf(fp, "%lf %d\n", &fthickness, &fparameters) != 2) {
+    if (!in.read_double(fthickness) || !in.read_int(fparameters)) {
       ERROR("Failed to reader header");
       return false;
     }
@@ -589,7 +677,7 @@ public:
     for (size_t k = 0; k < parameterset::NPARAMETERS; k ++) {
 
       int o;
-      if (fscanf(fp, "%d", &o) != 1) {
+      if (!in.read_int(o)) {
 	ERROR("Failed to read order");
 	return false;
       }
@@ -601,7 +689,7 @@ public:
       
       order[k] = o;
       for (size_t i = 0; i <= order[k]; i ++) {
-	if (!nodes[i].read_parameter(k, fp)) {
+	if (!nodes[i].read_parameter(k, in)) {
 	  ERROR("Failed to read node parameter");
 	  return false;
 	}
@@ -635,7 +723,7 @@ public:
     return true;
   }
 
-  int encode_size()
+  int encode_size() const
   {
     int size = sizeof(int) + sizeof(double);
 
@@ -650,7 +738,7 @@ public:
     return size;
   }
   
-  int encode(char *buffer, int &buffer_offset, int buffer_size)
+  int encode(char *buffer, int &buffer_offset, int buffer_size) const
   {
     int e;
     int s = 0;
@@ -772,14 +860,22 @@ public:
   parameterset interpolate(Mesh<real, maxorder> &mesh, real xi)
   {
     parameterset p;
+    real l[maxorder + 1];
+    size_t lorder = order[0];
+    mesh.quadrature[lorder]->cardinals(xi, l);
 
     for (size_t k = 0; k < parameterset::NPARAMETERS; k ++) {
 
+      if (order[k] != lorder) {
+	mesh.quadrature[order[k]]->cardinals(xi, l);
+	lorder = order[k];
+      }
+
       p[k] = 0.0;
 
       for (size_t i = 0; i <= order[k]; i ++) {
 
-	p[k] += nodes[i][k] * mesh.quadrature[order[k]]->cardinal[i].value(xi);
+	p[k] += nodes[i][k] * l[i];
 
       }
     }
@@ -795,14 +891,22 @@ public:
   {
     parameterset p;
     size_t poffset = 0;
+    real l[maxorder + 1];
+    size_t lorder = order[0];
+    mesh.quadrature[lorder]->cardinals(xi, l);
     
     for (size_t k = 0; k < parameterset::NPARAMETERS; k ++) {
 
+      if (order[k] != lorder) {
+	mesh.quadrature[order[k]]->cardinals(xi, l);
+	lorder = order[k];
+      }
+
       p[k] = 0.0;
 
       for (size_t i = 0; i <= order[k]; i ++) {
 
-	real w = mesh.quadrature[order[k]]->cardinal[i].value(xi);
+	real w = l[i];
 	p[k] += nodes[i][k] * w;
 
 	jacobian(poffset + i, 6*(moffset) + 0) += w * nodes[i].drho(k, depth);
@@ -0,0 +1,639 @@
+//
+//    Spec1D : A spectral element code for surface wave dispersion of Love
+//    and Rayleigh waves. See
+//
+//      R Hawkins, "A spectral element method for surface wave dispersion and adjoints",
+//      Geophysical Journal International, 2018, 215:1, 267 - 302
+//      https://doi.org/10.1093/gji/ggy277
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef depthpanel_hpp
+#define depthpanel_hpp
+
+#include <vector>
+#include <math.h>
+
+#include "spec1dmatrix.hpp"
+#include "specializedeigenproblem.hpp"
+#include "anisotropicrhovsxivpvs.hpp"
+#include "lovematrices.hpp"
+#include "rayleighmatrices.hpp"
+
+//
+// Eigenfunctions and depth sensitivity kernels of the fundamental mode on a
+// depth grid for a set of frequencies. Matrices are (nfrequencies x ndepths).
+// Love waves fill V and Rayleigh waves U and W, normalised so that
+// int rho (U^2 + V^2 + W^2) dz = 1 with a positive surface value. The kernels
+// are dk/dm(z) per unit depth for m = Vs, Xi and rho of the
+// AnisotropicRhoVsXiVpVs parameterisation (Vp/Vs held fixed).
+//
+template
+<
+  typename real
+>
+struct DepthPanel {
+  std::vector<real> depth;
+  std::vector<real> omega;
+  std::vector<real> k;
+
+  Spec1DMatrix<real> U;
+  Spec1DMatrix<real> V;
+  Spec1DMatrix<real> W;
+
+  Spec1DMatrix<real> Kvs;
+  Spec1DMatrix<real> Kxi;
+  Spec1DMatrix<real> Krho;
+};
+
+//
+// Precomputed Lobatto interpolation of the mesh cells onto a sorted depth
+// grid. Each cell holds the cardinal values and depth derivatives at the
+// depths it contains as an ((order + 1) x count) matrix so that the
+// eigenfunctions of many frequencies are evaluated in one product per cell.
+// Depths below the last cell lie in the halfspace, whose Laguerre scale
+// changes with frequency and so is evaluated per frequency.
+//
+template
+<
+  typename real,
+  size_t maxorder
+>
+class DepthInterpolation {
+public:
+
+  struct Block {
+    size_t first;
+    size_t count;
+    size_t offset;
+    size_t nodes;
+    Spec1DMatrix<real> S;
+    Spec1DMatrix<real> dS;
+  };
+  
+  bool build(const Mesh<real, maxorder> &mesh,
+	     const std::vector<real> &depth,
+	     const std::array<LobattoQuadrature<double, maxorder>*, maxorder + 1> &Lobatto)
+  {
+    size_t ndepths = depth.size();
+    
+    for (size_t d = 0; d < ndepths; d ++) {
+      if (depth[d] < 0.0 || (d > 0 && depth[d] < depth[d - 1])) {
+	ERROR("Depths must be non-negative and sorted: %f at %d", (double)depth[d], (int)d);
+	return false;
+      }
+    }
+
+    blocks.clear();
+    parameters.resize(ndepths);
+
+    size_t ncells = mesh.cells.size();
+    size_t offset = 0;
+    size_t d = 0;
+    real top = 0.0;
+    
+    for (size_t c = 0; c < ncells; c ++) {
+
+      const MeshCell<real, maxorder> &cell = mesh.cells[c];
+      real bottom = top + cell.thickness;
+
+      size_t first = d;
+      while (d < ndepths && depth[d] < bottom) {
+	d ++;
+      }
+
+      if (d > first) {
+	Block b;
+
+	b.first = first;
+	b.count = d - first;
+	b.offset = offset;
+	if (c == ncells - 1 && mesh.boundary.rho == 0.0) {
+	  //
+	  // Fixed boundary: last node is zero and not in the eigenvector
+	  //
+	  b.nodes = cell.order;
+	} else {
+	  b.nodes = cell.order + 1;
+	}
+	b.S.resize(cell.order + 1, b.count);
+	b.dS.resize(cell.order + 1, b.count);
+
+	for (size_t j = 0; j < b.count; j ++) {
+	  real xi = 2.0*(depth[first + j] - top)/cell.thickness - 1.0;
+
+	  Lobatto[cell.order]->cardinals(xi, b.S.col(j), b.dS.col(j));
+
+	  MeshParameter<real> p;
+	  for (size_t i = 0; i <= cell.order; i ++) {
+	    b.dS(i, j) *= 2.0/cell.thickness;
+
+	    p += b.S(i, j)*cell.nodes[i];
+	  }
+	  parameters[first + j] = p;
+	}
+
+	blocks.push_back(b);
+      }
+
+      offset += cell.order;
+      top = bottom;
+    }
+
+    halfspace_first = d;
+    halfspace_top = top;
+    halfspace_offset = offset;
+    for (; d < ndepths; d ++) {
+      parameters[d] = mesh.boundary;
+    }
+
+    return true;
+  }
+
+  //
+  // f(i, d) and df(i, d) at the cell depths from the eigenvectors in the
+  // columns of x, starting at row row0 (nfrequencies x ndepths)
+  //
+  void cells(const Spec1DMatrix<real> &x,
+	     size_t row0,
+	     Spec1DMatrix<real> &f,
+	     Spec1DMatrix<real> &df) const
+  {
+    int nf = x.cols();
+    
+    for (auto &b : blocks) {
+      SpecializedMultiplyTranspose(nf, b.count, b.nodes,
+				   x.data() + row0 + b.offset, x.rows(),
+				   b.S.data(), b.S.rows(),
+				   f.data() + b.first * nf, nf);
+      SpecializedMultiplyTranspose(nf, b.count, b.nodes,
+				   x.data() + row0 + b.offset, x.rows(),
+				   b.dS.data(), b.dS.rows(),
+				   df.data() + b.first * nf, nf);
+    }
+  }
+
+  //
+  // f(i, d) and df(i, d) in the Laguerre halfspace for frequency i with
+  // scale
+  //
+  template
+  <
+    typename quadrature_t
+  >
+  void halfspace(quadrature_t &laguerre,
+		 const std::vector<real> &depth,
+		 const Spec1DMatrix<real> &x,
+		 size_t row0,
+		 size_t i,
+		 real scale,
+		 Spec1DMatrix<real> &f,
+		 Spec1DMatrix<real> &df) const
+  {
+    const real *xi = x.col(i) + row0 + halfspace_offset;
+    std::vector<real> l(laguerre.n + 1);
+    std::vector<real> dl(laguerre.n + 1);
+    
+    for (size_t d = halfspace_first; d < depth.size(); d ++) {
+      real s = (depth[d] - halfspace_top) * scale;
+
+      laguerre.cardinals(s, l.data(), dl.data());
+
+      real v = 0.0;
+      real dv = 0.0;
+      for (size_t j = 0; j <= laguerre.n; j ++) {
+	v += l[j] * xi[j];
+	dv += dl[j] * xi[j];
+      }
+
+      f(i, d) = v;
+      df(i, d) = dv * scale;
+    }
+  }
+
+  std::vector<Block> blocks;
+  std::vector<MeshParameter<real>> parameters;
+
+  size_t halfspace_first;
+  real halfspace_top;
+  size_t halfspace_offset;
+};
+
+//
+// Derivatives of (rho, A, C, F, L, N), indexed by MeshOffset_t, with respect
+// to Vs, Xi and rho at a point. Returns false where the medium is fluid.
+//
+template
+<
+  typename real
+>
+bool DepthPanelDerivatives(const MeshParameter<real> &p,
+			   real dvs[6],
+			   real dxi[6],
+			   real drho[6])
+{
+  if (p.rho <= 0.0 || p.L <= 0.0) {
+    for (int m = 0; m < 6; m ++) {
+      dvs[m] = 0.0;
+      dxi[m] = 0.0;
+      drho[m] = 0.0;
+    }
+    drho[MESHOFFSET_RHO] = 1.0;
+    return false;
+  }
+  
+  real vs = sqrt((2.0*p.L + p.N)/(3.0*p.rho));
+  real xi = p.N/p.L;
+  real vpvs = sqrt(p.A/p.rho)/vs;
+
+  AnisotropicRhoVsXiVpVs<real> q(p.rho, vs, xi, vpvs);
+
+  real *d[3] = {drho, dvs, dxi};
+  for (size_t index = 0; index < 3; index ++) {
+    d[index][MESHOFFSET_RHO] = q.drho(index, 0.0);
+    d[index][MESHOFFSET_A] = q.dA(index, 0.0);
+    d[index][MESHOFFSET_C] = q.dC(index, 0.0);
+    d[index][MESHOFFSET_F] = q.dF(index, 0.0);
+    d[index][MESHOFFSET_L] = q.dL(index, 0.0);
+    d[index][MESHOFFSET_N] = q.dN(index, 0.0);
+  }
+
+  return true;
+}
+
+template
+<
+  typename real
+>
+real DepthPanelContract(const real K[6], const real d[6])
+{
+  real s = 0.0;
+  for (int m = 0; m < 6; m ++) {
+    s += K[m] * d[m];
+  }
+  return s;
+}
+
+//
+// Love fundamental mode panels. The kernels follow from the same
+// contraction as dk/dp in solve_fundamental_gradient_sep,
+//
+//   dk = (omega^2 v^T dA v - v^T dC v - k^2 v^T dB v)/(2 k v^T B v)
+//
+// for a point perturbation, giving the densities
+//
+//   K_rho = omega^2 V^2/(2 k I), K_N = -k V^2/(2 I), K_L = -V'^2/(2 k I)
+//
+// with I = int N V^2 dz.
+//
+template
+<
+  typename real,
+  size_t maxorder,
+  size_t maxboundaryorder = maxorder
+>
+class LoveDepthPanel {
+public:
+
+  typedef LoveMatrices<real, maxorder, maxboundaryorder> solver_t;
+
+  LoveDepthPanel(solver_t &_solver,
+		 const Mesh<real, maxorder> &_mesh,
+		 size_t _boundaryorder) :
+    solver(_solver),
+    mesh(_mesh),
+    boundaryorder(_boundaryorder)
+  {
+  }
+
+  //
+  // Frequencies are solved in the order given with the Laguerre scale
+  // updated from each solution as in the likelihoods, so they are best
+  // ordered from high to low.
+  //
+  bool compute(const std::vector<real> &omegas,
+	       const std::vector<real> &depths,
+	       real scale,
+	       DepthPanel<real> &panel)
+  {
+    if (!interpolation.build(mesh, depths, solver.Lobatto)) {
+      return false;
+    }
+
+    size_t nf = omegas.size();
+    size_t nd = depths.size();
+
+    panel.depth = depths;
+    panel.omega = omegas;
+    panel.k.assign(nf, 0.0);
+    scales.assign(nf, scale);
+    denominator.assign(nf, 0.0);
+
+    solver.recompute(mesh, boundaryorder, scale);
+    x.resize(solver.size, nf);
+    
+    for (size_t i = 0; i < nf; i ++) {
+
+      real omega = omegas[i];
+      real normA, normB, normC;
+      real k = solver.solve_fundamental_sep(omega, normA, normB, normC);
+      if (k <= 0.0) {
+	ERROR("Failed to compute wave number at omega %f", (double)omega);
+	return false;
+      }
+
+      normA = 0.0;
+      normB = 0.0;
+      for (size_t j = 0; j < solver.size; j ++) {
+	normA += solver.v(j, 0) * solver.A(j, j) * solver.v(j, 0);
+	normB += solver.v(j, 0) * solver.B(j, j) * solver.v(j, 0);
+      }
+
+      real s = 1.0/sqrt(normA);
+      if (solver.v(0, 0) < 0.0) {
+	s = -s;
+      }
+      for (size_t j = 0; j < solver.size; j ++) {
+	x(j, i) = s * solver.v(j, 0);
+      }
+      
+      panel.k[i] = k;
+      scales[i] = solver.laguerrescale;
+      denominator[i] = 2.0 * k * normB/normA;
+
+      if (i + 1 < nf && mesh.boundary.rho > 0.0) {
+	real vs2 = mesh.boundary.L/mesh.boundary.rho;
+	real disc1 = k*k - omega*omega/vs2;
+
+	if (isnormal(disc1) && disc1 > 0.0) {
+	  solver.recompute(mesh, boundaryorder, sqrt(disc1));
+	}
+      }
+    }
+
+    panel.U.resize(0, 0);
+    panel.W.resize(0, 0);
+    panel.V.resize(nf, nd);
+    panel.V.setZero();
+    dV.resize(nf, nd);
+    dV.setZero();
+
+    interpolation.cells(x, 0, panel.V, dV);
+    if (mesh.boundary.rho > 0.0) {
+      for (size_t i = 0; i < nf; i ++) {
+	interpolation.halfspace(*solver.Laguerre[boundaryorder], depths, x, 0, i, scales[i], panel.V, dV);
+      }
+    }
+
+    panel.Kvs.resize(nf, nd);
+    panel.Kxi.resize(nf, nd);
+    panel.Krho.resize(nf, nd);
+
+    for (size_t d = 0; d < nd; d ++) {
+
+      real dvs[6], dxi[6], drho[6];
+      DepthPanelDerivatives(interpolation.parameters[d], dvs, dxi, drho);
+
+      for (size_t i = 0; i < nf; i ++) {
+
+	real k = panel.k[i];
+	real V2 = panel.V(i, d) * panel.V(i, d);
+	real dV2 = dV(i, d) * dV(i, d);
+
+	real K[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+	K[MESHOFFSET_RHO] = omegas[i] * omegas[i] * V2/denominator[i];
+	K[MESHOFFSET_L] = -dV2/denominator[i];
+	K[MESHOFFSET_N] = -k * k * V2/denominator[i];
+
+	panel.Kvs(i, d) = DepthPanelContract(K, dvs);
+	panel.Kxi(i, d) = DepthPanelContract(K, dxi);
+	panel.Krho(i, d) = DepthPanelContract(K, drho);
+      }
+    }
+
+    return true;
+  }
+
+  solver_t &solver;
+  const Mesh<real, maxorder> &mesh;
+  size_t boundaryorder;
+
+  DepthInterpolation<real, maxorder> interpolation;
+  std::vector<real> scales;
+  std::vector<real> denominator;
+  Spec1DMatrix<real> x;
+  Spec1DMatrix<real> dV;
+};
+
+//
+// Rayleigh fundamental mode panels from the quadratic problem
+// (k^2 B + k C + D - omega^2 A) v = 0, where
+//
+//   dk = -(k^2 v^T dB v + k v^T dC v + v^T dD v - omega^2 v^T dA v)/(2 k v^T B v + v^T C v)
+//
+// gives with J = 2 k v^T B v + v^T C v the densities
+//
+//   K_rho = omega^2 (U^2 + W^2)/J, K_A = -k^2 U^2/J, K_C = -W'^2/J,
+//   K_F = -2 k U W'/J, K_L = -(U' - k W)^2/J
+//
+template
+<
+  typename real,
+  size_t maxorder,
+  size_t maxboundaryorder = maxorder
+>
+class RayleighDepthPanel {
+public:
+
+  typedef RayleighMatrices<real, maxorder, maxboundaryorder> solver_t;
+
+  RayleighDepthPanel(solver_t &_solver,
+		     const Mesh<real, maxorder> &_mesh,
+		     size_t _boundaryorder) :
+    solver(_solver),
+    mesh(_mesh),
+    boundaryorder(_boundaryorder)
+  {
+  }
+
+  //
+  // As LoveDepthPanel::compute with the Laguerre scale updated from the Vp
+  // of the halfspace.
+  //
+  bool compute(const std::vector<real> &omegas,
+	       const std::vector<real> &depths,
+	       real scale,
+	       DepthPanel<real> &panel)
+  {
+    if (!interpolation.build(mesh, depths, solver.Lobatto)) {
+      return false;
+    }
+
+    size_t nf = omegas.size();
+    size_t nd = depths.size();
+
+    panel.depth = depths;
+    panel.omega = omegas;
+    panel.k.assign(nf, 0.0);
+    scalesx.assign(nf, scale);
+    scalesz.assign(nf, scale);
+    denominator.assign(nf, 0.0);
+
+    solver.recompute(mesh, boundaryorder, scale, scale);
+    size_t size = solver.size;
+    x.resize(2*size, nf);
+    
+    for (size_t i = 0; i < nf; i ++) {
+
+      real omega = omegas[i];
+      real normA, normB, normC, normD, gamma, delta;
+      real k = solver.solve_fundamental_scaled(omega, normA, normB, normC, normD, gamma, delta);
+      if (k == 0.0) {
+	ERROR("Failed to compute wave number at omega %f", (double)omega);
+	return false;
+      }
+
+      //
+      // The eigenvector of -k has W negated
+      //
+      real sw = 1.0;
+      if (k < 0.0) {
+	k = -k;
+	sw = -1.0;
+      }
+      for (size_t j = 0; j < size; j ++) {
+	x(j, i) = solver.v(j, 0);
+	x(size + j, i) = sw * solver.v(size + j, 0);
+      }
+
+      normA = 0.0;
+      normB = 0.0;
+      normC = 0.0;
+      for (size_t j = 0; j < size; j ++) {
+	normA +=
+	  x(j, i) * solver.Ax(j, j) * x(j, i) +
+	  x(size + j, i) * solver.Az(j, j) * x(size + j, i);
+	normB +=
+	  x(j, i) * solver.Bx(j, j) * x(j, i) +
+	  x(size + j, i) * solver.Bz(j, j) * x(size + j, i);
+
+	real cx = 0.0;
+	real cz = 0.0;
+	for (size_t l = 0; l < size; l ++) {
+	  cx += solver.Cx(j, l) * x(size + l, i);
+	  cz += solver.Cz(j, l) * x(l, i);
+	}
+	normC += x(j, i) * cx + x(size + j, i) * cz;
+      }
+
+      real s = 1.0/sqrt(normA);
+      if (x(0, i) < 0.0) {
+	s = -s;
+      }
+      for (size_t j = 0; j < 2*size; j ++) {
+	x(j, i) *= s;
+      }
+
+      panel.k[i] = k;
+      scalesx[i] = solver.laguerrescalex;
+      scalesz[i] = solver.laguerrescalez;
+      denominator[i] = (2.0 * k * normB + normC)/normA;
+
+      if (i + 1 < nf && mesh.boundary.rho > 0.0) {
+	real vs2 = mesh.boundary.L/mesh.boundary.rho;
+	real vp2 = mesh.boundary.A/mesh.boundary.rho;
+
+	real disc1 = k*k - omega*omega/vs2;
+	real disc2 = k*k - omega*omega/vp2;
+
+	if (isnormal(disc1) && disc1 > 0.0 &&
+	    isnormal(disc2) && disc2 > 0.0) {
+	  solver.recompute(mesh, boundaryorder, sqrt(disc2), sqrt(disc2));
+	}
+      }
+    }
+
+    panel.V.resize(0, 0);
+    panel.U.resize(nf, nd);
+    panel.U.setZero();
+    panel.W.resize(nf, nd);
+    panel.W.setZero();
+    dU.resize(nf, nd);
+    dU.setZero();
+    dW.resize(nf, nd);
+    dW.setZero();
+
+    interpolation.cells(x, 0, panel.U, dU);
+    interpolation.cells(x, size, panel.W, dW);
+    if (mesh.boundary.rho > 0.0) {
+      for (size_t i = 0; i < nf; i ++) {
+	interpolation.halfspace(*solver.Laguerre[boundaryorder], depths, x, 0, i, scalesx[i], panel.U, dU);
+	interpolation.halfspace(*solver.Laguerre[boundaryorder], depths, x, size, i, scalesz[i], panel.W, dW);
+      }
+    }
+
+    panel.Kvs.resize(nf, nd);
+    panel.Kxi.resize(nf, nd);
+    panel.Krho.resize(nf, nd);
+
+    for (size_t d = 0; d < nd; d ++) {
+
+      real dvs[6], dxi[6], drho[6];
+      DepthPanelDerivatives(interpolation.parameters[d], dvs, dxi, drho);
+
+      for (size_t i = 0; i < nf; i ++) {
+
+	real k = panel.k[i];
+	real u = panel.U(i, d);
+	real w = panel.W(i, d);
+	real du = dU(i, d);
+	real dw = dW(i, d);
+	real J = denominator[i];
+
+	real K[6];
+	K[MESHOFFSET_RHO] = omegas[i] * omegas[i] * (u*u + w*w)/J;
+	K[MESHOFFSET_A] = -k * k * u * u/J;
+	K[MESHOFFSET_C] = -dw * dw/J;
+	K[MESHOFFSET_F] = -2.0 * k * u * dw/J;
+	K[MESHOFFSET_L] = -(du - k*w) * (du - k*w)/J;
+	K[MESHOFFSET_N] = 0.0;
+
+	panel.Kvs(i, d) = DepthPanelContract(K, dvs);
+	panel.Kxi(i, d) = DepthPanelContract(K, dxi);
+	panel.Krho(i, d) = DepthPanelContract(K, drho);
+      }
+    }
+
+    return true;
+  }
+
+  solver_t &solver;
+  const Mesh<real, maxorder> &mesh;
+  size_t boundaryorder;
+
+  DepthInterpolation<real, maxorder> interpolation;
+  std::vector<real> scalesx;
+  std::vector<real> scalesz;
+  std::vector<real> denominator;
+  Spec1DMatrix<real> x;
+  Spec1DMatrix<real> dU;
+  Spec1DMatrix<real> dW;
+};
+
+#endif // depthpanel_hpp
@@ -29,9 +29,26 @@
 #define encodedecode_hpp
 
 #include <string.h>
+#include <stdint.h>
 
 #include "logging.hpp"
 
+//
+// 64 bit FNV-1a hash used for content keys and checksums. Pass the previous
+// result as h to hash several buffers as one.
+//
+static const uint64_t FNV1A_OFFSET = 14695981039346656037ULL;
+
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t h = FNV1A_OFFSET)
+{
+  const unsigned char *p = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i ++) {
+    h ^= (uint64_t)p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
 template
 <
   typename T
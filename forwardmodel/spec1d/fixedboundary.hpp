@@ -29,6 +29,7 @@
 #define fixedboundary_hpp
 
 #include "mesh.hpp"
+#include "textreader.hpp"
 
 template
 <
@@ -118,12 +119,12 @@ public:
     fprintf(fp, "FixedBoundary\n");
   }
 
-  bool read(FILE *fp)
+  bool read(TextReader &in)
   {
     int order;
     double thickness;
     
-    if (fscanf(fp, "%d %lf\n", &order, &thickness) != 2) {
+    if (!in.read_int(order) || !in.read_double(thickness)) {
       ERROR("Failed to read cell parameters");
       return false;
     }
@@ -141,12 +142,12 @@ public:
     return true;
   }
 
-  int encode_size()
+  int encode_size() const
   {
     return 0;
   }
   
-  int encode(char *buffer, int &buffer_offset, int buffer_size)
+  int encode(char *buffer, int &buffer_offset, int buffer_size) const
   {
     return 0;
   }
@@ -27,6 +27,7 @@
 #define generalisedeigenproblem_hpp
 
 #include "spec1dmatrix.hpp"
+#include "lapackbackend.hpp"
 
 //
 // Copied from
@@ -34,12 +35,6 @@
 //   http://eigen.tuxfamily.org/index.php?title=Lapack
 //
 
-extern "C" void dggev_(const char* JOBVL, const char* JOBVR, const int* N,
-                       const double* A, const int* LDA, const double* B, const int* LDB,
-                       double* ALPHAR, double* ALPHAI, double* BETA,
-                       double* VL, const int* LDVL, double* VR, const int* LDVR,
-                       double* WORK, const int* LWORK, int* INFO);
-
 // Generalised Eigen-Problem
 // Solve:
 // A * v(j) = lambda(j) * B * v(j).
@@ -137,14 +132,14 @@ bool GEP<double>(const Spec1DMatrix<double> &A,
   double *beta   = lambda.col(2);
 
   // Get the optimum work size.
-  dggev_("V", "V", &N, A.data(), &LDA, B.data(), &LDB, alphar, alphai, beta,
-	 u.data(), &LDV, v.data(), &LDV, &WORKDUMMY, &LWORK, &INFO);
+  LapackBackend::get().dggev("V", "V", &N, A.data(), &LDA, B.data(), &LDB, alphar, alphai, beta,
+			     u.data(), &LDV, v.data(), &LDV, &WORKDUMMY, &LWORK, &INFO);
 
   LWORK = int(WORKDUMMY) + 32;
   work.resize(LWORK, 1);
 
-  dggev_("V", "V", &N, A.data(), &LDA, B.data(), &LDB, alphar, alphai, beta,
-	 u.data(), &LDV, v.data(), &LDV, work.data(), &LWORK, &INFO);
+  LapackBackend::get().dggev("V", "V", &N, A.data(), &LDA, B.data(), &LDB, alphar, alphai, beta,
+			     u.data(), &LDV, v.data(), &LDV, work.data(), &LWORK, &INFO);
 
   return INFO==0;
 }
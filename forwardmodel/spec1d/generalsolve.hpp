@@ -28,14 +28,7 @@
 #ifndef generalsolve_hpp
 #define generalsolve_hpp
 
-extern "C" void dgesv_(int *N,
-		       int *NRHS,
-		       double *A,
-		       int *LDA,
-		       int *IPIV,
-		       double *B,
-		       int *LDB,
-		       int *INFO);
+#include "lapackbackend.hpp"
 
 template
 <
@@ -63,7 +56,81 @@ bool GeneralSolve<double>(Spec1DMatrix<double> &A,
   int INFO;
   
   
-  dgesv_(&N, &NRHS, A.data(), &LDA, IPIV, B.data(), &LDB, &INFO);
+  LapackBackend::get().dgesv(&N, &NRHS, A.data(), &LDA, IPIV, B.data(), &LDB, &INFO);
+
+  if (INFO != 0) {
+    return false;
+  }
+
+  return true;
+}
+
+//
+// LU factorization of A in place for repeated solves with GeneralFactorSolve
+//
+template
+<
+  typename real
+>
+bool GeneralFactor(Spec1DMatrix<real> &A,
+		   int *IPIV)
+{
+  FATAL("Unimplemented");
+  return false;
+}
+
+template
+<>
+bool GeneralFactor<double>(Spec1DMatrix<double> &A,
+			   int *IPIV)
+{
+  int M = A.rows();
+  int N = A.cols();
+  int LDA = A.rows();
+
+  int INFO;
+
+  LapackBackend::get().dgetrf(&M, &N, A.data(), &LDA, IPIV, &INFO);
+
+  if (INFO != 0) {
+    return false;
+  }
+
+  return true;
+}
+
+//
+// Solve A x = B (or A^T x = B if transpose) using the factors from
+// GeneralFactor, B is overwritten with the solution
+//
+template
+<
+  typename real
+>
+bool GeneralFactorSolve(const Spec1DMatrix<real> &LU,
+			const int *IPIV,
+			Spec1DMatrix<real> &B,
+			bool transpose = false)
+{
+  FATAL("Unimplemented");
+  return false;
+}
+
+template
+<>
+bool GeneralFactorSolve<double>(const Spec1DMatrix<double> &LU,
+				const int *IPIV,
+				Spec1DMatrix<double> &B,
+				bool transpose)
+{
+  int N = LU.rows();
+  int LDA = LU.rows();
+  int NRHS = B.cols();
+  int LDB = B.rows();
+
+  int INFO;
+
+  LapackBackend::get().dgetrs(transpose ? "T" : "N", &N, &NRHS, LU.data(), &LDA, IPIV, B.data(), &LDB, &INFO);
 
   if (INFO != 0) {
     return false;
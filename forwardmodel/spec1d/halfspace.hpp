@@ -29,6 +29,7 @@
 
 #include <stdio.h>
 #include <string>
+#include "textreader.hpp"
 
 template
 <
@@ -46,12 +47,12 @@ public:
   {
   }
 
-  bool read(FILE *fp)
+  bool read(TextReader &in)
   {
     int nparameters;
     double thickness;
     
-    if (fscanf(fp, "%d %lf\n", &nparameters, &thickness) != 2) {
+    if (!in.read_int(nparameters) || !in.read_double(thickness)) {
       ERROR("Failed to read cell parameters");
       return false;
     }
@@ -63,7 +64,7 @@ public:
 
     for (size_t i = 0; i < np; i ++) {
       double p;
-      if (fscanf(fp, "%lf\n", &p) != 1) {
+      if (!in.read_double(p)) {
 	ERROR("Failed to read parameters");
 	return false;
       }
@@ -91,12 +92,12 @@ public:
     }
   }
 
-  int encode_size()
+  int encode_size() const
   {
     return np * sizeof(real);
   }
   
-  int encode(char *buffer, int &buffer_offset, int buffer_size)
+  int encode(char *buffer, int &buffer_offset, int buffer_size) const
   {
     for (size_t i = 0; i < np; i ++) {
       if (::encode<real>(parameters[i], buffer, buffer_offset, buffer_size) < 0) {
@@ -110,7 +111,7 @@ public:
   int decode(const char *buffer, int &buffer_offset, int buffer_size)
   {
     for (size_t i = 0; i < np; i ++) {
-      if (::decode<real>(parameters[0], buffer, buffer_offset, buffer_size) < 0) {
+      if (::decode<real>(parameters[i], buffer, buffer_offset, buffer_size) < 0) {
 	return -1;
       }
     }
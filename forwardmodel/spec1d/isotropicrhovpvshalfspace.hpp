@@ -29,6 +29,7 @@
 #define isotropicrhovpvshalfspace_hpp
 
 #include "mesh.hpp"
+#include "textreader.hpp"
 
 template
 <
@@ -163,12 +164,12 @@ public:
   }
   
 
-  bool read(FILE *fp)
+  bool read(TextReader &in)
   {
     int nparameters;
     double thickness;
     
-    if (fscanf(fp, "%d %lf\n", &nparameters, &thickness) != 2) {
+    if (!in.read_int(nparameters) || !in.read_double(thickness)) {
       ERROR("Failed to read cell parameters");
       return false;
     }
@@ -181,7 +182,7 @@ public:
     int order;
     double rho, vp, vs;
 
-    if (fscanf(fp, "%d %lf\n", &order, &rho) != 2) {
+    if (!in.read_int(order) || !in.read_double(rho)) {
       ERROR("Failed to read density");
       return false;
     }
@@ -191,7 +192,7 @@ public:
       return false;
     }
 
-    if (fscanf(fp, "%d %lf\n", &order, &vp) != 2) {
+    if (!in.read_int(order) || !in.read_double(vp)) {
       ERROR("Failed to read Vp");
       return false;
     }
@@ -201,7 +202,7 @@ public:
       return false;
     }
     
-    if (fscanf(fp, "%d %lf\n", &order, &vs) != 2) {
+    if (!in.read_int(order) || !in.read_double(vs)) {
       ERROR("Failed to read Vs");
       return false;
     }
@@ -29,6 +29,7 @@
 #define isotropicrhovshalfspace_hpp
 
 #include "mesh.hpp"
+#include "textreader.hpp"
 
 template
 <
@@ -117,13 +118,13 @@ public:
     }
   }
 
-  bool read(FILE *fp)
+  bool read(TextReader &in)
   {
     int nparameters;
     double thickness;
     double rho, vs;
     
-    if (fscanf(fp, "%d %lf\n", &nparameters, &thickness) != 2) {
+    if (!in.read_int(nparameters) || !in.read_double(thickness)) {
       ERROR("Failed to read cell parameters");
       return false;
     }
@@ -133,7 +134,7 @@ public:
       return false;
     }
       
-    if (fscanf(fp, "%lf %lf\n", &rho, &vs) != 2) {
+    if (!in.read_double(rho) || !in.read_double(vs)) {
       ERROR("Failed to read parameters");
       return false;
     }
@@ -155,12 +156,12 @@ public:
     fprintf(fp, "IsotropicRhoVsHalfspace\n%15.9f %15.9f\n", (double)parameters[0], (double)parameters[1]);
   }
 
-  int encode_size()
+  int encode_size() const
   {
     return 2*sizeof(real);
   }
   
-  int encode(char *buffer, int &buffer_offset, int buffer_size)
+  int encode(char *buffer, int &buffer_offset, int buffer_size) const
   {
     if (::encode<real>(parameters[0], buffer, buffer_offset, buffer_size) < 0) {
       return -1;
@@ -29,6 +29,7 @@
 #define isotropicvsxihalfspace_hpp
 
 #include "mesh.hpp"
+#include "textreader.hpp"
 
 template
 <
@@ -162,14 +163,14 @@ public:
     }
   }
 
-  bool read(FILE *fp)
+  bool read(TextReader &in)
   {
     int nparameters;
     double thickness;
     double vs;
     double xi;
     
-    if (fscanf(fp, "%d %lf\n", &nparameters, &thickness) != 2) {
+    if (!in.read_int(nparameters) || !in.read_double(thickness)) {
       ERROR("Failed to read cell parameters");
       return false;
     }
@@ -179,7 +180,7 @@ public:
       return false;
     }
       
-    if (fscanf(fp, "%lf %lf\n", &vs, &xi) != 2) {
+    if (!in.read_double(vs) || !in.read_double(xi)) {
       ERROR("Failed to read parameters");
       return false;
     }
@@ -201,12 +202,12 @@ public:
     fprintf(fp, "IsotropicVsXiHalfspace\n%15.9f %15.9f\n", (double)parameters[0], (double)parameters[1]);
   }
 
-  int encode_size()
+  int encode_size() const
   {
     return 2*sizeof(real);
   }
   
-  int encode(char *buffer, int &buffer_offset, int buffer_size)
+  int encode(char *buffer, int &buffer_offset, int buffer_size) const
   {
     if (::encode<real>(parameters[0], buffer, buffer_offset, buffer_size) < 0) {
       return -1;
@@ -35,6 +35,7 @@
 #include "polynomial.hpp"
 #include "eigenroots.hpp"
 
+#include "barycentric.hpp"
 #include "logging.hpp"
 
 //
@@ -270,6 +271,38 @@ public:
       }
       break;
     }
+
+    BarycentricWeights(n, nodes.data(), barycentric.data());
+  }
+
+  //
+  // All cardinal values l[i] = cardinal_i(x) and, if dl is given, their
+  // derivatives in O(n). The cardinals are exp(-(x - x_i)/2) times the
+  // Lagrange basis on the nodes, which is evaluated in barycentric form.
+  //
+  void cardinals(real x, real *l, real *dl = nullptr) const
+  {
+    BarycentricCardinals(n, nodes.data(), barycentric.data(), x, l, dl);
+
+    for (size_t i = 0; i <= n; i ++) {
+      real e = exp((nodes[i] - x)/2.0);
+      if (dl != nullptr) {
+	dl[i] = e * (dl[i] - 0.5*l[i]);
+      }
+      l[i] *= e;
+    }
+  }
+
+  //
+  // Batched over npoints points with l and dl ((n + 1) x npoints)
+  //
+  void cardinals(const real *x, size_t npoints, real *l, real *dl = nullptr) const
+  {
+    for (size_t i = 0; i < npoints; i ++) {
+      cardinals(x[i],
+		l + i*(n + 1),
+		dl == nullptr ? nullptr : dl + i*(n + 1));
+    }
   }
 
   size_t n;
@@ -277,6 +310,8 @@ public:
   std::array<real, maxorder + 1> weights;
   std::array<std::array<real, maxorder + 1>, maxorder + 1> derivative_weights;
   std::array<LaguerreCardinal<real>, maxorder + 1> cardinal;
+
+  std::array<real, maxorder + 1> barycentric;
 };
 
 #endif // laguerrequadrature_hpp
@@ -0,0 +1,557 @@
+//
+//    Spec1D : A spectral element code for surface wave dispersion of Love
+//    and Rayleigh waves. See
+//
+//      R Hawkins, "A spectral element method for surface wave dispersion and adjoints",
+//      Geophysical Journal International, 2018, 215:1, 267 - 302
+//      https://doi.org/10.1093/gji/ggy277
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef lapackbackend_hpp
+#define lapackbackend_hpp
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dlfcn.h>
+
+#include "logging.hpp"
+
+//
+// Reference routines compiled into libdggev
+//
+extern "C" {
+  void dggev_(const char* JOBVL, const char* JOBVR, const int* N,
+	      const double* A, const int* LDA, const double* B, const int* LDB,
+	      double* ALPHAR, double* ALPHAI, double* BETA,
+	      double* VL, const int* LDVL, double* VR, const int* LDVR,
+	      double* WORK, const int* LWORK, int* INFO);
+
+  void dgesv_(int *N,
+	      int *NRHS,
+	      double *A,
+	      int *LDA,
+	      int *IPIV,
+	      double *B,
+	      int *LDB,
+	      int *INFO);
+
+  void dgetrf_(int *M,
+	       int *N,
+	       double *A,
+	       int *LDA,
+	       int *IPIV,
+	       int *INFO);
+
+  void dgetrs_(const char *TRANS,
+	       int *N,
+	       int *NRHS,
+	       const double *A,
+	       int *LDA,
+	       const int *IPIV,
+	       double *B,
+	       int *LDB,
+	       int *INFO);
+
+  void dsysv_(const char *uplo,
+	      int *N,
+	      int *NRHS,
+	      double *A,
+	      int *LDA,
+	      int *IPIV,
+	      double *B,
+	      int *LDB,
+	      double *WORK,
+	      int *LWORK,
+	      int *INFO);
+
+  void dgghrd_(char *compq,
+	       char *compz,
+	       int *n,
+	       int *ilo,
+	       int *ihi,
+	       double *a,
+	       int *lda,
+	       double *b,
+	       int *ldb,
+	       double *q,
+	       int *ldq,
+	       double *z,
+	       int *ldz,
+	       int *info);
+
+  void dhgeqz_(char *job,
+	       char *compq,
+	       char *compz,
+	       int *n,
+	       int *ilo,
+	       int *ihi,
+	       double *h,
+	       int *ldh,
+	       double *t,
+	       int *ldt,
+	       double *alphar,
+	       double *alphai,
+	       double *beta,
+	       double *q,
+	       int *ldq,
+	       double *z,
+	       int *ldz,
+	       double *work,
+	       int *lwork,
+	       int *info);
+
+  void dtgevc_(char *side,
+	       char *howmny,
+	       int *select,
+	       int *n,
+	       double *s,
+	       int *lds,
+	       double *p,
+	       int *ldp,
+	       double *vl,
+	       int *ldvl,
+	       double *vr,
+	       int *ldvr,
+	       int *mm,
+	       int *m,
+	       double *work,
+	       int *info);
+
+  void dgemm_(const char *transa,
+	      const char *transb,
+	      const int *m,
+	      const int *n,
+	      const int *k,
+	      const double *alpha,
+	      const double *a,
+	      const int *lda,
+	      const double *b,
+	      const int *ldb,
+	      const double *beta,
+	      double *c,
+	      const int *ldc);
+}
+
+//
+// The dense LAPACK/BLAS routines used by the forward model. The reference
+// routines above are always linked and used by default. An optimised
+// library exporting the same Fortran symbols (OpenBLAS, BLIS with libflame,
+// MKL single dynamic library) can be selected at run time by naming its
+// shared library in the SPEC1D_LAPACK environment variable, or by default
+// at build time with -DSPEC1D_LAPACK_LIBRARY="libopenblas.so.0"
+// (SPEC1D_LAPACK=reference then restores the reference routines). If the
+// library cannot be loaded or lacks a routine the reference ones are kept.
+//
+// With SPEC1D_LAPACK_SELFTEST set the selected routines are cross checked
+// against the reference ones on first use and the program stops if they
+// disagree.
+//
+class LapackBackend {
+public:
+
+  typedef decltype(&dggev_) dggev_t;
+  typedef decltype(&dgesv_) dgesv_t;
+  typedef decltype(&dgetrf_) dgetrf_t;
+  typedef decltype(&dgetrs_) dgetrs_t;
+  typedef decltype(&dsysv_) dsysv_t;
+  typedef decltype(&dgghrd_) dgghrd_t;
+  typedef decltype(&dhgeqz_) dhgeqz_t;
+  typedef decltype(&dtgevc_) dtgevc_t;
+  typedef decltype(&dgemm_) dgemm_t;
+
+  static LapackBackend &get()
+  {
+    static LapackBackend backend;
+    static bool selected = backend.select();
+    (void)selected;
+    return backend;
+  }
+
+  //
+  // Replace the routines with those of a shared library, returns false
+  // (keeping the current routines) if any is missing
+  //
+  bool load(const char *library)
+  {
+    void *h = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+    if (h == nullptr) {
+      fprintf(stderr, "error: failed to load LAPACK library %s: %s\n", library, dlerror());
+      return false;
+    }
+
+    LapackBackend b;
+    if (!resolve(h, "dggev_", b.dggev) ||
+	!resolve(h, "dgesv_", b.dgesv) ||
+	!resolve(h, "dgetrf_", b.dgetrf) ||
+	!resolve(h, "dgetrs_", b.dgetrs) ||
+	!resolve(h, "dsysv_", b.dsysv) ||
+	!resolve(h, "dgghrd_", b.dgghrd) ||
+	!resolve(h, "dhgeqz_", b.dhgeqz) ||
+	!resolve(h, "dtgevc_", b.dtgevc) ||
+	!resolve(h, "dgemm_", b.dgemm)) {
+      fprintf(stderr, "error: %s is not a complete LAPACK library\n", library);
+      dlclose(h);
+      return false;
+    }
+
+    dggev = b.dggev;
+    dgesv = b.dgesv;
+    dgetrf = b.dgetrf;
+    dgetrs = b.dgetrs;
+    dsysv = b.dsysv;
+    dgghrd = b.dgghrd;
+    dhgeqz = b.dhgeqz;
+    dtgevc = b.dtgevc;
+    dgemm = b.dgemm;
+
+    if (handle != nullptr) {
+      dlclose(handle);
+    }
+    handle = h;
+    name = library;
+    
+    return true;
+  }
+
+  void use_reference()
+  {
+    dggev = dggev_;
+    dgesv = dgesv_;
+    dgetrf = dgetrf_;
+    dgetrs = dgetrs_;
+    dsysv = dsysv_;
+    dgghrd = dgghrd_;
+    dhgeqz = dhgeqz_;
+    dtgevc = dtgevc_;
+    dgemm = dgemm_;
+
+    if (handle != nullptr) {
+      dlclose(handle);
+      handle = nullptr;
+    }
+    name = "reference";
+  }
+
+  //
+  // True when an external library is in use
+  //
+  bool optimised() const
+  {
+    return handle != nullptr;
+  }
+
+  const char *backend_name() const
+  {
+    return name.c_str();
+  }
+
+  //
+  // Compare the selected routines with the reference ones on seeded random
+  // problems, reporting the largest relative differences to fp
+  //
+  bool selftest(FILE *fp, double tolerance = 1.0e-8) const
+  {
+    LapackBackend reference;
+    bool ok = true;
+
+    srand48(983);
+    
+    for (int N : {7, 64}) {
+
+      std::vector<double> A = random_matrix(N, N);
+      std::vector<double> S = random_matrix(N, N);
+      std::vector<double> B = random_matrix(N, 3);
+
+      //
+      // Symmetric A, symmetric positive definite S so the pencil (A, S)
+      // has real eigenvalues
+      //
+      for (int j = 0; j < N; j ++) {
+	for (int i = 0; i < j; i ++) {
+	  A[j * N + i] = A[i * N + j];
+	}
+      }
+      std::vector<double> P(N * N, 0.0);
+      for (int j = 0; j < N; j ++) {
+	for (int i = 0; i < N; i ++) {
+	  double s = 0.0;
+	  for (int k = 0; k < N; k ++) {
+	    s += S[k * N + i] * S[k * N + j];
+	  }
+	  P[j * N + i] = s + (i == j ? N : 0.0);
+	}
+      }
+
+      ok &= report(fp, N, "dgemm",
+		   product(*this, A, P, N), product(reference, A, P, N), tolerance);
+      ok &= report(fp, N, "dgesv",
+		   general_solve(*this, P, B, N), general_solve(reference, P, B, N), tolerance);
+      ok &= report(fp, N, "dgetrf/dgetrs",
+		   factor_solve(*this, P, B, N), factor_solve(reference, P, B, N), tolerance);
+      ok &= report(fp, N, "dsysv",
+		   symmetric_solve(*this, P, B, N), symmetric_solve(reference, P, B, N), tolerance);
+      ok &= report(fp, N, "dggev",
+		   pencil_eigenvalues(*this, A, P, N), pencil_eigenvalues(reference, A, P, N), tolerance);
+      ok &= report(fp, N, "dgghrd/dhgeqz/dtgevc",
+		   schur_eigenvalues(*this, A, P, N), schur_eigenvalues(reference, A, P, N), tolerance);
+    }
+
+    return ok;
+  }
+
+  dggev_t dggev;
+  dgesv_t dgesv;
+  dgetrf_t dgetrf;
+  dgetrs_t dgetrs;
+  dsysv_t dsysv;
+  dgghrd_t dgghrd;
+  dhgeqz_t dhgeqz;
+  dtgevc_t dtgevc;
+  dgemm_t dgemm;
+
+private:
+
+  LapackBackend() :
+    handle(nullptr)
+  {
+    use_reference();
+  }
+
+  LapackBackend(const LapackBackend &rhs) = delete;
+  LapackBackend &operator=(const LapackBackend &rhs) = delete;
+
+  //
+  // Apply the environment or build selection and optional self test
+  //
+  bool select()
+  {
+    const char *library = getenv("SPEC1D_LAPACK");
+#ifdef SPEC1D_LAPACK_LIBRARY
+    if (library == nullptr) {
+      library = SPEC1D_LAPACK_LIBRARY;
+    }
+#endif // SPEC1D_LAPACK_LIBRARY
+
+    if (library != nullptr && library[0] != '\0' && strcmp(library, "reference") != 0) {
+      if (!load(library)) {
+	fprintf(stderr, "warning: using reference LAPACK routines\n");
+      }
+    }
+
+    if (getenv("SPEC1D_LAPACK_SELFTEST") != nullptr) {
+      printf("lapack selftest: %s against reference\n", backend_name());
+      if (!selftest(stdout)) {
+	FATAL("LAPACK backend %s disagrees with the reference routines", backend_name());
+      }
+    }
+    
+    return true;
+  }
+
+  template
+  <
+    typename function
+  >
+  static bool resolve(void *h, const char *symbol, function &f)
+  {
+    void *p = dlsym(h, symbol);
+    if (p == nullptr) {
+      fprintf(stderr, "error: missing %s\n", symbol);
+      return false;
+    }
+
+    f = reinterpret_cast<function>(p);
+    return true;
+  }
+
+  static std::vector<double> random_matrix(int rows, int cols)
+  {
+    std::vector<double> m(rows * cols);
+    for (auto &v : m) {
+      v = drand48() - 0.5;
+    }
+    return m;
+  }
+
+  static std::vector<double> product(const LapackBackend &b,
+				     const std::vector<double> &A,
+				     const std::vector<double> &B,
+				     int N)
+  {
+    std::vector<double> C(N * N);
+    double one = 1.0;
+    double zero = 0.0;
+    b.dgemm("N", "T", &N, &N, &N, &one, A.data(), &N, B.data(), &N, &zero, C.data(), &N);
+    return C;
+  }
+
+  static std::vector<double> general_solve(const LapackBackend &b,
+					   std::vector<double> A,
+					   std::vector<double> B,
+					   int N)
+  {
+    std::vector<int> ipiv(N);
+    int nrhs = B.size()/N;
+    int info;
+    b.dgesv(&N, &nrhs, A.data(), &N, ipiv.data(), B.data(), &N, &info);
+    return B;
+  }
+
+  static std::vector<double> factor_solve(const LapackBackend &b,
+					  std::vector<double> A,
+					  std::vector<double> B,
+					  int N)
+  {
+    std::vector<int> ipiv(N);
+    int nrhs = B.size()/N;
+    int info;
+    b.dgetrf(&N, &N, A.data(), &N, ipiv.data(), &info);
+    b.dgetrs("T", &N, &nrhs, A.data(), &N, ipiv.data(), B.data(), &N, &info);
+    return B;
+  }
+
+  static std::vector<double> symmetric_solve(const LapackBackend &b,
+					     std::vector<double> A,
+					     std::vector<double> B,
+					     int N)
+  {
+    std::vector<int> ipiv(N);
+    int nrhs = B.size()/N;
+    int lwork = 64 * N;
+    std::vector<double> work(lwork);
+    int info;
+    b.dsysv("U", &N, &nrhs, A.data(), &N, ipiv.data(), B.data(), &N, work.data(), &lwork, &info);
+    return B;
+  }
+
+  static std::vector<double> pencil_eigenvalues(const LapackBackend &b,
+						std::vector<double> A,
+						std::vector<double> B,
+						int N)
+  {
+    std::vector<double> alphar(N), alphai(N), beta(N);
+    std::vector<double> vl(N * N), vr(N * N);
+    int lwork = 8 * N + 64 * N;
+    std::vector<double> work(lwork);
+    int info;
+    b.dggev("V", "V", &N, A.data(), &N, B.data(), &N,
+	    alphar.data(), alphai.data(), beta.data(),
+	    vl.data(), &N, vr.data(), &N, work.data(), &lwork, &info);
+    return sorted_eigenvalues(alphar, alphai, beta);
+  }
+
+  static std::vector<double> schur_eigenvalues(const LapackBackend &b,
+					       std::vector<double> A,
+					       std::vector<double> B,
+					       int N)
+  {
+    std::vector<double> Q(N * N, 0.0), Z(N * N, 0.0);
+    std::vector<double> alphar(N), alphai(N), beta(N);
+    int lwork = 6 * N;
+    std::vector<double> work(lwork);
+    int ilo = 1;
+    int ihi = N;
+    int mm = N;
+    int m;
+    int info;
+    char compI[] = "I";
+    char compV[] = "V";
+    char schur[] = "S";
+    char both[] = "B";
+
+    //
+    // As SpecializedEigenProblem: B is already upper triangular there
+    //
+    for (int j = 0; j < N; j ++) {
+      for (int i = j + 1; i < N; i ++) {
+	B[j * N + i] = 0.0;
+      }
+    }
+    
+    b.dgghrd(compI, compI, &N, &ilo, &ihi, A.data(), &N, B.data(), &N,
+	     Q.data(), &N, Z.data(), &N, &info);
+    b.dhgeqz(schur, compV, compV, &N, &ilo, &ihi, A.data(), &N, B.data(), &N,
+	     alphar.data(), alphai.data(), beta.data(),
+	     Q.data(), &N, Z.data(), &N, work.data(), &lwork, &info);
+    b.dtgevc(both, both, nullptr, &N, A.data(), &N, B.data(), &N,
+	     Q.data(), &N, Z.data(), &N, &mm, &m, work.data(), &info);
+    
+    return sorted_eigenvalues(alphar, alphai, beta);
+  }
+
+  //
+  // Eigenvalues (alphar + i alphai)/beta ordered by real then imaginary
+  // part as the order returned differs between implementations
+  //
+  static std::vector<double> sorted_eigenvalues(const std::vector<double> &alphar,
+						const std::vector<double> &alphai,
+						const std::vector<double> &beta)
+  {
+    std::vector<std::pair<double, double>> e(alphar.size());
+    for (size_t i = 0; i < alphar.size(); i ++) {
+      e[i] = std::make_pair(alphar[i]/beta[i], alphai[i]/beta[i]);
+    }
+    std::sort(e.begin(), e.end());
+    
+    std::vector<double> r;
+    for (auto &v : e) {
+      r.push_back(v.first);
+      r.push_back(v.second);
+    }
+    return r;
+  }
+
+  static bool report(FILE *fp,
+		     int N,
+		     const char *routine,
+		     const std::vector<double> &x,
+		     const std::vector<double> &xref,
+		     double tolerance)
+  {
+    double maxdiff = 0.0;
+    double maxref = 0.0;
+    for (size_t i = 0; i < x.size(); i ++) {
+      maxdiff = std::max(maxdiff, fabs(x[i] - xref[i]));
+      maxref = std::max(maxref, fabs(xref[i]));
+    }
+
+    double relative = maxref > 0.0 ? maxdiff/maxref : maxdiff;
+    bool ok = std::isfinite(relative) && relative < tolerance;
+
+    if (fp != nullptr) {
+      fprintf(fp, "lapack selftest: %-22s N %3d relative difference %10.3e %s\n",
+	      routine, N, relative, ok ? "ok" : "FAILED");
+    }
+    
+    return ok;
+  }
+  
+  void *handle;
+  std::string name;
+};
+
+#endif // lapackbackend_hpp
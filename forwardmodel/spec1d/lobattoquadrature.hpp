@@ -34,6 +34,7 @@
 #include "polynomial.hpp"
 #include "eigenroots.hpp"
 
+#include "barycentric.hpp"
 #include "logging.hpp"
 
 template
@@ -166,6 +167,29 @@ public:
       }
       break;
     }
+
+    BarycentricWeights(n, nodes.data(), barycentric.data());
+  }
+
+  //
+  // All cardinal values l[i] = cardinal_i(x) and, if dl is given, their
+  // derivatives in O(n) from the barycentric form of the Lagrange basis
+  //
+  void cardinals(real x, real *l, real *dl = nullptr) const
+  {
+    BarycentricCardinals(n, nodes.data(), barycentric.data(), x, l, dl);
+  }
+
+  //
+  // Batched over npoints points with l and dl ((n + 1) x npoints)
+  //
+  void cardinals(const real *x, size_t npoints, real *l, real *dl = nullptr) const
+  {
+    for (size_t i = 0; i < npoints; i ++) {
+      BarycentricCardinals(n, nodes.data(), barycentric.data(), x[i],
+			   l + i*(n + 1),
+			   dl == nullptr ? nullptr : dl + i*(n + 1));
+    }
   }
 
   size_t n;
@@ -177,6 +201,8 @@ public:
   
   std::array<Polynomial<real>, maxorder + 1> cardinal;
 
+  std::array<real, maxorder + 1> barycentric;
+
 };
 
 #endif // lobattoquadrature_hpp
@@ -44,6 +44,22 @@
 #include "specializedeigenproblem.hpp"
 #include "spec1dmatrix.hpp"
 
+//
+// Fundamental mode at one frequency kept for the curvature part of the
+// Hessian of k, see LoveMatrices::solve_fundamental_hessian_prepare
+//
+template
+<
+  typename real
+>
+struct LoveHessianState {
+  real laguerrescale;
+  real omega;
+  real mu;
+  real normB;
+  Spec1DMatrix<real> v;
+};
+
 template
 <
   typename real,
@@ -78,6 +94,8 @@ public:
   
   void recompute(const Mesh<real, maxorder> &mesh, size_t boundaryorder, real scale = 1.0)
   {
+    PerfRegion region("LoveMatrices::recompute");
+    
     if (boundaryorder > maxboundaryorder) {
       FATAL("Boundary order out of range: %d > %d", (int)boundaryorder, (int)maxboundaryorder);
     }
@@ -122,6 +140,8 @@ public:
 			     Spec1DMatrix<real> &v,
 			     size_t &nbasecells)
   {
+    PerfRegion region("LoveMatrices::postcomputegradient");
+    
     size_t nparameters = 0;
     for (auto &c: mesh.cells) {
       nparameters += c.jacobian.rows();
@@ -897,6 +917,267 @@ public:
     return k;
   }
 
+  //
+  // Wave number with its gradient dkdp and the product of its Hessian with
+  // direction, d2kdp = d^2k/dp^2 direction. mesh has the jacobians of
+  // project_gradient and curvature those of project_hessian in the same
+  // direction. This is solve_fundamental_hessian_prepare followed by
+  // solve_fundamental_hessian_curvature.
+  //
+  real solve_fundamental_hessian_sep(const Mesh<real, maxorder> &mesh,
+				     const Mesh<real, maxorder> &curvature,
+				     size_t boundaryorder,
+				     real omega,
+				     const Spec1DMatrix<real> &direction,
+				     Spec1DMatrix<real> &dkdp,
+				     Spec1DMatrix<real> &d2kdp)
+  {
+    LoveHessianState<real> state;
+    real k = solve_fundamental_hessian_prepare(mesh, boundaryorder, omega, dkdp, hessianK, state);
+    if (k <= 0.0) {
+      return k;
+    }
+
+    size_t nparameters = hessianK.rows();
+    if ((size_t)direction.rows() != nparameters) {
+      FATAL("Direction size mismatch: %d != %d", (int)direction.rows(), (int)nparameters);
+    }
+
+    solve_fundamental_hessian_curvature(curvature, boundaryorder, state, d2kdp);
+
+    for (size_t j = 0; j < nparameters; j ++) {
+      real s = 0.0;
+      for (size_t l = 0; l < nparameters; l ++) {
+	s += hessianK(j, l) * direction(l, 0);
+      }
+      d2kdp(j, 0) += s;
+    }
+
+    return k;
+  }
+
+  //
+  // Wave number with its gradient dkdp and the part of its Hessian that
+  // does not depend on the projection curvature, K, so that
+  //
+  //   d^2k/dp^2 direction = K direction + solve_fundamental_hessian_curvature
+  //
+  // With R = o2 A - C - mu B, mu = k^2 and R_j its derivative with respect
+  // to parameter j (mu fixed),
+  //
+  //   mu_j = v^T R_j v/v^T B v
+  //
+  // is differentiated where the derivative of v solves
+  // R dv = -(dR - dmu B) v. R is symmetric so the adjoint solve is used, for
+  // all parameters together. state keeps the mode for the curvature term.
+  //
+  real solve_fundamental_hessian_prepare(const Mesh<real, maxorder> &mesh,
+					 size_t boundaryorder,
+					 real omega,
+					 Spec1DMatrix<real> &dkdp,
+					 Spec1DMatrix<real> &K,
+					 LoveHessianState<real> &state)
+  {
+    if (size == 0) {
+      FATAL("Unconfigured");
+    }
+
+    D.setZero();
+    Bs.setZero();
+    
+    real o2 = omega*omega;
+    real scale = 0.0;
+    
+    for (size_t i = 0; i < size; i ++) {
+      D(i, i) = o2*A(i, i);
+      if (D(i, i) > scale) {
+	scale = D(i, i);
+      }
+    }
+
+    for (size_t j = 0; j < size; j ++) {
+      for (size_t i = 0; i < size; i ++) {
+        D(j, i) -= C(j, i);
+	D(j, i) /= scale;
+      }
+      Bs(j, j) = B(j, j)/scale;
+    }
+
+    if (!SpecializedEigenProblem(D, Bs, work, eu, ev, lambda, Q, Z)) {
+      ERROR("Failed to compute generalised eigen problem");
+      return 0.0;
+    }
+    
+    real fundamental = 0.0;
+    v.resize(size, 1);
+
+    for (size_t i = 0; i < size; i ++) {
+      if (lambda(i, 1) == 0.0) {
+
+	real k2 = lambda(i, 0)/lambda(i, 2);
+
+	if (k2 > 0.0 && k2 > fundamental) {
+	  fundamental = k2;
+
+	  for (size_t j = 0; j < size; j ++) {
+	    v(j, 0) = ev(j, i);
+	  }
+	}
+      }
+    }
+
+    if (fundamental <= 0.0) {
+      return 0.0;
+    }
+
+    double vnorm = 0.0;
+    for (size_t j = 0; j < size; j ++) {
+      vnorm += v(j, 0)*v(j, 0);
+    }
+    vnorm = sqrt(vnorm);
+    for (size_t j = 0; j < size; j ++) {
+      v(j, 0) /= vnorm;
+    }
+
+    real mu = fundamental;
+    real k = sqrt(mu);
+
+    size_t nbasecells;
+    size_t nparameters = postcomputegradient(mesh,
+					     boundaryorder,
+					     v,
+					     nbasecells);
+
+    real normB = 0.0;
+    for (size_t i = 0; i < size; i ++) {
+      normB += v(i, 0) * B(i, i) * v(i, 0);
+    }
+
+    //
+    // R_j v, v^T R_j v and v^T B_j v
+    //
+    hessianRv.resize(size, nparameters);
+    hessianN.resize(nparameters, 1);
+    hessianBv.resize(nparameters, 1);
+
+    for (size_t j = 0; j < nparameters; j ++) {
+      real n = 0.0;
+      real b = 0.0;
+      for (size_t i = 0; i < size; i ++) {
+	real r = o2*dAv(i, j) - dCv(i, j) - mu*dBv(i, j);
+	hessianRv(i, j) = r;
+	n += v(i, 0) * r;
+	b += v(i, 0) * dBv(i, j);
+      }
+      hessianN(j, 0) = n;
+      hessianBv(j, 0) = b;
+    }
+
+    //
+    // Solve R X_j = -(R_j - mu_j B) v (scaled as D, Bs) and remove the
+    // arbitrary multiple of v from each column
+    //
+    hessianf.resize(size, nparameters);
+    for (size_t j = 0; j < nparameters; j ++) {
+      real muj = hessianN(j, 0)/normB;
+      for (size_t i = 0; i < size; i ++) {
+	hessianf(i, j) = -(hessianRv(i, j) - muj * B(i, i) * v(i, 0))/scale;
+      }
+    }
+
+    hessianx.resize(size, nparameters);
+    if (!SpecializedEigenProblemAdjoint<real>(D, Bs, Q, Z, mu, hessianf, hessianx, work)) {
+      ERROR("Failed to solve for eigenvector derivative");
+      return 0.0;
+    }
+
+    //
+    // dnormB_j = v^T B_j v + 2 X_j^T B v
+    //
+    hessiandnormB.resize(nparameters, 1);
+    for (size_t j = 0; j < nparameters; j ++) {
+      real xv = 0.0;
+      for (size_t i = 0; i < size; i ++) {
+	xv += hessianx(i, j) * v(i, 0);
+      }
+
+      real xBv = 0.0;
+      for (size_t i = 0; i < size; i ++) {
+	hessianx(i, j) -= xv * v(i, 0);
+	xBv += hessianx(i, j) * B(i, i) * v(i, 0);
+      }
+      hessiandnormB(j, 0) = hessianBv(j, 0) + 2.0 * xBv;
+    }
+
+    //
+    // K_jl = (2 X_l^T R_j v - mu_l v^T B_j v - mu_j dnormB_l)/(2 k normB)
+    //        - mu_j mu_l/(4 k^3)
+    //
+    dkdp.resize(nparameters, 1);
+    K.resize(nparameters, nparameters);
+    SpecializedMultiplyTranspose(nparameters, nparameters, size,
+				 hessianRv.data(), size,
+				 hessianx.data(), size,
+				 K.data(), nparameters);
+    
+    for (size_t l = 0; l < nparameters; l ++) {
+      real mul = hessianN(l, 0)/normB;
+      
+      for (size_t j = 0; j < nparameters; j ++) {
+	real muj = hessianN(j, 0)/normB;
+	real dmuj = (2.0*K(j, l) - mul*hessianBv(j, 0) - muj*hessiandnormB(l, 0))/normB;
+
+	K(j, l) = dmuj/(2.0*k) - muj*mul/(4.0*k*k*k);
+      }
+      
+      dkdp(l, 0) = mul/(2.0*k);
+    }
+
+    state.laguerrescale = laguerrescale;
+    state.omega = omega;
+    state.mu = mu;
+    state.normB = normB;
+    state.v = v;
+
+    return k;
+  }
+
+  //
+  // The remaining part of d2kdp for the mode in state (from
+  // solve_fundamental_hessian_prepare on the same mesh order),
+  //
+  //   v^T R2 v/(2 k v^T B v)
+  //
+  // where R2 is the second derivative of R from the curvature jacobians. No
+  // eigen problem is solved and the matrices are not recomputed.
+  //
+  void solve_fundamental_hessian_curvature(const Mesh<real, maxorder> &curvature,
+					   size_t boundaryorder,
+					   LoveHessianState<real> &state,
+					   Spec1DMatrix<real> &d2kdp)
+  {
+    laguerrescale = state.laguerrescale;
+    
+    size_t nbasecells;
+    size_t nparameters = postcomputegradient(curvature,
+					     boundaryorder,
+					     state.v,
+					     nbasecells);
+
+    real o2 = state.omega*state.omega;
+    real mu = state.mu;
+    real c = 1.0/(2.0*sqrt(mu)*state.normB);
+    
+    d2kdp.resize(nparameters, 1);
+    for (size_t j = 0; j < nparameters; j ++) {
+      real vR2v = 0.0;
+      for (size_t i = 0; i < (size_t)state.v.rows(); i ++) {
+	vR2v += state.v(i, 0) * (o2*dAv(i, j) - dCv(i, j) - mu*dBv(i, j));
+      }
+      d2kdp(j, 0) = c*vR2v;
+    }
+  }
+
   real solve_fundamental_gep_vector(real omega,
 				    const Mesh<real, maxorder> &mesh,
 				    size_t boundaryorder,
@@ -1886,10 +2167,12 @@ public:
 	}
 	
 	real V = 0.0;
+	real l[maxorder + 1];
 
+	Lobatto[c.order]->cardinals(xi, l);
 	for (size_t i = 0; i <= c.order; i ++) {
 
-	  V += Lobatto[c.order]->cardinal[i].value(xi)*c.nodes[i].V;
+	  V += l[i]*c.nodes[i].V;
 
 	}
 
@@ -1915,8 +2198,11 @@ public:
       real xi = dz * laguerrescale;
 
       real V = 0.0;
+      real l[maxboundaryorder + 1];
+
+      Laguerre[amplitude.boundary.order]->cardinals(xi, l);
       for (size_t i = 0; i <= amplitude.boundary.order; i ++) {
-	V += Laguerre[amplitude.boundary.order]->cardinal[i].value(xi)*amplitude.boundary.nodes[i].V;
+	V += l[i]*amplitude.boundary.nodes[i].V;
       }
 
       return V;
@@ -1941,10 +2227,13 @@ public:
 	}
 	
 	real V = 0.0;
+	real l[maxorder + 1];
+	real dl[maxorder + 1];
 
+	Lobatto[c.order]->cardinals(xi, l, dl);
 	for (size_t i = 0; i <= c.order; i ++) {
 
-	  V += Lobatto[c.order]->cardinal[i].dydx(xi)*c.nodes[i].V * 2.0/c.thickness;
+	  V += dl[i]*c.nodes[i].V * 2.0/c.thickness;
 
 	}
 
@@ -1970,8 +2259,12 @@ public:
       real xi = dz * laguerrescale;
 
       real V = 0.0;
+      real l[maxboundaryorder + 1];
+      real dl[maxboundaryorder + 1];
+
+      Laguerre[amplitude.boundary.order]->cardinals(xi, l, dl);
       for (size_t i = 0; i <= amplitude.boundary.order; i ++) {
-	V += Laguerre[amplitude.boundary.order]->cardinal[i].dydx(xi)*amplitude.boundary.nodes[i].V * laguerrescale;
+	V += dl[i]*amplitude.boundary.nodes[i].V * laguerrescale;
       }
 
       return V * p.L;
@@ -2025,6 +2318,14 @@ public:
   Spec1DMatrix<real> adjointlambda0;
   Spec1DMatrix<real> adjointw;
 
+  Spec1DMatrix<real> hessianRv;
+  Spec1DMatrix<real> hessianN;
+  Spec1DMatrix<real> hessianBv;
+  Spec1DMatrix<real> hessianf;
+  Spec1DMatrix<real> hessianx;
+  Spec1DMatrix<real> hessiandnormB;
+  Spec1DMatrix<real> hessianK;
+
   Spec1DMatrix<real> l2values;
 };
 
@@ -29,6 +29,7 @@
 #define mesh_hpp
 
 #include <vector>
+#include <algorithm>
 
 #include "lobattoprojection.hpp"
 
@@ -247,45 +248,119 @@ public:
     boundary.print(fp);
   }
 
+  //
+  // Rebuild the cumulative depth index after the cells have changed:
+  // depth_index[i] is the top of cell i and depth_index[cells.size()] the top
+  // of the halfspace.
+  //
+  void update_depth_index()
+  {
+    depth_index.resize(cells.size() + 1);
+
+    real offset = 0.0;
+    for (size_t i = 0; i < cells.size(); i ++) {
+      depth_index[i] = offset;
+      offset += cells[i].thickness;
+    }
+    depth_index[cells.size()] = offset;
+  }
+
+  //
+  // Index of the cell containing depth z (cells.size() for the halfspace)
+  // and its top. Uses a binary search of the depth index, or a linear scan
+  // if the index has not been built for the current cells.
+  //
+  size_t locate(real z, real &top) const
+  {
+    if (depth_index.size() == cells.size() + 1) {
+      
+      size_t c = std::upper_bound(depth_index.begin() + 1, depth_index.end(), z) - (depth_index.begin() + 1);
+      top = depth_index[c];
+      return c;
+
+    } else {
+
+      top = 0.0;
+      for (size_t c = 0; c < cells.size(); c ++) {
+	if (z - top < cells[c].thickness) {
+	  return c;
+	}
+	top += cells[c].thickness;
+      }
+
+      return cells.size();
+    }
+  }
+
   MeshParameter<real> interpolate(real z) const
   {
-    real dz = z;
-    for (auto &c : cells) {
+    real top;
+    size_t c = locate(z, top);
+
+    if (c == cells.size()) {
+      //
+      // Return the boundary parameters
+      //
+      return boundary;
+    }
+
+    return interpolate_cell(cells[c], z - top);
+  }
 
-      if (dz < c.thickness) {
+  //
+  // Interpolate at n depths into p (n x 6, one column per MESHOFFSET_*
+  // parameter). Ascending runs of depths walk the cells from the previous
+  // one so a sorted profile costs O(n + cells).
+  //
+  void interpolate(const real *z, size_t n, Spec1DMatrix<real> &p) const
+  {
+    bool indexed = (depth_index.size() == cells.size() + 1);
+    size_t c = 0;
+    real top = 0.0;
 
-	real xi = 2.0*dz/c.thickness - 1.0;
+    p.resize(n, 6);
+    
+    for (size_t d = 0; d < n; d ++) {
 
-	if (xi < -1.0 || xi > 1.0) {
-	  FATAL("xi out of range: %f", xi);
+      if (d == 0 || !indexed || z[d] < z[d - 1]) {
+	c = locate(z[d], top);
+      } else {
+	while (c < cells.size() && z[d] >= depth_index[c + 1]) {
+	  c ++;
 	}
-	
-	MeshParameter<real> p;
+	top = depth_index[c];
+      }
 
-	for (size_t i = 0; i <= c.order; i ++) {
+      MeshParameter<real> q = (c == cells.size()) ? boundary : interpolate_cell(cells[c], z[d] - top);
 
-	  p += quadrature[c.order]->cardinal[i].value(xi)*c.nodes[i];
+      p(d, MESHOFFSET_RHO) = q.rho;
+      p(d, MESHOFFSET_A) = q.A;
+      p(d, MESHOFFSET_C) = q.C;
+      p(d, MESHOFFSET_F) = q.F;
+      p(d, MESHOFFSET_L) = q.L;
+      p(d, MESHOFFSET_N) = q.N;
+    }
+  }
 
-	}
+  MeshParameter<real> interpolate_cell(const MeshCell<real, maxorder> &c, real dz) const
+  {
+    real xi = 2.0*dz/c.thickness - 1.0;
 
-	// if (p.A < 0.0) {
-	//   c.print(stderr);
-	//   FATAL("-ve A: %f xi %f ", p.A, xi);
-	// }
-	
-	return p;
+    if (xi < -1.0 || xi > 1.0) {
+      FATAL("xi out of range: %f", xi);
+    }
 	
-      } else {
+    MeshParameter<real> p;
+    real l[maxorder + 1];
 
-	dz -= c.thickness;
+    quadrature[c.order]->cardinals(xi, l);
+    for (size_t i = 0; i <= c.order; i ++) {
+
+      p += l[i]*c.nodes[i];
 
-      }
     }
 
-    //
-    // Return the boundary parameters
-    //
-    return boundary;
+    return p;
   }
   
   std::array<LobattoProjection<double, maxorder>*, maxorder + 1> projection;
@@ -294,6 +369,7 @@ public:
   std::vector<MeshCell<real, maxorder>> cells;
   std::vector<size_t> cell_parameter_offsets;
   std::vector<size_t> cell_thickness_reference;
+  std::vector<real> depth_index;
 
   MeshParameter<real> boundary;
   size_t boundary_parameter_offset;
@@ -29,6 +29,7 @@
 #define model_hpp
 
 #include <vector>
+#include <algorithm>
 
 #include "modelinterface.hpp"
 #include "cell.hpp"
@@ -55,10 +56,10 @@ public:
   {
   }
   
-  bool read(FILE *fp)
+  bool read(TextReader &in)
   {
     int fcells;
-    if (fscanf(fp, "%d\n", &fcells) != 1) {
+    if (!in.read_int(fcells)) {
       ERROR("Failed to read no. cells");
       return false;
     }
@@ -72,17 +73,18 @@ public:
     cells.resize(fcells);
     
     for (int i = 0; i < fcells; i ++) {
-      if (!cells[i].read(fp)) {
+      if (!cells[i].read(in)) {
 	ERROR("Failed to read cell");
 	return false;
       }
     }
 
-    if (!boundary.read(fp)) {
+    if (!boundary.read(in)) {
       ERROR("Failed to read boundary");
       return false;
     }
 
+    update_depth_index();
     return true;
   }
 
@@ -100,6 +102,7 @@ public:
     }
       
     boundary.project(i, offset, mesh);
+    mesh.update_depth_index();
   }
 
   virtual void project_gradient(Mesh<real, maxorder> &mesh, size_t order) const
@@ -120,6 +123,34 @@ public:
     }
       
     boundary.project_gradient(i, offset, mesh);
+    mesh.update_depth_index();
+  }
+
+  //
+  // As project_gradient with the jacobians replaced by their derivatives in
+  // the direction of the model parameters, for second order products of the
+  // solvers. Not virtual as only some parameterisations have second
+  // derivatives.
+  //
+  void project_hessian(Mesh<real, maxorder> &mesh, size_t order, const Spec1DMatrix<real> &direction) const
+  {
+    mesh.cells.clear();
+    mesh.cell_parameter_offsets.clear();
+    mesh.cell_parameter_offsets.push_back(0);
+
+    mesh.cell_thickness_reference.clear();
+
+    real offset = 0.0;
+
+    size_t i = 0;
+    for (auto &c : cells) {
+      c.project_hessian(i, offset, mesh, order, direction);
+      offset += c.thickness;
+      i ++;
+    }
+
+    boundary.project_hessian(i, offset, mesh, direction);
+    mesh.update_depth_index();
   }
 
   virtual void project_threshold(Mesh<real, maxorder> &mesh,
@@ -146,6 +177,7 @@ public:
     }
       
     boundary.project(i, offset, mesh);
+    mesh.update_depth_index();
   }
 				 
   virtual void project_threshold_gradient(Mesh<real, maxorder> &mesh,
@@ -174,6 +206,7 @@ public:
     }
       
     boundary.project_gradient(i, offset, mesh);
+    mesh.update_depth_index();
   }
 
   virtual real halfspace_depth() const
@@ -203,8 +236,12 @@ public:
       FATAL("Invalid node");
     }
     
-    for (int i = 0; i < cell; i ++) {
-      offset += cells[i].thickness;
+    if (depth_index.size() == cells.size() + 1) {
+      offset = depth_index[cell];
+    } else {
+      for (int i = 0; i < cell; i ++) {
+	offset += cells[i].thickness;
+      }
     }
 
     real xi = mesh.quadrature[order]->nodes[node];
@@ -214,35 +251,63 @@ public:
 
   virtual bool interpolate(const Mesh<real, maxorder> &mesh, real z, real *parameters) const
   {
-    real offset = 0.0;
-      
-    for (auto &c : cells) {
+    real top;
+    size_t poffset;
+    size_t c = locate(z, top, poffset);
 
-      if (offset + c.thickness >= z) {
-
-	real xi = 2.0 * (z - offset)/c.thickness - 1.0;
-	
-	for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
-
-	  parameters[j] = 0.0;
-
-	  for (int i = 0; i <= (int)c.order[j]; i ++) {
+    if (c == cells.size()) {
+      for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
+	parameters[j] = boundary.parameters[j];
+      }
+    } else {
+      interpolate_cell(mesh, cells[c], z - top, parameters, nullptr, 0);
+    }
+    
+    return true;
+  }
 
-	    parameters[j] += mesh.quadrature[c.order[j]]->cardinal[i].value(xi) * c.nodes[i][j];
+  //
+  // Interpolate at n depths into parameters (n x NPARAMETERS, one column per
+  // parameter). Ascending runs of depths walk the cells from the previous
+  // one so a sorted profile costs O(n + cells).
+  //
+  virtual bool interpolate(const Mesh<real, maxorder> &mesh,
+			   const real *z,
+			   size_t n,
+			   Spec1DMatrix<real> &parameters) const
+  {
+    bool indexed = (depth_index.size() == cells.size() + 1);
+    size_t c = 0;
+    size_t poffset;
+    real top = 0.0;
+    real p[parameterset::NPARAMETERS];
 
-	  }
+    parameters.resize(n, parameterset::NPARAMETERS);
+    
+    for (size_t d = 0; d < n; d ++) {
 
+      if (d == 0 || !indexed || z[d] < z[d - 1]) {
+	c = locate(z[d], top, poffset);
+      } else {
+	while (c < cells.size() && z[d] > depth_index[c + 1]) {
+	  c ++;
 	}
+	top = depth_index[c];
+      }
 
-	return true;
+      if (c == cells.size()) {
+	for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
+	  p[j] = boundary.parameters[j];
+	}
+      } else {
+	interpolate_cell(mesh, cells[c], z[d] - top, p, nullptr, 0);
       }
 
-      offset += c.thickness;
+      for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
+	parameters(d, j) = p[j];
+      }
     }
 
-    for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
-      parameters[j] = boundary.parameters[j];
-    }
     return true;
   }
 
@@ -266,49 +331,118 @@ public:
 				    real *parameters,
 				    Spec1DMatrix<real> &dvdp) const
   {
+    real top;
+    size_t poffset;
+    size_t c = locate(z, top, poffset);
+
+    if (c == cells.size()) {
+      for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
+	parameters[j] = boundary.parameters[j];
+      }
+    } else {
+      interpolate_cell(mesh, cells[c], z - top, parameters, &dvdp, poffset);
+    }
+    
+    return true;
+  }
+
+  //
+  // Rebuild the cumulative depth and parameter offset indices after the
+  // cells have changed: depth_index[i] is the top of cell i and
+  // parameter_index[i] the offset of its first parameter, with the final
+  // entries for the halfspace.
+  //
+  void update_depth_index()
+  {
+    depth_index.resize(cells.size() + 1);
+    parameter_index.resize(cells.size() + 1);
+
     real offset = 0.0;
     size_t poffset = 0;
+    for (size_t i = 0; i < cells.size(); i ++) {
+      depth_index[i] = offset;
+      parameter_index[i] = poffset;
       
-    for (auto &c : cells) {
+      offset += cells[i].thickness;
+      for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
+	poffset += (cells[i].order[j] + 1);
+      }
+    }
+
+    depth_index[cells.size()] = offset;
+    parameter_index[cells.size()] = poffset;
+  }
+
+  //
+  // Index of the cell containing depth z (cells.size() for the halfspace),
+  // its top and parameter offset. Uses a binary search of the depth index,
+  // or a linear scan if the index has not been built for the current cells.
+  //
+  size_t locate(real z, real &top, size_t &poffset) const
+  {
+    if (depth_index.size() == cells.size() + 1) {
 
-      if (offset + c.thickness >= z) {
+      size_t c = std::lower_bound(depth_index.begin() + 1, depth_index.end(), z) - (depth_index.begin() + 1);
+      top = depth_index[c];
+      poffset = parameter_index[c];
+      return c;
 
-	real xi = 2.0 * (z - offset)/c.thickness - 1.0;
+    } else {
+
+      top = 0.0;
+      poffset = 0;
+      for (size_t c = 0; c < cells.size(); c ++) {
+	if (top + cells[c].thickness >= z) {
+	  return c;
+	}
 	
+	top += cells[c].thickness;
 	for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
+	  poffset += (cells[c].order[j] + 1);
+	}
+      }
 
-	  parameters[j] = 0.0;
+      return cells.size();
+    }
+  }
 
-	  for (int i = 0; i <= (int)c.order[j]; i ++) {
+  //
+  // Interpolate within cell c at dz below its top, and if dvdp is given fill
+  // the parameter weights from row poffset
+  //
+  void interpolate_cell(const Mesh<real, maxorder> &mesh,
+			const Cell<real, parameterset, maxorder> &c,
+			real dz,
+			real *parameters,
+			Spec1DMatrix<real> *dvdp,
+			size_t poffset) const
+  {
+    real xi = 2.0 * dz/c.thickness - 1.0;
+    real l[maxorder + 1];
+    size_t lorder = c.order[0];
+    mesh.quadrature[lorder]->cardinals(xi, l);
+	
+    for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
 
-	    real w = mesh.quadrature[c.order[j]]->cardinal[i].value(xi);
-	    
-	    parameters[j] += w * c.nodes[i][j];
+      if (c.order[j] != lorder) {
+	mesh.quadrature[c.order[j]]->cardinals(xi, l);
+	lorder = c.order[j];
+      }
 
-	    dvdp(poffset + i, 0) = w;
+      parameters[j] = 0.0;
 
-	  }
+      for (int i = 0; i <= (int)c.order[j]; i ++) {
 
-	  poffset += (c.order[j] + 1);
+	parameters[j] += l[i] * c.nodes[i][j];
 
+	if (dvdp != nullptr) {
+	  (*dvdp)(poffset + i, 0) = l[i];
 	}
 
-	return true;
-
-      } else {
-	for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
-	  poffset += (c.order[j] + 1);
-	}
       }
 
-      offset += c.thickness;
-    }
-
-    for (int j = 0; j < (int)parameterset::NPARAMETERS; j ++) {
-      parameters[j] = boundary.parameters[j];
+      poffset += (c.order[j] + 1);
     }
-    
-    return true;
   }
 
   virtual void project_with_refinement(Mesh<real, maxorder> &mesh,
@@ -336,6 +470,7 @@ public:
 		     max_cell_thickness,
 		     lower_boundary,
 		     mesh);
+    mesh.update_depth_index();
   }
 
   void print(FILE *fp)
@@ -377,7 +512,7 @@ public:
     return true;
   }
 
-  int encode_size()
+  int encode_size() const
   {
     int size = sizeof(int);
 
@@ -389,7 +524,7 @@ public:
     return size;
   }
   
-  int encode(char *buffer, int &offset, int buffer_size)
+  int encode(char *buffer, int &offset, int buffer_size) const
   {
     int s = 0;
     int e;
@@ -445,7 +580,9 @@ public:
       }
     }
 
-    return boundary.decode(buffer, offset, buffer_size);
+    int e = boundary.decode(buffer, offset, buffer_size);
+    update_depth_index();
+    return e;
   }
 
   
@@ -489,6 +626,7 @@ public:
     }
 
     fclose(fp);
+    update_depth_index();
     return true;
   }
 
@@ -512,6 +650,7 @@ public:
     }
 
     boundary = model.boundary;
+    update_depth_index();
   }
 
   void clone_with_merge(const Model &model, size_t cell, double &split)
@@ -542,6 +681,7 @@ public:
     }
 
     boundary = model.boundary;
+    update_depth_index();
   }
 
   real totalthickness() const
@@ -555,6 +695,9 @@ public:
   
   std::vector<Cell<real, parameterset, maxorder>> cells;
   boundarycondition boundary;
+
+  std::vector<real> depth_index;
+  std::vector<size_t> parameter_index;
 };
 
 #endif // model_hpp
@@ -29,6 +29,7 @@
 #define modelinterface_hpp
 
 #include "mesh.hpp"
+#include "textreader.hpp"
 
 template
 <
@@ -46,7 +47,7 @@ public:
   {
   }
   
-  virtual bool read(FILE *fp) = 0;
+  virtual bool read(TextReader &in) = 0;
   
   virtual void project(Mesh<real, maxorder> &mesh, size_t order) const = 0;
   virtual void project_with_refinement(Mesh<real, maxorder> &mesh,
@@ -60,6 +61,10 @@ public:
                                  size_t low_order) = 0;
 
   virtual bool interpolate(const Mesh<real, maxorder> &mesh, real z, real *parameters) const = 0;
+  virtual bool interpolate(const Mesh<real, maxorder> &mesh,
+			   const real *z,
+			   size_t n,
+			   Spec1DMatrix<real> &parameters) const = 0;
 
   virtual size_t parameter_count() const = 0;
   
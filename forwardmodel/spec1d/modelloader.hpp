@@ -33,6 +33,7 @@
 
 #include "model.hpp"
 #include "logging.hpp"
+#include "textreader.hpp"
 
 #include "empiricalmodel.hpp"
 
@@ -56,16 +57,15 @@ template
 >
 ModelInterface<real, maxorder>* ModelLoader(const char *filename)
 {
-  FILE *fp;
+  TextReader in;
 
-  fp = fopen(filename, "r");
-  if (fp == NULL) {
+  if (!in.open(filename)) {
     ERROR("Failed to open file");
     return nullptr;
   }
 
   int order;
-  if (fscanf(fp, "%d\n", &order) != 1) {
+  if (!in.read_int(order)) {
     ERROR("Failed to read header");
     return nullptr;
   }
@@ -78,7 +78,8 @@ ModelInterface<real, maxorder>* ModelLoader(const char *filename)
   char parameterset[1024];
   char boundary[1024];
 
-  if (fscanf(fp, "%s\n%s\n", parameterset, boundary) != 2) {
+  if (!in.read_word(parameterset, sizeof(parameterset)) ||
+      !in.read_word(boundary, sizeof(boundary))) {
     ERROR("Failed to read types");
     return nullptr;
   }
@@ -163,12 +164,11 @@ ModelInterface<real, maxorder>* ModelLoader(const char *filename)
     return nullptr;
   }
 
-  if (!p->read(fp)) {
+  if (!p->read(in)) {
     ERROR("Failed to read model");
     return nullptr;
   }
 
-  fclose(fp);
   return p;
 }
 
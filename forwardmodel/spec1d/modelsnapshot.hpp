@@ -0,0 +1,308 @@
+//
+//    Spec1D : A spectral element code for surface wave dispersion of Love
+//    and Rayleigh waves. See
+//
+//      R Hawkins, "A spectral element method for surface wave dispersion and adjoints",
+//      Geophysical Journal International, 2018, 215:1, 267 - 302
+//      https://doi.org/10.1093/gji/ggy277
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef modelsnapshot_hpp
+#define modelsnapshot_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "model.hpp"
+#include "encodedecode.hpp"
+
+//
+// Binary model snapshot. The layout is
+//
+//   magic        8 bytes  "S1DMODEL"
+//   version      int
+//   byte order   int      0x01020304 as written
+//   real size    int      sizeof(real)
+//   maxorder     int
+//   cell type    int length followed by the name
+//   boundary     int length followed by the name
+//   size         int      payload bytes
+//   checksum     uint64   FNV-1a of the payload
+//   payload               Model::encode
+//
+// Values are stored exactly so a save/load round trip is lossless, unlike the
+// 9 decimal places of the text format. Snapshots are only portable between
+// machines of the same byte order which is checked on load.
+//
+template
+<
+  typename real,
+  typename parameterset,
+  typename boundarycondition,
+  size_t maxorder
+>
+class ModelSnapshot {
+public:
+
+  typedef Model<real, parameterset, boundarycondition, maxorder> model_t;
+
+  static constexpr int VERSION = 1;
+  static constexpr int BYTEORDER = 0x01020304;
+  static constexpr int NAME_MAX = 256;
+  
+  static bool is_snapshot(const char *filename)
+  {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+      return false;
+    }
+
+    char magic[8];
+    bool r = (fread(magic, sizeof(magic), 1, fp) == 1 &&
+	      memcmp(magic, MAGIC(), sizeof(magic)) == 0);
+    fclose(fp);
+    return r;
+  }
+
+  static bool save(const model_t &model, const char *filename)
+  {
+    const char *cellname = parameterset::NAME();
+    const char *boundaryname = boundarycondition::NAME();
+    
+    int payload_size = model.encode_size();
+    int header_size = 8 + 7*sizeof(int) + strlen(cellname) + strlen(boundaryname) + sizeof(uint64_t);
+    int buffer_size = header_size + payload_size;
+
+    char *buffer = new char[buffer_size];
+    int offset = 0;
+
+    memcpy(buffer, MAGIC(), 8);
+    offset += 8;
+
+    int version = VERSION;
+    int byteorder = BYTEORDER;
+    
+    bool r =
+      ::encode<int>(version, buffer, offset, buffer_size) >= 0 &&
+      ::encode<int>(byteorder, buffer, offset, buffer_size) >= 0 &&
+      ::encode<int>((int)sizeof(real), buffer, offset, buffer_size) >= 0 &&
+      ::encode<int>((int)maxorder, buffer, offset, buffer_size) >= 0 &&
+      encode_name(cellname, buffer, offset, buffer_size) &&
+      encode_name(boundaryname, buffer, offset, buffer_size) &&
+      ::encode<int>(payload_size, buffer, offset, buffer_size) >= 0;
+
+    if (!r) {
+      ERROR("Failed to encode header");
+      delete [] buffer;
+      return false;
+    }
+
+    //
+    // Reserve the checksum and fill it in once the payload is encoded
+    //
+    int checksum_offset = offset;
+    offset += sizeof(uint64_t);
+    
+    if (model.encode(buffer, offset, buffer_size) < 0) {
+      ERROR("Failed to encode model");
+      delete [] buffer;
+      return false;
+    }
+
+    uint64_t sum = checksum(buffer + header_size, payload_size);
+    ::encode<uint64_t>(sum, buffer, checksum_offset, buffer_size);
+
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+      ERROR("Failed to create file");
+      delete [] buffer;
+      return false;
+    }
+
+    r = (fwrite(buffer, buffer_size, 1, fp) == 1);
+    fclose(fp);
+    delete [] buffer;
+
+    if (!r) {
+      ERROR("Failed to write snapshot");
+    }
+    return r;
+  }
+
+  static bool load(model_t &model, const char *filename)
+  {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+      ERROR("Failed to open file");
+      return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long file_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (file_size <= 0) {
+      ERROR("Empty snapshot");
+      fclose(fp);
+      return false;
+    }
+
+    int buffer_size = (int)file_size;
+    char *buffer = new char[buffer_size];
+    bool r = (fread(buffer, buffer_size, 1, fp) == 1);
+    fclose(fp);
+
+    if (!r) {
+      ERROR("Failed to read snapshot");
+      delete [] buffer;
+      return false;
+    }
+
+    r = decode_snapshot(model, buffer, buffer_size);
+    delete [] buffer;
+    return r;
+  }
+
+  static uint64_t checksum(const char *buffer, int size)
+  {
+    return fnv1a(buffer, size);
+  }
+
+private:
+
+  static const char *MAGIC()
+  {
+    return "S1DMODEL";
+  }
+  
+  static bool encode_name(const char *name, char *buffer, int &offset, int buffer_size)
+  {
+    int n = strlen(name);
+    if (::encode<int>(n, buffer, offset, buffer_size) < 0) {
+      return false;
+    }
+    if (offset + n > buffer_size) {
+      return false;
+    }
+    memcpy(buffer + offset, name, n);
+    offset += n;
+    return true;
+  }
+
+  static bool decode_name(char *name, const char *buffer, int &offset, int buffer_size)
+  {
+    int n;
+    if (::decode<int>(n, buffer, offset, buffer_size) < 0) {
+      return false;
+    }
+    if (n < 0 || n >= NAME_MAX || offset + n > buffer_size) {
+      return false;
+    }
+    memcpy(name, buffer + offset, n);
+    name[n] = '\0';
+    offset += n;
+    return true;
+  }
+
+  static bool decode_snapshot(model_t &model, char *buffer, int buffer_size)
+  {
+    if (buffer_size < 8 || memcmp(buffer, MAGIC(), 8) != 0) {
+      ERROR("Not a model snapshot");
+      return false;
+    }
+    int offset = 8;
+
+    int version, byteorder, realsize, fmaxorder;
+    if (::decode<int>(version, buffer, offset, buffer_size) < 0 ||
+	::decode<int>(byteorder, buffer, offset, buffer_size) < 0 ||
+	::decode<int>(realsize, buffer, offset, buffer_size) < 0 ||
+	::decode<int>(fmaxorder, buffer, offset, buffer_size) < 0) {
+      ERROR("Failed to decode header");
+      return false;
+    }
+
+    if (version != VERSION) {
+      ERROR("Unsupported snapshot version %d", version);
+      return false;
+    }
+
+    if (byteorder != BYTEORDER) {
+      ERROR("Snapshot byte order mismatch");
+      return false;
+    }
+
+    if (realsize != (int)sizeof(real)) {
+      ERROR("Snapshot real size mismatch (%d != %d)", realsize, (int)sizeof(real));
+      return false;
+    }
+
+    if (fmaxorder < 0 || fmaxorder > (int)maxorder) {
+      ERROR("Max order out of range");
+      return false;
+    }
+
+    char cellname[NAME_MAX];
+    char boundaryname[NAME_MAX];
+    if (!decode_name(cellname, buffer, offset, buffer_size) ||
+	!decode_name(boundaryname, buffer, offset, buffer_size)) {
+      ERROR("Failed to decode type names");
+      return false;
+    }
+
+    if (strcmp(cellname, parameterset::NAME()) != 0) {
+      ERROR("Cell type mismatch: %s != %s", cellname, parameterset::NAME());
+      return false;
+    }
+
+    if (strcmp(boundaryname, boundarycondition::NAME()) != 0) {
+      ERROR("Boundary type mismatch: %s != %s", boundaryname, boundarycondition::NAME());
+      return false;
+    }
+
+    int payload_size;
+    uint64_t sum;
+    if (::decode<int>(payload_size, buffer, offset, buffer_size) < 0 ||
+	::decode<uint64_t>(sum, buffer, offset, buffer_size) < 0) {
+      ERROR("Failed to decode header");
+      return false;
+    }
+
+    if (payload_size < 0 || offset + payload_size != buffer_size) {
+      ERROR("Snapshot size mismatch");
+      return false;
+    }
+
+    if (checksum(buffer + offset, payload_size) != sum) {
+      ERROR("Snapshot checksum mismatch");
+      return false;
+    }
+
+    if (model.decode(buffer, offset, buffer_size) < 0) {
+      ERROR("Failed to decode model");
+      return false;
+    }
+
+    return true;
+  }
+  
+};
+
+#endif // modelsnapshot_hpp
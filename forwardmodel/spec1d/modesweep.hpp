@@ -0,0 +1,898 @@
+//
+//    Spec1D : A spectral element code for surface wave dispersion of Love
+//    and Rayleigh waves. See
+//
+//      R Hawkins, "A spectral element method for surface wave dispersion and adjoints",
+//      Geophysical Journal International, 2018, 215:1, 267 - 302
+//      https://doi.org/10.1093/gji/ggy277
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef modesweep_hpp
+#define modesweep_hpp
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include "spec1dmatrix.hpp"
+#include "generalisedeigenproblem.hpp"
+#include "generalsolve.hpp"
+#include "lovematrices.hpp"
+#include "rayleighmatrices.hpp"
+
+//
+// Per mode dispersion from a sweep. Matrices are (nfrequencies x nmodes)
+// and are zero where a mode is cut off. If requested, dcdp[m] holds the
+// phase velocity Jacobian of mode m as (nparameters x nfrequencies).
+//
+template
+<
+  typename real
+>
+struct ModeSweepResult {
+  Spec1DMatrix<real> k;
+  Spec1DMatrix<real> c;
+  Spec1DMatrix<real> U;
+
+  std::vector<Spec1DMatrix<real>> dcdp;
+
+  int full_solves;
+  int tracked_solves;
+};
+
+//
+// Tracks the first nmodes branches of a generalised eigen problem
+//
+//   P(omega) x = lambda B(omega) x
+//
+// through a sequence of frequencies. The full QZ solve is only used at the
+// first frequency or when tracking fails; otherwise each branch is followed
+// with shift-invert iteration about the branch eigenvalue extrapolated from
+// the previous frequencies, started from the previous eigenvector. A tracked
+// solution is accepted only if its eigenvector overlaps the previous one by
+// at least overlap_threshold and the branches remain distinct.
+//
+// Modes are numbered by decreasing eigenvalue at the first frequency (mode 0
+// is the fundamental) and thereafter follow eigenvector character, so through
+// an avoided crossing a branch keeps its character rather than its rank. Once
+// a mode is no longer admissible (e.g. below its cutoff when sweeping from
+// high to low frequency) it remains cut off.
+//
+template
+<
+  typename real
+>
+class ModeTracker {
+public:
+
+  ModeTracker(int _nmodes,
+	      real _overlap_threshold = 0.9,
+	      real _tolerance = 1.0e-10,
+	      int _maxiterations = 30) :
+    nmodes(_nmodes),
+    overlap_threshold(_overlap_threshold),
+    tolerance(_tolerance),
+    maxiterations(_maxiterations),
+    IPIV(nullptr),
+    IPIV_size(0)
+  {
+  }
+
+  virtual ~ModeTracker()
+  {
+    delete [] IPIV;
+  }
+
+  bool sweep(const std::vector<real> &omegas,
+	     ModeSweepResult<real> &result,
+	     bool jacobians = false)
+  {
+    int nf = (int)omegas.size();
+
+    result.k.resize(nf, nmodes);
+    result.k.setZero();
+    result.c.resize(nf, nmodes);
+    result.c.setZero();
+    result.U.resize(nf, nmodes);
+    result.U.setZero();
+    result.dcdp.clear();
+    if (jacobians) {
+      result.dcdp.resize(nmodes);
+    }
+    result.full_solves = 0;
+    result.tracked_solves = 0;
+
+    lambda.assign(nmodes, 0.0);
+    lambda_prev.assign(nmodes, 0.0);
+    active.assign(nmodes, true);
+    x.resize(nmodes);
+    y.resize(nmodes);
+    
+    for (int i = 0; i < nf; i ++) {
+
+      real omega = omegas[i];
+
+      pencil(omega, P, Bp);
+
+      bool tracked = (i > 0) && track(omega, i > 1 ? omegas[i - 2] : omegas[i - 1], omegas[i - 1]);
+      if (tracked) {
+	result.tracked_solves ++;
+      } else {
+	if (!full(omega, i == 0)) {
+	  return false;
+	}
+	result.full_solves ++;
+      }
+
+      for (int m = 0; m < nmodes; m ++) {
+	if (!active[m]) {
+	  continue;
+	}
+
+	real U;
+	real k = wavenumber(omega, lambda[m]);
+	group(omega, lambda[m], x[m], U);
+	
+	result.k(i, m) = k;
+	result.c(i, m) = omega/k;
+	result.U(i, m) = U;
+
+	if (jacobians) {
+	  Spec1DMatrix<real> dkdp;
+	  if (!jacobian(omega, lambda[m], x[m], y[m], dkdp)) {
+	    return false;
+	  }
+
+	  Spec1DMatrix<real> &J = result.dcdp[m];
+	  if (J.rows() != dkdp.rows()) {
+	    J.resize(dkdp.rows(), nf);
+	    J.setZero();
+	  }
+	  for (int j = 0; j < dkdp.rows(); j ++) {
+	    J(j, i) = -dkdp(j, 0) * omega/(k*k);
+	  }
+	}
+      }
+
+      if (active[0]) {
+	update_scale(omega, wavenumber(omega, lambda[0]));
+      }
+    }
+
+    return true;
+  }
+
+  int nmodes;
+  real overlap_threshold;
+  real tolerance;
+  int maxiterations;
+
+protected:
+
+  //
+  // Form the pencil at omega
+  //
+  virtual void pencil(real omega, Spec1DMatrix<real> &P, Spec1DMatrix<real> &B) = 0;
+
+  //
+  // True if the (real) eigenvalue is a trapped mode at omega
+  //
+  virtual bool admissible(real omega, real lambda) const = 0;
+
+  virtual real wavenumber(real omega, real lambda) const = 0;
+
+  virtual void group(real omega, real lambda, const Spec1DMatrix<real> &x, real &U) = 0;
+
+  //
+  // dk/dp from the right (x) and left (y) eigenvectors
+  //
+  virtual bool jacobian(real omega,
+			real lambda,
+			const Spec1DMatrix<real> &x,
+			const Spec1DMatrix<real> &y,
+			Spec1DMatrix<real> &dkdp) = 0;
+
+  //
+  // Laguerre scale continuation from the fundamental mode
+  //
+  virtual void update_scale(real omega, real k) = 0;
+
+  //
+  // True if the left eigenvector differs from the right (non-symmetric pencil)
+  //
+  virtual bool need_left() const = 0;
+
+  Spec1DMatrix<real> P;
+  Spec1DMatrix<real> Bp;
+
+private:
+
+  bool full(real omega, bool first)
+  {
+    Spec1DMatrix<real> work, eu, ev, elambda;
+    Spec1DMatrix<real> tP(P);
+    Spec1DMatrix<real> tB(Bp);
+
+    if (!GEP(tP, tB, work, eu, ev, elambda)) {
+      ERROR("Failed to compute generalised eigen problem");
+      return false;
+    }
+
+    //
+    // Admissible eigenvalues in decreasing order
+    //
+    std::vector<int> order;
+    int n = P.rows();
+    for (int i = 0; i < n; i ++) {
+      if (elambda(i, 1) == 0.0 && elambda(i, 2) != 0.0) {
+	real l = elambda(i, 0)/elambda(i, 2);
+	if (admissible(omega, l)) {
+	  order.push_back(i);
+	}
+      }
+    }
+
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+	return elambda(a, 0)/elambda(a, 2) > elambda(b, 0)/elambda(b, 2);
+      });
+
+    //
+    // Modes beyond the no. admissible eigenvalues are cut off
+    //
+    int nactive = 0;
+    for (int m = 0; m < nmodes; m ++) {
+      if (active[m]) {
+	if (nactive >= (int)order.size()) {
+	  active[m] = false;
+	} else {
+	  nactive ++;
+	}
+      }
+    }
+
+    //
+    // Assign eigenpairs: in decreasing order at the first frequency, otherwise
+    // by maximum eigenvector overlap with each branch so that a branch is
+    // followed consistently with the tracked solutions
+    //
+    std::vector<bool> taken(order.size(), false);
+    int next = 0;
+    for (int m = 0; m < nmodes; m ++) {
+      if (!active[m]) {
+	continue;
+      }
+
+      int best = -1;
+      if (first || x[m].rows() != n) {
+	best = next ++;
+      } else {
+	real best_overlap = -1.0;
+	for (int o = 0; o < (int)order.size(); o ++) {
+	  if (taken[o]) {
+	    continue;
+	  }
+
+	  Spec1DMatrix<real> xo;
+	  xo.resize(n, 1);
+	  for (int j = 0; j < n; j ++) {
+	    xo(j, 0) = ev(j, order[o]);
+	  }
+
+	  real ov = overlap(xo, x[m]);
+	  if (ov > best_overlap) {
+	    best_overlap = ov;
+	    best = o;
+	  }
+	}
+      }
+      taken[best] = true;
+
+      int e = order[best];
+      lambda_prev[m] = first ? 0.0 : lambda[m];
+      lambda[m] = elambda(e, 0)/elambda(e, 2);
+
+      Spec1DMatrix<real> xm;
+      Spec1DMatrix<real> ym;
+      xm.resize(n, 1);
+      ym.resize(n, 1);
+      for (int j = 0; j < n; j ++) {
+	xm(j, 0) = ev(j, e);
+	ym(j, 0) = eu(j, e);
+      }
+      normalize(xm, first ? nullptr : &x[m]);
+      normalize(ym, first ? nullptr : &y[m]);
+      x[m] = xm;
+      y[m] = ym;
+    }
+
+    if (!need_left()) {
+      for (int m = 0; m < nmodes; m ++) {
+	y[m] = x[m];
+      }
+    }
+    
+    return true;
+  }
+
+  bool track(real omega, real omega2, real omega1)
+  {
+    int n = P.rows();
+    std::vector<real> newlambda(nmodes, 0.0);
+    std::vector<Spec1DMatrix<real>> newx(nmodes);
+    std::vector<Spec1DMatrix<real>> newy(nmodes);
+
+    if (n != x[0].rows()) {
+      return false;
+    }
+    
+    for (int m = 0; m < nmodes; m ++) {
+      if (!active[m]) {
+	continue;
+      }
+
+      //
+      // Linear extrapolation of the branch
+      //
+      real sigma = lambda[m];
+      if (lambda_prev[m] != 0.0 && omega1 != omega2) {
+	sigma += (lambda[m] - lambda_prev[m]) * (omega - omega1)/(omega1 - omega2);
+      }
+
+      if (!inverse_iteration(sigma, x[m], y[m], newlambda[m], newx[m], newy[m])) {
+	return false;
+      }
+
+      if (!admissible(omega, newlambda[m])) {
+	//
+	// Possible cutoff: confirm with the full solve
+	//
+	return false;
+      }
+
+      if (overlap(newx[m], x[m]) < overlap_threshold) {
+	return false;
+      }
+
+      for (int l = 0; l < m; l ++) {
+	if (active[l] &&
+	    fabs(newlambda[l] - newlambda[m]) <= 1.0e3 * tolerance * fabs(newlambda[l])) {
+	  return false;
+	}
+      }
+    }
+
+    for (int m = 0; m < nmodes; m ++) {
+      if (active[m]) {
+	lambda_prev[m] = lambda[m];
+	lambda[m] = newlambda[m];
+	x[m] = newx[m];
+	y[m] = newy[m];
+      }
+    }
+
+    return true;
+  }
+
+  //
+  // Shift-invert iteration about sigma started from x0 (and y0 for the left
+  // eigenvector of non-symmetric pencils). The shift is refined once with the
+  // current eigenvalue estimate if convergence is slow.
+  //
+  bool inverse_iteration(real sigma,
+			 const Spec1DMatrix<real> &x0,
+			 const Spec1DMatrix<real> &y0,
+			 real &l,
+			 Spec1DMatrix<real> &xn,
+			 Spec1DMatrix<real> &yn)
+  {
+    int n = P.rows();
+
+    if (IPIV_size < n) {
+      delete [] IPIV;
+      IPIV = new int[n];
+      IPIV_size = n;
+    }
+
+    xn = x0;
+    normalize(xn, nullptr);
+    l = sigma;
+
+    for (int refine = 0; refine < 2; refine ++) {
+
+      if (!factor(sigma)) {
+	return false;
+      }
+
+      bool converged = false;
+      for (int it = 0; it < maxiterations; it ++) {
+
+	Spec1DMatrix<real> z;
+	z.resize(n, 1);
+	for (int i = 0; i < n; i ++) {
+	  real s = 0.0;
+	  for (int j = 0; j < n; j ++) {
+	    s += Bp(i, j) * xn(j, 0);
+	  }
+	  z(i, 0) = s;
+	}
+
+	if (!GeneralFactorSolve(LU, IPIV, z)) {
+	  return false;
+	}
+
+	real xz = 0.0;
+	for (int i = 0; i < n; i ++) {
+	  xz += xn(i, 0) * z(i, 0);
+	}
+	if (xz == 0.0) {
+	  return false;
+	}
+	l = sigma + 1.0/xz;
+
+	xn = z;
+	normalize(xn, &x0);
+
+	if (residual(l, xn) < tolerance) {
+	  converged = true;
+	  break;
+	}
+      }
+
+      if (converged) {
+	break;
+      }
+
+      if (refine == 1) {
+	return false;
+      }
+      
+      sigma = l;
+    }
+
+    if (need_left()) {
+      yn = y0;
+      normalize(yn, nullptr);
+      
+      for (int it = 0; it < maxiterations; it ++) {
+	Spec1DMatrix<real> z;
+	z.resize(n, 1);
+	for (int i = 0; i < n; i ++) {
+	  real s = 0.0;
+	  for (int j = 0; j < n; j ++) {
+	    s += Bp(j, i) * yn(j, 0);
+	  }
+	  z(i, 0) = s;
+	}
+
+	if (!GeneralFactorSolve(LU, IPIV, z, true)) {
+	  return false;
+	}
+
+	Spec1DMatrix<real> last(yn);
+	yn = z;
+	normalize(yn, &y0);
+	
+	if (1.0 - overlap(yn, last) < tolerance) {
+	  break;
+	}
+      }
+    } else {
+      yn = xn;
+    }
+
+    return true;
+  }
+
+  bool factor(real sigma)
+  {
+    int n = P.rows();
+
+    LU.resize(n, n);
+    for (int j = 0; j < n; j ++) {
+      for (int i = 0; i < n; i ++) {
+	LU(i, j) = P(i, j) - sigma * Bp(i, j);
+      }
+    }
+
+    if (!GeneralFactor(LU, IPIV)) {
+      //
+      // Shift landed exactly on an eigenvalue: perturb
+      //
+      real ds = (sigma == 0.0 ? 1.0 : fabs(sigma)) * 1.0e-9;
+      for (int i = 0; i < n; i ++) {
+	for (int j = 0; j < n; j ++) {
+	  LU(i, j) = P(i, j) - (sigma + ds) * Bp(i, j);
+	}
+      }
+      return GeneralFactor(LU, IPIV);
+    }
+
+    return true;
+  }
+
+  real residual(real l, const Spec1DMatrix<real> &v) const
+  {
+    int n = P.rows();
+    real r = 0.0;
+    real s = 0.0;
+    for (int i = 0; i < n; i ++) {
+      real pv = 0.0;
+      real bv = 0.0;
+      for (int j = 0; j < n; j ++) {
+	pv += P(i, j) * v(j, 0);
+	bv += Bp(i, j) * v(j, 0);
+      }
+      r += (pv - l*bv)*(pv - l*bv);
+      s += pv*pv + l*l*bv*bv;
+    }
+
+    if (s == 0.0) {
+      return 0.0;
+    }
+    return sqrt(r/s);
+  }
+
+  static real overlap(const Spec1DMatrix<real> &a, const Spec1DMatrix<real> &b)
+  {
+    real ab = 0.0;
+    real aa = 0.0;
+    real bb = 0.0;
+    for (int i = 0; i < a.rows(); i ++) {
+      ab += a(i, 0) * b(i, 0);
+      aa += a(i, 0) * a(i, 0);
+      bb += b(i, 0) * b(i, 0);
+    }
+
+    if (aa == 0.0 || bb == 0.0) {
+      return 0.0;
+    }
+    return fabs(ab)/sqrt(aa * bb);
+  }
+
+  //
+  // Unit norm with sign aligned to reference (if given)
+  //
+  static void normalize(Spec1DMatrix<real> &a, const Spec1DMatrix<real> *reference)
+  {
+    real aa = 0.0;
+    real ab = 0.0;
+    for (int i = 0; i < a.rows(); i ++) {
+      aa += a(i, 0) * a(i, 0);
+      if (reference != nullptr && reference->rows() == a.rows()) {
+	ab += a(i, 0) * (*reference)(i, 0);
+      }
+    }
+
+    real s = sqrt(aa);
+    if (ab < 0.0) {
+      s = -s;
+    }
+    if (s != 0.0) {
+      for (int i = 0; i < a.rows(); i ++) {
+	a(i, 0) /= s;
+      }
+    }
+  }
+
+  std::vector<real> lambda;
+  std::vector<real> lambda_prev;
+  std::vector<bool> active;
+  std::vector<Spec1DMatrix<real>> x;
+  std::vector<Spec1DMatrix<real>> y;
+
+  Spec1DMatrix<real> LU;
+  int *IPIV;
+  int IPIV_size;
+};
+
+//
+// Love overtones: (omega^2 A - C) v = k^2 B v
+//
+template
+<
+  typename real,
+  size_t maxorder,
+  size_t maxboundaryorder = maxorder
+>
+class LoveModeSweep : public ModeTracker<real> {
+public:
+
+  typedef LoveMatrices<real, maxorder, maxboundaryorder> solver_t;
+  
+  LoveModeSweep(solver_t &_solver,
+		const Mesh<real, maxorder> &_mesh,
+		size_t _boundaryorder,
+		int nmodes) :
+    ModeTracker<real>(nmodes),
+    solver(_solver),
+    mesh(_mesh),
+    boundaryorder(_boundaryorder)
+  {
+  }
+
+protected:
+
+  virtual void pencil(real omega, Spec1DMatrix<real> &P, Spec1DMatrix<real> &B)
+  {
+    int n = solver.size;
+    real o2 = omega*omega;
+    
+    P.resize(n, n);
+    B.resize(n, n);
+    for (int j = 0; j < n; j ++) {
+      for (int i = 0; i < n; i ++) {
+	P(i, j) = o2*solver.A(i, j) - solver.C(i, j);
+	B(i, j) = solver.B(i, j);
+      }
+    }
+  }
+
+  virtual bool admissible(real omega, real lambda) const
+  {
+    if (lambda <= 0.0) {
+      return false;
+    }
+
+    if (mesh.boundary.rho > 0.0) {
+      //
+      // Trapped modes only: k > omega/vs of the halfspace
+      //
+      real vs2 = mesh.boundary.L/mesh.boundary.rho;
+      return lambda > omega*omega/vs2;
+    }
+
+    return true;
+  }
+
+  virtual real wavenumber(real omega, real lambda) const
+  {
+    return sqrt(lambda);
+  }
+
+  virtual void group(real omega, real lambda, const Spec1DMatrix<real> &x, real &U)
+  {
+    real normA = 0.0;
+    real normB = 0.0;
+    for (int j = 0; j < (int)solver.size; j ++) {
+      normA += x(j, 0) * solver.A(j, j) * x(j, 0);
+      normB += x(j, 0) * solver.B(j, j) * x(j, 0);
+    }
+
+    U = normB*sqrt(lambda)/(omega*normA);
+  }
+
+  virtual bool jacobian(real omega,
+			real lambda,
+			const Spec1DMatrix<real> &x,
+			const Spec1DMatrix<real> &y,
+			Spec1DMatrix<real> &dkdp)
+  {
+    Spec1DMatrix<real> v(x);
+    size_t nbasecells;
+    size_t nparameters = solver.postcomputegradient(mesh, boundaryorder, v, nbasecells);
+
+    real o2 = omega*omega;
+    real k = sqrt(lambda);
+    real normB = 0.0;
+    for (int j = 0; j < (int)solver.size; j ++) {
+      normB += x(j, 0) * solver.B(j, j) * x(j, 0);
+    }
+
+    dkdp.resize(nparameters, 1);
+    for (size_t j = 0; j < nparameters; j ++) {
+      real udAv = 0.0;
+      real udBv = 0.0;
+      real udCv = 0.0;
+      for (int i = 0; i < (int)solver.size; i ++) {
+	udAv += x(i, 0) * solver.dAv(i, j);
+	udBv += x(i, 0) * solver.dBv(i, j);
+	udCv += x(i, 0) * solver.dCv(i, j);
+      }
+
+      dkdp(j, 0) = ((o2*udAv - udCv) - lambda*udBv)/(2.0 * k * normB);
+    }
+
+    return true;
+  }
+
+  virtual void update_scale(real omega, real k)
+  {
+    if (mesh.boundary.rho > 0.0) {
+      real vs2 = mesh.boundary.L/mesh.boundary.rho;
+      real disc1 = k*k - omega*omega/vs2;
+
+      if (isnormal(disc1) && disc1 > 0.0) {
+	solver.recompute(mesh, boundaryorder, sqrt(disc1));
+      }
+    }
+  }
+
+  virtual bool need_left() const
+  {
+    return false;
+  }
+
+  solver_t &solver;
+  const Mesh<real, maxorder> &mesh;
+  size_t boundaryorder;
+};
+
+//
+// Rayleigh overtones from the scaled linearisation of the quadratic problem
+// (k^2 B + k C + D - omega^2 A) v = 0, eigenvalue k/gamma
+//
+template
+<
+  typename real,
+  size_t maxorder,
+  size_t maxboundaryorder = maxorder
+>
+class RayleighModeSweep : public ModeTracker<real> {
+public:
+
+  typedef RayleighMatrices<real, maxorder, maxboundaryorder> solver_t;
+  
+  RayleighModeSweep(solver_t &_solver,
+		    const Mesh<real, maxorder> &_mesh,
+		    size_t _boundaryorder,
+		    int nmodes) :
+    ModeTracker<real>(nmodes),
+    solver(_solver),
+    mesh(_mesh),
+    boundaryorder(_boundaryorder),
+    gamma(1.0),
+    delta(1.0)
+  {
+  }
+
+protected:
+
+  virtual void pencil(real omega, Spec1DMatrix<real> &P, Spec1DMatrix<real> &B)
+  {
+    gamma = solver.computeE_scaled(omega, delta);
+    P = solver.As;
+    B = solver.Bs;
+  }
+
+  virtual bool admissible(real omega, real lambda) const
+  {
+    if (lambda <= 0.0) {
+      return false;
+    }
+
+    if (mesh.boundary.rho > 0.0) {
+      real vs2 = mesh.boundary.L/mesh.boundary.rho;
+      real k = lambda * gamma;
+      return k*k > omega*omega/vs2;
+    }
+
+    return true;
+  }
+
+  virtual real wavenumber(real omega, real lambda) const
+  {
+    return lambda * gamma;
+  }
+
+  virtual void group(real omega, real lambda, const Spec1DMatrix<real> &x, real &U)
+  {
+    size_t size = solver.size;
+    real normA = 0.0;
+    real normB = 0.0;
+    real normC = 0.0;
+    for (size_t j = 0; j < size; j ++) {
+      normA +=
+	x(j, 0) * solver.Ax(j, j) * x(j, 0) +
+	x(size + j, 0) * solver.Az(j, j) * x(size + j, 0);
+      normB +=
+	x(j, 0) * solver.Bx(j, j) * x(j, 0) +
+	x(size + j, 0) * solver.Bz(j, j) * x(size + j, 0);
+
+      real cx = 0.0;
+      real cz = 0.0;
+      for (size_t i = 0; i < size; i ++) {
+	cx += solver.Cx(j, i) * x(size + i, 0);
+	cz += solver.Cz(j, i) * x(i, 0);
+      }
+      normC += x(j, 0) * cx + x(size + j, 0) * cz;
+    }
+
+    real k = lambda * gamma;
+    U = (2.0*normB*k + normC)/(2.0*omega*normA);
+  }
+
+  virtual bool jacobian(real omega,
+			real lambda,
+			const Spec1DMatrix<real> &x,
+			const Spec1DMatrix<real> &y,
+			Spec1DMatrix<real> &dkdp)
+  {
+    //
+    // First order perturbation of the linearised pencil, as in
+    // solve_fundamental_gradient_generic
+    //
+    size_t size = solver.size;
+    Spec1DMatrix<real> v(x);
+    size_t nparameters = solver.postcomputegradient(mesh, boundaryorder, v);
+
+    real norm = 0.0;
+    for (size_t j = 0; j < size; j ++) {
+      norm -= y(j, 0) * (solver.Bx(j, j) * gamma * gamma * delta) * x(j, 0);
+      norm -= y(size + j, 0) * (solver.Bz(j, j) * gamma * gamma * delta) * x(size + j, 0);
+      norm -= y(2*size + j, 0) * x(2*size + j, 0);
+      norm -= y(3*size + j, 0) * x(3*size + j, 0);
+    }
+
+    if (norm == 0.0) {
+      ERROR("Left and right eigenvectors orthogonal");
+      return false;
+    }
+
+    real o2 = omega*omega;
+    dkdp.resize(nparameters, 1);
+    dkdp.setZero();
+    for (size_t j = 0; j < nparameters; j ++) {
+      for (size_t i = 0; i < size; i ++) {
+	dkdp(j, 0) += y(i, 0) * solver.dCxv(i, j) * delta * gamma;
+	dkdp(j, 0) += y(i, 0) * lambda * solver.dBxv(i, j) * gamma * gamma * delta;
+
+	dkdp(j, 0) += y(size + i, 0) * solver.dCzv(i, j) * delta * gamma;
+	dkdp(j, 0) += y(size + i, 0) * lambda * solver.dBzv(i, j) * gamma * gamma * delta;
+
+	dkdp(j, 0) += y(2*size + i, 0) * (solver.dDxv(i, j) - o2*solver.dAxv(i, j)) * delta;
+	dkdp(j, 0) += y(3*size + i, 0) * (solver.dDzv(i, j) - o2*solver.dAzv(i, j)) * delta;
+      }
+
+      dkdp(j, 0) *= gamma/norm;
+    }
+
+    return true;
+  }
+
+  virtual void update_scale(real omega, real k)
+  {
+    if (mesh.boundary.rho > 0.0) {
+      real vs2 = mesh.boundary.L/mesh.boundary.rho;
+      real vp2 = mesh.boundary.A/mesh.boundary.rho;
+
+      real disc1 = k*k - omega*omega/vs2;
+      real disc2 = k*k - omega*omega/vp2;
+
+      if (isnormal(disc1) && disc1 > 0.0 &&
+	  isnormal(disc2) && disc2 > 0.0) {
+	real newscale2 = sqrt(disc2);
+	solver.recompute(mesh, boundaryorder, newscale2, newscale2);
+      }
+    }
+  }
+
+  virtual bool need_left() const
+  {
+    return true;
+  }
+
+  solver_t &solver;
+  const Mesh<real, maxorder> &mesh;
+  size_t boundaryorder;
+  real gamma;
+  real delta;
+};
+
+#endif // modesweep_hpp
@@ -31,6 +31,7 @@
 #include <array>
 
 #include "encodedecode.hpp"
+#include "textreader.hpp"
 
 template
 <
@@ -73,12 +74,52 @@ public:
   virtual real dL(size_t i, real depth) const = 0;
   
   virtual real dN(size_t i, real depth) const = 0;
-  
-  virtual bool read(FILE *fp)
+
+  //
+  // Second derivatives with respect to parameters i and j, only needed for
+  // Hessian-vector products so not all parameterisations provide them
+  //
+  virtual real d2rho(size_t i, size_t j, real depth) const
+  {
+    FATAL("Second derivatives not implemented");
+    return 0.0;
+  }
+
+  virtual real d2A(size_t i, size_t j, real depth) const
+  {
+    FATAL("Second derivatives not implemented");
+    return 0.0;
+  }
+
+  virtual real d2C(size_t i, size_t j, real depth) const
+  {
+    FATAL("Second derivatives not implemented");
+    return 0.0;
+  }
+
+  virtual real d2F(size_t i, size_t j, real depth) const
+  {
+    FATAL("Second derivatives not implemented");
+    return 0.0;
+  }
+
+  virtual real d2L(size_t i, size_t j, real depth) const
+  {
+    FATAL("Second derivatives not implemented");
+    return 0.0;
+  }
+
+  virtual real d2N(size_t i, size_t j, real depth) const
+  {
+    FATAL("Second derivatives not implemented");
+    return 0.0;
+  }
+
+  virtual bool read(TextReader &in)
   {
     for (auto &r : *this) {
       double t;
-      if (fscanf(fp, "%lf", &t) != 1) {
+      if (!in.read_double(t)) {
 	return false;
       }
       r = t;      
@@ -87,7 +128,7 @@ public:
     return true;
   }
 
-  virtual bool read_parameter(int k, FILE *fp)
+  virtual bool read_parameter(int k, TextReader &in)
   {
     if (k < 0 || k >= (int)set_size) {
       return false;;
@@ -95,7 +136,7 @@ public:
 
     double t;
 
-    if (fscanf(fp, "%lf", &t) != 1) {
+    if (!in.read_double(t)) {
       return false;
     }
 
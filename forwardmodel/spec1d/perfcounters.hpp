@@ -0,0 +1,328 @@
+//
+//    Spec1D : A spectral element code for surface wave dispersion of Love
+//    and Rayleigh waves. See
+//
+//      R Hawkins, "A spectral element method for surface wave dispersion and adjoints",
+//      Geophysical Journal International, 2018, 215:1, 267 - 302
+//      https://doi.org/10.1093/gji/ggy277
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef perfcounters_hpp
+#define perfcounters_hpp
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//
+// Optional hardware counter instrumentation of named regions. Disabled
+// regions cost a single test. When enabled each thread opens one counter
+// group with perf_event_open on first use; where counters are unavailable
+// (no permission, virtualised PMU, non Linux) only calls and thread cpu
+// time are recorded.
+//
+class PerfCounters {
+public:
+
+  enum {
+    CYCLES = 0,
+    INSTRUCTIONS,
+    L1D_MISSES,
+    LLC_MISSES,
+    BRANCH_MISSES,
+    NCOUNTERS
+  };
+
+  struct Totals {
+    Totals() :
+      calls(0),
+      seconds(0.0)
+    {
+      memset(counts, 0, sizeof(counts));
+    }
+
+    unsigned long long calls;
+    double seconds;
+    unsigned long long counts[NCOUNTERS];
+  };
+
+  struct ThreadRecord {
+    int id;
+    int fds[NCOUNTERS];
+    int order[NCOUNTERS];
+    int nopen;
+    std::map<std::string, Totals> regions;
+  };
+
+  static void enable()
+  {
+    flag() = true;
+  }
+
+  static bool enabled()
+  {
+    return flag();
+  }
+
+  static const char *name(int counter)
+  {
+    static const char *names[NCOUNTERS] = {
+      "cycles",
+      "instructions",
+      "l1d_misses",
+      "llc_misses",
+      "branch_misses"
+    };
+    
+    return names[counter];
+  }
+
+  //
+  // Record for the calling thread, opening its counters on first use
+  //
+  static ThreadRecord *thread_record()
+  {
+    static thread_local ThreadRecord *record = nullptr;
+
+    if (record == nullptr) {
+      record = new ThreadRecord;
+      record->nopen = 0;
+      for (int i = 0; i < NCOUNTERS; i ++) {
+	record->fds[i] = -1;
+	record->order[i] = -1;
+      }
+
+      open(record);
+      
+      std::lock_guard<std::mutex> lock(registry_mutex());
+      record->id = registry().size();
+      registry().push_back(record);
+    }
+
+    return record;
+  }
+
+  //
+  // Current values indexed by counter, unavailable counters are zero
+  //
+  static void read(const ThreadRecord *record, uint64_t *values)
+  {
+    memset(values, 0, sizeof(uint64_t) * NCOUNTERS);
+    
+#ifdef __linux__
+    if (record->nopen > 0) {
+      uint64_t buffer[NCOUNTERS + 1];
+      ssize_t size = sizeof(uint64_t) * (record->nopen + 1);
+      
+      if (::read(record->fds[CYCLES], buffer, size) == size) {
+	for (int i = 0; i < record->nopen && i < (int)buffer[0]; i ++) {
+	  values[record->order[i]] = buffer[i + 1];
+	}
+      }
+    }
+#endif
+  }
+
+  static void accumulate(ThreadRecord *record,
+			 const char *region,
+			 double seconds,
+			 const uint64_t *start,
+			 const uint64_t *stop)
+  {
+    Totals &t = record->regions[region];
+
+    t.calls ++;
+    t.seconds += seconds;
+    for (int i = 0; i < NCOUNTERS; i ++) {
+      t.counts[i] += stop[i] - start[i];
+    }
+  }
+
+  //
+  // Per region and thread totals, "-" for counters that could not be opened
+  //
+  static bool report(const char *filename)
+  {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "error: failed to create %s\n", filename);
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    
+    fprintf(fp, "# region thread calls seconds");
+    for (int i = 0; i < NCOUNTERS; i ++) {
+      fprintf(fp, " %s", name(i));
+    }
+    fprintf(fp, " ipc\n");
+    
+    for (auto record : registry()) {
+      for (auto &r : record->regions) {
+	const Totals &t = r.second;
+	
+	fprintf(fp, "%s %d %llu %.6f", r.first.c_str(), record->id, t.calls, t.seconds);
+	for (int i = 0; i < NCOUNTERS; i ++) {
+	  if (record->fds[i] >= 0) {
+	    fprintf(fp, " %llu", t.counts[i]);
+	  } else {
+	    fprintf(fp, " -");
+	  }
+	}
+	
+	if (record->fds[CYCLES] >= 0 && record->fds[INSTRUCTIONS] >= 0 && t.counts[CYCLES] > 0) {
+	  fprintf(fp, " %.3f\n", (double)t.counts[INSTRUCTIONS]/(double)t.counts[CYCLES]);
+	} else {
+	  fprintf(fp, " -\n");
+	}
+      }
+    }
+
+    fclose(fp);
+    return true;
+  }
+  
+private:
+
+  static bool &flag()
+  {
+    static bool enabled = false;
+    return enabled;
+  }
+
+  static std::vector<ThreadRecord*> &registry()
+  {
+    static std::vector<ThreadRecord*> records;
+    return records;
+  }
+
+  static std::mutex &registry_mutex()
+  {
+    static std::mutex m;
+    return m;
+  }
+
+  static void open(ThreadRecord *record)
+  {
+#ifdef __linux__
+    static const uint32_t types[NCOUNTERS] = {
+      PERF_TYPE_HARDWARE,
+      PERF_TYPE_HARDWARE,
+      PERF_TYPE_HW_CACHE,
+      PERF_TYPE_HARDWARE,
+      PERF_TYPE_HARDWARE
+    };
+    static const uint64_t configs[NCOUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_L1D |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for (int i = 0; i < NCOUNTERS; i ++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[i];
+      attr.config = configs[i];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.disabled = (i == CYCLES) ? 1 : 0;
+
+      int leader = record->fds[CYCLES];
+      if (i > CYCLES && leader < 0) {
+	break;
+      }
+      
+      int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+      if (fd >= 0) {
+	record->fds[i] = fd;
+	record->order[record->nopen] = i;
+	record->nopen ++;
+      }
+    }
+
+    if (record->fds[CYCLES] >= 0) {
+      ioctl(record->fds[CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(record->fds[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+};
+
+//
+// Scoped region, e.g. PerfRegion region("recompute");
+//
+class PerfRegion {
+public:
+
+  PerfRegion(const char *_name) :
+    name(_name),
+    record(nullptr)
+  {
+    if (PerfCounters::enabled()) {
+      record = PerfCounters::thread_record();
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start_time);
+      PerfCounters::read(record, start);
+    }
+  }
+
+  ~PerfRegion()
+  {
+    if (record != nullptr) {
+      uint64_t stop[PerfCounters::NCOUNTERS];
+      timespec stop_time;
+      
+      PerfCounters::read(record, stop);
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &stop_time);
+
+      double seconds = (double)(stop_time.tv_sec - start_time.tv_sec) +
+	(double)(stop_time.tv_nsec - start_time.tv_nsec)/1.0e9;
+      
+      PerfCounters::accumulate(record, name, seconds, start, stop);
+    }
+  }
+
+private:
+
+  const char *name;
+  PerfCounters::ThreadRecord *record;
+  timespec start_time;
+  uint64_t start[PerfCounters::NCOUNTERS];
+};
+
+#endif // perfcounters_hpp
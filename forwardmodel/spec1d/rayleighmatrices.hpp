@@ -38,6 +38,26 @@
 #include "generalsolve.hpp"
 #include "specializedeigenproblem.hpp"
 
+//
+// Fundamental mode at one frequency kept for the curvature part of the
+// Hessian of k, see RayleighMatrices::solve_fundamental_hessian_prepare
+//
+template
+<
+  typename real
+>
+struct RayleighHessianState {
+  real laguerrescalex;
+  real laguerrescalez;
+  real omega;
+  real gamma;
+  real delta;
+  real mu;
+  real normB;
+  Spec1DMatrix<real> u;
+  Spec1DMatrix<real> v;
+};
+
 template
 <
   typename real,
@@ -75,6 +95,8 @@ public:
 
   void recompute(const Mesh<real, maxorder> &mesh, size_t boundaryorder, real scalex = 1.0, real scalez = 1.0)
   {
+    PerfRegion region("RayleighMatrices::recompute");
+    
     if (boundaryorder > maxboundaryorder) {
       FATAL("Boundary order out of range: %d > %d", (int)boundaryorder, (int)maxboundaryorder);
     }
@@ -140,6 +162,8 @@ public:
 			     size_t boundaryorder,
 			     Spec1DMatrix<real> &v)
   {
+    PerfRegion region("RayleighMatrices::postcomputegradient");
+    
     size_t nparameters = 0;
     for (auto &c: mesh.cells) {
       nparameters += c.jacobian.rows();
@@ -2440,6 +2464,332 @@ public:
     return k;
   }
 
+  //
+  // Wave number with its gradient dkdp and the product of its Hessian with
+  // direction, d2kdp = d^2k/dp^2 direction. mesh has the jacobians of
+  // project_gradient and curvature those of project_hessian in the same
+  // direction. This is solve_fundamental_hessian_prepare followed by
+  // solve_fundamental_hessian_curvature.
+  //
+  real solve_fundamental_hessian_generic(const Mesh<real, maxorder> &mesh,
+					 const Mesh<real, maxorder> &curvature,
+					 size_t boundaryorder,
+					 real omega,
+					 const Spec1DMatrix<real> &direction,
+					 Spec1DMatrix<real> &dkdp,
+					 Spec1DMatrix<real> &d2kdp)
+  {
+    RayleighHessianState<real> state;
+    real k = solve_fundamental_hessian_prepare(mesh, boundaryorder, omega, dkdp, hessianK, state);
+    if (k == 0.0) {
+      return k;
+    }
+
+    size_t nparameters = hessianK.rows();
+    if ((size_t)direction.rows() != nparameters) {
+      FATAL("Direction size mismatch: %d != %d", (int)direction.rows(), (int)nparameters);
+    }
+
+    solve_fundamental_hessian_curvature(curvature, boundaryorder, state, d2kdp);
+
+    for (size_t j = 0; j < nparameters; j ++) {
+      real s = 0.0;
+      for (size_t l = 0; l < nparameters; l ++) {
+	s += hessianK(j, l) * direction(l, 0);
+      }
+      d2kdp(j, 0) += s;
+    }
+
+    return k;
+  }
+
+  //
+  // Wave number with its gradient dkdp and the part of its Hessian that
+  // does not depend on the projection curvature, K, so that
+  //
+  //   d^2k/dp^2 direction = K direction + solve_fundamental_hessian_curvature
+  //
+  // For the scaled problem As v = mu Bs v with left vector u, R = As - mu Bs
+  // and R_j its derivative with respect to parameter j (mu fixed),
+  //
+  //   mu_j = u^T R_j v/u^T Bs v
+  //
+  // is differentiated where the derivatives of v and u solve
+  // R dv = -(dR - dmu Bs) v and R^T du = -(dR - dmu Bs)^T u, for all
+  // parameters together. k is gamma mu with gamma fixed. state keeps the
+  // mode for the curvature term.
+  //
+  real solve_fundamental_hessian_prepare(const Mesh<real, maxorder> &mesh,
+					 size_t boundaryorder,
+					 real omega,
+					 Spec1DMatrix<real> &dkdp,
+					 Spec1DMatrix<real> &K,
+					 RayleighHessianState<real> &state)
+  {
+    if (size == 0) {
+      FATAL("Unconfigured");
+    }
+
+    real delta;
+    real gamma = computeE_scaled(omega, delta);
+    real o2 = omega*omega;
+    
+    if (!SpecializedEigenProblem(As, Bs, work, eu, ev, lambda, Q, Z)) {
+      ERROR("Failed to compute generalized eigen problem");
+      return 0.0;
+    }
+
+    real mu = 0.0;
+    v.resize(4*size, 1);
+    u.resize(4*size, 1);
+    
+    for (size_t i = 0; i < 4*size; i ++) {
+      if (lambda(i, 1) == 0.0) {
+
+	real k = lambda(i, 0)/lambda(i, 2);
+
+	if (k > 0.0 && k > mu) {
+	  mu = k;
+
+	  for (size_t j = 0; j < 4*size; j ++) {
+	    u(j, 0) = eu(j, i);
+	    v(j, 0) = ev(j, i);
+	  }
+	}
+      }
+    }
+
+    if (mu <= 0.0) {
+      return 0.0;
+    }
+    
+    double unorm = 0.0;
+    double vnorm = 0.0;
+    for (size_t i = 0; i < 4*size; i ++) {
+      unorm += u(i, 0) * u(i, 0);
+      vnorm += v(i, 0) * v(i, 0);
+    }
+    unorm = sqrt(unorm);
+    vnorm = sqrt(vnorm);
+    for (size_t i = 0; i < 4*size; i ++) {
+      u(i, 0) /= unorm;
+      v(i, 0) /= vnorm;
+    }
+
+    //
+    // Diagonal of Bs (As and Bs now hold the Schur form)
+    //
+    hessianBs.resize(4*size, 1);
+    for (size_t i = 0; i < size; i ++) {
+      hessianBs(i, 0) = -gamma*gamma*delta*Bx(i, i);
+      hessianBs(size + i, 0) = -gamma*gamma*delta*Bz(i, i);
+      hessianBs(2*size + i, 0) = -1.0;
+      hessianBs(3*size + i, 0) = -1.0;
+    }
+
+    real normB = 0.0;
+    for (size_t i = 0; i < 4*size; i ++) {
+      normB += u(i, 0) * hessianBs(i, 0) * v(i, 0);
+    }
+    
+    size_t nparameters = postcomputegradient(mesh, boundaryorder, v);
+
+    //
+    // R_j v, u^T R_j v and u^T Bs_j v
+    //
+    hessianRv.resize(4*size, nparameters);
+    hessianN.resize(nparameters, 1);
+    hessianBv.resize(nparameters, 1);
+
+    for (size_t j = 0; j < nparameters; j ++) {
+      real b = 0.0;
+      for (size_t i = 0; i < size; i ++) {
+	b -= gamma*gamma*delta*(u(i, 0)*dBxv(i, j) + u(size + i, 0)*dBzv(i, j));
+      }
+      
+      real n = 0.0;
+      for (size_t i = 0; i < 4*size; i ++) {
+	real r = hessian_Rw(i, j, gamma, delta, o2, mu);
+	hessianRv(i, j) = r;
+	n += u(i, 0) * r;
+      }
+
+      hessianN(j, 0) = n;
+      hessianBv(j, 0) = b;
+    }
+
+    //
+    // R_j^T u: Dx, Dz, Ax, Az and Bx, Bz are symmetric and Cz = Cx^T, so
+    // rows 0 .. 2n - 1 are R_j applied to (u_0, u_1) plus the A0 blocks
+    // applied to (u_2, u_3), the remaining rows are zero.
+    //
+    hessiana.resize(4*size, 1);
+    hessiana.setZero();
+    for (size_t i = 0; i < 2*size; i ++) {
+      hessiana(i, 0) = u(i, 0);
+    }
+    postcomputegradient(mesh, boundaryorder, hessiana);
+
+    hessianRTu.resize(4*size, nparameters);
+    hessianRTu.setZero();
+    for (size_t j = 0; j < nparameters; j ++) {
+      for (size_t i = 0; i < 2*size; i ++) {
+	hessianRTu(i, j) = hessian_Rw(i, j, gamma, delta, o2, mu);
+      }
+    }
+
+    for (size_t i = 0; i < 2*size; i ++) {
+      hessiana(i, 0) = u(2*size + i, 0);
+    }
+    postcomputegradient(mesh, boundaryorder, hessiana);
+
+    for (size_t j = 0; j < nparameters; j ++) {
+      for (size_t i = 0; i < 2*size; i ++) {
+	hessianRTu(i, j) += hessian_Rw(2*size + i, j, gamma, delta, o2, mu);
+      }
+    }
+
+    //
+    // Solve R X_j = -(R_j - mu_j Bs) v and R^T Y_j = -(R_j - mu_j Bs)^T u
+    // and remove the arbitrary multiples of v and u
+    //
+    hessianf.resize(4*size, nparameters);
+    hessianh.resize(4*size, nparameters);
+    for (size_t j = 0; j < nparameters; j ++) {
+      real muj = hessianN(j, 0)/normB;
+      for (size_t i = 0; i < 4*size; i ++) {
+	hessianf(i, j) = -(hessianRv(i, j) - muj * hessianBs(i, 0) * v(i, 0));
+	hessianh(i, j) = -(hessianRTu(i, j) - muj * hessianBs(i, 0) * u(i, 0));
+      }
+    }
+
+    if (!SpecializedEigenProblemSolve<real>(As, Bs, Q, Z, mu, hessianf, hessianx, work)) {
+      ERROR("Failed to solve for eigenvector derivative");
+      return 0.0;
+    }
+
+    hessiany.resize(4*size, nparameters);
+    if (!SpecializedEigenProblemAdjoint<real>(As, Bs, Q, Z, mu, hessianh, hessiany, work)) {
+      ERROR("Failed to solve for left eigenvector derivative");
+      return 0.0;
+    }
+
+    //
+    // dnormB_j = u^T Bs_j v + Y_j^T Bs v + u^T Bs X_j
+    //
+    hessiandnormB.resize(nparameters, 1);
+    for (size_t j = 0; j < nparameters; j ++) {
+      real xv = 0.0;
+      real yu = 0.0;
+      for (size_t i = 0; i < 4*size; i ++) {
+	xv += hessianx(i, j) * v(i, 0);
+	yu += hessiany(i, j) * u(i, 0);
+      }
+
+      real b = hessianBv(j, 0);
+      for (size_t i = 0; i < 4*size; i ++) {
+	hessianx(i, j) -= xv * v(i, 0);
+	hessiany(i, j) -= yu * u(i, 0);
+	b += (hessiany(i, j) * v(i, 0) + u(i, 0) * hessianx(i, j)) * hessianBs(i, 0);
+      }
+      hessiandnormB(j, 0) = b;
+    }
+
+    //
+    // K_jl = gamma (Y_l^T R_j v + X_l^T R_j^T u - mu_l u^T Bs_j v
+    //               - mu_j dnormB_l)/normB
+    //
+    dkdp.resize(nparameters, 1);
+    K.resize(nparameters, nparameters);
+    hessianN2.resize(nparameters, nparameters);
+    SpecializedMultiplyTranspose(nparameters, nparameters, 4*size,
+				 hessianRv.data(), 4*size,
+				 hessiany.data(), 4*size,
+				 K.data(), nparameters);
+    SpecializedMultiplyTranspose(nparameters, nparameters, 2*size,
+				 hessianRTu.data(), 4*size,
+				 hessianx.data(), 4*size,
+				 hessianN2.data(), nparameters);
+    
+    for (size_t l = 0; l < nparameters; l ++) {
+      real mul = hessianN(l, 0)/normB;
+      
+      for (size_t j = 0; j < nparameters; j ++) {
+	real muj = hessianN(j, 0)/normB;
+	real n = K(j, l) + hessianN2(j, l);
+	K(j, l) = gamma*(n - mul*hessianBv(j, 0) - muj*hessiandnormB(l, 0))/normB;
+      }
+      
+      dkdp(l, 0) = gamma*mul;
+    }
+
+    state.laguerrescalex = laguerrescalex;
+    state.laguerrescalez = laguerrescalez;
+    state.omega = omega;
+    state.gamma = gamma;
+    state.delta = delta;
+    state.mu = mu;
+    state.normB = normB;
+    state.u = u;
+    state.v = v;
+    
+    return gamma*mu;
+  }
+
+  //
+  // The remaining part of d2kdp for the mode in state (from
+  // solve_fundamental_hessian_prepare on the same mesh order),
+  //
+  //   gamma u^T R2 v/u^T Bs v
+  //
+  // where R2 is the second derivative of R from the curvature jacobians. No
+  // eigen problem is solved: size and the Laguerre scales are restored from
+  // state for the gradient arrays and the matrices are left as they are.
+  //
+  void solve_fundamental_hessian_curvature(const Mesh<real, maxorder> &curvature,
+					   size_t boundaryorder,
+					   RayleighHessianState<real> &state,
+					   Spec1DMatrix<real> &d2kdp)
+  {
+    size = state.v.rows()/4;
+    laguerrescalex = state.laguerrescalex;
+    laguerrescalez = state.laguerrescalez;
+    
+    size_t nparameters = postcomputegradient(curvature, boundaryorder, state.v);
+
+    real o2 = state.omega*state.omega;
+    real c = state.gamma/state.normB;
+    
+    d2kdp.resize(nparameters, 1);
+    for (size_t j = 0; j < nparameters; j ++) {
+      real uR2v = 0.0;
+      for (size_t i = 0; i < 4*size; i ++) {
+	uR2v += state.u(i, 0) * hessian_Rw(i, j, state.gamma, state.delta, o2, state.mu);
+      }
+      d2kdp(j, 0) = c*uR2v;
+    }
+  }
+
+  //
+  // Row i of R_j w for the scaled problem, R = As - mu Bs, from the
+  // gradient arrays of postcomputegradient(w)
+  //
+  real hessian_Rw(size_t i, size_t j, real gamma, real delta, real o2, real mu) const
+  {
+    if (i < size) {
+      return gamma*delta*dCxv(i, j) + mu*gamma*gamma*delta*dBxv(i, j);
+    } else if (i < 2*size) {
+      i -= size;
+      return gamma*delta*dCzv(i, j) + mu*gamma*gamma*delta*dBzv(i, j);
+    } else if (i < 3*size) {
+      i -= 2*size;
+      return delta*(dDxv(i, j) - o2*dAxv(i, j));
+    } else {
+      i -= 3*size;
+      return delta*(dDzv(i, j) - o2*dAzv(i, j));
+    }
+  }
+
   real solve_fundamental_scaled_vector(real omega,
 				       const Mesh<real, maxorder> &mesh,
 				       size_t boundaryorder,
@@ -4765,9 +5115,12 @@ public:
 	u = 0.0;
 	w = 0.0;
 
+	real l[maxorder + 1];
+	Lobatto[c.order]->cardinals(xi, l);
+	
 	for (size_t i = 0; i <= c.order; i ++) {
 
-	  real s = Lobatto[c.order]->cardinal[i].value(xi);
+	  real s = l[i];
 
 	  u += s*c.nodes[i].U;
 	  w += s*c.nodes[i].W;
@@ -4801,10 +5154,15 @@ public:
 
       u = 0.0;
       w = 0.0;
+
+      real lu[maxboundaryorder + 1];
+      real lw[maxboundaryorder + 1];
+      Laguerre[amplitude.boundary.order]->cardinals(xiu, lu);
+      Laguerre[amplitude.boundary.order]->cardinals(xiw, lw);
       
       for (size_t i = 0; i <= amplitude.boundary.order; i ++) {
-	u += Laguerre[amplitude.boundary.order]->cardinal[i].value(xiu)*amplitude.boundary.nodes[i].U;
-	w += Laguerre[amplitude.boundary.order]->cardinal[i].value(xiw)*amplitude.boundary.nodes[i].W;
+	u += lu[i]*amplitude.boundary.nodes[i].U;
+	w += lw[i]*amplitude.boundary.nodes[i].W;
       }
       
     }
@@ -4833,10 +5191,14 @@ public:
 	r2 = 0.0;
 	r4 = 0.0;
 
+	real l[maxorder + 1];
+	real dl[maxorder + 1];
+	Lobatto[c.order]->cardinals(xi, l, dl);
+
 	for (size_t i = 0; i <= c.order; i ++) {
 
-	  real s = Lobatto[c.order]->cardinal[i].value(xi);
-	  real ds = Lobatto[c.order]->cardinal[i].dydx(xi) * 2.0/c.thickness;
+	  real s = l[i];
+	  real ds = dl[i] * 2.0/c.thickness;
 
 	  r2 += p.L*(ds*c.nodes[i].U - k*s*c.nodes[i].W);
 	  r4 += p.F*k*s*c.nodes[i].U + p.C*ds*c.nodes[i].W;
@@ -4870,16 +5232,23 @@ public:
 
       r2 = 0.0;
       r4 = 0.0;
+
+      real lu[maxboundaryorder + 1];
+      real dlu[maxboundaryorder + 1];
+      real lw[maxboundaryorder + 1];
+      real dlw[maxboundaryorder + 1];
+      Laguerre[amplitude.boundary.order]->cardinals(xiu, lu, dlu);
+      Laguerre[amplitude.boundary.order]->cardinals(xiw, lw, dlw);
       
       for (size_t i = 0; i <= amplitude.boundary.order; i ++) {
 
-	real s = Laguerre[amplitude.boundary.order]->cardinal[i].value(xiu);
-	real ds = Laguerre[amplitude.boundary.order]->cardinal[i].dydx(xiu) * laguerrescalex;
+	real s = lu[i];
+	real ds = dlu[i] * laguerrescalex;
 	  
 	r2 += p.L*(ds*amplitude.boundary.nodes[i].U - k*s*amplitude.boundary.nodes[i].W);
 	
-	s = Laguerre[amplitude.boundary.order]->cardinal[i].value(xiw);
-	ds = Laguerre[amplitude.boundary.order]->cardinal[i].dydx(xiw) * laguerrescalez;
+	s = lw[i];
+	ds = dlw[i] * laguerrescalez;
 	  
 	r4 += p.F*k*s*amplitude.boundary.nodes[i].U + p.C*ds*amplitude.boundary.nodes[i].W;
       }
@@ -5213,6 +5582,20 @@ public:
   Spec1DMatrix<real> adjointlambda;
   Spec1DMatrix<real> adjointw;
 
+  Spec1DMatrix<real> hessianBs;
+  Spec1DMatrix<real> hessianRv;
+  Spec1DMatrix<real> hessianN;
+  Spec1DMatrix<real> hessianBv;
+  Spec1DMatrix<real> hessianf;
+  Spec1DMatrix<real> hessianx;
+  Spec1DMatrix<real> hessiana;
+  Spec1DMatrix<real> hessianh;
+  Spec1DMatrix<real> hessiany;
+  Spec1DMatrix<real> hessianRTu;
+  Spec1DMatrix<real> hessianN2;
+  Spec1DMatrix<real> hessiandnormB;
+  Spec1DMatrix<real> hessianK;
+
   Spec1DMatrix<real> tAs;
   Spec1DMatrix<real> tBs;
   
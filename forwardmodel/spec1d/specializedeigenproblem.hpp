@@ -31,61 +31,8 @@
 #include <math.h>
 
 #include "spec1dmatrix.hpp"
-
-extern "C" {
-  void dgghrd_(char *compq,
-	       char *compz,
-	       int *n,
-	       int *ilo,
-	       int *ihi,
-	       double *a,
-	       int *lda,
-	       double *b,
-	       int *ldb,
-	       double *q,
-	       int *ldq,
-	       double *z,
-	       int *ldz,
-	       int *info);
-
-  void dhgeqz_(char *job,
-	       char *compq,
-	       char *compz,
-	       int *n,
-	       int *ilo,
-	       int *ihi,
-	       double *h,
-	       int *ldh,
-	       double *t,
-	       int *ldt,
-	       double *alphar,
-	       double *alphai,
-	       double *beta,
-	       double *q,
-	       int *ldq,
-	       double *z,
-	       int *ldz,
-	       double *work,
-	       int *lwork,
-	       int *info);
-
-  void dtgevc_(char *side,
-	       char *howmny,
-	       int *select,
-	       int *n,
-	       double *s,
-	       int *lds,
-	       double *p,
-	       int *ldp,
-	       double *vl,
-	       int *ldvl,
-	       double *vr,
-	       int *ldvr,
-	       int *mm,
-	       int *m,
-	       double *work,
-	       int *info);
-}
+#include "perfcounters.hpp"
+#include "lapackbackend.hpp"
 
 template
 <
@@ -115,6 +62,8 @@ bool SpecializedEigenProblem<double>(Spec1DMatrix<double> &A,
 				     Spec1DMatrix<double> &Q,
 				     Spec1DMatrix<double> &Z)
 {
+  PerfRegion region("SpecializedEigenProblem");
+  
   int N = A.rows();
   int lwork = 6*N; // DTGEVC requires workspace 6*N which is largest
 
@@ -141,20 +90,20 @@ bool SpecializedEigenProblem<double>(Spec1DMatrix<double> &A,
   char compI[] = "I";
   int info;
   
-  dgghrd_(compI,
-	  compI,
-	  &N,
-	  &ilo,
-	  &ihi,
-	  A.data(),
-	  &lda,
-	  B.data(),
-	  &ldb,
-	  VL.data(),
-	  &ldq,
-	  VR.data(),
-	  &ldz,
-	  &info);
+  LapackBackend::get().dgghrd(compI,
+			      compI,
+			      &N,
+			      &ilo,
+			      &ihi,
+			      A.data(),
+			      &lda,
+			      B.data(),
+			      &ldb,
+			      VL.data(),
+			      &ldq,
+			      VR.data(),
+			      &ldz,
+			      &info);
 
   if (info != 0) {
     ERROR("Failed to reduce to general Hessenberg form");
@@ -167,26 +116,26 @@ bool SpecializedEigenProblem<double>(Spec1DMatrix<double> &A,
   char schur[] = "S";
   char compV[] = "V";
   
-  dhgeqz_(schur,
-	  compV,
-	  compV,
-	  &N,
-	  &ilo,
-	  &ihi,
-	  A.data(),
-	  &lda,
-	  B.data(),
-	  &ldb,
-	  lambda.col(0),
-	  lambda.col(1),
-	  lambda.col(2),
-	  VL.data(),
-	  &ldq,
-	  VR.data(),
-	  &ldz,
-	  work.data(),
-	  &lwork,
-	  &info);
+  LapackBackend::get().dhgeqz(schur,
+			      compV,
+			      compV,
+			      &N,
+			      &ilo,
+			      &ihi,
+			      A.data(),
+			      &lda,
+			      B.data(),
+			      &ldb,
+			      lambda.col(0),
+			      lambda.col(1),
+			      lambda.col(2),
+			      VL.data(),
+			      &ldq,
+			      VR.data(),
+			      &ldz,
+			      work.data(),
+			      &lwork,
+			      &info);
  
   //
   // Copy VL, VR to Q, Z (assignment operator resizes)
@@ -202,22 +151,22 @@ bool SpecializedEigenProblem<double>(Spec1DMatrix<double> &A,
   int mm = N;
   int m;
   
-  dtgevc_(both,
-	  allback,
-	  nullptr,
-	  &N,
-	  A.data(),
-	  &lda,
-	  B.data(),
-	  &ldb,
-	  VL.data(),
-	  &ldq,
-	  VR.data(),
-	  &ldz,
-	  &mm,
-	  &m,
-	  work.data(),
-	  &info);
+  LapackBackend::get().dtgevc(both,
+			      allback,
+			      nullptr,
+			      &N,
+			      A.data(),
+			      &lda,
+			      B.data(),
+			      &ldb,
+			      VL.data(),
+			      &ldq,
+			      VR.data(),
+			      &ldz,
+			      &mm,
+			      &m,
+			      work.data(),
+			      &info);
 
   if (info != 0) {
     ERROR("Failed to compute eigen vectors\n");
@@ -387,6 +336,27 @@ bool SpecializedEigenProblemAdjoint(Spec1DMatrix<real> &S,
   return false;
 }
 
+//
+// Solve (A - alpha B) X = B for the generalized Schur form of A, B (the
+// transpose of SpecializedEigenProblemAdjoint)
+//
+template
+<
+  typename real
+>
+bool SpecializedEigenProblemSolve(Spec1DMatrix<real> &S,
+				  Spec1DMatrix<real> &P,
+				  Spec1DMatrix<real> &Q,
+				  Spec1DMatrix<real> &Z,
+				  real alpha,
+				  Spec1DMatrix<real> &B,
+				  Spec1DMatrix<real> &X,
+				  Spec1DMatrix<real> &work)
+{
+  ERROR("Unimplemented");
+  return false;
+}
+
 void sepdump(const char *filename, Spec1DMatrix<double> &m)
 {
   FILE *fp = fopen(filename, "w");
@@ -403,6 +373,108 @@ void sepdump(const char *filename, Spec1DMatrix<double> &m)
 }
 	     
 	  
+//
+// Column major products for the adjoint and verification, tiled so that a
+// block of A is reused from cache for every column of C it contributes to.
+// With an optimised LAPACK backend its dgemm is used instead.
+//
+static const int SPECIALIZED_TILE = 64;
+
+//
+// C (m x n) = A (m x k) B (k x n), or A B^T for B (n x k) when transb
+//
+void
+SpecializedMultiply(bool transb,
+		    int m,
+		    int n,
+		    int k,
+		    const double *A,
+		    int lda,
+		    const double *B,
+		    int ldb,
+		    double *C,
+		    int ldc)
+{
+  LapackBackend &lapack = LapackBackend::get();
+  if (lapack.optimised()) {
+    double one = 1.0;
+    double zero = 0.0;
+    lapack.dgemm("N", transb ? "T" : "N", &m, &n, &k, &one, A, &lda, B, &ldb, &zero, C, &ldc);
+    return;
+  }
+  
+  for (int j = 0; j < n; j ++) {
+    for (int i = 0; i < m; i ++) {
+      C[j * ldc + i] = 0.0;
+    }
+  }
+  
+  for (int j0 = 0; j0 < n; j0 += SPECIALIZED_TILE) {
+    int j1 = j0 + SPECIALIZED_TILE < n ? j0 + SPECIALIZED_TILE : n;
+    
+    for (int l0 = 0; l0 < k; l0 += SPECIALIZED_TILE) {
+      int l1 = l0 + SPECIALIZED_TILE < k ? l0 + SPECIALIZED_TILE : k;
+      
+      for (int i0 = 0; i0 < m; i0 += SPECIALIZED_TILE) {
+	int i1 = i0 + SPECIALIZED_TILE < m ? i0 + SPECIALIZED_TILE : m;
+
+	for (int j = j0; j < j1; j ++) {
+	  double *c = C + j * ldc;
+	  
+	  for (int l = l0; l < l1; l ++) {
+	    const double *a = A + l * lda;
+	    double b = transb ? B[l * ldb + j] : B[j * ldb + l];
+	    
+	    for (int i = i0; i < i1; i ++) {
+	      c[i] += a[i] * b;
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
+
+//
+// C (m x n) = A^T B for A (k x m) and B (k x n) as dot products of columns
+//
+void
+SpecializedMultiplyTranspose(int m,
+			     int n,
+			     int k,
+			     const double *A,
+			     int lda,
+			     const double *B,
+			     int ldb,
+			     double *C,
+			     int ldc)
+{
+  LapackBackend &lapack = LapackBackend::get();
+  if (lapack.optimised()) {
+    double one = 1.0;
+    double zero = 0.0;
+    lapack.dgemm("T", "N", &m, &n, &k, &one, A, &lda, B, &ldb, &zero, C, &ldc);
+    return;
+  }
+  
+  for (int i0 = 0; i0 < m; i0 += SPECIALIZED_TILE) {
+    int i1 = i0 + SPECIALIZED_TILE < m ? i0 + SPECIALIZED_TILE : m;
+
+    for (int j = 0; j < n; j ++) {
+      const double *b = B + j * ldb;
+      
+      for (int i = i0; i < i1; i ++) {
+	const double *a = A + i * lda;
+	double s = 0.0;
+	for (int l = 0; l < k; l ++) {
+	  s += a[l] * b[l];
+	}
+	C[j * ldc + i] = s;
+      }
+    }
+  }
+}
+
 template
 <>
 bool SpecializedEigenProblemAdjoint<double>(Spec1DMatrix<double> &S,
@@ -414,8 +486,9 @@ bool SpecializedEigenProblemAdjoint<double>(Spec1DMatrix<double> &S,
 					    Spec1DMatrix<double> &lambda,
 					    Spec1DMatrix<double> &work)
 {
+  PerfRegion region("SpecializedEigenProblemAdjoint");
+  
   int N = S.rows();
-  work.resize(2*N, 1);
 
   if (B.rows() != N || lambda.rows() != N) {
     FATAL("B/Lambda no. rows incorrect");
@@ -426,83 +499,202 @@ bool SpecializedEigenProblemAdjoint<double>(Spec1DMatrix<double> &S,
     FATAL("B/Lambda columns mismatch\n");
     return false;
   }
-  
 
-  for (int k = 0; k < B.cols(); k ++) {
+  //
+  // All right hand sides are solved together so that each of Z, S, P and Q
+  // is streamed once. Columns of work: [0, M) Z^T B, [M, 2M) Q^T lambda and
+  // 2M, 2M + 1 the current columns of S^T - alpha P^T.
+  //
+  int M = B.cols();
+  work.resize(N, 2*M + 2);
+
+  double *ZtB = work.col(0);
+  double *QtL = work.col(M);
+  double *t = work.col(2*M);
+  double *t1 = work.col(2*M + 1);
   
-    //
-    // Multiply B by Z^T and store in work[0 .. N - 1]
-    //
-    for (int i = 0; i < N; i ++) {
-      double s = 0.0;
-      for (int j = 0; j < N; j ++) {
-	s += Z(j, i) * B(j, k);
+  //
+  // Multiply B by Z^T
+  //
+  SpecializedMultiplyTranspose(N, M, N, Z.data(), N, B.data(), N, ZtB, N);
+
+  //
+  // Forward substitute S^T - alpha P^T to solve for Q^T lambda
+  //
+  for (int i = 0; i < N; i ++) {
+
+    if (i < (N - 1) && S(i + 1, i) != 0.0) {
+
+      //
+      // 2x2
+      //
+      const double *si = S.col(i);
+      const double *pi = P.col(i);
+      const double *si1 = S.col(i + 1);
+      const double *pi1 = P.col(i + 1);
+      for (int j = 0; j < i; j ++) {
+	t[j] = si[j] - alpha*pi[j];
+	t1[j] = si1[j] - alpha*pi1[j];
       }
-      work(i, 0) = s;
-    }
 
-    //
-    // Forward substitute S^T - alpha P^T to solve for Q^T lambda and store in work[N .. 2*N - 1]
-    //
-    for (int i = 0; i < N; i ++) {
+      double bi = si[i] - alpha*pi[i];
+      double bi1 = si[i + 1] - alpha*pi[i + 1];
 
-      if (i < (N - 1) && S(i + 1, i) != 0.0) {
+      double di = si1[i] - alpha*pi1[i];
+      double di1 = si1[i + 1] - alpha*pi1[i + 1];
 
-	//
-	// 2x2
-	//
+      for (int k = 0; k < M; k ++) {
+	const double *x = QtL + k * N;
+	const double *w = ZtB + k * N;
+	
 	double a = 0.0;
 	double c = 0.0;
 	for (int j = 0; j < i; j ++) {
-	  a += (S(j, i) - alpha*P(j, i)) * work(N + j, 0);
-	  c += (S(j, i + 1) - alpha*P(j, i + 1)) * work(N + j, 0);
+	  a += t[j] * x[j];
+	  c += t1[j] * x[j];
 	}
 
-	double bi = S(i, i) - alpha*P(i, i);
-	double bi1 = S(i + 1, i) - alpha*P(i + 1, i);
-
-	double di = S(i, i + 1) - alpha*P(i, i + 1);
-	double di1 = S(i + 1, i + 1) - alpha*P(i + 1, i + 1);
-	
-	
 	// a + bi Q^T lambda_i + bi1 Q^T lambda_{i + 1} = work[i]
 	// c + di Q^T lambda_i + di1 Q^T lambda_{i + 1} = work[i + 1]
-	Solve2x2(bi, bi1, di, di1, work(i, 0) - a, work(i + 1, 0) - c, work(N + i, 0), work(N + i + 1, 0));
-	i ++;
-	
+	Solve2x2(bi, bi1, di, di1, w[i] - a, w[i + 1] - c, QtL[k * N + i], QtL[k * N + i + 1]);
+      }
+      i ++;
+      
+    } else {
+
+      //
+      // 1x1
+      //
+      double denom = (S(i, i) - alpha*P(i, i));
+      if (denom == 0.0) {
+	for (int k = 0; k < M; k ++) {
+	  QtL[k * N + i] = 0.0;
+	}
       } else {
 
-	//
-	// 1x1
-	//
-	double denom = (S(i, i) - alpha*P(i, i));
-	double s = 0.0;
-	if (denom == 0.0) {
-	  work(N + i, 0) = 0.0;
-	} else {
-	  
+	const double *si = S.col(i);
+	const double *pi = P.col(i);
+	for (int j = 0; j < i; j ++) {
+	  t[j] = si[j] - alpha*pi[j];
+	}
+
+	for (int k = 0; k < M; k ++) {
+	  const double *x = QtL + k * N;
+	  double s = 0.0;
 	  for (int j = 0; j < i; j ++) {
-	    s += (S(j, i) - alpha*P(j, i)) * work(N + j, 0);
+	    s += t[j] * x[j];
 	  }
 	  
-	  work(N + i, 0) = (work(i, 0) - s)/denom;
+	  QtL[k * N + i] = (ZtB[k * N + i] - s)/denom;
 	}
-
       }
+
     }
+  }
     
-    //
-    // Multiply work[N .. 2*N - 1] by Q and store in lambda
-    //
-    for (int i = 0; i < N; i ++) {
-      double s = 0.0;
-      for (int j = 0; j < N; j ++) {
-	s += Q(i, j) * work(N + j, 0);
+  //
+  // Multiply Q^T lambda by Q
+  //
+  SpecializedMultiply(false, N, M, N, Q.data(), N, QtL, N, lambda.data(), N);
+
+  return true;
+}
+
+template
+<>
+bool SpecializedEigenProblemSolve<double>(Spec1DMatrix<double> &S,
+					  Spec1DMatrix<double> &P,
+					  Spec1DMatrix<double> &Q,
+					  Spec1DMatrix<double> &Z,
+					  double alpha,
+					  Spec1DMatrix<double> &B,
+					  Spec1DMatrix<double> &X,
+					  Spec1DMatrix<double> &work)
+{
+  PerfRegion region("SpecializedEigenProblemSolve");
+  
+  int N = S.rows();
+
+  if (B.rows() != N) {
+    FATAL("B no. rows incorrect");
+    return false;
+  }
+
+  int M = B.cols();
+  work.resize(N, M);
+  X.resize(N, M);
+
+  double *QtB = work.col(0);
+
+  //
+  // Multiply B by Q^T
+  //
+  SpecializedMultiplyTranspose(N, M, N, Q.data(), N, B.data(), N, QtB, N);
+
+  //
+  // Back substitute S - alpha P for Z^T X. Each solved component is
+  // eliminated from the rows above with its column so that S and P are
+  // read by column. As for the adjoint, a zero pivot (alpha is the
+  // eigenvalue) leaves that component zero.
+  //
+  for (int i = N - 1; i >= 0; i --) {
+
+    if (i > 0 && S(i, i - 1) != 0.0) {
+
+      //
+      // 2x2
+      //
+      const double *si0 = S.col(i - 1);
+      const double *pi0 = P.col(i - 1);
+      const double *si1 = S.col(i);
+      const double *pi1 = P.col(i);
+
+      double a11 = si0[i - 1] - alpha*pi0[i - 1];
+      double a21 = si0[i] - alpha*pi0[i];
+      double a12 = si1[i - 1] - alpha*pi1[i - 1];
+      double a22 = si1[i] - alpha*pi1[i];
+
+      for (int k = 0; k < M; k ++) {
+	double *x = QtB + k * N;
+	double z0;
+	double z1;
+
+	Solve2x2(a11, a12, a21, a22, x[i - 1], x[i], z0, z1);
+	x[i - 1] = z0;
+	x[i] = z1;
+
+	for (int j = 0; j < i - 1; j ++) {
+	  x[j] -= (si0[j] - alpha*pi0[j]) * z0 + (si1[j] - alpha*pi1[j]) * z1;
+	}
+      }
+      i --;
+      
+    } else {
+
+      //
+      // 1x1
+      //
+      const double *si = S.col(i);
+      const double *pi = P.col(i);
+      double denom = si[i] - alpha*pi[i];
+
+      for (int k = 0; k < M; k ++) {
+	double *x = QtB + k * N;
+	double z = (denom == 0.0) ? 0.0 : x[i]/denom;
+	x[i] = z;
+
+	for (int j = 0; j < i; j ++) {
+	  x[j] -= (si[j] - alpha*pi[j]) * z;
+	}
       }
-      lambda(i, k) = s;
     }
   }
 
+  //
+  // Multiply Z^T X by Z
+  //
+  SpecializedMultiply(false, N, M, N, Z.data(), N, QtB, N, X.data(), N);
+
   return true;
 }
 
@@ -521,32 +713,12 @@ SpecializedEigenProblemVerify(Spec1DMatrix<double> &S,
   //
   // Compute Q S
   //
-  for (int i = 0; i < N; i ++) {
-    
-    for (int j = 0; j < N; j ++) {
-      double s = 0.0;
-      for (int k = 0; k < N; k ++) {
-	s += Q(i, k) * S(k, j);
-      }
-      
-      work(i, j) = s;
-    }
-  }
+  SpecializedMultiply(false, N, N, N, Q.data(), N, S.data(), N, work.data(), N);
 
   //
   // Compute work Z^T
   //
-  for (int i = 0; i < N; i ++) {
-    
-    for (int j = 0; j < N; j ++) {
-      double s = 0.0;
-      for (int k = 0; k < N; k ++) {
-	s += work(i, k) * Z(j, k);
-      }
-      
-      A(i, j) = s;
-    }
-  }
+  SpecializedMultiply(true, N, N, N, work.data(), N, Z.data(), N, A.data(), N);
 }
 
 #endif // specializedeigenproblem_hpp
@@ -28,18 +28,7 @@
 #ifndef symmetricsolve_hpp
 #define symmetricsolve_hpp
 
-
-extern "C" void dsysv_(const char *uplo,
-		       int *N,
-		       int *NRHS,
-		       double *A,
-		       int *LDA,
-		       int *IPIV,
-		       double *B,
-		       int *LDB,
-		       double *WORK,
-		       int *LWORK,
-		       int *INFO);
+#include "lapackbackend.hpp"
 
 template
 <
@@ -70,7 +59,7 @@ bool SymmetricSolve<double>(Spec1DMatrix<double> &A,
   
   int LWORK = -1;
   double tWORK;  
-  dsysv_("U", &N, &NRHS, A.data(), &LDA, IPIV, B.data(), &LDB, &tWORK, &LWORK, &INFO);
+  LapackBackend::get().dsysv("U", &N, &NRHS, A.data(), &LDA, IPIV, B.data(), &LDB, &tWORK, &LWORK, &INFO);
 
   if (INFO != 0) {
     FATAL("Failed to get optimal work size");
@@ -79,7 +68,7 @@ bool SymmetricSolve<double>(Spec1DMatrix<double> &A,
   WORK.resize(tWORK, 1);
   LWORK = WORK.rows();
   
-  dsysv_("U", &N, &NRHS, A.data(), &LDA, IPIV, B.data(), &LDB, WORK.data(), &LWORK, &INFO);
+  LapackBackend::get().dsysv("U", &N, &NRHS, A.data(), &LDA, IPIV, B.data(), &LDB, WORK.data(), &LWORK, &INFO);
 
   if (INFO != 0) {
     return false;
@@ -0,0 +1,438 @@
+//
+//    Spec1D : A spectral element code for surface wave dispersion of Love
+//    and Rayleigh waves. See
+//
+//      R Hawkins, "A spectral element method for surface wave dispersion and adjoints",
+//      Geophysical Journal International, 2018, 215:1, 267 - 302
+//      https://doi.org/10.1093/gji/ggy277
+//    
+//    Copyright (C) 2014 - 2018 Rhys Hawkins
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+#ifndef textreader_hpp
+#define textreader_hpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <locale.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.hpp"
+
+//
+// Whitespace separated text input for model, reference and data files. The
+// file is memory mapped (read in one call if mapping fails) and tokens are
+// parsed in place with the same semantics as the fscanf conversions they
+// replace: %d, %lf and %s, each skipping leading whitespace. Parse failures
+// are reported with the file name, line and column.
+//
+// Decimal values with at most 19 significant digits and a small decimal
+// exponent are converted exactly with a single multiply/divide by a power of
+// ten, everything else falls back to strtod in the C locale, so values are
+// bit identical to fscanf.
+//
+class TextReader {
+public:
+
+  TextReader() :
+    begin(nullptr),
+    end(nullptr),
+    p(nullptr),
+    linestart(nullptr),
+    lineno(1),
+    mapped(false),
+    mapsize(0),
+    name(nullptr)
+  {
+  }
+
+  ~TextReader()
+  {
+    close();
+  }
+
+  bool open(const char *filename)
+  {
+    close();
+
+    name = filename;
+    
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      ::close(fd);
+      return false;
+    }
+
+    mapsize = (size_t)st.st_size;
+    char *data = nullptr;
+    
+    if (mapsize > 0) {
+      void *m = mmap(nullptr, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m != MAP_FAILED) {
+	data = (char*)m;
+	mapped = true;
+      } else {
+	//
+	// Fallback for files that can't be mapped
+	//
+	data = new char[mapsize];
+	size_t n = 0;
+	while (n < mapsize) {
+	  ssize_t r = ::read(fd, data + n, mapsize - n);
+	  if (r <= 0) {
+	    break;
+	  }
+	  n += r;
+	}
+	mapsize = n;
+      }
+    }
+
+    ::close(fd);
+
+    begin = data;
+    end = data + mapsize;
+    p = begin;
+    linestart = begin;
+    lineno = 1;
+    
+    return true;
+  }
+
+  void close()
+  {
+    if (begin != nullptr) {
+      if (mapped) {
+	munmap((void*)begin, mapsize);
+      } else {
+	delete [] begin;
+      }
+    }
+
+    begin = nullptr;
+    end = nullptr;
+    p = nullptr;
+    linestart = nullptr;
+    lineno = 1;
+    mapped = false;
+    mapsize = 0;
+  }
+
+  //
+  // True if only whitespace remains
+  //
+  bool eof()
+  {
+    skip_whitespace();
+    return p >= end;
+  }
+
+  //
+  // Skip to the start of the next line
+  //
+  void skip_line()
+  {
+    while (p < end && *p != '\n') {
+      p ++;
+    }
+    if (p < end) {
+      p ++;
+      lineno ++;
+      linestart = p;
+    }
+  }
+
+  bool read_int(int &v)
+  {
+    skip_whitespace();
+
+    const char *s = p;
+    bool negative = false;
+    
+    if (s < end && (*s == '-' || *s == '+')) {
+      negative = (*s == '-');
+      s ++;
+    }
+
+    if (s >= end || !isdigit_c(*s)) {
+      return fail("integer");
+    }
+
+    long long t = 0;
+    while (s < end && isdigit_c(*s)) {
+      if (t < 1000000000000LL) {
+	t = t * 10 + (*s - '0');
+      }
+      s ++;
+    }
+
+    v = (int)(negative ? -t : t);
+    p = s;
+    return true;
+  }
+
+  bool read_double(double &v)
+  {
+    skip_whitespace();
+
+    if (fast_double(v)) {
+      return true;
+    }
+
+    //
+    // Fallback: strtod in the C locale on a terminated copy of the token
+    //
+    char buffer[TOKEN_MAX + 1];
+    size_t n = 0;
+    while (p + n < end && n < TOKEN_MAX && !isspace_c(p[n])) {
+      buffer[n] = p[n];
+      n ++;
+    }
+    buffer[n] = '\0';
+
+    static locale_t c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+    
+    char *endptr;
+    v = strtod_l(buffer, &endptr, c_locale);
+    if (endptr == buffer) {
+      return fail("floating point value");
+    }
+
+    p += (endptr - buffer);
+    return true;
+  }
+
+  //
+  // Equivalent of %s into a buffer of size bytes (including terminator)
+  //
+  bool read_word(char *buffer, int size)
+  {
+    skip_whitespace();
+
+    if (p >= end) {
+      return fail("word");
+    }
+
+    int n = 0;
+    while (p < end && !isspace_c(*p)) {
+      if (n < size - 1) {
+	buffer[n] = *p;
+	n ++;
+      }
+      p ++;
+    }
+    buffer[n] = '\0';
+
+    return true;
+  }
+
+  int line() const
+  {
+    return lineno;
+  }
+
+  int column() const
+  {
+    return (int)(p - linestart) + 1;
+  }
+
+  const char *filename() const
+  {
+    return name;
+  }
+
+private:
+
+  static constexpr size_t TOKEN_MAX = 128;
+  
+  static bool isdigit_c(char c)
+  {
+    return c >= '0' && c <= '9';
+  }
+
+  static bool isspace_c(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+  }
+
+  void skip_whitespace()
+  {
+    while (p < end && isspace_c(*p)) {
+      if (*p == '\n') {
+	lineno ++;
+	linestart = p + 1;
+      }
+      p ++;
+    }
+  }
+
+  bool fail(const char *expected)
+  {
+    if (p >= end) {
+      ERROR("%s:%d:%d: expected %s, found end of file", name, line(), column(), expected);
+    } else {
+      char token[32];
+      size_t n = 0;
+      while (p + n < end && n < sizeof(token) - 1 && !isspace_c(p[n])) {
+	token[n] = p[n];
+	n ++;
+      }
+      token[n] = '\0';
+      ERROR("%s:%d:%d: expected %s, found \"%s\"", name, line(), column(), expected, token);
+    }
+    return false;
+  }
+
+  //
+  // Exact conversion for the common case: [+-]digits[.digits][(e|E)[+-]digits]
+  // with at most 19 significant digits, mantissa < 2^53 and |exponent| <= 22.
+  // Returns false (without consuming input) for anything else.
+  //
+  bool fast_double(double &v)
+  {
+    static const double pow10[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *s = p;
+    bool negative = false;
+
+    if (s < end && (*s == '-' || *s == '+')) {
+      negative = (*s == '-');
+      s ++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+
+    //
+    // Leading zeros are not significant
+    //
+    while (s < end && *s == '0') {
+      s ++;
+      any = true;
+    }
+    
+    while (s < end && isdigit_c(*s)) {
+      if (digits >= 19) {
+	return false;
+      }
+      mantissa = mantissa * 10 + (*s - '0');
+      digits ++;
+      s ++;
+      any = true;
+    }
+
+    if (s < end && *s == '.') {
+      s ++;
+      if (digits == 0) {
+	while (s < end && *s == '0') {
+	  s ++;
+	  exponent --;
+	  any = true;
+	}
+      }
+      while (s < end && isdigit_c(*s)) {
+	if (digits >= 19) {
+	  return false;
+	}
+	mantissa = mantissa * 10 + (*s - '0');
+	digits ++;
+	exponent --;
+	s ++;
+	any = true;
+      }
+    }
+
+    if (!any) {
+      return false;
+    }
+
+    if (s < end && (*s == 'e' || *s == 'E')) {
+      s ++;
+      bool eneg = false;
+      if (s < end && (*s == '-' || *s == '+')) {
+	eneg = (*s == '-');
+	s ++;
+      }
+      if (s >= end || !isdigit_c(*s)) {
+	return false;
+      }
+      int e = 0;
+      while (s < end && isdigit_c(*s)) {
+	if (e < 10000) {
+	  e = e * 10 + (*s - '0');
+	}
+	s ++;
+      }
+      exponent += eneg ? -e : e;
+    }
+
+    //
+    // Anything else directly following the number (hex, inf/nan, ...) is
+    // left to strtod
+    //
+    if (s < end && !isspace_c(*s)) {
+      return false;
+    }
+
+    if (mantissa > (1ULL << 53)) {
+      return false;
+    }
+
+    double d = (double)mantissa;
+    if (mantissa == 0) {
+      d = 0.0;
+    } else if (exponent >= 0 && exponent <= 22) {
+      d *= pow10[exponent];
+    } else if (exponent < 0 && exponent >= -22) {
+      d /= pow10[-exponent];
+    } else {
+      return false;
+    }
+
+    v = negative ? -d : d;
+    p = s;
+    return true;
+  }
+
+  const char *begin;
+  const char *end;
+  const char *p;
+  const char *linestart;
+  int lineno;
+  bool mapped;
+  size_t mapsize;
+  const char *name;
+};
+
+#endif // textreader_hpp